@@ -148,6 +148,12 @@ static void fm_config_init(FmConfig *self)
     self->places_network = FM_CONFIG_DEFAULT_PLACES_NETWORK;
     self->places_unmounted = FM_CONFIG_DEFAULT_PLACES_UNMOUNTED;
     self->smart_desktop_autodrop = FM_CONFIG_DEFAULT_SMART_DESKTOP_AUTODROP;
+    self->max_job_threads = FM_CONFIG_DEFAULT_MAX_JOB_THREADS;
+    self->thumbnail_threads = FM_CONFIG_DEFAULT_THUMBNAIL_THREADS;
+    self->thumbnail_cache_size = FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_SIZE;
+    self->thumbnail_cache_folders = FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_FOLDERS;
+    self->thumbnail_packs = FM_CONFIG_DEFAULT_THUMBNAIL_PACKS;
+    self->copy_threads = FM_CONFIG_DEFAULT_COPY_THREADS;
 }
 
 /**
@@ -249,6 +255,12 @@ void fm_config_load_from_key_file(FmConfig* cfg, GKeyFile* kf)
     fm_key_file_get_bool(kf, "config", "defer_content_test", &cfg->defer_content_test);
     fm_key_file_get_bool(kf, "config", "quick_exec", &cfg->quick_exec);
     fm_key_file_get_bool(kf, "config", "smart_desktop_autodrop", &cfg->smart_desktop_autodrop);
+    fm_key_file_get_int(kf, "config", "max_job_threads", &cfg->max_job_threads);
+    fm_key_file_get_int(kf, "config", "thumbnail_threads", &cfg->thumbnail_threads);
+    fm_key_file_get_int(kf, "config", "thumbnail_cache_size", &cfg->thumbnail_cache_size);
+    fm_key_file_get_int(kf, "config", "thumbnail_cache_folders", &cfg->thumbnail_cache_folders);
+    fm_key_file_get_bool(kf, "config", "thumbnail_packs", &cfg->thumbnail_packs);
+    fm_key_file_get_int(kf, "config", "copy_threads", &cfg->copy_threads);
     g_free(cfg->format_cmd);
     cfg->format_cmd = g_key_file_get_string(kf, "config", "format_cmd", NULL);
     /* append blacklist */
@@ -455,6 +467,12 @@ void fm_config_save(FmConfig* cfg, const char* name)
                 _save_config_strv(str, cfg, modules_blacklist);
                 _save_config_strv(str, cfg, modules_whitelist);
                 _save_config_bool(str, cfg, smart_desktop_autodrop);
+                _save_config_int(str, cfg, max_job_threads);
+                _save_config_int(str, cfg, thumbnail_threads);
+                _save_config_int(str, cfg, thumbnail_cache_size);
+                _save_config_int(str, cfg, thumbnail_cache_folders);
+                _save_config_bool(str, cfg, thumbnail_packs);
+                _save_config_int(str, cfg, copy_threads);
             g_string_append(str, "\n[ui]\n");
                 _save_config_int(str, cfg, big_icon_size);
                 _save_config_int(str, cfg, small_icon_size);
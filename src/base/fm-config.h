@@ -79,6 +79,13 @@ typedef struct _FmConfigClass       FmConfigClass;
 
 #define     FM_CONFIG_DEFAULT_AUTO_SELECTION_DELAY 600
 
+#define     FM_CONFIG_DEFAULT_MAX_JOB_THREADS   8
+#define     FM_CONFIG_DEFAULT_THUMBNAIL_THREADS 2
+#define     FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_SIZE 32768
+#define     FM_CONFIG_DEFAULT_THUMBNAIL_CACHE_FOLDERS 3
+#define     FM_CONFIG_DEFAULT_THUMBNAIL_PACKS   TRUE
+#define     FM_CONFIG_DEFAULT_COPY_THREADS      4
+
 /* this enum is used by FmDndDest but we save it nicely in config so have it here */
 
 /**
@@ -142,6 +149,12 @@ typedef enum
  * @list_view_size_units: (since 1.2.0) file size units in list view: h, k, M, G
  * @format_cmd: (since 1.2.0) command to format the volume (device will be added)
  * @smart_desktop_autodrop: (since 1.2.0) enable "smart shortcut" auto-action for ~/Desktop
+ * @max_job_threads: (since 1.2.0) max number of threads running jobs simultaneously
+ * @thumbnail_threads: (since 1.2.0) max number of threads to load and generate thumbnails
+ * @thumbnail_cache_size: (since 1.2.0) memory in KB to keep recently used thumbnails
+ * @thumbnail_cache_folders: (since 1.2.0) number of last folders to keep thumbnails for
+ * @thumbnail_packs: (since 1.2.0) keep thumbnails of big folders in pack files
+ * @copy_threads: (since 1.2.0) max number of local files copied simultaneously from each file system
  */
 struct _FmConfig
 {
@@ -202,6 +215,13 @@ struct _FmConfig
     gchar *format_cmd;
 
     gboolean smart_desktop_autodrop;
+
+    gint max_job_threads;
+    gint thumbnail_threads;
+    gint thumbnail_cache_size;
+    gint thumbnail_cache_folders;
+    gboolean thumbnail_packs;
+    gint copy_threads;
     /*< private >*/
     gpointer _reserved1; /* reserved space for updates until next ABI */
     gpointer _reserved2;
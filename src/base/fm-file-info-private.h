@@ -0,0 +1,42 @@
+/*
+ *      fm-file-info-private.h
+ *
+ *      Copyright 2009 PCMan <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* internals of FmFileInfo shared with FmFolder and FmDirListJob,
+   this header is not installed */
+
+#ifndef __FM_FILE_INFO_PRIVATE_H__
+#define __FM_FILE_INFO_PRIVATE_H__
+
+#include "fm-file-info.h"
+
+G_BEGIN_DECLS
+
+/* shared storage for collate keys of files in a folder */
+typedef struct _FmFileInfoArena FmFileInfoArena;
+
+FmFileInfoArena* _fm_file_info_arena_new(void);
+void _fm_file_info_arena_unref(FmFileInfoArena* arena);
+void _fm_file_info_make_collate_key(FmFileInfo* fi, FmFileInfoArena* arena);
+void _fm_file_info_detach_arena(FmFileInfo* fi);
+
+G_END_DECLS
+
+#endif /* __FM_FILE_INFO_PRIVATE_H__ */
@@ -34,13 +34,14 @@
 #endif
 
 #include <menu-cache.h>
-#include "fm-file-info.h"
+#include "fm-file-info-private.h"
 #include <glib.h>
 #include <glib/gi18n-lib.h>
 #include <grp.h> /* Query group name */
 #include <pwd.h> /* Query user name */
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -95,12 +96,12 @@ struct _FmFileInfo
     gulong blksize;
     goffset blocks;
 
-    /* FIXME: caching the collate key can greatly speed up sorting.
-     *        However, memory usage is greatly increased!.
-     *        Is there a better alternative solution?
-     */
+    /* caching the collate key can greatly speed up sorting. To save memory
+     * keys made while listing a folder are kept in a shared arena instead
+     * of allocating them for each file */
     char* collate_key; /* used to sort files by name */
     char* collate_key_case; /* the same but case-sensitive */
+    FmFileInfoArena* arena; /* if not NULL then collate_key is in it */
     char* disp_size;  /* displayed human-readable file size */
     char* disp_mtime; /* displayed last modification time */
     char* disp_owner;
@@ -128,6 +129,25 @@ struct _FmFileInfoList
     FmList list;
 };
 
+struct _FmFileInfoArena
+{
+    gint n_ref;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock; /* protects chunk, only copying is done under it */
+#else
+    GMutex* lock;
+#endif
+    GStringChunk* chunk;
+};
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#define ARENA_LOCK(arena)   g_mutex_lock(&(arena)->lock)
+#define ARENA_UNLOCK(arena) g_mutex_unlock(&(arena)->lock)
+#else
+#define ARENA_LOCK(arena)   g_mutex_lock((arena)->lock)
+#define ARENA_UNLOCK(arena) g_mutex_unlock((arena)->lock)
+#endif
+
 /* intialize the file info system */
 void _fm_file_info_init(void)
 {
@@ -195,12 +215,38 @@ FmFileInfo* fm_file_info_new ()
  */
 gboolean _fm_file_info_set_from_native_file(FmFileInfo* fi, const char* path,
                                             GError** err, gboolean get_fast)
+{
+    return _fm_file_info_set_from_native_file_at(fi, -1, path, err, get_fast);
+}
+
+/* If @dirfd is not negative then all file tests are done relative to
+ * @dirfd using on-disk basename of @path, which saves kernel the full
+ * path lookup for each file when listing big directories. */
+gboolean _fm_file_info_set_from_native_file_at(FmFileInfo* fi, int dirfd,
+                                               const char* path,
+                                               GError** err, gboolean get_fast)
 {
     struct stat st;
     char *dname;
+#ifdef HAVE_AT_FUNCS
+    const char *name = NULL;
+#define _LSTAT(_st) (name ? fstatat(dirfd, name, _st, AT_SYMLINK_NOFOLLOW) : lstat(path, _st))
+#define _STAT(_st) (name ? fstatat(dirfd, name, _st, 0) : stat(path, _st))
+#define _ACCESS(_mode) (name ? faccessat(dirfd, name, _mode, 0) : g_access(path, _mode))
+
+    if (dirfd >= 0)
+    {
+        name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+    }
+#else
+#define _LSTAT(_st) lstat(path, _st)
+#define _STAT(_st) stat(path, _st)
+#define _ACCESS(_mode) g_access(path, _mode)
+#endif
 
     g_return_val_if_fail(fi && fi->path, FALSE);
-    if(lstat(path, &st) == 0)
+    if(_LSTAT(&st) == 0)
     {
         fi->mode = st.st_mode;
         fi->mtime = st.st_mtime;
@@ -214,13 +260,24 @@ gboolean _fm_file_info_set_from_native_file(FmFileInfo* fi, const char* path,
         /* handle symlinks: use target to retrieve its info */
         if(S_ISLNK(st.st_mode))
         {
-            if (stat(path, &st) < 0)
+            if (_STAT(&st) < 0)
             {
                 /* g_debug("invalid symlink: %s", strerror(errno)); */
                 fi->icon = fm_icon_from_name("dialog-warning");
                 /* we cannot test broken symlink so skip all tests */
                 get_fast = TRUE;
             }
+#ifdef HAVE_AT_FUNCS
+            if (name)
+            {
+                char buf[PATH_MAX + 1];
+                ssize_t len = readlinkat(dirfd, name, buf, PATH_MAX);
+
+                if (len >= 0)
+                    fi->target = g_strndup(buf, len);
+            }
+            else
+#endif
             fi->target = g_file_read_link(path, NULL);
         }
 
@@ -237,15 +294,17 @@ gboolean _fm_file_info_set_from_native_file(FmFileInfo* fi, const char* path,
             if ((st.st_mode & S_IXUSR) == S_IXUSR) /* executable */
                 fi->mime_type = fm_mime_type_from_name("application/x-executable");
             else
-                fi->mime_type = fm_mime_type_from_file_name(fm_path_get_basename(fi->path));
+                fi->mime_type = _fm_mime_type_from_file_name_cached(fm_path_get_basename(fi->path), &st);
         }
         else
-            fi->mime_type = fm_mime_type_from_native_file(path, fm_path_get_basename(fi->path), &st);
+            fi->mime_type = _fm_mime_type_from_native_file_at(dirfd, path,
+                                                              fm_path_get_basename(fi->path),
+                                                              &st);
 
         if (get_fast) /* do rough estimation */
             fi->accessible = ((st.st_mode & S_IRUSR) == S_IRUSR);
         else
-            fi->accessible = (g_access(path, R_OK) == 0);
+            fi->accessible = (_ACCESS(R_OK) == 0);
 
         /* special handling for desktop entry files */
         if(G_UNLIKELY(!get_fast && fm_file_info_is_desktop_entry(fi)))
@@ -436,6 +495,9 @@ _not_desktop_entry:
     fi->icon_is_changeable = fm_file_info_is_desktop_entry(fi);
         /* FIXME: add support for icon change on directories too */
     return TRUE;
+#undef _LSTAT
+#undef _STAT
+#undef _ACCESS
 }
 
 gboolean fm_file_info_set_from_native_file(FmFileInfo* fi, const char* path, GError** err)
@@ -784,11 +846,16 @@ FmFileInfo* fm_file_info_new_from_menu_cache_item(FmPath* path, MenuCacheItem* i
     return fi;
 }
 
-static void fm_file_info_clear(FmFileInfo* fi)
+static void _fm_file_info_clear_collate_keys(FmFileInfo* fi)
 {
     if(fi->collate_key)
     {
-        if(fi->collate_key != COLLATE_USING_DISPLAY_NAME)
+        if(fi->arena)
+        {
+            _fm_file_info_arena_unref(fi->arena);
+            fi->arena = NULL;
+        }
+        else if(fi->collate_key != COLLATE_USING_DISPLAY_NAME)
             g_free(fi->collate_key);
         fi->collate_key = NULL;
     }
@@ -799,6 +866,11 @@ static void fm_file_info_clear(FmFileInfo* fi)
             g_free(fi->collate_key_case);
         fi->collate_key_case = NULL;
     }
+}
+
+static void fm_file_info_clear(FmFileInfo* fi)
+{
+    _fm_file_info_clear_collate_keys(fi);
 
     if(G_LIKELY(fi->path))
     {
@@ -916,6 +988,12 @@ void fm_file_info_update(FmFileInfo* fi, FmFileInfo* src)
 
     if(src->collate_key == COLLATE_USING_DISPLAY_NAME)
         fi->collate_key = COLLATE_USING_DISPLAY_NAME;
+    else if(src->arena) /* share the key instead of copying */
+    {
+        fi->collate_key = src->collate_key;
+        fi->arena = src->arena;
+        g_atomic_int_inc(&fi->arena->n_ref);
+    }
     else
         fi->collate_key = g_strdup(src->collate_key);
     if(src->collate_key_case == COLLATE_USING_DISPLAY_NAME)
@@ -1042,18 +1120,7 @@ void fm_file_info_set_disp_name(FmFileInfo* fi, const char* name)
 {
     _fm_path_set_display_name(fi->path, name);
     /* reset collate keys */
-    if(fi->collate_key)
-    {
-        if(fi->collate_key != COLLATE_USING_DISPLAY_NAME)
-            g_free(fi->collate_key);
-        fi->collate_key = NULL;
-    }
-    if(fi->collate_key_case)
-    {
-        if(fi->collate_key_case != COLLATE_USING_DISPLAY_NAME)
-            g_free(fi->collate_key_case);
-        fi->collate_key_case = NULL;
-    }
+    _fm_file_info_clear_collate_keys(fi);
 }
 
 /**
@@ -1394,6 +1461,88 @@ gboolean fm_file_info_can_thumbnail(FmFileInfo* fi)
     return TRUE;
 }
 
+/* Folders may contain many thousands of files and sorting them by name
+ * requires collate key of each file. Making those keys is slow so the
+ * FmDirListJob makes them in its thread while listing the folder, and
+ * stores them all in one arena so they don't take a heap allocation per
+ * file. The arena is freed when all files listed are freed, or detached
+ * from it by FmFolder when the folder is gone. */
+FmFileInfoArena* _fm_file_info_arena_new(void)
+{
+    FmFileInfoArena* arena = g_slice_new(FmFileInfoArena);
+    arena->n_ref = 1;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&arena->lock);
+#else
+    arena->lock = g_mutex_new();
+#endif
+    arena->chunk = g_string_chunk_new(16 * 1024);
+    return arena;
+}
+
+void _fm_file_info_arena_unref(FmFileInfoArena* arena)
+{
+    if(g_atomic_int_dec_and_test(&arena->n_ref))
+    {
+        g_string_chunk_free(arena->chunk);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        g_mutex_clear(&arena->lock);
+#else
+        g_mutex_free(arena->lock);
+#endif
+        g_slice_free(FmFileInfoArena, arena);
+    }
+}
+
+/* Copies collate key of @fi out of its arena if @fi is still used by
+ * someone else than the caller, so a single file kept after its folder
+ * is gone doesn't keep keys of the whole folder in memory. Should be
+ * called in main thread. */
+void _fm_file_info_detach_arena(FmFileInfo* fi)
+{
+    FmFileInfoArena* arena = fi->arena;
+
+    if(arena == NULL || g_atomic_int_get(&fi->n_ref) < 2)
+        return;
+    fi->collate_key = g_strdup(fi->collate_key);
+    fi->arena = NULL;
+    _fm_file_info_arena_unref(arena);
+}
+
+/* Creates collate key for @fi if it has none yet, storing it in @arena if
+ * it is not %NULL. Can be used in any thread while @fi is not yet shared. */
+void _fm_file_info_make_collate_key(FmFileInfo* fi, FmFileInfoArena* arena)
+{
+    const char* disp_name;
+    char* casefold;
+    char* collate;
+
+    if(fi->collate_key)
+        return;
+    disp_name = fm_file_info_get_disp_name(fi);
+    casefold = g_utf8_casefold(disp_name, -1);
+    collate = g_utf8_collate_key_for_filename(casefold, -1);
+    g_free(casefold);
+    if(strcmp(collate, disp_name) == 0)
+    {
+        /* if the collate key is the same as the display name,
+         * then there is no need to save it.
+         * Just use the display name directly. */
+        fi->collate_key = COLLATE_USING_DISPLAY_NAME;
+        g_free(collate);
+    }
+    else if(arena)
+    {
+        ARENA_LOCK(arena);
+        fi->collate_key = g_string_chunk_insert(arena->chunk, collate);
+        ARENA_UNLOCK(arena);
+        g_atomic_int_inc(&arena->n_ref);
+        fi->arena = arena;
+        g_free(collate);
+    }
+    else
+        fi->collate_key = collate;
+}
 
 /**
  * fm_file_info_get_collate_key:
@@ -1412,22 +1561,7 @@ const char* fm_file_info_get_collate_key(FmFileInfo* fi)
 {
     /* create a collate key on demand, if we don't have one */
     if(G_UNLIKELY(!fi->collate_key))
-    {
-        const char* disp_name = fm_file_info_get_disp_name(fi);
-        char* casefold = g_utf8_casefold(disp_name, -1);
-        char* collate = g_utf8_collate_key_for_filename(casefold, -1);
-        g_free(casefold);
-        if(strcmp(collate, disp_name))
-            fi->collate_key = collate;
-        else
-        {
-            /* if the collate key is the same as the display name,
-             * then there is no need to save it.
-             * Just use the display name directly. */
-            fi->collate_key = COLLATE_USING_DISPLAY_NAME;
-            g_free(collate);
-        }
-    }
+        _fm_file_info_make_collate_key(fi, NULL);
 
     /* if the collate key is the same as the display name, 
      * just return the display name instead. */
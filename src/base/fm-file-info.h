@@ -46,6 +46,10 @@ struct _MenuCacheItem;/* forward declaration for MenuCacheItem */
 void _fm_file_info_init();
 void _fm_file_info_finalize();
 
+gboolean _fm_file_info_set_from_native_file_at(FmFileInfo* fi, int dirfd,
+                                               const char* path,
+                                               GError** err, gboolean get_fast);
+
 FmFileInfo* fm_file_info_new();
 #ifndef FM_DISABLE_DEPRECATED
 FmFileInfo* fm_file_info_new_from_gfileinfo(FmPath* path, GFileInfo* inf);
@@ -38,6 +38,7 @@
 #include "fm-dummy-monitor.h"
 #include "fm-file.h"
 #include "fm-config.h"
+#include "fm-file-info-private.h"
 
 #include <string.h>
 
@@ -67,13 +68,18 @@ struct _FmFolder
     FmDirListJob* dirlist_job;
     FmFileInfo* dir_fi;
     FmFileInfoList* files;
+    GHashTable* files_index; /* FmPath -> GList link in files */
 
     /* for file monitor */
     guint idle_handler;
-    GSList* files_to_add;
-    GSList* files_to_update;
-    GSList* files_to_del;
+    GHashTable* files_to_add; /* set of FmPath, holds reference */
+    GHashTable* files_to_update; /* set of FmPath, holds reference */
+    GHashTable* files_to_del; /* set of GList links in files */
     GSList* pending_jobs;
+    guint update_delay; /* ms to coalesce events, grows under load */
+    FmDirListJob* rescan_job; /* bulk update instead of FmFileInfoJob */
+    GHashTable* rescan_deleted; /* set of FmPath deleted while rescanning */
+    GHashTable* rescan_updated; /* set of FmPath queued for update before rescan */
     gboolean pending_change_notify;
     gboolean filesystem_info_pending;
     gboolean wants_incremental;
@@ -105,9 +111,24 @@ static GVolumeMonitor* volume_monitor = NULL;
 G_LOCK_DEFINE_STATIC(query);
 /* protects hash access */
 G_LOCK_DEFINE_STATIC(hash);
-/* protects access to files_to_add, files_to_update and files_to_del */
+/* protects access to files_to_add, files_to_update and files_to_del,
+   and modification of files and files_index */
 G_LOCK_DEFINE_STATIC(lists);
 
+/* Monitor events are coalesced over a time window which is doubled each
+   time an update gets more than UPDATE_BURST changes, up to the max,
+   and halved when the folder calms down. If too many files are changed
+   then the folder is rescanned at once instead of querying each file. */
+#define UPDATE_BURST            100
+#define UPDATE_DELAY_STEP       100 /* ms */
+#define UPDATE_DELAY_MAX        2000 /* ms */
+#define RESCAN_THRESHOLD        1000
+
+/* statistics, protected by lists lock */
+static guint n_events = 0;
+static guint n_coalesced = 0;
+static guint n_rescans = 0;
+
 static void fm_folder_class_init(FmFolderClass *klass)
 {
     GObjectClass *g_object_class;
@@ -332,9 +353,44 @@ static void fm_folder_class_init(FmFolderClass *klass)
 }
 
 
+static inline GHashTable* _path_set_new(void)
+{
+    /* FmPath objects are unique so comparing pointers is enough */
+    return g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                 (GDestroyNotify)fm_path_unref, NULL);
+}
+
+/* moves all paths from the set into a list, references are moved too */
+static GSList* _path_set_steal_all(GHashTable* set)
+{
+    GSList* list = NULL;
+    GHashTableIter it;
+    gpointer path;
+
+    g_hash_table_iter_init(&it, set);
+    while(g_hash_table_iter_next(&it, &path, NULL))
+        list = g_slist_prepend(list, path);
+    g_hash_table_steal_all(set);
+    return list;
+}
+
 static void fm_folder_init(FmFolder *folder)
 {
     folder->files = fm_file_info_list_new();
+    folder->files_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    folder->files_to_add = _path_set_new();
+    folder->files_to_update = _path_set_new();
+    folder->files_to_del = g_hash_table_new(g_direct_hash, g_direct_equal);
+    folder->rescan_deleted = _path_set_new();
+    folder->rescan_updated = _path_set_new();
+}
+
+/* adds file into the folder, should be called with lists lock held */
+static void _fm_folder_add_file_info(FmFolder* folder, FmFileInfo* fi)
+{
+    fm_file_info_list_push_tail(folder->files, fi);
+    g_hash_table_insert(folder->files_index, fm_file_info_get_path(fi),
+                        fm_list_peek_tail_link((FmList*)folder->files));
 }
 
 static gboolean on_idle_reload(FmFolder* folder)
@@ -361,6 +417,152 @@ static void queue_reload(FmFolder* folder)
     G_UNLOCK(query);
 }
 
+static gboolean on_idle(FmFolder* folder);
+
+/* schedules processing of queued changes, should be called with lists
+   lock held */
+static void _fm_folder_queue_update(FmFolder* folder)
+{
+    if(folder->idle_handler)
+        return;
+    if(folder->update_delay == 0)
+        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+    else
+        folder->idle_handler = g_timeout_add_full(G_PRIORITY_LOW, folder->update_delay,
+                                                  (GSourceFunc)on_idle, folder, NULL);
+}
+
+static void on_rescan_job_finished(FmDirListJob* job, FmFolder* folder)
+{
+    GSList *files_added = NULL, *files_changed = NULL, *files_removed = NULL;
+    GHashTable* listed;
+    GList *l, *next;
+
+    if(!fm_job_is_cancelled(FM_JOB(job)))
+    {
+        listed = g_hash_table_new(g_direct_hash, g_direct_equal);
+        G_LOCK(lists);
+        for(l = fm_file_info_list_peek_head_link(job->files); l; l = l->next)
+        {
+            FmFileInfo* fi = (FmFileInfo*)l->data;
+            FmPath* path = fm_file_info_get_path(fi);
+            GList* l2;
+
+            if(g_hash_table_lookup(folder->rescan_deleted, path))
+                continue;
+            g_hash_table_insert(listed, path, fi);
+            l2 = _fm_folder_get_file_by_path(folder, path);
+            if(l2) /* update only files which really changed */
+            {
+                FmFileInfo* fi2 = (FmFileInfo*)l2->data;
+                /* files queued for update could have same stat but still
+                   need it, e.g. ones listed without content test */
+                if(g_hash_table_lookup(folder->rescan_updated, path) ||
+                   fm_file_info_get_mtime(fi2) != fm_file_info_get_mtime(fi) ||
+                   fm_file_info_get_size(fi2) != fm_file_info_get_size(fi) ||
+                   fm_file_info_get_mode(fi2) != fm_file_info_get_mode(fi))
+                {
+                    fm_file_info_update(fi2, fi);
+                    files_changed = g_slist_prepend(files_changed, fi2);
+                }
+            }
+            else
+            {
+                _fm_folder_add_file_info(folder, fi);
+                files_added = g_slist_prepend(files_added, fi);
+            }
+        }
+        /* files which weren't found are gone */
+        for(l = fm_file_info_list_peek_head_link(folder->files); l; l = next)
+        {
+            FmFileInfo* fi = (FmFileInfo*)l->data;
+            next = l->next;
+            if(!g_hash_table_lookup(listed, fm_file_info_get_path(fi)))
+            {
+                g_hash_table_remove(folder->files_to_del, l);
+                g_hash_table_remove(folder->files_index, fm_file_info_get_path(fi));
+                fm_file_info_list_delete_link_nounref(folder->files, l);
+                files_removed = g_slist_prepend(files_removed, fi);
+            }
+        }
+        g_hash_table_remove_all(folder->rescan_deleted);
+        g_hash_table_remove_all(folder->rescan_updated);
+        folder->rescan_job = NULL;
+        n_rescans++;
+        /* process changes which were queued while rescanning */
+        _fm_folder_queue_update(folder);
+        G_UNLOCK(lists);
+        g_hash_table_destroy(listed);
+
+        if(files_added)
+        {
+            g_signal_emit(folder, signals[FILES_ADDED], 0, files_added);
+            g_slist_free(files_added);
+        }
+        if(files_changed)
+        {
+            g_signal_emit(folder, signals[FILES_CHANGED], 0, files_changed);
+            g_slist_free(files_changed);
+        }
+        if(files_removed)
+        {
+            g_signal_emit(folder, signals[FILES_REMOVED], 0, files_removed);
+            /* files still kept by someone shouldn't keep the arena */
+            g_slist_foreach(files_removed, (GFunc)_fm_file_info_detach_arena, NULL);
+            g_slist_foreach(files_removed, (GFunc)fm_file_info_unref, NULL);
+            g_slist_free(files_removed);
+        }
+        g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
+    }
+    else
+    {
+        G_LOCK(lists);
+        g_hash_table_remove_all(folder->rescan_deleted);
+        g_hash_table_remove_all(folder->rescan_updated);
+        folder->rescan_job = NULL;
+        G_UNLOCK(lists);
+    }
+    g_object_unref(job);
+}
+
+/* lists all the folder again instead of querying each changed file */
+static void _fm_folder_start_rescan(FmFolder* folder)
+{
+    FmDirListJob* job = fm_dir_list_job_new2(folder->dir_path, FM_DIR_LIST_JOB_DETAILED);
+
+    g_signal_connect(job, "finished", G_CALLBACK(on_rescan_job_finished), folder);
+    G_LOCK(lists);
+    folder->rescan_job = job;
+    G_UNLOCK(lists);
+    if(!fm_job_run_async(FM_JOB(job)))
+    {
+        G_LOCK(lists);
+        folder->rescan_job = NULL;
+        G_UNLOCK(lists);
+        g_object_unref(job);
+        g_critical("failed to start folder rescan job");
+    }
+    /* the job will be freed automatically in on_rescan_job_finished() */
+}
+
+static void free_rescan_job(FmFolder* folder)
+{
+    FmDirListJob* job;
+
+    G_LOCK(lists);
+    job = folder->rescan_job;
+    folder->rescan_job = NULL;
+    g_hash_table_remove_all(folder->rescan_deleted);
+    g_hash_table_remove_all(folder->rescan_updated);
+    G_UNLOCK(lists);
+    if(job)
+    {
+        g_signal_handlers_disconnect_by_func(job, on_rescan_job_finished, folder);
+        fm_job_cancel(FM_JOB(job));
+        g_object_unref(job);
+    }
+}
+
 static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder)
 {
     GList* l;
@@ -371,6 +573,7 @@ static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder)
         gboolean need_added = g_signal_has_handler_pending(folder, signals[FILES_ADDED], 0, TRUE);
         gboolean need_changed = g_signal_has_handler_pending(folder, signals[FILES_CHANGED], 0, TRUE);
 
+        G_LOCK(lists);
         for(l=fm_file_info_list_peek_head_link(job->file_infos);l;l=l->next)
         {
             FmFileInfo* fi = (FmFileInfo*)l->data;
@@ -393,9 +596,10 @@ static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder)
             {
                 if(need_added)
                     files_to_add = g_slist_prepend(files_to_add, fi);
-                fm_file_info_list_push_tail(folder->files, fi);
+                _fm_folder_add_file_info(folder, fi);
             }
         }
+        G_UNLOCK(lists);
         if(files_to_add)
         {
             g_signal_emit(folder, signals[FILES_ADDED], 0, files_to_add);
@@ -417,7 +621,7 @@ static gboolean on_idle(FmFolder* folder)
     GSList* l;
     FmFileInfoJob* job = NULL;
     GSList *files_to_add, *files_to_del, *files_to_update;
-    gboolean stop_emission;
+    gboolean stop_emission, need_rescan = FALSE;
 
     /* check if folder still exists */
     if(g_source_is_destroyed(g_main_current_source()))
@@ -430,12 +634,45 @@ static gboolean on_idle(FmFolder* folder)
     stop_emission = folder->stop_emission;
     if (!stop_emission)
     {
-        files_to_add = folder->files_to_add;
-        folder->files_to_add = NULL;
-        files_to_del = folder->files_to_del;
-        folder->files_to_del = NULL;
-        files_to_update = folder->files_to_update;
-        folder->files_to_update = NULL;
+        GHashTableIter it;
+        gpointer link;
+        guint n_changes = g_hash_table_size(folder->files_to_add) +
+                          g_hash_table_size(folder->files_to_update);
+
+        files_to_add = files_to_update = NULL;
+        if (folder->rescan_job)
+            /* keep changes until rescan is finished */
+            n_changes = 0;
+        else if (n_changes >= RESCAN_THRESHOLD && fm_path_is_native(folder->dir_path))
+        {
+            /* rescan will get them all; files queued for update are handed
+               over to it so they are updated even if their stat is same */
+            GHashTable *updated = folder->rescan_updated;
+
+            g_hash_table_remove_all(folder->files_to_add);
+            folder->rescan_updated = folder->files_to_update;
+            folder->files_to_update = updated;
+            need_rescan = TRUE;
+        }
+        else
+        {
+            files_to_add = _path_set_steal_all(folder->files_to_add);
+            files_to_update = _path_set_steal_all(folder->files_to_update);
+        }
+        n_changes += g_hash_table_size(folder->files_to_del);
+        /* widen the window while folder is busy, narrow it when calm */
+        if (n_changes >= UPDATE_BURST)
+            folder->update_delay = MIN(MAX(folder->update_delay * 2, UPDATE_DELAY_STEP),
+                                       UPDATE_DELAY_MAX);
+        else if (folder->update_delay / 2 < UPDATE_DELAY_STEP)
+            folder->update_delay = 0;
+        else
+            folder->update_delay /= 2;
+        files_to_del = NULL;
+        g_hash_table_iter_init(&it, folder->files_to_del);
+        while(g_hash_table_iter_next(&it, &link, NULL))
+            files_to_del = g_slist_prepend(files_to_del, link);
+        g_hash_table_remove_all(folder->files_to_del);
     }
     G_UNLOCK(lists);
 
@@ -445,6 +682,9 @@ static gboolean on_idle(FmFolder* folder)
 
     /* g_debug("folder: on_idle() started"); */
 
+    if(need_rescan)
+        _fm_folder_start_rescan(folder);
+
     if(files_to_update || files_to_add)
         job = (FmFileInfoJob*)fm_file_info_job_new(NULL, 0);
 
@@ -486,13 +726,18 @@ static gboolean on_idle(FmFolder* folder)
     if(files_to_del)
     {
         GSList* ll;
+        G_LOCK(lists);
         for(ll=files_to_del;ll;ll=ll->next)
         {
             GList* l= (GList*)ll->data;
             ll->data = l->data;
+            g_hash_table_remove(folder->files_index, fm_file_info_get_path(l->data));
             fm_file_info_list_delete_link_nounref(folder->files, l);
         }
+        G_UNLOCK(lists);
         g_signal_emit(folder, signals[FILES_REMOVED], 0, files_to_del);
+        /* files still kept by someone shouldn't keep the arena */
+        g_slist_foreach(files_to_del, (GFunc)_fm_file_info_detach_arena, NULL);
         g_slist_foreach(files_to_del, (GFunc)fm_file_info_unref, NULL);
         g_slist_free(files_to_del);
 
@@ -529,16 +774,17 @@ gboolean _fm_folder_event_file_added(FmFolder *folder, FmPath *path)
     gboolean added = TRUE;
 
     G_LOCK(lists);
+    n_events++;
     /* make sure that the file is not already queued for addition. */
-    if(!g_slist_find(folder->files_to_add, path))
+    if(!g_hash_table_lookup(folder->files_to_add, path))
     {
         GList *l = _fm_folder_get_file_by_path(folder, path);
         if(!l) /* it's new file */
         {
             /* add the file name to queue for addition. */
-            folder->files_to_add = g_slist_append(folder->files_to_add, path);
+            g_hash_table_insert(folder->files_to_add, path, path);
         }
-        else if(g_slist_find(folder->files_to_update, path))
+        else if(g_hash_table_lookup(folder->files_to_update, path))
         {
             /* file already queued for update, don't duplicate */
             added = FALSE;
@@ -548,16 +794,18 @@ gboolean _fm_folder_event_file_added(FmFolder *folder, FmPath *path)
         {
             /* bug #3591771: 'ln -fns . test' leave no file visible in folder.
                If it is queued for deletion then cancel that operation */
-            folder->files_to_del = g_slist_remove(folder->files_to_del, l);
+            g_hash_table_remove(folder->files_to_del, l);
             /* update the existing item. */
-            folder->files_to_update = g_slist_append(folder->files_to_update, path);
+            g_hash_table_insert(folder->files_to_update, path, path);
         }
     }
     else
         /* file already queued for adding, don't duplicate */
         added = FALSE;
-    if(added && !folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+    if(added)
+        _fm_folder_queue_update(folder);
+    else
+        n_coalesced++;
     G_UNLOCK(lists);
     return added;
 }
@@ -567,16 +815,20 @@ gboolean _fm_folder_event_file_changed(FmFolder *folder, FmPath *path)
     gboolean added;
 
     G_LOCK(lists);
+    n_events++;
     /* make sure that the file is not already queued for changes or
      * it's already queued for addition. */
-    if(!g_slist_find(folder->files_to_update, path) &&
-       !g_slist_find(folder->files_to_add, path) &&
-       _fm_folder_get_file_by_path(folder, path)) /* ensure it is our file */
+    if(g_hash_table_lookup(folder->files_to_update, path) ||
+       g_hash_table_lookup(folder->files_to_add, path))
     {
-        folder->files_to_update = g_slist_append(folder->files_to_update, path);
+        n_coalesced++;
+        added = FALSE;
+    }
+    else if(_fm_folder_get_file_by_path(folder, path)) /* ensure it is our file */
+    {
+        g_hash_table_insert(folder->files_to_update, path, path);
         added = TRUE;
-        if(!folder->idle_handler)
-            folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+        _fm_folder_queue_update(folder);
     }
     else
     {
@@ -589,30 +841,23 @@ gboolean _fm_folder_event_file_changed(FmFolder *folder, FmPath *path)
 void _fm_folder_event_file_deleted(FmFolder *folder, FmPath *path)
 {
     GList *l;
-    GSList *sl;
 
     G_LOCK(lists);
+    n_events++;
     l = _fm_folder_get_file_by_path(folder, path);
-    if(l && !g_slist_find(folder->files_to_del, l) )
-        folder->files_to_del = g_slist_prepend(folder->files_to_del, l);
+    if(l)
+        g_hash_table_insert(folder->files_to_del, l, l);
     /* if the file is already queued for addition or update, that operation
-       will be just a waste, therefore cancel it right now */
-    sl = g_slist_find(folder->files_to_update, path);
-    if(sl)
-    {
-        folder->files_to_update = g_slist_delete_link(folder->files_to_update, sl);
-    }
-    else if((sl = g_slist_find(folder->files_to_add, path)))
-    {
-        folder->files_to_add = g_slist_delete_link(folder->files_to_add, sl);
-    }
-    else
-        path = NULL;
-    if(!folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+       will be just a waste, therefore cancel it right now; the reference
+       held by the set is dropped by g_hash_table_remove() */
+    if(g_hash_table_remove(folder->files_to_update, path) ||
+       g_hash_table_remove(folder->files_to_add, path))
+        n_coalesced++;
+    /* the file might be listed already by rescan, don't let it appear */
+    if(folder->rescan_job)
+        g_hash_table_insert(folder->rescan_deleted, fm_path_ref(path), path);
+    _fm_folder_queue_update(folder);
     G_UNLOCK(lists);
-    if (path != NULL)
-        fm_path_unref(path); /* link was freed above so we should unref it */
 }
 
 static void on_folder_changed(GFileMonitor* mon, GFile* gf, GFile* other, GFileMonitorEvent evt, FmFolder* folder)
@@ -664,8 +909,7 @@ static void on_folder_changed(GFileMonitor* mon, GFile* gf, GFile* other, GFileM
         case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
             folder->pending_change_notify = TRUE;
             G_LOCK(lists);
-            if(!folder->idle_handler)
-                folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+            _fm_folder_queue_update(folder);
             G_UNLOCK(lists);
             /* g_debug("folder is changed"); */
             break;
@@ -705,8 +949,7 @@ static void on_folder_changed(GFileMonitor* mon, GFile* gf, GFile* other, GFileM
         return;
     }
     G_LOCK(lists);
-    if(!folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+    _fm_folder_queue_update(folder);
     G_UNLOCK(lists);
 }
 
@@ -721,12 +964,14 @@ static void on_dirlist_job_finished(FmDirListJob* job, FmFolder* folder)
     if(!fm_job_is_cancelled(FM_JOB(job)) && !folder->wants_incremental)
     {
         GList* l;
+        G_LOCK(lists);
         for(l = fm_file_info_list_peek_head_link(job->files); l; l=l->next)
         {
             FmFileInfo* inf = (FmFileInfo*)l->data;
             files = g_slist_prepend(files, inf);
-            fm_file_info_list_push_tail(folder->files, inf);
+            _fm_folder_add_file_info(folder, inf);
         }
+        G_UNLOCK(lists);
         if(G_LIKELY(files))
         {
             GSList *l;
@@ -735,8 +980,11 @@ static void on_dirlist_job_finished(FmDirListJob* job, FmFolder* folder)
             if (folder->defer_content_test && fm_path_is_native(folder->dir_path))
                 /* we got only basic info on content, schedule update it now */
                 for (l = files; l; l = l->next)
-                    folder->files_to_update = g_slist_prepend(folder->files_to_update,
-                                                fm_path_ref(fm_file_info_get_path(l->data)));
+                {
+                    FmPath *path = fm_path_ref(fm_file_info_get_path(l->data));
+                    /* if path is already there, the new reference is dropped */
+                    g_hash_table_insert(folder->files_to_update, path, path);
+                }
             G_UNLOCK(lists);
             g_signal_emit(folder, signals[FILES_ADDED], 0, files);
             g_slist_free(files);
@@ -747,24 +995,23 @@ static void on_dirlist_job_finished(FmDirListJob* job, FmFolder* folder)
 
         /* Some new files are created while FmDirListJob is loading the folder. */
         G_LOCK(lists);
-        if(G_UNLIKELY(folder->files_to_add))
+        if(G_UNLIKELY(g_hash_table_size(folder->files_to_add) > 0))
         {
             /* This should be a very rare case. Could this happen? */
-            GSList* l;
-            for(l = folder->files_to_add; l;)
+            GHashTableIter it;
+            gpointer path;
+            g_hash_table_iter_init(&it, folder->files_to_add);
+            while(g_hash_table_iter_next(&it, &path, NULL))
             {
-                FmPath *path = l->data;
-                GSList* next = l->next;
                 if(_fm_folder_get_file_by_path(folder, path))
                 {
                     /* we already have the file. remove it from files_to_add, 
                      * and put it in files_to_update instead.
-                     * No strdup for name is needed here. We steal
-                     * the string from files_to_add.*/
-                    folder->files_to_update = g_slist_prepend(folder->files_to_update, path);
-                    folder->files_to_add = g_slist_delete_link(folder->files_to_add, l);
+                     * No ref for path is needed here. We steal
+                     * the reference from files_to_add.*/
+                    g_hash_table_iter_steal(&it);
+                    g_hash_table_insert(folder->files_to_update, path, path);
                 }
-                l = next;
             }
         }
         G_UNLOCK(lists);
@@ -784,11 +1031,13 @@ static void on_dirlist_job_files_found(FmDirListJob* job, GSList* files, gpointe
 {
     FmFolder* folder = FM_FOLDER(user_data);
     GSList* l;
+    G_LOCK(lists);
     for(l = files; l; l = l->next)
     {
         FmFileInfo* file = FM_FILE_INFO(l->data);
-        fm_file_info_list_push_tail(folder->files, file);
+        _fm_folder_add_file_info(folder, file);
     }
+    G_UNLOCK(lists);
     if (G_UNLIKELY(!folder->dir_fi && job->dir_fi))
         /* we may want info while folder is still loading */
         folder->dir_fi = fm_file_info_ref(job->dir_fi);
@@ -869,6 +1118,9 @@ static void fm_folder_dispose(GObject *object)
     if(folder->dirlist_job)
         free_dirlist_job(folder);
 
+    if(folder->rescan_job)
+        free_rescan_job(folder);
+
     if(folder->pending_jobs)
     {
         GSList* l;
@@ -901,23 +1153,6 @@ static void fm_folder_dispose(GObject *object)
     {
         g_source_remove(folder->idle_handler);
         folder->idle_handler = 0;
-        if(folder->files_to_add)
-        {
-            g_slist_foreach(folder->files_to_add, (GFunc)fm_path_unref, NULL);
-            g_slist_free(folder->files_to_add);
-            folder->files_to_add = NULL;
-        }
-        if(folder->files_to_update)
-        {
-            g_slist_foreach(folder->files_to_update, (GFunc)fm_path_unref, NULL);
-            g_slist_free(folder->files_to_update);
-            folder->files_to_update = NULL;
-        }
-        if(folder->files_to_del)
-        {
-            g_slist_free(folder->files_to_del);
-            folder->files_to_del = NULL;
-        }
     }
 
     if(folder->fs_size_cancellable)
@@ -950,8 +1185,45 @@ static void fm_folder_dispose(GObject *object)
         folder->gf = NULL;
     }
 
+    G_LOCK(lists);
+    if(folder->files_to_add)
+    {
+        g_hash_table_destroy(folder->files_to_add);
+        folder->files_to_add = NULL;
+    }
+    if(folder->files_to_update)
+    {
+        g_hash_table_destroy(folder->files_to_update);
+        folder->files_to_update = NULL;
+    }
+    if(folder->files_to_del)
+    {
+        g_hash_table_destroy(folder->files_to_del);
+        folder->files_to_del = NULL;
+    }
+    if(folder->files_index)
+    {
+        g_hash_table_destroy(folder->files_index);
+        folder->files_index = NULL;
+    }
+    if(folder->rescan_deleted)
+    {
+        g_hash_table_destroy(folder->rescan_deleted);
+        folder->rescan_deleted = NULL;
+    }
+    if(folder->rescan_updated)
+    {
+        g_hash_table_destroy(folder->rescan_updated);
+        folder->rescan_updated = NULL;
+    }
+    G_UNLOCK(lists);
+
     if(folder->files)
     {
+        /* collate keys of files listed are kept in arenas of dir list
+           jobs, copy them out of there for files which outlive us */
+        g_list_foreach(fm_file_info_list_peek_head_link(folder->files),
+                       (GFunc)_fm_file_info_detach_arena, NULL);
         fm_file_info_list_unref(folder->files);
         folder->files = NULL;
     }
@@ -1066,6 +1338,8 @@ void fm_folder_reload(FmFolder* folder)
     /* cancel running dir listing job if there is any. */
     if(folder->dirlist_job)
         free_dirlist_job(folder);
+    if(folder->rescan_job)
+        free_rescan_job(folder);
 
     /* remove all existing files */
     if(l)
@@ -1079,7 +1353,14 @@ void fm_folder_reload(FmFolder* folder)
             g_signal_emit(folder, signals[FILES_REMOVED], 0, files_to_del);
             g_slist_free(files_to_del);
         }
+        G_LOCK(lists);
+        /* links queued for deletion are freed below so forget them */
+        g_hash_table_remove_all(folder->files_to_del);
+        g_hash_table_remove_all(folder->files_index);
+        g_list_foreach(fm_file_info_list_peek_head_link(folder->files),
+                       (GFunc)_fm_file_info_detach_arena, NULL);
         fm_file_info_list_clear(folder->files); /* fm_file_info_unref will be invoked. */
+        G_UNLOCK(lists);
     }
 
     /* also re-create a new file monitor */
@@ -1193,15 +1474,7 @@ FmPath* fm_folder_get_path(FmFolder* folder)
 
 static GList* _fm_folder_get_file_by_path(FmFolder* folder, FmPath *path)
 {
-    GList* l = fm_file_info_list_peek_head_link(folder->files);
-    for(;l;l=l->next)
-    {
-        FmFileInfo* fi = (FmFileInfo*)l->data;
-        FmPath* lpath = fm_file_info_get_path(fi);
-        if(lpath == path)
-            return l;
-    }
-    return NULL;
+    return (GList*)g_hash_table_lookup(folder->files_index, path);
 }
 
 /**
@@ -1373,8 +1646,7 @@ _out:
     G_UNLOCK(query);
     /* we have a reference borrowed by async query still */
     G_LOCK(lists);
-    if(!folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+    _fm_folder_queue_update(folder);
     G_UNLOCK(lists);
     g_object_unref(folder);
 }
@@ -1456,8 +1728,7 @@ void fm_folder_unblock_updates(FmFolder *folder)
     G_LOCK(lists);
     folder->stop_emission = FALSE;
     /* query update now */
-    if(!folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
+    _fm_folder_queue_update(folder);
     G_UNLOCK(lists);
     /* g_debug("fm_folder_unblock_updates OK"); */
 }
@@ -1602,6 +1873,33 @@ static void on_mount_removed(GVolumeMonitor* vm, GMount* mount, gpointer user_da
     }
 }
 
+/**
+ * fm_folder_get_update_stats
+ * @events: (out) (allow-none): location to store number of change events
+ * @coalesced: (out) (allow-none): location to store number of merged events
+ * @rescans: (out) (allow-none): location to store number of folder rescans
+ *
+ * Retrieves statistics of handling changes in all folders. The @events
+ * counts all events of file creation, change, or deletion. The
+ * @coalesced counts events which were merged with changes already
+ * queued for the same file. The @rescans counts how many times folder
+ * had so many files changed at once that it was listed again instead
+ * of querying each file.
+ *
+ * Since: 1.2.0
+ */
+void fm_folder_get_update_stats(guint* events, guint* coalesced, guint* rescans)
+{
+    G_LOCK(lists);
+    if(events)
+        *events = n_events;
+    if(coalesced)
+        *coalesced = n_coalesced;
+    if(rescans)
+        *rescans = n_rescans;
+    G_UNLOCK(lists);
+}
+
 void _fm_folder_init()
 {
     hash = g_hash_table_new((GHashFunc)fm_path_hash, (GEqualFunc)fm_path_equal);
@@ -110,6 +110,8 @@ void fm_folder_reload(FmFolder* folder);
 gboolean fm_folder_get_filesystem_info(FmFolder* folder, guint64* total_size, guint64* free_size);
 void fm_folder_query_filesystem_info(FmFolder* folder);
 
+void fm_folder_get_update_stats(guint* events, guint* coalesced, guint* rescans);
+
 /* internal event handling to workaroung GIO inotify delay */
 gboolean _fm_folder_event_file_added(FmFolder *folder, FmPath *path);
 gboolean _fm_folder_event_file_changed(FmFolder *folder, FmPath *path);
@@ -41,6 +41,8 @@
 #include <fcntl.h>
 #include <string.h>
 
+#include <stdlib.h>
+
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
 #endif
@@ -71,6 +73,65 @@ static FmMimeType* desktop_entry_type = NULL;
 
 static FmMimeType* fm_mime_type_new(const char* type_name);
 
+/* Persistent cache of types detected by content sniffing.
+ * The file is a header followed by array of entries sorted by key and
+ * then by list of NUL-terminated type names referenced by entries. It is
+ * mapped into memory on first use and entries used or added during this
+ * session are kept in cache_new hash table. The cache file is rewritten
+ * on exit, and also a while after many new entries were added so they
+ * are not lost if the application crashes. Recently used entries are
+ * kept first if it grows too big.
+ * The file is never modified in place so mapping it is safe. */
+#define MIME_CACHE_MAGIC        "LFMMIME1"
+#define MIME_CACHE_MAX_ENTRIES  65536 /* 2.5 MiB of entries at most */
+#define MIME_CACHE_SAVE_COUNT   256 /* new entries to save the cache */
+#define MIME_CACHE_SAVE_DELAY   30 /* seconds */
+
+typedef struct
+{
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime;
+    gint64 size;
+    guint32 type; /* index in types list */
+    guint32 stamp; /* session when entry was used last time */
+} FmMimeCacheEntry;
+
+typedef struct
+{
+    char magic[8];
+    guint32 n_entries;
+    guint32 n_types;
+    guint32 stamp;
+    guint32 reserved;
+} FmMimeCacheHeader;
+
+typedef struct
+{
+    FmMimeCacheEntry e; /* e.type is not used */
+    FmMimeType* mime_type;
+} FmMimeCacheItem;
+
+static gboolean cache_loaded = FALSE;
+static gboolean cache_dirty = FALSE;
+static char* cache_map = NULL;
+static gsize cache_map_len = 0;
+static const FmMimeCacheEntry* cache_entries = NULL;
+static guint cache_n_entries = 0;
+static const char** cache_types = NULL;
+static guint cache_n_types = 0;
+static guint32 cache_stamp = 1;
+static GHashTable* cache_new = NULL;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+static guint cache_n_added = 0; /* entries added in this session */
+static guint cache_n_unsaved = 0; /* entries added since last save */
+static guint cache_save_handler = 0;
+G_LOCK_DEFINE_STATIC(mime_cache);
+
+static void _mime_cache_save(void);
+static void _mime_cache_unload(void);
+
 void _fm_mime_type_init()
 {
     mime_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -88,6 +149,14 @@ void _fm_mime_type_init()
 
 void _fm_mime_type_finalize()
 {
+    G_LOCK(mime_cache);
+    if(cache_save_handler)
+        g_source_remove(cache_save_handler);
+    cache_save_handler = 0;
+    if(cache_dirty)
+        _mime_cache_save();
+    _mime_cache_unload();
+    G_UNLOCK(mime_cache);
     fm_mime_type_unref(directory_type);
     fm_mime_type_unref(shortcut_type);
     fm_mime_type_unref(mountable_type);
@@ -95,6 +164,360 @@ void _fm_mime_type_finalize()
     g_hash_table_destroy(mime_hash);
 }
 
+static char* _mime_cache_get_path(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "libfm", "mime-cache", NULL);
+}
+
+static guint _mime_cache_hash(gconstpointer key)
+{
+    const FmMimeCacheEntry* e = key;
+    return (guint)(e->ino ^ (e->ino >> 32) ^ e->dev ^ e->mtime ^ e->size);
+}
+
+static gboolean _mime_cache_equal(gconstpointer a, gconstpointer b)
+{
+    const FmMimeCacheEntry *e1 = a, *e2 = b;
+    return e1->ino == e2->ino && e1->dev == e2->dev &&
+           e1->mtime == e2->mtime && e1->size == e2->size;
+}
+
+static int _mime_cache_compare(const void* a, const void* b)
+{
+    const FmMimeCacheEntry *e1 = a, *e2 = b;
+    if(e1->dev != e2->dev)
+        return e1->dev < e2->dev ? -1 : 1;
+    if(e1->ino != e2->ino)
+        return e1->ino < e2->ino ? -1 : 1;
+    if(e1->mtime != e2->mtime)
+        return e1->mtime < e2->mtime ? -1 : 1;
+    if(e1->size != e2->size)
+        return e1->size < e2->size ? -1 : 1;
+    return 0;
+}
+
+/* sorts most recently used entries first */
+static int _mime_cache_compare_stamp(const void* a, const void* b)
+{
+    const FmMimeCacheEntry *e1 = a, *e2 = b;
+    if(e1->stamp == e2->stamp)
+        return 0;
+    return e1->stamp > e2->stamp ? -1 : 1;
+}
+
+static void _mime_cache_item_free(gpointer data)
+{
+    FmMimeCacheItem* item = data;
+    fm_mime_type_unref(item->mime_type);
+    g_slice_free(FmMimeCacheItem, item);
+}
+
+/* should be called with lock held */
+static void _mime_cache_load(void)
+{
+    char* path = _mime_cache_get_path();
+    const FmMimeCacheHeader* hdr;
+    const char *p, *end;
+    gsize offset;
+    guint i;
+
+    cache_loaded = TRUE;
+    cache_new = g_hash_table_new_full(_mime_cache_hash, _mime_cache_equal,
+                                      NULL, _mime_cache_item_free);
+#ifdef HAVE_MMAP
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+
+        if(fd >= 0)
+        {
+            if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(FmMimeCacheHeader))
+            {
+                cache_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(cache_map == MAP_FAILED)
+                    cache_map = NULL;
+                else
+                    cache_map_len = st.st_size;
+            }
+            close(fd);
+        }
+    }
+#else
+    if(!g_file_get_contents(path, &cache_map, &cache_map_len, NULL))
+        cache_map = NULL;
+#endif
+    g_free(path);
+    if(!cache_map)
+        return;
+    /* validate the data, file may be broken */
+    hdr = (const FmMimeCacheHeader*)cache_map;
+    if(cache_map_len < sizeof(FmMimeCacheHeader) ||
+       memcmp(hdr->magic, MIME_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+       hdr->n_entries > MIME_CACHE_MAX_ENTRIES)
+        goto _invalid;
+    offset = sizeof(FmMimeCacheHeader) + hdr->n_entries * sizeof(FmMimeCacheEntry);
+    if(offset > cache_map_len || hdr->n_types > cache_map_len - offset)
+        goto _invalid;
+    cache_types = g_new(const char*, hdr->n_types);
+    p = cache_map + offset;
+    end = cache_map + cache_map_len;
+    for(i = 0; i < hdr->n_types; i++)
+    {
+        const char* eos = memchr(p, '\0', end - p);
+        if(!eos)
+            goto _invalid;
+        cache_types[i] = p;
+        p = eos + 1;
+    }
+    cache_entries = (const FmMimeCacheEntry*)(cache_map + sizeof(FmMimeCacheHeader));
+    cache_n_entries = hdr->n_entries;
+    cache_n_types = hdr->n_types;
+    cache_stamp = hdr->stamp + 1;
+    return;
+
+_invalid:
+    g_free(cache_types);
+    cache_types = NULL;
+#ifdef HAVE_MMAP
+    munmap(cache_map, cache_map_len);
+#else
+    g_free(cache_map);
+#endif
+    cache_map = NULL;
+    cache_map_len = 0;
+}
+
+/* should be called with lock held */
+static void _mime_cache_unload(void)
+{
+    if(!cache_loaded)
+        return;
+    if(cache_map)
+#ifdef HAVE_MMAP
+        munmap(cache_map, cache_map_len);
+#else
+        g_free(cache_map);
+#endif
+    cache_map = NULL;
+    cache_map_len = 0;
+    cache_entries = NULL;
+    cache_n_entries = 0;
+    g_free(cache_types);
+    cache_types = NULL;
+    cache_n_types = 0;
+    g_hash_table_destroy(cache_new);
+    cache_new = NULL;
+    cache_n_added = 0;
+    cache_dirty = FALSE;
+    cache_loaded = FALSE;
+}
+
+/* should be called with lock held */
+static void _mime_cache_save(void)
+{
+    FmMimeCacheHeader hdr;
+    FmMimeCacheEntry* entries;
+    GHashTable* type_idx;
+    GPtrArray* types;
+    GHashTableIter it;
+    FmMimeCacheItem* item;
+    GString* buf;
+    char *path, *dir;
+    guint n = 0, i;
+
+    entries = g_new(FmMimeCacheEntry, cache_n_entries + g_hash_table_size(cache_new));
+    type_idx = g_hash_table_new(g_str_hash, g_str_equal);
+    types = g_ptr_array_new();
+    /* entries used in this session, they have current stamp */
+    g_hash_table_iter_init(&it, cache_new);
+    while(g_hash_table_iter_next(&it, NULL, (gpointer*)&item))
+    {
+        const char* type = item->mime_type->type;
+        gpointer idx;
+
+        if(!g_hash_table_lookup_extended(type_idx, type, NULL, &idx))
+        {
+            idx = GUINT_TO_POINTER(types->len);
+            g_hash_table_insert(type_idx, (gpointer)type, idx);
+            g_ptr_array_add(types, (gpointer)type);
+        }
+        entries[n] = item->e;
+        entries[n].type = GPOINTER_TO_UINT(idx);
+        n++;
+    }
+    /* entries from the old file which were not used in this session */
+    for(i = 0; i < cache_n_entries; i++)
+    {
+        const char* type;
+        gpointer idx;
+
+        if(cache_entries[i].type >= cache_n_types ||
+           g_hash_table_lookup(cache_new, &cache_entries[i]))
+            continue;
+        type = cache_types[cache_entries[i].type];
+        if(!g_hash_table_lookup_extended(type_idx, type, NULL, &idx))
+        {
+            idx = GUINT_TO_POINTER(types->len);
+            g_hash_table_insert(type_idx, (gpointer)type, idx);
+            g_ptr_array_add(types, (gpointer)type);
+        }
+        entries[n] = cache_entries[i];
+        entries[n].type = GPOINTER_TO_UINT(idx);
+        n++;
+    }
+    /* evict least recently used entries if there are too many */
+    if(n > MIME_CACHE_MAX_ENTRIES)
+    {
+        qsort(entries, n, sizeof(FmMimeCacheEntry), _mime_cache_compare_stamp);
+        n = MIME_CACHE_MAX_ENTRIES;
+    }
+    qsort(entries, n, sizeof(FmMimeCacheEntry), _mime_cache_compare);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MIME_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.n_entries = n;
+    hdr.n_types = types->len;
+    hdr.stamp = cache_stamp;
+    buf = g_string_sized_new(sizeof(hdr) + n * sizeof(FmMimeCacheEntry) + types->len * 24);
+    g_string_append_len(buf, (const char*)&hdr, sizeof(hdr));
+    g_string_append_len(buf, (const char*)entries, n * sizeof(FmMimeCacheEntry));
+    for(i = 0; i < types->len; i++)
+        g_string_append_len(buf, types->pdata[i], strlen(types->pdata[i]) + 1);
+
+    /* g_file_set_contents() replaces the file atomically so anyone who
+       has it mapped still sees the old contents */
+    path = _mime_cache_get_path();
+    dir = g_path_get_dirname(path);
+    if(g_mkdir_with_parents(dir, 0700) == 0)
+        g_file_set_contents(path, buf->str, buf->len, NULL);
+    g_free(dir);
+    g_free(path);
+    g_string_free(buf, TRUE);
+    g_ptr_array_free(types, TRUE);
+    g_hash_table_destroy(type_idx);
+    g_free(entries);
+    cache_dirty = FALSE;
+    cache_n_unsaved = 0;
+}
+
+static gboolean _mime_cache_save_timeout(gpointer unused)
+{
+    G_LOCK(mime_cache);
+    if(!g_source_is_destroyed(g_main_current_source()))
+    {
+        cache_save_handler = 0;
+        if(cache_dirty)
+            _mime_cache_save();
+    }
+    G_UNLOCK(mime_cache);
+    return FALSE;
+}
+
+static inline void _mime_cache_make_key(FmMimeCacheEntry* key, struct stat* pstat)
+{
+    key->dev = pstat->st_dev;
+    key->ino = pstat->st_ino;
+    key->mtime = pstat->st_mtime;
+    key->size = pstat->st_size;
+    key->type = 0;
+    key->stamp = cache_stamp;
+}
+
+/* returns type detected by content before or NULL; a miss is counted
+ * only if the file will be read because of it */
+static FmMimeType* _mime_cache_lookup(struct stat* pstat, gboolean count_miss)
+{
+    FmMimeCacheEntry key;
+    const FmMimeCacheEntry* e;
+    FmMimeCacheItem* item;
+    FmMimeType* mime_type = NULL;
+
+    G_LOCK(mime_cache);
+    if(G_UNLIKELY(!cache_loaded))
+        _mime_cache_load();
+    _mime_cache_make_key(&key, pstat);
+    item = g_hash_table_lookup(cache_new, &key);
+    if(item)
+        mime_type = fm_mime_type_ref(item->mime_type);
+    else if(cache_n_entries > 0 &&
+            (e = bsearch(&key, cache_entries, cache_n_entries,
+                         sizeof(FmMimeCacheEntry), _mime_cache_compare)) != NULL &&
+            e->type < cache_n_types)
+    {
+        mime_type = fm_mime_type_from_name(cache_types[e->type]);
+        /* remember it was used so it survives eviction */
+        item = g_slice_new(FmMimeCacheItem);
+        item->e = key;
+        item->mime_type = fm_mime_type_ref(mime_type);
+        g_hash_table_insert(cache_new, &item->e, item);
+        cache_dirty = TRUE;
+    }
+    if(mime_type)
+        cache_hits++;
+    else if(count_miss)
+        cache_misses++;
+    G_UNLOCK(mime_cache);
+    return mime_type;
+}
+
+static void _mime_cache_add(struct stat* pstat, FmMimeType* mime_type)
+{
+    FmMimeCacheItem* item = g_slice_new(FmMimeCacheItem);
+
+    G_LOCK(mime_cache);
+    if(G_UNLIKELY(!cache_loaded))
+        _mime_cache_load();
+    _mime_cache_make_key(&item->e, pstat);
+    item->mime_type = fm_mime_type_ref(mime_type);
+    if(!g_hash_table_lookup(cache_new, &item->e))
+    {
+        cache_n_added++;
+        cache_n_unsaved++;
+    }
+    g_hash_table_replace(cache_new, &item->e, item);
+    cache_dirty = TRUE;
+    /* save it once there are many new entries, waiting a bit since
+       more of them are likely coming while the folder is listed */
+    if(cache_n_unsaved >= MIME_CACHE_SAVE_COUNT && cache_save_handler == 0)
+        cache_save_handler = g_timeout_add_seconds_full(G_PRIORITY_LOW,
+                                                        MIME_CACHE_SAVE_DELAY,
+                                                        _mime_cache_save_timeout,
+                                                        NULL, NULL);
+    G_UNLOCK(mime_cache);
+}
+
+/**
+ * fm_mime_type_get_cache_stats
+ * @hits: (out) (allow-none): location to store number of cache hits
+ * @misses: (out) (allow-none): location to store number of cache misses
+ * @n_entries: (out) (allow-none): location to store number of entries
+ *
+ * Retrieves statistics of persistent cache of file types which were
+ * detected by content. The cache is used to skip reading files when
+ * the same files are listed again, even after restart of application.
+ * Only lookups made before reading a file count as misses, lookups in
+ * fast listing mode which never reads files count only when they hit.
+ *
+ * Returns: ratio of cache hits to all lookups, in range from 0 to 1.
+ *
+ * Since: 1.2.0
+ */
+gdouble fm_mime_type_get_cache_stats(guint* hits, guint* misses, guint* n_entries)
+{
+    gdouble rate;
+
+    G_LOCK(mime_cache);
+    if(hits)
+        *hits = cache_hits;
+    if(misses)
+        *misses = cache_misses;
+    if(n_entries)
+        *n_entries = cache_n_entries + cache_n_added;
+    rate = (cache_hits + cache_misses) ? (gdouble)cache_hits / (cache_hits + cache_misses) : 0.0;
+    G_UNLOCK(mime_cache);
+    return rate;
+}
+
 /**
  * fm_mime_type_from_file_name
  * @ufile_name: file name to guess
@@ -118,6 +541,24 @@ FmMimeType* fm_mime_type_from_file_name(const char* ufile_name)
     return mime_type;
 }
 
+/* same as fm_mime_type_from_file_name() but if guess is uncertain then
+ * uses type detected by content before if it is available; never does
+ * any I/O except for loading the cache */
+FmMimeType* _fm_mime_type_from_file_name_cached(const char* ufile_name,
+                                                struct stat* pstat)
+{
+    FmMimeType* mime_type = NULL;
+    char * type;
+    gboolean uncertain;
+    type = g_content_type_guess(ufile_name, NULL, 0, &uncertain);
+    if(uncertain && pstat->st_size > 0)
+        mime_type = _mime_cache_lookup(pstat, FALSE);
+    if(!mime_type)
+        mime_type = fm_mime_type_from_name(type);
+    g_free(type);
+    return mime_type;
+}
+
 /**
  * fm_mime_type_from_native_file
  * @file_path: full path to file
@@ -137,14 +578,38 @@ FmMimeType* fm_mime_type_from_file_name(const char* ufile_name)
 FmMimeType* fm_mime_type_from_native_file(const char* file_path,
                                         const char* base_name,
                                         struct stat* pstat)
+{
+    return _fm_mime_type_from_native_file_at(-1, file_path, base_name, pstat);
+}
+
+/* same as fm_mime_type_from_native_file() but if @dirfd is not negative
+ * then file is opened relative to @dirfd using on-disk basename of
+ * @file_path, which saves path lookups when listing big directories */
+FmMimeType* _fm_mime_type_from_native_file_at(int dirfd,
+                                              const char* file_path,
+                                              const char* base_name,
+                                              struct stat* pstat)
 {
     FmMimeType* mime_type;
     struct stat st;
+#ifdef HAVE_AT_FUNCS
+    const char* name = NULL;
+
+    if(dirfd >= 0)
+    {
+        name = strrchr(file_path, '/');
+        name = name ? name + 1 : file_path;
+    }
+#endif
 
     if(!pstat)
     {
         pstat = &st;
+#ifdef HAVE_AT_FUNCS
+        if(name ? fstatat(dirfd, name, &st, 0) == -1 : stat(file_path, &st) == -1)
+#else
         if(stat(file_path, &st) == -1)
+#endif
             return NULL;
     }
 
@@ -160,6 +625,18 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,
                 g_free(type);
                 return fm_mime_type_from_name("text/plain");
             }
+            /* the file might be tested already */
+            mime_type = _mime_cache_lookup(pstat, TRUE);
+            if(mime_type)
+            {
+                g_free(type);
+                return mime_type;
+            }
+#ifdef HAVE_AT_FUNCS
+            if(name)
+                fd = openat(dirfd, name, O_RDONLY);
+            else
+#endif
             fd = open(file_path, O_RDONLY);
             if(fd >= 0)
             {
@@ -190,6 +667,13 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,
                 type = g_content_type_guess(NULL, (guchar*)buf, len, &uncertain);
             /* #endif */
                 close(fd);
+                if(len > 0)
+                {
+                    mime_type = fm_mime_type_from_name(type);
+                    g_free(type);
+                    _mime_cache_add(pstat, mime_type);
+                    return mime_type;
+                }
             }
         }
         mime_type = fm_mime_type_from_name(type);
@@ -46,11 +46,21 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,  /* Should be o
 
 FmMimeType* fm_mime_type_from_name(const char* type);
 
+FmMimeType* _fm_mime_type_from_file_name_cached(const char* ufile_name,
+                                                struct stat* pstat);
+
+FmMimeType* _fm_mime_type_from_native_file_at(int dirfd,
+                                              const char* file_path,
+                                              const char* base_name,
+                                              struct stat* pstat);
+
 FmMimeType* _fm_mime_type_get_inode_directory();
 FmMimeType* _fm_mime_type_get_inode_x_shortcut();
 FmMimeType* _fm_mime_type_get_inode_mount_point();
 FmMimeType* _fm_mime_type_get_application_x_desktop();
 
+gdouble fm_mime_type_get_cache_stats(guint* hits, guint* misses, guint* n_entries);
+
 FmMimeType* fm_mime_type_ref(FmMimeType* mime_type);
 void fm_mime_type_unref(gpointer mime_type_);
 
@@ -49,8 +49,9 @@ struct _FmPath
     gint n_ref;
     FmPath* parent;
     char *disp_name;
-    GSequenceIter *iter; /* iterator in parent, NULL for root path */
-    GSequence *children; /* children to reuse paths */
+    GHashTable *children; /* children to reuse paths: name -> FmPath */
+    guint hash; /* fm_path_hash() value, computed once on creation */
+    guint str_len; /* length of fm_path_to_str() string */
     guchar flags; /* FmPathFlags flags : 8; */
     char name[1]; /* basename: in local encoding if native, uri-escaped otherwise */
 };
@@ -78,10 +79,51 @@ static FmPath* apps_root_path = NULL;
 
 static GSList* roots = NULL;
 
-/* a lock for access to changeable data: roots list, and
-   members of FmPath struct: disp_name, iter, children */
+/* a lock for access to the roots list */
 G_LOCK_DEFINE_STATIC(roots);
 
+/* Children table of FmPath and disp_name of those children are protected
+   by one of the locks below, selected by address of the parent path (root
+   paths use the lock for NULL parent). Creating or dropping a child locks
+   only its parent's shard so threads which work in different directories
+   don't contend for a single global lock. No code should hold two of these
+   locks at once since shards may coincide. */
+#define PATH_LOCK_SHARDS 64
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+static GMutex path_locks[PATH_LOCK_SHARDS];
+#define PATH_LOCK(_path) g_mutex_lock(&path_locks[_path_lock_shard(_path)])
+#define PATH_UNLOCK(_path) g_mutex_unlock(&path_locks[_path_lock_shard(_path)])
+#else
+static GMutex *path_locks[PATH_LOCK_SHARDS];
+#define PATH_LOCK(_path) g_mutex_lock(path_locks[_path_lock_shard(_path)])
+#define PATH_UNLOCK(_path) g_mutex_unlock(path_locks[_path_lock_shard(_path)])
+#endif
+
+static inline guint _path_lock_shard(FmPath *path)
+{
+    gsize p = GPOINTER_TO_SIZE(path);
+    /* allocations are aligned so low bits carry no information */
+    return ((p >> 4) ^ (p >> 12)) % PATH_LOCK_SHARDS;
+}
+
+/* takes a reference unless the path is already being destroyed, i.e. its
+   last reference was dropped but fm_path_unref() didn't remove it from the
+   parent yet; such a path should be never returned to the caller */
+static inline gboolean _fm_path_ref_if_alive(FmPath *path)
+{
+    gint n_ref;
+
+    do
+    {
+        n_ref = g_atomic_int_get(&path->n_ref);
+        if (n_ref == 0)
+            return FALSE;
+    }
+    while (!g_atomic_int_compare_and_exchange(&path->n_ref, n_ref, n_ref + 1));
+    return TRUE;
+}
+
 static FmPath* _fm_path_alloc(FmPath* parent, int name_len, int flags)
 {
     FmPath* path;
@@ -91,24 +133,74 @@ static FmPath* _fm_path_alloc(FmPath* parent, int name_len, int flags)
     path->parent = parent ? fm_path_ref(parent) : NULL;
     path->disp_name = NULL;
     path->children = NULL;
-    path->iter = NULL;
     return path;
 }
 
-static inline FmPath* _fm_path_new_internal(FmPath* parent, const char* name, int name_len, int flags)
+/* terminates name and sets up data which depend on name and parent */
+static void _fm_path_set_name_len(FmPath* path, int name_len)
 {
-    FmPath* path = _fm_path_alloc(parent, name_len, flags);
-    memcpy(path->name, name, name_len);
+    FmPath* parent = path->parent;
+
     path->name[name_len] = '\0';
+    path->hash = g_str_hash(path->name);
+    path->str_len = name_len;
+    if(parent)
+    {
+        /* this is learned from g_str_hash() of glib. */
+        path->hash = (path->hash << 5) - path->hash + '/';
+        /* this is learned from g_icon_hash() of gio. */
+        path->hash ^= parent->hash;
+        path->str_len += parent->str_len;
+        if(parent->parent) /* if parent dir is not root_path */
+            path->str_len++;
+    }
+}
+
+/* returns referenced child of @parent with @name, creating it if needed;
+   @name should be nul-terminated and already escaped if required */
+static FmPath* _fm_path_intern_child(FmPath* parent, const char* name, int name_len, int flags)
+{
+    FmPath* path;
+
+    PATH_LOCK(parent);
+    if (parent->children == NULL)
+        parent->children = g_hash_table_new(g_str_hash, g_str_equal);
+    else
+    {
+        /* try to reuse existing path */
+        path = g_hash_table_lookup(parent->children, name);
+        if (path && _fm_path_ref_if_alive(path))
+        {
+            PATH_UNLOCK(parent);
+            /* g_debug("found reusable path '%s'", name); */
+            return path;
+        }
+        /* otherwise it's either absent or dying one, the dying one
+           will not remove itself from parent after it's replaced */
+    }
+    path = _fm_path_alloc(parent, name_len, flags);
+    memcpy(path->name, name, name_len);
+    _fm_path_set_name_len(path, name_len);
+    g_hash_table_replace(parent->children, path->name, path);
+    PATH_UNLOCK(parent);
+    return path;
+}
+
+static FmPath* _fm_path_new_internal(FmPath* parent, const char* name, int name_len, int flags)
+{
+    FmPath* path;
+    char *key;
+
     if (parent)
     {
-        G_LOCK(roots);
-        if (parent->children == NULL)
-            parent->children = g_sequence_new(NULL);
-        path->iter = g_sequence_insert_sorted(parent->children, path,
-                                              (GCompareDataFunc)fm_path_compare, NULL);
-        G_UNLOCK(roots);
+        key = g_strndup(name, name_len);
+        path = _fm_path_intern_child(parent, key, name_len, flags);
+        g_free(key);
+        return path;
     }
+    path = _fm_path_alloc(NULL, name_len, flags);
+    memcpy(path->name, name, name_len);
+    _fm_path_set_name_len(path, name_len);
     return path;
 }
 
@@ -225,16 +317,14 @@ static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** rema
         path = l->data;
         if(strncmp(path->name, uri, scheme_len) == 0 &&
            (!host_len || !strncmp(&path->name[scheme_len + 3], host, host_len)) &&
-           strcmp(&path->name[len-1], "/") == 0)
+           strcmp(&path->name[len-1], "/") == 0 &&
+           _fm_path_ref_if_alive(path))
         {
-            fm_path_ref(path);
             G_UNLOCK(roots);
             return path;
         }
     }
     path = _fm_path_alloc(NULL, len, flags);
-    roots = g_slist_append(roots, path);
-    G_UNLOCK(roots);
     buf = path->name;
     memcpy(buf, uri, scheme_len); /* the scheme */
     buf += scheme_len;
@@ -246,9 +336,11 @@ static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** rema
         buf += host_len;
     }
     buf[0] = '/'; /* the trailing / */
-    buf[1] = '\0';
+    _fm_path_set_name_len(path, len);
     if (disp_name)
         path->disp_name = g_strdup(disp_name); /* no lock required, it's new data */
+    roots = g_slist_append(roots, path);
+    G_UNLOCK(roots);
     return path;
 
 on_error: /* this is not a valid URI */
@@ -277,6 +369,8 @@ FmPath* _fm_path_new_child_len(FmPath* parent, const char* basename, int name_le
                                gboolean dont_escape, gboolean is_query)
 {
     FmPath* path;
+    char buf[256];
+    char *name;
     int flags;
 
     /* skip empty basename */
@@ -319,53 +413,29 @@ FmPath* _fm_path_new_child_len(FmPath* parent, const char* basename, int name_le
     if(name_len == 0)
         return fm_path_ref(parent);
 
-    /* create path data first */
+    /* make a nul-terminated key to look up existing path with */
     if(dont_escape)
     {
-        path = _fm_path_alloc(parent, name_len, flags);
-        memcpy(path->name, basename, name_len);
+        if(G_LIKELY(name_len < (int)sizeof(buf)))
+            name = buf;
+        else
+            name = g_malloc(name_len + 1);
+        memcpy(name, basename, name_len);
+        name[name_len] = '\0';
     }
     else
     {
-        GString *str = g_string_new_len(basename, name_len);
+        char *str = g_strndup(basename, name_len);
         /* remote file names don't come escaped from gvfs; isn't that a bug of gvfs? */
-        char *escaped = g_uri_escape_string(str->str, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, FALSE);
-        /* g_debug("got child %s", escaped); */
-        name_len = strlen(escaped);
-        path = _fm_path_alloc(parent, name_len, flags);
-        memcpy(path->name, escaped, name_len);
-        g_free(escaped);
-        g_string_free(str, TRUE);
+        name = g_uri_escape_string(str, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, FALSE);
+        /* g_debug("got child %s", name); */
+        name_len = strlen(name);
+        g_free(str);
     }
-    path->name[name_len] = '\0';
-
-    G_LOCK(roots);
-    if (parent->children)
-    {
-        GSequenceIter *iter;
 
-        /* try to reuse existing path */
-        iter = g_sequence_lookup(parent->children, path,
-                                 (GCompareDataFunc)fm_path_compare, NULL);
-        if (iter)
-        {
-                /* g_debug("found reusable path '%.*s'", name_len, basename); */
-            FmPath *np = fm_path_ref(g_sequence_get(iter));
-            G_UNLOCK(roots); /* we should not unref with lock up */
-            fm_path_unref(path); /* drop this path and reuse found one */
-            return np;
-        }
-        else
-            path->iter = g_sequence_insert_sorted(parent->children, path,
-                                                  (GCompareDataFunc)fm_path_compare,
-                                                  NULL);
-    }
-    else
-    {
-        parent->children = g_sequence_new(NULL);
-        path->iter = g_sequence_append(parent->children, path);
-    }
-    G_UNLOCK(roots);
+    path = _fm_path_intern_child(parent, name, name_len, flags);
+    if(name != buf)
+        g_free(name);
     return path;
 }
 
@@ -553,30 +623,31 @@ static FmPath *_lookup_in_children(FmPath *path, const char *display_name)
 {
     FmPath *subpath = NULL;
 
-    G_LOCK(roots);
+    PATH_LOCK(path);
     if (path->children != NULL)
     {
-        GSequenceIter *iter = g_sequence_get_begin_iter(path->children);
+        GHashTableIter iter;
+        FmPath *child;
         const char *name;
 
-        while (!g_sequence_iter_is_end(iter))
+        g_hash_table_iter_init(&iter, path->children);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&child))
         {
-            path = (FmPath*)g_sequence_get(iter);
-            name = path->disp_name;
+            name = child->disp_name;
             if (name)
             {
                 if (name == BASENAME_AS_DISP_NAME)
-                    name = path->name;
-                if (strcmp(display_name, name) == 0)
+                    name = child->name;
+                if (strcmp(display_name, name) == 0 &&
+                    _fm_path_ref_if_alive(child))
                 {
-                    subpath = fm_path_ref(path);
+                    subpath = child;
                     break;
                 }
             }
-            iter = g_sequence_iter_next(iter);
         }
     }
-    G_UNLOCK(roots);
+    PATH_UNLOCK(path);
     return subpath;
 }
 
@@ -779,17 +850,20 @@ void fm_path_unref(FmPath* path)
     /* g_debug("fm_path_unref: %s, n_ref = %d", fm_path_to_str(path), path->n_ref); */
     if(g_atomic_int_dec_and_test(&path->n_ref))
     {
-        G_LOCK(roots);
         if(G_LIKELY(path->parent))
         {
-            if (G_LIKELY(path->iter))
-                g_sequence_remove(path->iter);
-                /* otherwise it's fresh abandoned one, see above */
-            G_UNLOCK(roots); /* we should not unref with lock up */
+            PATH_LOCK(path->parent);
+            /* it might be replaced with new path already, see
+               _fm_path_intern_child(), then leave the table alone */
+            if (G_LIKELY(path->parent->children) &&
+                g_hash_table_lookup(path->parent->children, path->name) == path)
+                g_hash_table_remove(path->parent->children, path->name);
+            PATH_UNLOCK(path->parent); /* we should not unref with lock up */
             fm_path_unref(path->parent);
         }
         else
         {
+            G_LOCK(roots);
             roots = g_slist_remove(roots, path);
             G_UNLOCK(roots);
         }
@@ -798,8 +872,8 @@ void fm_path_unref(FmPath* path)
             g_free(path->disp_name);
         if (G_UNLIKELY(path->children))
         {
-            g_assert(g_sequence_get_length(path->children) == 0);
-            g_sequence_free(path->children);
+            g_assert(g_hash_table_size(path->children) == 0);
+            g_hash_table_destroy(path->children);
         }
         g_free(path);
     }
@@ -893,26 +967,24 @@ gboolean fm_path_has_prefix(FmPath* path, FmPath* prefix)
     return FALSE;
 }
 
-/* recursive internal implem. of fm_path_to_str returns end of current
-   build string */
-static gchar* fm_path_to_str_int(FmPath* path, gchar** ret, gint str_len)
+/* fills path string backwards from its end, buf should have space for
+   path->str_len bytes */
+static void fm_path_to_str_int(FmPath* path, gchar* buf)
 {
-    gint name_len = strlen(path->name);
-    gchar* pbuf;
+    gchar* pbuf = buf + path->str_len;
+    guint name_len;
 
-    if (!path->parent)
-    {
-        *ret = g_new0(gchar, str_len + name_len + 1 );
-        pbuf = *ret;
-    }
-    else
+    for(; path->parent; path = path->parent)
     {
-        pbuf = fm_path_to_str_int( path->parent, ret, str_len + name_len + 1 );
+        name_len = path->str_len - path->parent->str_len;
         if (path->parent->parent) /* if parent dir is not root_path */
-            *pbuf++ = G_DIR_SEPARATOR;
+            name_len--;
+        pbuf -= name_len;
+        memcpy(pbuf, path->name, name_len);
+        if (path->parent->parent)
+            *--pbuf = G_DIR_SEPARATOR;
     }
-    memcpy( pbuf, path->name, name_len );
-    return pbuf + name_len;
+    memcpy(buf, path->name, path->str_len);
 }
 
 /**
@@ -928,11 +1000,41 @@ static gchar* fm_path_to_str_int(FmPath* path, gchar** ret, gint str_len)
  */
 char* fm_path_to_str(FmPath* path)
 {
-    gchar *ret;
-    fm_path_to_str_int( path, &ret, 0 );
+    gchar *ret = g_malloc(path->str_len + 1);
+    fm_path_to_str_int(path, ret);
+    ret[path->str_len] = '\0';
     return ret;
 }
 
+/**
+ * fm_path_to_str_buf
+ * @path: a path
+ * @buf: (out caller-allocates) (allow-none): buffer to write string into
+ * @size: size of @buf in bytes
+ *
+ * Writes the same string as fm_path_to_str() returns into @buf without
+ * any memory allocation. If @buf is too small to contain the string
+ * with terminating nul then @buf is set to empty string (if @size isn't
+ * 0). The @buf may be %NULL if @size is 0, that may be used to get the
+ * length of string.
+ *
+ * Returns: length of string representation of @path, not including
+ * terminating nul.
+ *
+ * Since: 1.2.0
+ */
+gsize fm_path_to_str_buf(FmPath* path, char* buf, gsize size)
+{
+    if(G_LIKELY(size > path->str_len))
+    {
+        fm_path_to_str_int(path, buf);
+        buf[path->str_len] = '\0';
+    }
+    else if(size > 0)
+        buf[0] = '\0';
+    return path->str_len;
+}
+
 /**
  * fm_path_to_uri
  * @path: a path
@@ -1054,19 +1156,19 @@ char* fm_path_display_basename(FmPath* path)
 {
     if(G_UNLIKELY(!path->parent)) /* root_path element */
         return g_strdup(path->name);
-    G_LOCK(roots);
+    PATH_LOCK(path->parent);
     if (G_LIKELY(path->disp_name == BASENAME_AS_DISP_NAME))
     {
-        G_UNLOCK(roots);
+        PATH_UNLOCK(path->parent);
         return g_strdup(path->name);
     }
     if (path->disp_name)
     {
         char *name = g_strdup(path->disp_name);
-        G_UNLOCK(roots);
+        PATH_UNLOCK(path->parent);
         return name;
     }
-    G_UNLOCK(roots);
+    PATH_UNLOCK(path->parent);
     if(!fm_path_is_native(path))
         return g_uri_unescape_string(path->name, NULL);
     return g_filename_display_name(path->name);
@@ -1085,13 +1187,13 @@ void _fm_path_set_display_name(FmPath *path, const char *disp_name)
         g_free(_name);
         return;
     }
-    G_LOCK(roots);
+    PATH_LOCK(path->parent);
     if (path->disp_name != BASENAME_AS_DISP_NAME)
     {
         /* check if it is set already */
         if (g_strcmp0(disp_name, path->disp_name) == 0)
         {
-            G_UNLOCK(roots);
+            PATH_UNLOCK(path->parent);
             return;
         }
         g_free(path->disp_name);
@@ -1105,28 +1207,38 @@ void _fm_path_set_display_name(FmPath *path, const char *disp_name)
         path->disp_name = BASENAME_AS_DISP_NAME;
     else
         path->disp_name = g_strdup(disp_name);
-    G_UNLOCK(roots);
+    PATH_UNLOCK(path->parent);
 }
 
-/* use this to avoid change from another thread */
-static char *_display_name_static_keeper = NULL;
+/* use this to avoid change from another thread, one string per thread */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+static GPrivate _display_name_keeper = G_PRIVATE_INIT(g_free);
+#else
+static GPrivate *_display_name_keeper = NULL;
+#endif
 
-/* this API is not thread capable! */
+/* returned string is valid until next call in the same thread */
 const char *_fm_path_get_display_name(FmPath *path)
 {
-    G_LOCK(roots);
+    char *disp_name;
+
+    PATH_LOCK(path->parent);
     if (path->disp_name == BASENAME_AS_DISP_NAME)
     {
-        G_UNLOCK(roots);
+        PATH_UNLOCK(path->parent);
         return path->name;
     }
-    g_free(_display_name_static_keeper);
     /* use this to keep disp_name after returning from lock because another
-       thread may change it at that time, although _display_name_static_keeper
-       isn't protected by lock so should be protected by general glib lock */
-    _display_name_static_keeper = g_strdup(path->disp_name);
-    G_UNLOCK(roots);
-    return _display_name_static_keeper;
+       thread may change it at that time */
+    disp_name = g_strdup(path->disp_name);
+    PATH_UNLOCK(path->parent);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_private_replace(&_display_name_keeper, disp_name);
+#else
+    g_free(g_private_get(_display_name_keeper));
+    g_private_set(_display_name_keeper, disp_name);
+#endif
+    return disp_name;
 }
 
 /**
@@ -1142,13 +1254,19 @@ const char *_fm_path_get_display_name(FmPath *path)
 GFile* fm_path_to_gfile(FmPath* path)
 {
     GFile* gf;
+    char buf[PATH_MAX];
     char* str;
-    str = fm_path_to_str(path);
+
+    if(fm_path_to_str_buf(path, buf, sizeof(buf)) < sizeof(buf))
+        str = buf;
+    else
+        str = fm_path_to_str(path);
     if(fm_path_is_native(path))
         gf = g_file_new_for_path(str);
     else
         gf = fm_file_new_for_uri(str);
-    g_free(str);
+    if(str != buf)
+        g_free(str);
     return gf;
 }
 
@@ -1231,6 +1349,13 @@ void _fm_path_init()
 {
     const char* sep, *name;
     FmPath* tmp, *parent;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    int i;
+
+    for(i = 0; i < PATH_LOCK_SHARDS; i++)
+        path_locks[i] = g_mutex_new();
+    _display_name_keeper = g_private_new(g_free);
+#endif
 
     /* path object of root_path dir */
     root_path = _fm_path_new_internal(NULL, "/", 1, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
@@ -1321,15 +1446,7 @@ void _fm_path_finalize(void)
 /* FIXME: is this good enough? */
 guint fm_path_hash(FmPath* path)
 {
-    guint hash = g_str_hash(path->name);
-    if(path->parent)
-    {
-        /* this is learned from g_str_hash() of glib. */
-        hash = (hash << 5) - hash + '/';
-        /* this is learned from g_icon_hash() of gio. */
-        hash ^= fm_path_hash(path->parent);
-    }
-    return hash;
+    return path->hash;
 }
 
 /**
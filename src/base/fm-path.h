@@ -110,6 +110,7 @@ FmPath* fm_path_get_scheme_path(FmPath* path);
 #endif
 
 char* fm_path_to_str(FmPath* path);
+gsize fm_path_to_str_buf(FmPath* path, char* buf, gsize size);
 char* fm_path_to_uri(FmPath* path);
 GFile* fm_path_to_gfile(FmPath* path);
 
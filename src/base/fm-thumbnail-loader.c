@@ -42,13 +42,20 @@
 
 #include "fm-config.h"
 #include "fm-utils.h"
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <signal.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #ifdef USE_EXIF
 #include <libexif/exif-loader.h>
 #endif
@@ -82,7 +89,12 @@ struct _ThumbnailTask
     char* uri;              /* used internally */
     char* normal_path;      /* used internally */
     char* large_path;       /* used internally */
+    char* md5;              /* used internally: MD5 of URI */
+    char* dir_md5;          /* used internally: MD5 of folder URI */
     GList* requests;        /* access should be locked */
+    GQueue* queue;          /* queue containing the task, access should be locked */
+    GList* link;            /* link of the task in the queue */
+    gboolean high_priority; /* access should be locked */
 };
 /* cancelled above raised when all requests are cancelled and never dropped again */
 
@@ -99,13 +111,6 @@ struct _FmThumbnailLoader
     gboolean done : 1; /* it has pix set so will be pushed into ready queue */
 };
 
-typedef struct _ThumbnailCacheItem ThumbnailCacheItem;
-struct _ThumbnailCacheItem
-{
-    guint size;
-    GObject* pix; /* no reference on it */
-};
-
 typedef struct _ThumbnailCache ThumbnailCache;
 struct _ThumbnailCache
 {
@@ -113,7 +118,16 @@ struct _ThumbnailCache
     GSList* items;
 };
 
-/* FIXME: use thread pool */
+typedef struct _ThumbnailCacheItem ThumbnailCacheItem;
+struct _ThumbnailCacheItem
+{
+    guint size;
+    GObject* pix; /* no reference on it */
+    ThumbnailCache* cache; /* the cache which contains this item */
+    GList* lru_link; /* link in lru_queue or warm_queue, it holds reference on pix then */
+    gsize bytes; /* estimated memory used by pix */
+    gboolean warm; /* lru_link is in warm_queue */
+};
 
 /* Lock for loader, generator, and ready queues */
 #if GLIB_CHECK_VERSION(2, 32, 0)
@@ -128,9 +142,18 @@ static GCond *queue_cond;
 #define cond_ptr queue_cond
 #endif
 
-/* load generated thumbnails */
-static GQueue loader_queue = G_QUEUE_INIT; /* consists of ThumbnailTask */
-static gboolean loader_thread_running = FALSE;
+/* Each task is processed in two stages: first thumbnails are loaded
+   from disk, then missing ones are generated. Each stage has its own
+   thread pool so loading of cached thumbnails is never blocked behind a
+   slow thumbnailer. Tasks wait in two queues per stage: [0] for normal
+   and [1] for high priority. Thread pools get just a token for each task
+   and the thread takes the most urgent task from the queues itself. */
+static GQueue loader_queue[2] = { G_QUEUE_INIT, G_QUEUE_INIT }; /* consists of ThumbnailTask */
+static GQueue generator_queue[2] = { G_QUEUE_INIT, G_QUEUE_INIT };
+static GQueue running_queue = G_QUEUE_INIT; /* tasks processed by threads */
+static GThreadPool* loader_pool = NULL;
+static GThreadPool* generator_pool = NULL;
+static gint n_threads = 0;
 
 /* already loaded thumbnails */
 static GQueue ready_queue = G_QUEUE_INIT; /* consists of FmThumbnailLoader */
@@ -140,11 +163,87 @@ static guint ready_idle_handler = 0;
 /* cached thumbnails, elements are ThumbnailCache* */
 static GHashTable* hash = NULL;
 
+/* Cached thumbnails are kept alive by the hash only while anyone else
+   holds them. To avoid reloading the thumbnails on return to the folder,
+   recently used ones are held in lru_queue until their total size exceeds
+   fm_config->thumbnail_cache_size. Thumbnails in few folders which were
+   requested last are kept in warm_queue and evicted only when lru_queue
+   is empty, so eviction always takes the tail of some queue. */
+static GQueue lru_queue = G_QUEUE_INIT; /* consists of ThumbnailCacheItem */
+static GQueue warm_queue = G_QUEUE_INIT; /* consists of ThumbnailCacheItem */
+static gsize lru_bytes = 0;
+static GQueue warm_folders = G_QUEUE_INIT; /* consists of FmPath */
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+static guint cache_evictions = 0;
+
 static char* thumb_dir = NULL;
 
-static guint thumbnailer_timeout_id = 0;
+/* Folders with many images get also pack files, one per folder and size,
+   so next time their thumbnails are loaded without opening thousands of
+   files and checking their tEXt chunks. The pack contains a header, an
+   index sorted by MD5 of file URI, and data which are the same PNG images
+   which are saved in freedesktop.org thumbnails directory. Packs are never
+   modified in place but only replaced so they can be mapped safely.
+   Packs are written by a single background thread which waits while there
+   are thumbnails to load, and which removes least recently used packs when
+   all of them take more than PACKS_MAX_TOTAL. */
+#define PACK_MAGIC          "LFMTPK1"
+#define PACK_FLUSH_COUNT    64 /* new thumbnails in folder to rewrite its pack */
+#define PACK_MAX_SIZE       (32 << 20)
+#define PACK_MAX_OPEN       16
+#define PACKS_MAX_TOTAL     (256 << 20)
+#define PACK_PRUNE_WRITES   32 /* check total size after that many writes */
+#define PACK_IDLE_WAIT      100000 /* us */
+
+typedef struct
+{
+    char magic[8];
+    guint32 n_entries;
+    guint32 reserved;
+} ThumbnailPackHeader;
+
+typedef struct
+{
+    char md5[32]; /* not NUL-terminated */
+    gint64 mtime;
+    guint32 offset;
+    guint32 length;
+} ThumbnailPackEntry;
+
+typedef struct
+{
+    char* key; /* "<md5 of folder URI>-<normal|large>" */
+    char* map;
+    gsize len;
+    const ThumbnailPackEntry* entries;
+    guint n_entries;
+    int n_ref;
+} ThumbnailPack;
+
+typedef struct
+{
+    char md5[33];
+    time_t mtime;
+    char* path;
+} ThumbnailPackItem;
 
-static gpointer load_thumbnail_thread(gpointer user_data);
+typedef struct
+{
+    char* key;
+    GPtrArray* items; /* NULL to only prune old packs */
+} ThumbnailPackJob;
+
+G_LOCK_DEFINE_STATIC(packs);
+static GQueue open_packs = G_QUEUE_INIT; /* ThumbnailPack, recently used first */
+static GHashTable* pending_packs = NULL; /* key -> GPtrArray of ThumbnailPackItem */
+static char* packs_dir = NULL;
+static GThreadPool* pack_pool = NULL; /* single thread writing packs */
+static volatile gint packs_quit = 0;
+static guint n_pack_writes = 0; /* accessed by pack_pool thread only */
+
+static void load_thumbnail_thread(gpointer unused, gpointer unused2);
+static void generate_thumbnail_thread(gpointer unused, gpointer unused2);
 static void load_thumbnails(ThumbnailTask* task);
 static void generate_thumbnails(ThumbnailTask* task);
 static gboolean generate_thumbnails_with_builtin(ThumbnailTask* task);
@@ -182,6 +281,65 @@ static gboolean on_ready_idle(gpointer user_data)
     return FALSE;
 }
 
+/* should be called with queue lock held */
+/* may be called in thread */
+static void thumbnail_task_enqueue(GQueue* stage, ThumbnailTask* task, gboolean first)
+{
+    GQueue* queue = &stage[task->high_priority ? 1 : 0];
+
+    if(first)
+    {
+        g_queue_push_head(queue, task);
+        task->link = queue->head;
+    }
+    else
+    {
+        g_queue_push_tail(queue, task);
+        task->link = queue->tail;
+    }
+    task->queue = queue;
+}
+
+/* should be called with queue lock held */
+/* may be called in thread */
+static void thumbnail_task_unqueue(ThumbnailTask* task)
+{
+    if(task->queue)
+        g_queue_delete_link(task->queue, task->link);
+    task->queue = NULL;
+    task->link = NULL;
+}
+
+/* should be called with queue lock held */
+/* in thread */
+/* takes the most urgent task from stage and marks it running */
+static ThumbnailTask* thumbnail_task_dequeue(GQueue* stage)
+{
+    ThumbnailTask* task = g_queue_peek_head(&stage[1]);
+
+    if(!task)
+        task = g_queue_peek_head(&stage[0]);
+    if(task)
+    {
+        thumbnail_task_unqueue(task);
+        g_queue_push_tail(&running_queue, task);
+        task->queue = &running_queue;
+        task->link = running_queue.tail;
+    }
+    return task;
+}
+
+/* should be called with queue lock held */
+static gboolean thumbnail_task_is_cancelled(ThumbnailTask* task)
+{
+    GList *l;
+
+    for(l = task->requests; l; l = l->next)
+        if(!((FmThumbnailLoader*)l->data)->cancelled)
+            return FALSE;
+    return TRUE;
+}
+
 /* should be called with queue lock held */
 /* may be called in thread */
 /* moves all requests into ready_queue */
@@ -189,6 +347,7 @@ inline static void thumbnail_task_free(ThumbnailTask* task)
 {
     GList *l;
 
+    thumbnail_task_unqueue(task);
     for(l = task->requests; l; l = l->next)
     {
         FmThumbnailLoader* req = (FmThumbnailLoader*)l->data;
@@ -203,6 +362,11 @@ inline static void thumbnail_task_free(ThumbnailTask* task)
     fm_file_info_unref(task->fi);
     if (task->cancellable)
         g_object_unref(task->cancellable);
+    g_free(task->uri);
+    g_free(task->normal_path);
+    g_free(task->large_path);
+    g_free(task->md5);
+    g_free(task->dir_md5);
     g_slice_free(ThumbnailTask, task);
 }
 
@@ -240,6 +404,113 @@ static void on_pixbuf_destroy(gpointer data, GObject* obj_ptr)
     g_mutex_unlock(lock_ptr);
 }
 
+static gboolean thumbnail_cache_is_warm(FmPath* folder);
+
+/* should be called with queue lock held */
+/* may be called in thread */
+/* marks item as recently used and holds its pix in lru_queue or warm_queue */
+static void thumbnail_cache_touch(ThumbnailCacheItem* item)
+{
+    gboolean warm = thumbnail_cache_is_warm(fm_path_get_parent(item->cache->path));
+    GQueue* queue = warm ? &warm_queue : &lru_queue;
+
+    if(item->lru_link)
+    {
+        g_queue_unlink(item->warm ? &warm_queue : &lru_queue, item->lru_link);
+        g_queue_push_head_link(queue, item->lru_link);
+    }
+    else
+    {
+        g_object_ref(item->pix);
+        g_queue_push_head(queue, item);
+        item->lru_link = queue->head;
+        lru_bytes += item->bytes;
+    }
+    item->warm = warm;
+}
+
+/* should be called with queue lock held */
+static gboolean thumbnail_cache_is_warm(FmPath* folder)
+{
+    GList* l;
+
+    if(folder == NULL)
+        return FALSE;
+    for(l = warm_folders.head; l; l = l->next)
+        if(fm_path_equal(l->data, folder))
+            return TRUE;
+    return FALSE;
+}
+
+/* should be called with queue lock held */
+/* in main loop */
+static void thumbnail_cache_use_folder(FmPath* folder)
+{
+    gint n = fm_config->thumbnail_cache_folders;
+    GList* l;
+
+    if(folder == NULL)
+        return;
+    for(l = warm_folders.head; l; l = l->next)
+        if(fm_path_equal(l->data, folder))
+            break;
+    if(l) /* move it to the head */
+    {
+        g_queue_unlink(&warm_folders, l);
+        g_queue_push_head_link(&warm_folders, l);
+    }
+    else
+        g_queue_push_head(&warm_folders, fm_path_ref(folder));
+    while((gint)warm_folders.length > MAX(n, 0))
+    {
+        FmPath* old = g_queue_pop_tail(&warm_folders);
+        GList* next;
+        /* thumbnails of the folder aren't kept longer than others anymore,
+           this happens only on change of folder so it may take a while */
+        for(l = warm_queue.tail; l; l = next)
+        {
+            ThumbnailCacheItem* item = l->data;
+            next = l->prev;
+            if(fm_path_equal(fm_path_get_parent(item->cache->path), old))
+            {
+                g_queue_unlink(&warm_queue, l);
+                g_queue_push_head_link(&lru_queue, l);
+                item->warm = FALSE;
+            }
+        }
+        fm_path_unref(old);
+    }
+}
+
+/* should be called with queue lock held */
+/* may be called in thread */
+/* returns list of pixbufs which should be unreferenced after the lock
+   is released since that may call on_pixbuf_destroy() */
+static GSList* thumbnail_cache_trim(void)
+{
+    gsize budget = (gsize)MAX(fm_config->thumbnail_cache_size, 0) << 10;
+    GSList* to_unref = NULL;
+
+    while(lru_bytes > budget)
+    {
+        ThumbnailCacheItem* item;
+
+        /* only warm folders left so evict them as well */
+        if(lru_queue.length > 0)
+            item = g_queue_pop_tail(&lru_queue);
+        else if(warm_queue.length > 0)
+            item = g_queue_pop_tail(&warm_queue);
+        else
+            break;
+        item->lru_link = NULL;
+        item->warm = FALSE;
+        lru_bytes -= item->bytes;
+        to_unref = g_slist_prepend(to_unref, item->pix);
+        cache_evictions++;
+    }
+    return to_unref;
+}
+
 /* called with queue lock held */
 /* in thread */
 inline static void cache_thumbnail_in_hash(FmPath* path, GObject* pix, guint size)
@@ -268,9 +539,15 @@ inline static void cache_thumbnail_in_hash(FmPath* path, GObject* pix, guint siz
         item = g_slice_new(ThumbnailCacheItem);
         item->size = size;
         item->pix = pix;
+        item->cache = cache;
+        item->lru_link = NULL;
+        item->warm = FALSE;
+        /* assume it's RGBA image */
+        item->bytes = (gsize)backend.get_image_width(pix) * backend.get_image_height(pix) * 4;
         cache->items = g_slist_prepend(cache->items, item);
         g_object_weak_ref(G_OBJECT(pix), on_pixbuf_destroy, cache);
     }
+    thumbnail_cache_touch(item);
 }
 
 /* in thread */
@@ -279,6 +556,7 @@ static void thumbnail_task_finish(ThumbnailTask* task, GObject* normal_pix, GObj
     GObject* cached_pix = NULL;
     gint cached_size = 0;
     GList* l;
+    GSList* to_unref;
 
     /* sort the requests by requested size to utilize cached scaled pixbuf */
     g_mutex_lock(lock_ptr);
@@ -330,7 +608,9 @@ static void thumbnail_task_finish(ThumbnailTask* task, GObject* normal_pix, GObj
 push_it:
         req->done = TRUE;
     }
+    to_unref = thumbnail_cache_trim();
     g_mutex_unlock(lock_ptr);
+    g_slist_free_full(to_unref, g_object_unref);
     if(cached_pix)
         g_object_unref(cached_pix);
 }
@@ -368,6 +648,461 @@ static gboolean is_thumbnail_outdated(GObject* thumb_pix, const char* thumbnail_
     return outdated;
 }
 
+/* may be called in thread */
+static void thumbnail_pack_unref(ThumbnailPack* pack)
+{
+    G_LOCK(packs);
+    if(--pack->n_ref > 0)
+    {
+        G_UNLOCK(packs);
+        return;
+    }
+    G_UNLOCK(packs);
+    if(pack->map)
+#ifdef HAVE_MMAP
+        munmap(pack->map, pack->len);
+#else
+        g_free(pack->map);
+#endif
+    g_free(pack->key);
+    g_slice_free(ThumbnailPack, pack);
+}
+
+/* in thread */
+/* returns pack with no data if it does not exist or is invalid */
+static ThumbnailPack* thumbnail_pack_open(const char* key)
+{
+    ThumbnailPack* pack = g_slice_new0(ThumbnailPack);
+    const ThumbnailPackHeader* hdr;
+    char* path = g_strconcat(packs_dir, "/", key, ".pack", NULL);
+
+    pack->key = g_strdup(key);
+    pack->n_ref = 1;
+#ifdef HAVE_MMAP
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+
+        if(fd >= 0)
+        {
+            if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ThumbnailPackHeader))
+            {
+                pack->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(pack->map == MAP_FAILED)
+                    pack->map = NULL;
+                else
+                    pack->len = st.st_size;
+            }
+            close(fd);
+        }
+    }
+#else
+    if(!g_file_get_contents(path, &pack->map, &pack->len, NULL))
+        pack->map = NULL;
+#endif
+    g_free(path);
+    if(!pack->map)
+        return pack;
+    hdr = (const ThumbnailPackHeader*)pack->map;
+    if(pack->len < sizeof(ThumbnailPackHeader) ||
+       memcmp(hdr->magic, PACK_MAGIC, sizeof(hdr->magic)) != 0 ||
+       hdr->n_entries > (pack->len - sizeof(ThumbnailPackHeader)) / sizeof(ThumbnailPackEntry))
+    {
+#ifdef HAVE_MMAP
+        munmap(pack->map, pack->len);
+#else
+        g_free(pack->map);
+#endif
+        pack->map = NULL;
+        pack->len = 0;
+        return pack;
+    }
+    pack->entries = (const ThumbnailPackEntry*)(pack->map + sizeof(ThumbnailPackHeader));
+    pack->n_entries = hdr->n_entries;
+    return pack;
+}
+
+/* in thread */
+static ThumbnailPack* thumbnail_pack_get(const char* key)
+{
+    ThumbnailPack* pack;
+    GList* l;
+
+    G_LOCK(packs);
+    for(l = open_packs.head; l; l = l->next)
+        if(strcmp(((ThumbnailPack*)l->data)->key, key) == 0)
+            break;
+    if(l)
+    {
+        g_queue_unlink(&open_packs, l);
+        g_queue_push_head_link(&open_packs, l);
+        pack = l->data;
+        pack->n_ref++;
+        G_UNLOCK(packs);
+        return pack;
+    }
+    G_UNLOCK(packs);
+    /* do I/O without lock, another thread might open it meanwhile but
+       that does not matter much */
+    pack = thumbnail_pack_open(key);
+    G_LOCK(packs);
+    g_queue_push_head(&open_packs, pack);
+    pack->n_ref++; /* for the queue */
+    l = NULL;
+    if(open_packs.length > PACK_MAX_OPEN)
+        l = g_queue_pop_tail_link(&open_packs);
+    G_UNLOCK(packs);
+    if(l)
+    {
+        thumbnail_pack_unref(l->data);
+        g_list_free_1(l);
+    }
+    return pack;
+}
+
+/* in thread */
+/* drops opened pack so it will be opened again on next access */
+static void thumbnail_pack_forget(const char* key)
+{
+    ThumbnailPack* pack = NULL;
+    GList* l;
+
+    G_LOCK(packs);
+    for(l = open_packs.head; l; l = l->next)
+        if(strcmp(((ThumbnailPack*)l->data)->key, key) == 0)
+            break;
+    if(l)
+    {
+        pack = l->data;
+        g_queue_delete_link(&open_packs, l);
+    }
+    G_UNLOCK(packs);
+    if(pack)
+        thumbnail_pack_unref(pack);
+}
+
+static int thumbnail_pack_compare(const void* a, const void* b)
+{
+    return memcmp(((const ThumbnailPackEntry*)a)->md5,
+                  ((const ThumbnailPackEntry*)b)->md5, 32);
+}
+
+static inline char* thumbnail_pack_key(ThumbnailTask* task, gboolean large)
+{
+    return g_strconcat(task->dir_md5, large ? "-large" : "-normal", NULL);
+}
+
+/* in thread */
+static GObject* thumbnail_pack_load(ThumbnailTask* task, gboolean large)
+{
+    ThumbnailPack* pack;
+    ThumbnailPackEntry key;
+    const ThumbnailPackEntry* e;
+    GObject* pix = NULL;
+    char* pack_key;
+
+    if(!fm_config->thumbnail_packs || !task->dir_md5)
+        return NULL;
+    pack_key = thumbnail_pack_key(task, large);
+    pack = thumbnail_pack_get(pack_key);
+    g_free(pack_key);
+    if(pack->n_entries > 0)
+    {
+        memcpy(key.md5, task->md5, 32);
+        e = bsearch(&key, pack->entries, pack->n_entries,
+                    sizeof(ThumbnailPackEntry), thumbnail_pack_compare);
+        if(e && e->mtime == fm_file_info_get_mtime(task->fi) &&
+           e->offset <= pack->len && e->length <= pack->len - e->offset)
+        {
+            GInputStream* stream;
+
+            stream = g_memory_input_stream_new_from_data(pack->map + e->offset,
+                                                         e->length, NULL);
+            pix = backend.read_image_from_stream(stream, e->length, task->cancellable);
+            g_object_unref(stream);
+            DEBUG("thumbnail loaded from pack: %p", pix);
+        }
+    }
+    thumbnail_pack_unref(pack);
+    return pix;
+}
+
+static void thumbnail_pack_items_free(gpointer data)
+{
+    GPtrArray* items = data;
+    guint i;
+
+    for(i = 0; i < items->len; i++)
+    {
+        ThumbnailPackItem* item = items->pdata[i];
+        g_free(item->path);
+        g_slice_free(ThumbnailPackItem, item);
+    }
+    g_ptr_array_free(items, TRUE);
+}
+
+/* in thread */
+/* rewrites the pack with new items added */
+static void thumbnail_pack_write(const char* key, GPtrArray* items)
+{
+    ThumbnailPack* pack = thumbnail_pack_get(key);
+    GArray* index = g_array_new(FALSE, FALSE, sizeof(ThumbnailPackEntry));
+    GString* data = g_string_new(NULL);
+    GHashTable* added = g_hash_table_new(g_str_hash, g_str_equal);
+    ThumbnailPackHeader hdr;
+    ThumbnailPackEntry entry;
+    GString* out;
+    char *path, md5[33];
+    guint i, offset;
+    int j;
+
+    /* new items first, the latest of them wins */
+    for(j = items->len - 1; j >= 0; j--)
+    {
+        ThumbnailPackItem* item = items->pdata[j];
+        char* contents;
+        gsize len;
+
+        if(g_hash_table_lookup(added, item->md5) ||
+           !g_file_get_contents(item->path, &contents, &len, NULL))
+            continue;
+        if(data->len + len <= PACK_MAX_SIZE)
+        {
+            memcpy(entry.md5, item->md5, 32);
+            entry.mtime = item->mtime;
+            entry.offset = data->len;
+            entry.length = len;
+            g_array_append_val(index, entry);
+            g_string_append_len(data, contents, len);
+            g_hash_table_insert(added, item->md5, item);
+        }
+        g_free(contents);
+    }
+    /* then old items which are still fit */
+    md5[32] = '\0';
+    for(i = 0; i < pack->n_entries; i++)
+    {
+        const ThumbnailPackEntry* e = &pack->entries[i];
+
+        memcpy(md5, e->md5, 32);
+        if(g_hash_table_lookup(added, md5) || e->offset > pack->len ||
+           e->length > pack->len - e->offset || data->len + e->length > PACK_MAX_SIZE)
+            continue;
+        entry = *e;
+        entry.offset = data->len;
+        g_array_append_val(index, entry);
+        g_string_append_len(data, pack->map + e->offset, e->length);
+    }
+    g_hash_table_destroy(added);
+    thumbnail_pack_unref(pack);
+
+    g_array_sort(index, thumbnail_pack_compare);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+    hdr.n_entries = index->len;
+    offset = sizeof(hdr) + index->len * sizeof(ThumbnailPackEntry);
+    for(i = 0; i < index->len; i++)
+        g_array_index(index, ThumbnailPackEntry, i).offset += offset;
+    out = g_string_sized_new(offset + data->len);
+    g_string_append_len(out, (const char*)&hdr, sizeof(hdr));
+    g_string_append_len(out, index->data, index->len * sizeof(ThumbnailPackEntry));
+    g_string_append_len(out, data->str, data->len);
+    g_string_free(data, TRUE);
+    g_array_free(index, TRUE);
+
+    /* g_file_set_contents() replaces the file atomically */
+    path = g_strconcat(packs_dir, "/", key, ".pack", NULL);
+    if(g_mkdir_with_parents(packs_dir, 0700) == 0)
+        g_file_set_contents(path, out->str, out->len, NULL);
+    g_free(path);
+    g_string_free(out, TRUE);
+    thumbnail_pack_forget(key);
+    DEBUG("thumbnail pack %s written", key);
+}
+
+typedef struct
+{
+    char* path;
+    char* key;
+    time_t used;
+    goffset size;
+} ThumbnailPackFile;
+
+static int thumbnail_pack_file_compare(const void* a, const void* b)
+{
+    const ThumbnailPackFile* fa = a;
+    const ThumbnailPackFile* fb = b;
+    return fa->used < fb->used ? -1 : (fa->used > fb->used ? 1 : 0);
+}
+
+/* in thread */
+/* removes least recently used packs until they fit into PACKS_MAX_TOTAL;
+   since packs only duplicate thumbnails nothing is lost but speed */
+static void thumbnail_packs_prune(void)
+{
+    GDir* dir = g_dir_open(packs_dir, 0, NULL);
+    GArray* files;
+    const char* name;
+    goffset total = 0;
+    guint i;
+
+    if(!dir)
+        return;
+    files = g_array_new(FALSE, FALSE, sizeof(ThumbnailPackFile));
+    while((name = g_dir_read_name(dir)))
+    {
+        ThumbnailPackFile file;
+        struct stat st;
+
+        if(!g_str_has_suffix(name, ".pack"))
+            continue;
+        file.path = g_build_filename(packs_dir, name, NULL);
+        if(stat(file.path, &st) < 0)
+        {
+            g_free(file.path);
+            continue;
+        }
+        file.key = g_strndup(name, strlen(name) - 5);
+        /* atime is updated at most daily with relatime, that's enough */
+        file.used = MAX(st.st_atime, st.st_mtime);
+        file.size = st.st_size;
+        total += file.size;
+        g_array_append_val(files, file);
+    }
+    g_dir_close(dir);
+    if(total > PACKS_MAX_TOTAL)
+    {
+        g_array_sort(files, thumbnail_pack_file_compare);
+        /* free a quarter more so it isn't done again on every write */
+        for(i = 0; i < files->len && total > PACKS_MAX_TOTAL / 4 * 3; i++)
+        {
+            ThumbnailPackFile* file = &g_array_index(files, ThumbnailPackFile, i);
+            if(g_unlink(file->path) == 0)
+            {
+                total -= file->size;
+                thumbnail_pack_forget(file->key);
+                DEBUG("thumbnail pack %s removed", file->key);
+            }
+        }
+    }
+    for(i = 0; i < files->len; i++)
+    {
+        g_free(g_array_index(files, ThumbnailPackFile, i).path);
+        g_free(g_array_index(files, ThumbnailPackFile, i).key);
+    }
+    g_array_free(files, TRUE);
+}
+
+/* in thread */
+static gboolean thumbnail_loader_is_busy(void)
+{
+    gboolean busy;
+
+    g_mutex_lock(lock_ptr);
+    busy = !g_queue_is_empty(&loader_queue[0]) || !g_queue_is_empty(&loader_queue[1]);
+    g_mutex_unlock(lock_ptr);
+    return busy;
+}
+
+/* in pack_pool thread */
+static void thumbnail_pack_thread(gpointer data, gpointer unused)
+{
+    ThumbnailPackJob* job = data;
+
+    /* packs are for the next visit so let visible thumbnails load first,
+       reading all those PNG files again would only slow them down */
+    while(!g_atomic_int_get(&packs_quit) && thumbnail_loader_is_busy())
+        g_usleep(PACK_IDLE_WAIT);
+    if(!g_atomic_int_get(&packs_quit))
+    {
+        if(job->items)
+            thumbnail_pack_write(job->key, job->items);
+        if(!job->items || ++n_pack_writes % PACK_PRUNE_WRITES == 0)
+            thumbnail_packs_prune();
+    }
+    /* thumbnails which were not added into pack will be added next time */
+    if(job->items)
+        thumbnail_pack_items_free(job->items);
+    g_free(job->key);
+    g_slice_free(ThumbnailPackJob, job);
+}
+
+/* called with lock on packs */
+/* passes items to the pack writer thread, takes ownership of them */
+static void thumbnail_pack_queue(const char* key, GPtrArray* items)
+{
+    ThumbnailPackJob* job;
+
+    if(g_atomic_int_get(&packs_quit))
+    {
+        thumbnail_pack_items_free(items);
+        return;
+    }
+    if(!pack_pool)
+    {
+        pack_pool = g_thread_pool_new(thumbnail_pack_thread, NULL, 1, FALSE, NULL);
+        /* clean up what was left by previous sessions first */
+        job = g_slice_new0(ThumbnailPackJob);
+        g_thread_pool_push(pack_pool, job, NULL);
+    }
+    job = g_slice_new(ThumbnailPackJob);
+    job->key = g_strdup(key);
+    job->items = items;
+    g_thread_pool_push(pack_pool, job, NULL);
+}
+
+/* in thread */
+/* remembers the thumbnail to add into the pack for its folder */
+static void thumbnail_pack_add(ThumbnailTask* task, gboolean large, const char* png_path)
+{
+    ThumbnailPackItem* item;
+    ThumbnailPack* pack;
+    GPtrArray* items;
+    gpointer orig_key;
+    guint n_pending, n_entries;
+    char* key;
+
+    if(!fm_config->thumbnail_packs || !task->dir_md5)
+        return;
+    key = thumbnail_pack_key(task, large);
+    item = g_slice_new(ThumbnailPackItem);
+    memcpy(item->md5, task->md5, 33);
+    item->mtime = fm_file_info_get_mtime(task->fi);
+    item->path = g_strdup(png_path);
+    G_LOCK(packs);
+    items = g_hash_table_lookup(pending_packs, key);
+    if(!items)
+    {
+        items = g_ptr_array_new();
+        g_hash_table_insert(pending_packs, g_strdup(key), items);
+    }
+    g_ptr_array_add(items, item);
+    n_pending = items->len;
+    G_UNLOCK(packs);
+    if(n_pending < PACK_FLUSH_COUNT)
+        goto _out;
+    /* rewrite the pack only when it grows by quarter at least, otherwise
+       big folders would cause rewriting big pack too often */
+    pack = thumbnail_pack_get(key);
+    n_entries = pack->n_entries;
+    thumbnail_pack_unref(pack);
+    if(n_pending < n_entries / 4)
+        goto _out;
+    G_LOCK(packs);
+    if(g_hash_table_lookup_extended(pending_packs, key, &orig_key, (gpointer*)&items))
+    {
+        g_hash_table_steal(pending_packs, key); /* it's ours now */
+        g_free(orig_key);
+    }
+    else /* another thread took it already */
+        items = NULL;
+    if(items)
+        thumbnail_pack_queue(key, items);
+    G_UNLOCK(packs);
+_out:
+    g_free(key);
+}
+
 /* in thread */
 static void load_thumbnails(ThumbnailTask* task)
 {
@@ -382,6 +1117,8 @@ static void load_thumbnails(ThumbnailTask* task)
     DEBUG("loading: %s, %s, %s", fm_file_info_get_name(task->fi), normal_path, large_path);
 
     if(task->flags & LOAD_NORMAL)
+        normal_pix = thumbnail_pack_load(task, FALSE);
+    if((task->flags & LOAD_NORMAL) && !normal_pix)
     {
         normal_pix = backend.read_image_from_file(normal_path);
         if(!normal_pix || is_thumbnail_outdated(normal_pix, normal_path, fm_file_info_get_mtime(task->fi)))
@@ -395,6 +1132,7 @@ static void load_thumbnails(ThumbnailTask* task)
         else
         {
             DEBUG("normal thumbnail loaded: %p", normal_pix);
+            thumbnail_pack_add(task, FALSE, normal_path);
         }
     }
 
@@ -402,6 +1140,8 @@ static void load_thumbnails(ThumbnailTask* task)
         goto _out;
 
     if(task->flags & LOAD_LARGE)
+        large_pix = thumbnail_pack_load(task, TRUE);
+    if((task->flags & LOAD_LARGE) && !large_pix)
     {
         large_pix = backend.read_image_from_file(large_path);
         if(!large_pix || is_thumbnail_outdated(large_pix, large_path, fm_file_info_get_mtime(task->fi)))
@@ -411,6 +1151,8 @@ static void load_thumbnails(ThumbnailTask* task)
             task->flags |= GENERATE_LARGE;
             large_pix = NULL;
         }
+        else
+            thumbnail_pack_add(task, TRUE, large_path);
     }
 
     /* thumbnails which don't require re-generation should all be loaded at this point. */
@@ -427,91 +1169,82 @@ _out:
 }
 
 /* in thread */
-static gpointer load_thumbnail_thread(gpointer user_data)
+static void load_thumbnail_thread(gpointer unused, gpointer unused2)
 {
     ThumbnailTask* task;
-    GChecksum* sum = g_checksum_new(G_CHECKSUM_MD5);
-    gchar* normal_path  = g_build_filename(thumb_dir, "normal/00000000000000000000000000000000.png", NULL);
-    gchar* normal_basename = strrchr(normal_path, '/') + 1;
-    gchar* large_path = g_build_filename(thumb_dir, "large/00000000000000000000000000000000.png", NULL);
-    gchar* large_basename = strrchr(large_path, '/') + 1;
+    FmPath* parent;
+    char* md5;
 
-    /* ensure thumbnail directories exists */
-    g_mkdir_with_parents(normal_path, 0700);
-    g_mkdir_with_parents(large_path, 0700);
-
-    for(;;)
+    g_mutex_lock(lock_ptr);
+    task = thumbnail_task_dequeue(loader_queue);
+    if(G_UNLIKELY(!task)) /* the task was cancelled and removed */
     {
-        g_mutex_lock(lock_ptr);
-        task = g_queue_pop_head(&loader_queue);
-        if(G_LIKELY(task))
-        {
-            char* uri;
-            const char* md5;
-            GList *reql;
-
-            for (reql = task->requests; reql; reql = reql->next)
-                if (!((FmThumbnailLoader*)reql->data)->cancelled)
-                    break;
-            if (reql == NULL) /* all requests were cancelled already */
-                goto _free_task;
-            if (!task->cancellable)
-                task->cancellable = g_cancellable_new();
-            g_mutex_unlock(lock_ptr);
-            uri = fm_path_to_uri(fm_file_info_get_path(task->fi));
-
-            /* generate filename for the thumbnail */
-            g_checksum_update(sum, (guchar*)uri, -1);
-            md5 = g_checksum_get_string(sum); /* md5 sum of the URI */
+        g_mutex_unlock(lock_ptr);
+        return;
+    }
+    if(thumbnail_task_is_cancelled(task)) /* all requests were cancelled already */
+    {
+        thumbnail_task_free(task);
+        g_mutex_unlock(lock_ptr);
+        return;
+    }
+    task->cancellable = g_cancellable_new();
+    g_mutex_unlock(lock_ptr);
 
-            task->uri = uri;
+    /* generate filename for the thumbnail */
+    task->uri = fm_path_to_uri(fm_file_info_get_path(task->fi));
+    md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, task->uri, -1); /* md5 sum of the URI */
+    if (task->flags & LOAD_NORMAL)
+        task->normal_path = g_strdup_printf("%s/normal/%s.png", thumb_dir, md5);
+    if (task->flags & LOAD_LARGE)
+        task->large_path = g_strdup_printf("%s/large/%s.png", thumb_dir, md5);
+    task->md5 = md5;
+    /* the pack for the folder */
+    parent = fm_path_get_parent(fm_file_info_get_path(task->fi));
+    if (parent)
+    {
+        char* dir_uri = fm_path_to_uri(parent);
+        task->dir_md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, dir_uri, -1);
+        g_free(dir_uri);
+    }
 
-            if (task->flags & LOAD_NORMAL)
-            {
-                memcpy( normal_basename, md5, 32 );
-                task->normal_path = normal_path;
-            }
-            if (task->flags & LOAD_LARGE)
-            {
-                memcpy( large_basename, md5, 32 );
-                task->large_path = large_path;
-            }
+    load_thumbnails(task);
 
-            if(task->flags & (GENERATE_NORMAL|GENERATE_LARGE))
-                generate_thumbnails(task); /* second cycle */
-            else
-                load_thumbnails(task); /* first cycle */
+    g_mutex_lock(lock_ptr);
+    if(g_cancellable_is_cancelled(task->cancellable) /* task is done */
+       || (task->flags & (GENERATE_NORMAL|GENERATE_LARGE)) == 0)
+        thumbnail_task_free(task);
+    else /* pass it to generator */
+    {
+        thumbnail_task_unqueue(task);
+        thumbnail_task_enqueue(generator_queue, task, FALSE);
+        g_thread_pool_push(generator_pool, GINT_TO_POINTER(1), NULL);
+    }
+    g_mutex_unlock(lock_ptr);
+}
 
-            g_checksum_reset(sum);
-            task->uri = NULL;
-            task->normal_path = NULL;
-            task->large_path = NULL;
-            g_free(uri);
+/* in thread */
+static void generate_thumbnail_thread(gpointer unused, gpointer unused2)
+{
+    ThumbnailTask* task;
 
-            g_mutex_lock(lock_ptr);
+    g_mutex_lock(lock_ptr);
+    task = thumbnail_task_dequeue(generator_queue);
+    if(G_UNLIKELY(!task))
+    {
+        g_mutex_unlock(lock_ptr);
+        return;
+    }
+    if(thumbnail_task_is_cancelled(task))
+        g_cancellable_cancel(task->cancellable);
+    g_mutex_unlock(lock_ptr);
 
-            if(g_cancellable_is_cancelled(task->cancellable) /* task is done */
-               || (task->flags & (GENERATE_NORMAL|GENERATE_LARGE)) == 0)
-_free_task:
-                thumbnail_task_free(task);
-            else
-                g_queue_push_tail(&loader_queue, task); /* return it to regen */
+    if(!g_cancellable_is_cancelled(task->cancellable))
+        generate_thumbnails(task);
 
-            g_mutex_unlock(lock_ptr);
-        }
-        else /* no task is left in the loader_queue */
-        {
-            loader_thread_running = FALSE;
-            g_mutex_unlock(lock_ptr);
-            g_free(normal_path);
-            g_free(large_path);
-            g_checksum_free(sum);
-#if GLIB_CHECK_VERSION(2, 32, 0)
-            g_thread_unref(g_thread_self());
-#endif
-            return NULL;
-        }
-    }
+    g_mutex_lock(lock_ptr);
+    thumbnail_task_free(task);
+    g_mutex_unlock(lock_ptr);
 }
 
 /* should be called with queue locked */
@@ -526,18 +1259,26 @@ inline static GObject* find_thumbnail_in_hash(FmPath* path, guint size)
         {
             ThumbnailCacheItem* item = (ThumbnailCacheItem*)l->data;
             if(item->size == size)
+            {
+                cache_hits++;
+                thumbnail_cache_touch(item);
                 return item->pix;
+            }
         }
     }
+    cache_misses++;
     return NULL;
 }
 
 /* should be called with queue locked */
 /* may be called in thread */
-static ThumbnailTask* find_queued_task(GQueue* queue, FmFileInfo* fi)
+static ThumbnailTask* find_queued_task(GQueue* stage, FmFileInfo* fi)
 {
     GList* l;
-    for( l = queue->head; l; l=l->next )
+    int i;
+
+    for(i = 0; i < 2; i++)
+    for( l = stage[i].head; l; l=l->next )
     {
         ThumbnailTask* task = (ThumbnailTask*)l->data;
         /* if it's processing then it's too late to add */
@@ -549,6 +1290,35 @@ static ThumbnailTask* find_queued_task(GQueue* queue, FmFileInfo* fi)
     return NULL;
 }
 
+/* in main loop */
+static void update_thread_pools(void)
+{
+    gint n = fm_config->thumbnail_threads;
+
+    if(n <= 0)
+        n = FM_CONFIG_DEFAULT_THUMBNAIL_THREADS;
+    if(G_UNLIKELY(loader_pool == NULL))
+    {
+        char* dir;
+
+        /* ensure thumbnail directories exists */
+        dir = g_build_filename(thumb_dir, "normal", NULL);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+        dir = g_build_filename(thumb_dir, "large", NULL);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+        loader_pool = g_thread_pool_new(load_thumbnail_thread, NULL, n, FALSE, NULL);
+        generator_pool = g_thread_pool_new(generate_thumbnail_thread, NULL, n, FALSE, NULL);
+    }
+    else if(n != n_threads)
+    {
+        g_thread_pool_set_max_threads(loader_pool, n, NULL);
+        g_thread_pool_set_max_threads(generator_pool, n, NULL);
+    }
+    n_threads = n;
+}
+
 /**
  * fm_thumbnail_loader_load
  * @src_file: an image file
@@ -575,7 +1345,6 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
     ThumbnailTask* task;
     GObject* pix;
     FmPath* src_path = fm_file_info_get_path(src_file);
-    gboolean thread_running;
 
     g_return_val_if_fail(hash != NULL, NULL);
     g_assert(callback != NULL);
@@ -593,28 +1362,35 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
 
     g_mutex_lock(lock_ptr);
 
+    thumbnail_cache_use_folder(fm_path_get_parent(src_path));
     /* find in the cache first to see if thumbnail is already cached */
     pix = find_thumbnail_in_hash(src_path, size);
     if(pix)
     {
+        GSList* to_unref;
+
         DEBUG("cache found!");
         req->pix = (GObject*)g_object_ref(pix);
         /* call the ready callback in main loader_thread_id from idle handler. */
         g_queue_push_tail(&ready_queue, req);
         if( 0 == ready_idle_handler ) /* schedule an idle handler if there isn't one. */
             ready_idle_handler = g_idle_add_full(G_PRIORITY_LOW, on_ready_idle, NULL, NULL);
+        to_unref = thumbnail_cache_trim();
         g_mutex_unlock(lock_ptr);
+        g_slist_free_full(to_unref, g_object_unref);
         return req;
     }
 
     /* if it's not cached, add it to the loader_queue for loading. */
-    task = find_queued_task(&loader_queue, src_file);
+    task = find_queued_task(loader_queue, src_file);
 
     if(!task)
     {
         task = g_slice_new0(ThumbnailTask);
         task->fi = fm_file_info_ref(src_file);
-        g_queue_push_tail(&loader_queue, task);
+        thumbnail_task_enqueue(loader_queue, task, FALSE);
+        update_thread_pools();
+        g_thread_pool_push(loader_pool, GINT_TO_POINTER(1), NULL);
     }
     else
     {
@@ -628,24 +1404,43 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
         task->flags |= LOAD_NORMAL;
 
     task->requests = g_list_append(task->requests, req);
-
-    thread_running = loader_thread_running;
-    loader_thread_running = TRUE;
     g_mutex_unlock(lock_ptr);
 
-    if(!thread_running)
-#if GLIB_CHECK_VERSION(2, 32, 0)
-        g_thread_new("loader", load_thumbnail_thread, NULL);
-        /* we don't use loader_thread_id but Glib 2.32 crashes if we unref
-           GThread while it's in creation progress. It is a bug of GLib
-           certainly but as workaround we'll unref it in the thread itself */
-#else
-        g_thread_create( load_thumbnail_thread, NULL, FALSE, NULL);
-#endif
-
     return req;
 }
 
+/**
+ * fm_thumbnail_loader_raise_priority
+ * @req: the request descriptor
+ *
+ * Moves the request ahead of all other requests which wait for loading
+ * or generation. Requests which have raised priority most recently will
+ * be processed first. This is intended to be used for files which are
+ * visible to the user now, so thumbnails for them will be shown first
+ * even if a lot of other thumbnails were requested before.
+ *
+ * Since: 1.2.0
+ */
+/* in main loop */
+void fm_thumbnail_loader_raise_priority(FmThumbnailLoader* req)
+{
+    ThumbnailTask* task;
+
+    g_return_if_fail(req != NULL);
+
+    g_mutex_lock(lock_ptr);
+    task = req->task;
+    if(task && task->queue && task->queue != &running_queue)
+    {
+        GQueue* stage = (task->queue == &loader_queue[0] ||
+                         task->queue == &loader_queue[1]) ? loader_queue : generator_queue;
+        thumbnail_task_unqueue(task);
+        task->high_priority = TRUE;
+        thumbnail_task_enqueue(stage, task, TRUE);
+    }
+    g_mutex_unlock(lock_ptr);
+}
+
 /**
  * fm_thumbnail_loader_cancel
  * @req: the request descriptor
@@ -659,25 +1454,26 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
 /* in main loop */
 void fm_thumbnail_loader_cancel(FmThumbnailLoader* req)
 {
-    GList* l;
+    ThumbnailTask* task;
 
     g_return_if_fail(req != NULL);
 
     g_mutex_lock(lock_ptr);
     req->cancelled = TRUE;
+    task = req->task;
 
-    if(req->task == NULL)
+    if(task == NULL || !thumbnail_task_is_cancelled(task))
         goto done;
 
-    for(l = req->task->requests; l; l = l->next)
+    if(task->queue != &running_queue)
     {
-        req = (FmThumbnailLoader*)l->data;
-        if(!req->cancelled)
-            break;
+        /* nobody works on it yet so just drop it */
+        thumbnail_task_free(task);
+        DEBUG("dropping the task");
     }
-    if(l == NULL && req->task->cancellable != NULL)
+    else if(task->cancellable != NULL)
     {
-        g_cancellable_cancel(req->task->cancellable);
+        g_cancellable_cancel(task->cancellable);
         DEBUG("cancelling the task");
     }
 
@@ -736,11 +1532,49 @@ guint fm_thumbnail_loader_get_size(FmThumbnailLoader* req)
     return req->size;
 }
 
+/**
+ * fm_thumbnail_loader_get_cache_stats
+ * @hits: (out) (allow-none): location to store number of cache hits
+ * @misses: (out) (allow-none): location to store number of cache misses
+ * @evictions: (out) (allow-none): location to store number of evictions
+ * @bytes: (out) (allow-none): location to store memory used by cache
+ *
+ * Retrieves statistics of in-memory cache of loaded thumbnails. Size of
+ * the cache is limited by #FmConfig:thumbnail_cache_size and thumbnails
+ * in last #FmConfig:thumbnail_cache_folders folders are evicted last.
+ *
+ * Returns: ratio of cache hits to all requests, in range from 0 to 1.
+ *
+ * Since: 1.2.0
+ */
+gdouble fm_thumbnail_loader_get_cache_stats(guint* hits, guint* misses,
+                                            guint* evictions, gsize* bytes)
+{
+    gdouble rate;
+
+    g_mutex_lock(lock_ptr);
+    if(hits)
+        *hits = cache_hits;
+    if(misses)
+        *misses = cache_misses;
+    if(evictions)
+        *evictions = cache_evictions;
+    if(bytes)
+        *bytes = lru_bytes;
+    rate = (cache_hits + cache_misses) ? (gdouble)cache_hits / (cache_hits + cache_misses) : 0.0;
+    g_mutex_unlock(lock_ptr);
+    return rate;
+}
+
 /* in main loop */
 void _fm_thumbnail_loader_init()
 {
     thumb_dir = g_build_filename(fm_get_home_dir(), ".thumbnails", NULL);
     hash = g_hash_table_new((GHashFunc)fm_path_hash, (GEqualFunc)fm_path_equal);
+    packs_dir = g_build_filename(g_get_user_cache_dir(), "libfm", "thumbnail-packs", NULL);
+    g_atomic_int_set(&packs_quit, 0);
+    pending_packs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          thumbnail_pack_items_free);
 #if !GLIB_CHECK_VERSION(2, 32, 0)
     lock_ptr = g_mutex_new();
     cond_ptr = g_cond_new();
@@ -750,6 +1584,7 @@ void _fm_thumbnail_loader_init()
 static gboolean fm_thumbnail_loader_cleanup(gpointer unused)
 {
     FmThumbnailLoader* req;
+    ThumbnailPack* pack;
 
     /* loader_queue is empty and cur_loading is finished */
     while((req = g_queue_pop_head(&ready_queue)))
@@ -758,18 +1593,31 @@ static gboolean fm_thumbnail_loader_cleanup(gpointer unused)
     hash = NULL;
     g_free(thumb_dir);
     thumb_dir = NULL;
+    /* thumbnails which were not added into packs will be added next time */
+    g_hash_table_destroy(pending_packs);
+    pending_packs = NULL;
+    while((pack = g_queue_pop_head(&open_packs)))
+        thumbnail_pack_unref(pack);
+    g_free(packs_dir);
+    packs_dir = NULL;
     return FALSE;
 }
 
 /* in main loop */
 void _fm_thumbnail_loader_finalize(void)
 {
+    GQueue* queues[] = { &loader_queue[0], &loader_queue[1], &generator_queue[0],
+                         &generator_queue[1], &running_queue };
     ThumbnailTask* task;
     GList *qlist, *rlist;
+    GSList* pixbufs = NULL;
+    GThreadPool* pool;
+    guint i;
 
     g_mutex_lock(lock_ptr);
     /* cancel all pending requests before destroying hash */
-    for (qlist = g_queue_peek_head_link(&loader_queue); qlist; qlist = qlist->next)
+    for (i = 0; i < G_N_ELEMENTS(queues); i++)
+    for (qlist = g_queue_peek_head_link(queues[i]); qlist; qlist = qlist->next)
     {
         task = qlist->data;
         if (task->cancellable)
@@ -779,18 +1627,51 @@ void _fm_thumbnail_loader_finalize(void)
             ((FmThumbnailLoader*)rlist->data)->cancelled = TRUE;
     }
     g_mutex_unlock(lock_ptr);
-    /* if thread was alive it will die after that */
+    /* if threads were alive they will die after that */
     g_cond_broadcast(cond_ptr);
+    /* loader threads may push tasks into generator so stop them first */
+    if (loader_pool)
+        g_thread_pool_free(loader_pool, TRUE, TRUE);
+    if (generator_pool)
+        g_thread_pool_free(generator_pool, TRUE, TRUE);
+    loader_pool = generator_pool = NULL;
+    /* nothing can be added into packs now so stop the writer as well */
+    g_atomic_int_set(&packs_quit, 1);
+    G_LOCK(packs);
+    pool = pack_pool;
+    pack_pool = NULL;
+    G_UNLOCK(packs);
+    if (pool)
+        g_thread_pool_free(pool, FALSE, TRUE);
+    for (i = 0; i < G_N_ELEMENTS(queues); i++)
+        while((task = g_queue_peek_head(queues[i])))
+            thumbnail_task_free(task);
+    /* release all thumbnails held by the cache */
     g_mutex_lock(lock_ptr);
-    while (loader_thread_running)
-        g_cond_wait(cond_ptr, lock_ptr);
+    for (qlist = g_queue_peek_head_link(&lru_queue); qlist; qlist = qlist->next)
+    {
+        ThumbnailCacheItem* item = qlist->data;
+        item->lru_link = NULL;
+        pixbufs = g_slist_prepend(pixbufs, item->pix);
+    }
+    g_queue_clear(&lru_queue);
+    for (qlist = g_queue_peek_head_link(&warm_queue); qlist; qlist = qlist->next)
+    {
+        ThumbnailCacheItem* item = qlist->data;
+        item->lru_link = NULL;
+        item->warm = FALSE;
+        pixbufs = g_slist_prepend(pixbufs, item->pix);
+    }
+    g_queue_clear(&warm_queue);
+    lru_bytes = 0;
+    while (!g_queue_is_empty(&warm_folders))
+        fm_path_unref(g_queue_pop_head(&warm_folders));
     g_mutex_unlock(lock_ptr);
+    g_slist_free_full(pixbufs, g_object_unref);
 #if !GLIB_CHECK_VERSION(2, 32, 0)
     g_mutex_free(lock_ptr);
     g_cond_free(cond_ptr);
 #endif
-    while((task = g_queue_pop_head(&loader_queue)))
-        thumbnail_task_free(task);
     fm_thumbnail_loader_cleanup(NULL);
 }
 
@@ -867,7 +1748,8 @@ static void save_thumbnail_to_disk(ThumbnailTask* task, GObject* pix, const char
         backend.set_image_text(pix, "tEXt::Thumb::MTime", mtime_str);
         backend.write_image(pix, tmpfile);
         close(fd);
-        g_rename(tmpfile, path);
+        if(g_rename(tmpfile, path) == 0)
+            thumbnail_pack_add(task, path == task->large_path, path);
         g_free(tmpfile);
     }
     DEBUG("generator: save to %s", path);
@@ -1048,38 +1930,42 @@ static gboolean generate_thumbnails_with_builtin(ThumbnailTask* task)
     return TRUE;
 }
 
+typedef struct
+{
+    gboolean finished;
+    gboolean timed_out;
+    guint timeout_id;
+    int status;
+} ThumbnailerStatus;
+
 /* call from main thread */
 static gboolean on_thumbnailer_timeout(gpointer user_data)
 {
-    gboolean *timed_out;
+    ThumbnailerStatus *st = user_data;
 
-    /* check if it is destroyed already */
-    if(g_source_is_destroyed(g_main_current_source()))
-        return FALSE;
-    timed_out = user_data;
     /* g_print("thumbnail timeout!\n"); */
     g_mutex_lock(lock_ptr);
-    *timed_out = TRUE;
-    thumbnailer_timeout_id = 0;
+    /* check if it is destroyed already, st is invalid in such case */
+    if(!g_source_is_destroyed(g_main_current_source()))
+    {
+        st->timed_out = TRUE;
+        st->timeout_id = 0;
+    }
     g_mutex_unlock(lock_ptr);
     g_cond_broadcast(cond_ptr);
     return FALSE;
 }
 
-typedef struct
-{
-    gboolean finished;
-    int status;
-} ThumbnailerStatus;
-
 /* this is in main loop due to g_child_watch_add() */
 static void _pid_watcher(GPid pid, gint status, gpointer user_data)
 {
     ThumbnailerStatus *st = user_data;
 
     DEBUG("pid %d terminated", (int)pid);
+    g_mutex_lock(lock_ptr);
     st->status = status;
     st->finished = TRUE;
+    g_mutex_unlock(lock_ptr);
     g_cond_broadcast(cond_ptr);
 }
 
@@ -1088,31 +1974,23 @@ static gboolean run_thumbnailer(FmThumbnailer* thumbnailer, ThumbnailTask* task,
                                 const char* output_file, guint size)
 {
     /* g_print("run_thumbnailer: uri: %s\n", uri); */
-    ThumbnailerStatus status = { FALSE, 0 };
-    gboolean timed_out = FALSE;
+    ThumbnailerStatus status = { FALSE, FALSE, 0, 0 };
     GPid _pid = fm_thumbnailer_launch_for_uri_async(thumbnailer, task->uri,
                                                     output_file, size, NULL);
     if(_pid <= 0) /* failed to launch */
         /* FIXME: print error message from failed thumbnailer */
         return FALSE;
     g_mutex_lock(lock_ptr);
-    if(thumbnailer_timeout_id)
-    {
-        g_mutex_unlock(lock_ptr);
-        g_critical("libfm: run_thumbnailer() concurrent process attempt");
-        kill(_pid, SIGTERM);
-        return FALSE;
-    }
-    thumbnailer_timeout_id = g_timeout_add_seconds(THUMBNAILER_TIMEOUT_SEC,
-                                                   on_thumbnailer_timeout, &timed_out);
+    status.timeout_id = g_timeout_add_seconds(THUMBNAILER_TIMEOUT_SEC,
+                                              on_thumbnailer_timeout, &status);
     g_child_watch_add(_pid, _pid_watcher, &status);
     /* g_print("pid: %d\n", thumbnailer_pid); */
-    while (!timed_out && !status.finished &&
+    while (!status.timed_out && !status.finished &&
            !g_cancellable_is_cancelled(task->cancellable))
         g_cond_wait(cond_ptr, lock_ptr);
-    if (thumbnailer_timeout_id)
-        g_source_remove(thumbnailer_timeout_id);
-    thumbnailer_timeout_id = 0;
+    if (status.timeout_id)
+        g_source_remove(status.timeout_id);
+    status.timeout_id = 0;
     if (!status.finished)
         kill(_pid, SIGTERM);
     /* wait for the thumbnailer process to terminate */
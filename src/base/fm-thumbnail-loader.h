@@ -62,12 +62,17 @@ FmThumbnailLoader* fm_thumbnail_loader_load(FmFileInfo* src_file,
 
 void fm_thumbnail_loader_cancel(FmThumbnailLoader* req);
 
+void fm_thumbnail_loader_raise_priority(FmThumbnailLoader* req);
+
 GObject* fm_thumbnail_loader_get_data(FmThumbnailLoader* req);
 
 FmFileInfo* fm_thumbnail_loader_get_file_info(FmThumbnailLoader* req);
 
 guint fm_thumbnail_loader_get_size(FmThumbnailLoader* req);
 
+gdouble fm_thumbnail_loader_get_cache_stats(guint* hits, guint* misses,
+                                            guint* evictions, gsize* bytes);
+
 /* for toolkit-specific image loading code */
 
 typedef struct _FmThumbnailLoaderBackend FmThumbnailLoaderBackend;
@@ -82,6 +82,7 @@ void fm_gtk_finalize(void)
     _fm_thumbnail_finalize();
     _fm_file_properties_finalize();
     _fm_folder_model_finalize();
+    _fm_dir_tree_model_finalize();
     _fm_folder_view_finalize();
     _fm_file_menu_finalize();
 
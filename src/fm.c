@@ -158,6 +158,7 @@ void fm_finalize(void)
     _fm_thumbnailer_finalize(); /* need to be before fm_mime_type_finalize() */
     _fm_archiver_finalize();
     _fm_folder_finalize();
+    _fm_deep_count_job_finalize();
     _fm_file_info_finalize();
     _fm_mime_type_finalize();
     _fm_monitor_finalize();
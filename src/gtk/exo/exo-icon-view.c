@@ -121,6 +121,7 @@ enum
   PROP_MODEL,
   PROP_COLUMNS,
   PROP_ITEM_WIDTH,
+  PROP_FIXED_ITEM_SIZE,
   PROP_SPACING,
   PROP_ROW_SPACING,
   PROP_COLUMN_SPACING,
@@ -176,6 +177,14 @@ typedef struct _ExoIconViewItem     ExoIconViewItem;
 #define EXO_ICON_VIEW_CHILD(obj)       ((ExoIconViewChild *) (obj))
 #define EXO_ICON_VIEW_ITEM(obj)        ((ExoIconViewItem *) (obj))
 
+/* the items array is indexed by the row of the item in the model */
+#define EXO_ICON_VIEW_N_ITEMS(icon_view)     ((gint) (icon_view)->priv->items->len)
+#define EXO_ICON_VIEW_NTH_ITEM(icon_view, n) EXO_ICON_VIEW_ITEM (g_ptr_array_index ((icon_view)->priv->items, (n)))
+
+/* whether the items are layouted on a grid of uniform cells */
+#define EXO_ICON_VIEW_FIXED_LAYOUT(icon_view) ((icon_view)->priv->fixed_item_size \
+                                               && (icon_view)->priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS)
+
 
 
 static void                 exo_icon_view_cell_layout_init               (GtkCellLayoutIface     *iface);
@@ -284,6 +293,10 @@ static void                 exo_icon_view_paint_item                     (ExoIco
 static void                 exo_icon_view_queue_draw_item                (ExoIconView            *icon_view,
                                                                           ExoIconViewItem        *item);
 static void                 exo_icon_view_queue_layout                   (ExoIconView            *icon_view);
+static void                 exo_icon_view_queue_layout_from              (ExoIconView            *icon_view,
+                                                                          gint                    index);
+static gint                 exo_icon_view_find_first_item_below          (const ExoIconView      *icon_view,
+                                                                          gint                    y);
 static void                 exo_icon_view_set_cursor_item                (ExoIconView            *icon_view,
                                                                           ExoIconViewItem        *item,
                                                                           gint                    cursor_cell);
@@ -305,6 +318,8 @@ static void                 exo_icon_view_calculate_item_size2           (ExoIco
                                                                           ExoIconViewItem        *item,
                                                                           gint                   *max_width,
                                                                           gint                   *max_height);
+static gboolean             exo_icon_view_ensure_item_cells              (ExoIconView            *icon_view,
+                                                                          ExoIconViewItem        *item);
 static void                 exo_icon_view_update_rubberband              (gpointer                data);
 static void                 exo_icon_view_invalidate_sizes               (ExoIconView            *icon_view);
 static void                 exo_icon_view_add_move_binding               (GtkBindingSet          *binding_set,
@@ -541,7 +556,8 @@ struct _ExoIconViewPrivate
 
   GtkTreeModel *model;
 
-  GList *items;
+  /* ExoIconViewItem's, item->index is the position in this array */
+  GPtrArray *items;
 
   GtkAdjustment *hadjustment;
   GtkAdjustment *vadjustment;
@@ -554,6 +570,22 @@ struct _ExoIconViewPrivate
 
   gint layout_idle_id;
 
+  /* the first item whose position is no longer valid (0 if the whole
+   * view needs to be layouted, G_MAXINT if the layout is up to date),
+   * and the item size and allocation that layout was done for.
+   */
+  gint layout_first_item;
+  gint layout_item_size;
+  gint layout_width;
+  gint layout_height;
+
+  /* uniform item size support, see exo_icon_view_set_fixed_item_size() */
+  guint fixed_item_size : 1;
+  gint fixed_item_width;
+  gint fixed_item_height;
+  gint *fixed_cell_width;
+  gint *fixed_cell_height;
+
   gboolean doing_rubberband;
   gint rubberband_x_1, rubberband_y_1;
   gint rubberband_x2, rubberband_y2;
@@ -660,6 +692,18 @@ static guint icon_view_signals[LAST_SIGNAL];
 
 
 
+/* Returns the item at @index or %NULL if there's no such item. */
+static inline ExoIconViewItem*
+exo_icon_view_nth_item (const ExoIconView *icon_view,
+                        gint               index)
+{
+  if (G_UNLIKELY (index < 0 || index >= EXO_ICON_VIEW_N_ITEMS (icon_view)))
+    return NULL;
+  return EXO_ICON_VIEW_NTH_ITEM (icon_view, index);
+}
+
+
+
 G_DEFINE_TYPE_WITH_CODE (ExoIconView, exo_icon_view, GTK_TYPE_CONTAINER,
 #if GTK_CHECK_VERSION(3, 0, 0)
     G_IMPLEMENT_INTERFACE (GTK_TYPE_SCROLLABLE, NULL)
@@ -802,6 +846,23 @@ exo_icon_view_class_init (ExoIconViewClass *klass)
                                                      -1, G_MAXINT, -1,
                                                      EXO_PARAM_READWRITE));
 
+  /**
+   * ExoIconView:fixed-item-size:
+   *
+   * If the fixed-item-size property is %TRUE then all items are
+   * assumed to have the size of the largest item measured so far,
+   * so the view with %EXO_ICON_VIEW_LAYOUT_ROWS layout can place
+   * items without measuring each of them and only visible items
+   * are measured.
+   **/
+  g_object_class_install_property (gobject_class,
+                                   PROP_FIXED_ITEM_SIZE,
+                                   g_param_spec_boolean ("fixed-item-size",
+                                                         _("Fixed item size"),
+                                                         _("Whether all items have the same size"),
+                                                         FALSE,
+                                                         EXO_PARAM_READWRITE));
+
   /**
    * ExoIconView:layout-mode:
    *
@@ -1284,6 +1345,8 @@ exo_icon_view_init (ExoIconView *icon_view)
   icon_view->priv->search_position_func = exo_icon_view_search_position_func;
 
   icon_view->priv->flags = EXO_ICON_VIEW_DRAW_KEYFOCUS;
+
+  icon_view->priv->items = g_ptr_array_new ();
 }
 
 
@@ -1350,6 +1413,10 @@ exo_icon_view_finalize (GObject *object)
   if (G_UNLIKELY (icon_view->priv->layout_idle_id != 0))
     g_source_remove (icon_view->priv->layout_idle_id);
 
+  /* the items were released with the model */
+  g_ptr_array_free (icon_view->priv->items, TRUE);
+  g_free (icon_view->priv->fixed_cell_width);
+
   (*G_OBJECT_CLASS (exo_icon_view_parent_class)->finalize) (object);
 }
 
@@ -1380,6 +1447,10 @@ exo_icon_view_get_property (GObject      *object,
       g_value_set_int (value, priv->item_width);
       break;
 
+    case PROP_FIXED_ITEM_SIZE:
+      g_value_set_boolean (value, priv->fixed_item_size);
+      break;
+
     case PROP_MARGIN:
       g_value_set_int (value, priv->margin);
       break;
@@ -1485,6 +1556,10 @@ exo_icon_view_set_property (GObject      *object,
       exo_icon_view_set_item_width (icon_view, g_value_get_int (value));
       break;
 
+    case PROP_FIXED_ITEM_SIZE:
+      exo_icon_view_set_fixed_item_size (icon_view, g_value_get_boolean (value));
+      break;
+
     case PROP_MARGIN:
       exo_icon_view_set_margin (icon_view, g_value_get_int (value));
       break;
@@ -1742,6 +1817,10 @@ exo_icon_view_allocate_children (ExoIconView *icon_view)
     {
       child = EXO_ICON_VIEW_CHILD (lp->data);
 
+      /* with uniform item size the cells box may be not measured yet */
+      if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view))
+        exo_icon_view_ensure_item_cells (icon_view, child->item);
+
       /* totally ignore our child's requisition */
       if (child->cell < 0)
         allocation = child->item->area;
@@ -1858,12 +1937,12 @@ exo_icon_view_expose_event (GtkWidget      *widget,
   ExoIconView            *icon_view = EXO_ICON_VIEW (widget);
   GtkTreePath            *path;
   GdkRectangle            rubber_rect = { 0, };
-  const GList            *lp;
+  GdkRectangle            event_area;
+  gint                    event_area_last;
   gint                    dest_index = -1;
+  gint                    n;
 #if !GTK_CHECK_VERSION(3, 0, 0)
   gboolean                rtl;
-  gint                    event_area_last;
-  GdkRectangle            event_area;
   cairo_t                *cr;
 
   /* verify that the expose happened on the icon window */
@@ -1913,6 +1992,11 @@ exo_icon_view_expose_event (GtkWidget      *widget,
 #if GTK_CHECK_VERSION(3, 0, 0)
   cairo_save (cr);
   gtk_cairo_transform_to_window (cr, widget, priv->bin_window);
+
+  /* determine the last interesting coordinate (only used in rows mode) */
+  if (!gdk_cairo_get_clip_rectangle (cr, &event_area))
+    event_area.y = event_area.height = 0;
+  event_area_last = event_area.y + event_area.height;
 #else
   rtl = (gtk_widget_get_direction (GTK_WIDGET (icon_view)) == GTK_TEXT_DIR_RTL);
   event_area = event->area;
@@ -1946,11 +2030,15 @@ exo_icon_view_expose_event (GtkWidget      *widget,
 #endif
     }
 
-  /* paint all items that are affected by the expose event */
-  for (lp = priv->items; lp != NULL; lp = lp->next)
+  /* paint all items that are affected by the expose event, skipping
+   * the rows above the area right away */
+  n = 0;
+  if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
+    n = exo_icon_view_find_first_item_below (icon_view, event_area.y);
+  for (; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
       /* check if this item is in the visible area */
-      item = EXO_ICON_VIEW_ITEM (lp->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 #if !GTK_CHECK_VERSION(3, 0, 0)
       if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
         {
@@ -1979,6 +2067,10 @@ exo_icon_view_expose_event (GtkWidget      *widget,
         {
           exo_icon_view_paint_item (icon_view, item, &event_area, event->window, item->area.x, item->area.y, TRUE);
 #else
+      if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS)
+          && item->area.y > event_area_last)
+        break;
+
       cairo_save (cr);
       cairo_rectangle (cr, item->area.x, item->area.y, item->area.width, item->area.height);
       cairo_clip (cr);
@@ -2939,15 +3031,15 @@ exo_icon_view_start_rubberbanding (ExoIconView  *icon_view,
   GdkColor       *color;
   guchar          alpha;
   gpointer        drag_data;
-  GList          *items;
   GtkStyle       *style;
+  gint            n;
 
   /* be sure to disable any previously active rubberband */
   exo_icon_view_stop_rubberbanding (icon_view);
 
-  for (items = icon_view->priv->items; items; items = items->next)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      ExoIconViewItem *item = items->data;
+      ExoIconViewItem *item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
       item->selected_before_rubberbanding = item->selected;
     }
 
@@ -3034,7 +3126,7 @@ exo_icon_view_update_rubberband_selection (ExoIconView *icon_view)
   gboolean         selected;
   gboolean         changed = FALSE;
   gboolean         is_in;
-  GList           *lp;
+  gint             n;
   gint             x, y;
   gint             width;
   gint             height;
@@ -3046,9 +3138,9 @@ exo_icon_view_update_rubberband_selection (ExoIconView *icon_view)
   height = ABS (icon_view->priv->rubberband_y_1 - icon_view->priv->rubberband_y2);
 
   /* check all items */
-  for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = EXO_ICON_VIEW_ITEM (lp->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       is_in = exo_icon_view_item_hit_test (icon_view, item, x, y, width, height);
 
@@ -3079,6 +3171,17 @@ exo_icon_view_item_hit_test (ExoIconView      *icon_view,
   GList *l;
   GdkRectangle box;
 
+  if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view))
+    {
+      /* all cells are inside of the uniform item area, don't
+       * measure items which are far away from the rectangle */
+      if (MIN (x + width, item->area.x + item->area.width) - MAX (x, item->area.x) <= 0 ||
+          MIN (y + height, item->area.y + item->area.height) - MAX (y, item->area.y) <= 0)
+        return FALSE;
+      if (exo_icon_view_ensure_item_cells (icon_view, item))
+        exo_icon_view_queue_layout (icon_view);
+    }
+
   for (l = icon_view->priv->cell_list; l; l = l->next)
     {
       ExoIconViewCellInfo *info = (ExoIconViewCellInfo *)l->data;
@@ -3107,13 +3210,13 @@ exo_icon_view_unselect_all_internal (ExoIconView  *icon_view)
 {
   ExoIconViewItem *item;
   gboolean         dirty = FALSE;
-  GList           *lp;
+  gint             n;
 
   if (G_LIKELY (icon_view->priv->selection_mode != GTK_SELECTION_NONE))
     {
-      for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+      for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
         {
-          item = EXO_ICON_VIEW_ITEM (lp->data);
+          item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
           if (item->selected)
             {
               dirty = TRUE;
@@ -3385,9 +3488,9 @@ exo_icon_view_adjustment_changed (GtkAdjustment *adjustment,
 }
 
 
-static GList*
+static gint
 exo_icon_view_layout_single_row (ExoIconView *icon_view,
-                                 GList       *first_item,
+                                 gint         first_item,
                                  gint         item_width,
                                  gint         row,
                                  gint        *y,
@@ -3397,8 +3500,8 @@ exo_icon_view_layout_single_row (ExoIconView *icon_view,
   ExoIconViewPrivate *priv = icon_view->priv;
   ExoIconViewItem    *item;
   gboolean            rtl;
-  GList              *last_item;
-  GList              *items = first_item;
+  gint                last_item;
+  gint                n;
   gint               *max_width;
   gint               *max_height;
   gint                focus_width;
@@ -3427,9 +3530,9 @@ exo_icon_view_layout_single_row (ExoIconView *icon_view,
   x = priv->margin + focus_width;
   current_width = 2 * (priv->margin + focus_width);
 
-  for (items = first_item; items != NULL; items = items->next)
+  for (n = first_item; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = EXO_ICON_VIEW_ITEM (items->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       exo_icon_view_calculate_item_size (icon_view, item);
       colspan = 1 + (item->area.width - 1) / (item_width + priv->column_spacing);
@@ -3438,7 +3541,7 @@ exo_icon_view_layout_single_row (ExoIconView *icon_view,
 
       current_width += item->area.width + priv->column_spacing + 2 * focus_width;
 
-      if (G_LIKELY (items != first_item))
+      if (G_LIKELY (n != first_item))
         {
           if ((priv->columns <= 0 && current_width > allocation.width) ||
               (priv->columns > 0 && col >= priv->columns) ||
@@ -3466,12 +3569,12 @@ exo_icon_view_layout_single_row (ExoIconView *icon_view,
       col += colspan;
     }
 
-  last_item = items;
+  last_item = n;
 
   /* Now go through the row again and align the icons */
-  for (items = first_item; items != last_item; items = items->next)
+  for (n = first_item; n < last_item; n++)
     {
-      item = EXO_ICON_VIEW_ITEM (items->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       exo_icon_view_calculate_item_size2 (icon_view, item, max_width, max_height);
 
@@ -3488,9 +3591,9 @@ exo_icon_view_layout_single_row (ExoIconView *icon_view,
 
 
 
-static GList*
+static gint
 exo_icon_view_layout_single_col (ExoIconView *icon_view,
-                                 GList       *first_item,
+                                 gint         first_item,
                                  gint         item_height,
                                  gint         col,
                                  gint        *x,
@@ -3499,8 +3602,8 @@ exo_icon_view_layout_single_col (ExoIconView *icon_view,
 {
   ExoIconViewPrivate *priv = icon_view->priv;
   ExoIconViewItem    *item;
-  GList              *items = first_item;
-  GList              *last_item;
+  gint                last_item;
+  gint                n;
   gint               *max_width;
   gint               *max_height;
   gint                focus_width;
@@ -3527,9 +3630,9 @@ exo_icon_view_layout_single_col (ExoIconView *icon_view,
   y = priv->margin + focus_width;
   current_height = 2 * (priv->margin + focus_width);
 
-  for (items = first_item; items != NULL; items = items->next)
+  for (n = first_item; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = EXO_ICON_VIEW_ITEM (items->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       exo_icon_view_calculate_item_size (icon_view, item);
 
@@ -3539,7 +3642,7 @@ exo_icon_view_layout_single_col (ExoIconView *icon_view,
 
       current_height += item->area.height + priv->row_spacing + 2 * focus_width;
 
-      if (G_LIKELY (items != first_item))
+      if (G_LIKELY (n != first_item))
         {
           if (current_height >= allocation.height ||
              (max_rows > 0 && row >= max_rows))
@@ -3566,12 +3669,12 @@ exo_icon_view_layout_single_col (ExoIconView *icon_view,
       row += rowspan;
     }
 
-  last_item = items;
+  last_item = n;
 
   /* Now go through the column again and align the icons */
-  for (items = first_item; items != last_item; items = items->next)
+  for (n = first_item; n < last_item; n++)
     {
-      item = EXO_ICON_VIEW_ITEM (items->data);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       exo_icon_view_calculate_item_size2 (icon_view, item, max_width, max_height);
 
@@ -3614,20 +3717,36 @@ exo_icon_view_set_adjustment_upper (GtkAdjustment *adj,
 static gint
 exo_icon_view_layout_cols (ExoIconView *icon_view,
                            gint         item_height,
+                           gint         first_item,
                            gint        *x,
                            gint        *maximum_height,
                            gint         max_rows)
 {
-  GList *icons = icon_view->priv->items;
-  GList *items;
+  ExoIconViewItem *item;
   gboolean rtl;
+  gint   icons = 0;
+  gint   items;
   gint   col = 0;
-  gint   rows = 0;
+  gint   rows = icon_view->priv->rows;
   gint   shift;
 
   rtl = (gtk_widget_get_direction (GTK_WIDGET (icon_view)) == GTK_TEXT_DIR_RTL);
 
   shift = icon_view->priv->margin;
+
+  /* the columns before the one of the first changed item are still
+   * valid, continue with that column (every new column moves all the
+   * previous ones in RTL mode, so start over there).
+   */
+  if (first_item > 0 && !rtl)
+    {
+      col = EXO_ICON_VIEW_NTH_ITEM (icon_view, first_item - 1)->col;
+      for (icons = first_item - 1; icons > 0; icons--)
+        if (EXO_ICON_VIEW_NTH_ITEM (icon_view, icons - 1)->col != (guint) col)
+          break;
+      shift = EXO_ICON_VIEW_NTH_ITEM (icon_view, icons)->area.x;
+    }
+
   *x = shift;
 
   do
@@ -3639,17 +3758,15 @@ exo_icon_view_layout_cols (ExoIconView *icon_view,
 
       if (rtl)
       {
-          GList *items2;
-          ExoIconViewItem *item;
           gint i;
 
           /* update width */
           shift -= icon_view->priv->margin; /* width of the new column */
           *x += shift;
           /* shift all previous items to right so new column will be left one */
-          if (items) for (items2 = icon_view->priv->items; items2 != items; items2 = items2->next)
+          for (; --items >= 0; )
           {
-              item = EXO_ICON_VIEW_ITEM (items2->data);
+              item = EXO_ICON_VIEW_NTH_ITEM (icon_view, items);
 
               item->area.x += shift;
               for (i = 0; i < icon_view->priv->n_cells; i++)
@@ -3662,14 +3779,11 @@ exo_icon_view_layout_cols (ExoIconView *icon_view,
           *x = shift;
       /* count the number of rows in the first column */
       if (G_UNLIKELY (col == 0))
-        {
-          for (items = icon_view->priv->items, rows = 0; items != icons; items = items->next, ++rows)
-            ;
-        }
+        rows = icons;
 
       col++;
     }
-  while (icons != NULL);
+  while (icons < EXO_ICON_VIEW_N_ITEMS (icon_view));
 
   *x += icon_view->priv->margin;
   icon_view->priv->cols = col;
@@ -3682,17 +3796,36 @@ exo_icon_view_layout_cols (ExoIconView *icon_view,
 static gint
 exo_icon_view_layout_rows (ExoIconView *icon_view,
                            gint         item_width,
+                           gint         first_item,
                            gint        *y,
                            gint        *maximum_width,
                            gint         max_cols)
 {
-  GList *icons = icon_view->priv->items;
-  GList *items;
+  ExoIconViewItem *item;
+  gint   icons = 0;
   gint   row = 0;
-  gint   cols = 0;
+  gint   cols = icon_view->priv->cols;
+  gint   focus_width;
 
   *y = icon_view->priv->margin;
 
+  /* the rows before the one of the first changed item are still
+   * valid, continue with that row.
+   */
+  if (first_item > 0)
+    {
+      row = EXO_ICON_VIEW_NTH_ITEM (icon_view, first_item - 1)->row;
+      for (icons = first_item - 1; icons > 0; icons--)
+        if (EXO_ICON_VIEW_NTH_ITEM (icon_view, icons - 1)->row != (guint) row)
+          break;
+
+      gtk_widget_style_get (GTK_WIDGET (icon_view),
+                            "focus-line-width", &focus_width,
+                            NULL);
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, icons);
+      *y = item->area.y - focus_width;
+    }
+
   do
     {
       icons = exo_icon_view_layout_single_row (icon_view, icons,
@@ -3701,14 +3834,11 @@ exo_icon_view_layout_rows (ExoIconView *icon_view,
 
       /* count the number of columns in the first row */
       if (G_UNLIKELY (row == 0))
-        {
-          for (items = icon_view->priv->items, cols = 0; items != icons; items = items->next, ++cols)
-            ;
-        }
+        cols = icons;
 
       row++;
     }
-  while (icons != NULL);
+  while (icons < EXO_ICON_VIEW_N_ITEMS (icon_view));
 
   *y += icon_view->priv->margin;
   icon_view->priv->rows = row;
@@ -3718,12 +3848,125 @@ exo_icon_view_layout_rows (ExoIconView *icon_view,
 
 
 
+static gint
+exo_icon_view_layout_fixed (ExoIconView *icon_view,
+                            gint         first_item,
+                            gint        *y,
+                            gint        *maximum_width,
+                            gint         max_cols)
+{
+  ExoIconViewPrivate *priv = icon_view->priv;
+  ExoIconViewItem    *item;
+  GtkAllocation       allocation;
+  gboolean            rtl;
+  gboolean            grew;
+  gint                n_items = EXO_ICON_VIEW_N_ITEMS (icon_view);
+  gint                focus_width;
+  gint                col_width;
+  gint                row_height;
+  gint                cols, rows;
+  gint                row, col;
+  gint                first, last;
+  gint                dx, dy;
+  gint                x, n, i;
+
+  rtl = (gtk_widget_get_direction (GTK_WIDGET (icon_view)) == GTK_TEXT_DIR_RTL);
+  gtk_widget_get_allocation (GTK_WIDGET (icon_view), &allocation);
+
+  gtk_widget_style_get (GTK_WIDGET (icon_view),
+                        "focus-line-width", &focus_width,
+                        NULL);
+
+  /* the uniform item size is unknown until some item was measured */
+  if (G_UNLIKELY (priv->fixed_item_width <= 0 && n_items > 0))
+    exo_icon_view_ensure_item_cells (icon_view, EXO_ICON_VIEW_NTH_ITEM (icon_view, 0));
+
+  do
+    {
+      col_width = priv->fixed_item_width + priv->column_spacing + 2 * focus_width;
+      row_height = MAX (priv->fixed_item_height + priv->row_spacing + 2 * focus_width, 1);
+
+      if (priv->columns > 0)
+        cols = priv->columns;
+      else
+        cols = (allocation.width - 2 * (priv->margin + focus_width)) / MAX (col_width, 1);
+      if (max_cols > 0)
+        cols = MIN (cols, max_cols);
+      cols = MAX (cols, 1);
+      rows = (n_items + cols - 1) / cols;
+
+      /* all rows before the one of the first changed item are still in place */
+      if (cols != priv->cols)
+        first_item = 0;
+      first_item -= first_item % cols;
+
+      /* every item gets its cell of the grid, items which were changed
+       * since they were measured are measured again once visible */
+      for (n = first_item; n < n_items; n++)
+        {
+          item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
+          row = n / cols;
+          col = n % cols;
+
+          if (G_UNLIKELY (item->area.width == -1))
+            {
+              g_free (item->box);
+              item->box = NULL;
+              item->n_cells = 0;
+            }
+
+          x = priv->margin + focus_width + col * col_width;
+          x = rtl ? allocation.width - priv->fixed_item_width - x : x;
+          dx = x - item->area.x;
+          dy = priv->margin + focus_width + row * row_height - item->area.y;
+
+          item->area.x += dx;
+          item->area.y += dy;
+          item->area.width = priv->fixed_item_width;
+          item->area.height = priv->fixed_item_height;
+          if (item->box != NULL && (dx != 0 || dy != 0))
+            {
+              for (i = 0; i < item->n_cells; i++)
+                {
+                  item->box[i].x += dx;
+                  item->box[i].y += dy;
+                }
+            }
+
+          item->row = row;
+          item->col = rtl ? MIN (cols, n_items - row * cols) - 1 - col : col;
+        }
+
+      /* measure the items in the visible area, start over if one of them
+       * doesn't fit into the current item size */
+      first = (gtk_adjustment_get_value (priv->vadjustment) - priv->margin) / row_height;
+      last = (gtk_adjustment_get_value (priv->vadjustment) + allocation.height - priv->margin) / row_height + 1;
+      first = CLAMP (first * cols, 0, n_items);
+      last = CLAMP (last * cols, 0, n_items);
+      for (n = first, grew = FALSE; n < last && !grew; n++)
+        grew = exo_icon_view_ensure_item_cells (icon_view, EXO_ICON_VIEW_NTH_ITEM (icon_view, n));
+      if (grew)
+        first_item = 0;
+    }
+  while (grew);
+
+  if (n_items > 0)
+    *maximum_width = MAX (*maximum_width, 2 * (priv->margin + focus_width) + MIN (cols, n_items) * col_width);
+  *y = 2 * priv->margin + rows * row_height;
+  priv->rows = rows;
+
+  return cols;
+}
+
+
+
 static void
 exo_icon_view_layout (ExoIconView *icon_view)
 {
   ExoIconViewPrivate *priv = icon_view->priv;
   ExoIconViewItem    *item;
-  GList              *icons;
+  gint                n;
+  gint                first_item;
   gint                maximum_height = 0;
   gint                maximum_width = 0;
   gint                item_height;
@@ -3741,48 +3984,89 @@ exo_icon_view_layout (ExoIconView *icon_view)
 
   gtk_widget_get_allocation (GTK_WIDGET (icon_view), &allocation);
 
+  /* only the items starting with the first changed one need to be
+   * layouted again, unless the widget was resized meanwhile. Always
+   * redo the last row or column since removed items might have left
+   * it shorter. */
+  first_item = priv->layout_first_item;
+  if (allocation.width != priv->layout_width || allocation.height != priv->layout_height)
+    first_item = 0;
+  first_item = MAX (0, MIN (first_item, EXO_ICON_VIEW_N_ITEMS (icon_view) - 1));
+
   /* determine the layout mode */
   if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
     {
-      /* calculate item sizes on-demand */
-      item_width = priv->item_width;
-      if (item_width < 0)
+      if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view))
         {
-          for (icons = priv->items; icons != NULL; icons = icons->next)
+          if (first_item > 0)
+            maximum_width = priv->width;
+
+          cols = exo_icon_view_layout_fixed (icon_view, first_item, &y, &maximum_width, 0);
+
+          /* see below */
+          if (cols == priv->cols + 1 && y > allocation.height &&
+              priv->height <= allocation.height)
             {
-              item = icons->data;
-              exo_icon_view_calculate_item_size (icon_view, item);
-              item_width = MAX (item_width, item->area.width);
+              cols = exo_icon_view_layout_fixed (icon_view, 0, &y, &maximum_width, priv->cols);
             }
+
+          item_width = priv->fixed_item_width;
         }
+      else
+        {
+          /* calculate item sizes on-demand */
+          item_width = priv->item_width;
+          if (item_width < 0)
+            {
+              for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+                {
+                  item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
+                  exo_icon_view_calculate_item_size (icon_view, item);
+                  item_width = MAX (item_width, item->area.width);
+                }
+            }
 
-      cols = exo_icon_view_layout_rows (icon_view, item_width, &y, &maximum_width, 0);
+          /* all rows need to be redone if the column width changed */
+          if (item_width != priv->layout_item_size)
+            first_item = 0;
+          else if (first_item > 0)
+            maximum_width = priv->width;
 
-      /* If, by adding another column, we increase the height of the icon view, thus forcing a
-       * vertical scrollbar to appear that would prevent the last column from being able to fit,
-       * we need to relayout the icons with one less column.
-       */
-      if (cols == priv->cols + 1 && y > allocation.height &&
-          priv->height <= allocation.height)
-        {
-          cols = exo_icon_view_layout_rows (icon_view, item_width, &y, &maximum_width, priv->cols);
+          cols = exo_icon_view_layout_rows (icon_view, item_width, first_item, &y, &maximum_width, 0);
+
+          /* If, by adding another column, we increase the height of the icon view, thus forcing a
+           * vertical scrollbar to appear that would prevent the last column from being able to fit,
+           * we need to relayout the icons with one less column.
+           */
+          if (cols == priv->cols + 1 && y > allocation.height &&
+              priv->height <= allocation.height)
+            {
+              cols = exo_icon_view_layout_rows (icon_view, item_width, 0, &y, &maximum_width, priv->cols);
+            }
         }
 
       priv->width = maximum_width;
       priv->height = y;
       priv->cols = cols;
+      priv->layout_item_size = item_width;
     }
   else
     {
       /* calculate item sizes on-demand */
-      for (icons = priv->items, item_height = 0; icons != NULL; icons = icons->next)
+      for (n = 0, item_height = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
         {
-          item = icons->data;
+          item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
           exo_icon_view_calculate_item_size (icon_view, item);
           item_height = MAX (item_height, item->area.height);
         }
 
-      rows = exo_icon_view_layout_cols (icon_view, item_height, &x, &maximum_height, 0);
+      /* all columns need to be redone if the row height changed */
+      if (item_height != priv->layout_item_size)
+        first_item = 0;
+      else if (first_item > 0)
+        maximum_height = priv->height;
+
+      rows = exo_icon_view_layout_cols (icon_view, item_height, first_item, &x, &maximum_height, 0);
 
       /* If, by adding another row, we increase the width of the icon view, thus forcing a
        * horizontal scrollbar to appear that would prevent the last row from being able to fit,
@@ -3791,16 +4075,16 @@ exo_icon_view_layout (ExoIconView *icon_view)
       if (rows == priv->rows + 1 && x > allocation.width &&
           priv->width <= allocation.width)
         {
-          rows = exo_icon_view_layout_cols (icon_view, item_height, &x, &maximum_height, priv->rows);
+          rows = exo_icon_view_layout_cols (icon_view, item_height, 0, &x, &maximum_height, priv->rows);
         }
       else if (x < allocation.width &&
                gtk_widget_get_direction (GTK_WIDGET (icon_view)) == GTK_TEXT_DIR_RTL)
         {
           /* shift items to align right border */
           gint shift = allocation.width - x, i;
-          for (icons = priv->items; icons != NULL; icons = icons->next)
+          for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
           {
-              item = icons->data;
+              item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
               item->area.x += shift;
               for (i = 0; i < icon_view->priv->n_cells; i++)
                   item->box[i].x += shift;
@@ -3810,8 +4094,14 @@ exo_icon_view_layout (ExoIconView *icon_view)
       priv->height = maximum_height;
       priv->width = x;
       priv->rows = rows;
+      priv->layout_item_size = item_height;
     }
 
+  /* the layout is up to date now */
+  priv->layout_first_item = G_MAXINT;
+  priv->layout_width = allocation.width;
+  priv->layout_height = allocation.height;
+
   exo_icon_view_set_adjustment_upper (priv->hadjustment, priv->width);
   exo_icon_view_set_adjustment_upper (priv->vadjustment, priv->height);
 
@@ -3847,6 +4137,9 @@ exo_icon_view_get_cell_area (ExoIconView         *icon_view,
                              ExoIconViewCellInfo *info,
                              GdkRectangle        *cell_area)
 {
+  if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view))
+    exo_icon_view_ensure_item_cells (icon_view, item);
+
   if (icon_view->priv->orientation == GTK_ORIENTATION_HORIZONTAL)
     {
       cell_area->x = item->box[info->position].x - item->before[info->position];
@@ -4035,13 +4328,104 @@ exo_icon_view_calculate_item_size2 (ExoIconView     *icon_view,
 
 
 
+/* Measures the cells of @item for the uniform item size layout unless that
+ * was already done. Returns %TRUE if the item didn't fit into the uniform
+ * size, the other items need to be measured and layouted again then.
+ */
+static gboolean
+exo_icon_view_ensure_item_cells (ExoIconView     *icon_view,
+                                 ExoIconViewItem *item)
+{
+  ExoIconViewPrivate *priv = icon_view->priv;
+  ExoIconViewItem    *other;
+  gboolean            grew = FALSE;
+  gint                width;
+  gint                x, y;
+  gint                n, i;
+
+  if (G_LIKELY (item->box != NULL && item->area.width != -1 && item->n_cells == priv->n_cells))
+    return FALSE;
+
+  if (G_UNLIKELY (priv->fixed_cell_width == NULL))
+    {
+      priv->fixed_cell_width = g_new0 (gint, 2 * priv->n_cells);
+      priv->fixed_cell_height = priv->fixed_cell_width + priv->n_cells;
+    }
+
+  /* measure the item, keeping its position */
+  x = item->area.x;
+  y = item->area.y;
+  item->area.width = -1;
+  exo_icon_view_calculate_item_size (icon_view, item);
+
+  for (i = 0; i < priv->n_cells; i++)
+    {
+      if (item->box[i].width > priv->fixed_cell_width[i])
+        {
+          priv->fixed_cell_width[i] = item->box[i].width;
+          grew = TRUE;
+        }
+      if (item->box[i].height > priv->fixed_cell_height[i])
+        {
+          priv->fixed_cell_height[i] = item->box[i].height;
+          grew = TRUE;
+        }
+    }
+
+  width = MAX (item->area.width, priv->item_width);
+  if (width > priv->fixed_item_width)
+    {
+      priv->fixed_item_width = width;
+      grew = TRUE;
+    }
+
+  /* align the cells to the largest cells seen so far */
+  item->area.x = x;
+  item->area.y = y;
+  item->area.width = priv->fixed_item_width;
+  exo_icon_view_calculate_item_size2 (icon_view, item, priv->fixed_cell_width, priv->fixed_cell_height);
+  if (item->area.height > priv->fixed_item_height)
+    {
+      priv->fixed_item_height = item->area.height;
+      grew = TRUE;
+    }
+  item->area.width = priv->fixed_item_width;
+  item->area.height = priv->fixed_item_height;
+
+  if (G_UNLIKELY (grew))
+    {
+      /* the cells measured before are aligned to the old size */
+      for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+        {
+          other = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
+          g_free (other->box);
+          other->box = NULL;
+          other->n_cells = 0;
+        }
+      exo_icon_view_ensure_item_cells (icon_view, item);
+    }
+
+  return grew;
+}
+
+
+
 static void
 exo_icon_view_invalidate_sizes (ExoIconView *icon_view)
 {
-  GList *lp;
+  ExoIconViewPrivate *priv = icon_view->priv;
+  gint                n;
+
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+    EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->area.width = -1;
+
+  /* the uniform item size is measured again as well */
+  g_free (priv->fixed_cell_width);
+  priv->fixed_cell_width = NULL;
+  priv->fixed_cell_height = NULL;
+  priv->fixed_item_width = 0;
+  priv->fixed_item_height = 0;
 
-  for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
-    EXO_ICON_VIEW_ITEM (lp->data)->area.width = -1;
   exo_icon_view_queue_layout (icon_view);
 }
 
@@ -4070,6 +4454,11 @@ exo_icon_view_paint_item (ExoIconView     *icon_view,
   if (G_UNLIKELY (icon_view->priv->model == NULL))
     return;
 
+  /* the cells of items which weren't visible before aren't measured yet */
+  if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view)
+      && exo_icon_view_ensure_item_cells (icon_view, item))
+    exo_icon_view_queue_layout (icon_view);
+
   exo_icon_view_set_cell_data (icon_view, item);
 
   //rtl = gtk_widget_get_direction (GTK_WIDGET (icon_view)) == GTK_TEXT_DIR_RTL;
@@ -4230,12 +4619,53 @@ layout_destroy (gpointer user_data)
 static void
 exo_icon_view_queue_layout (ExoIconView *icon_view)
 {
+  exo_icon_view_queue_layout_from (icon_view, 0);
+}
+
+
+
+/* Queues a layout of the items starting with the item at @index, the
+ * items before it keep their positions.
+ */
+static void
+exo_icon_view_queue_layout_from (ExoIconView *icon_view,
+                                 gint         index)
+{
+  icon_view->priv->layout_first_item = MIN (icon_view->priv->layout_first_item, index);
+
   if (G_UNLIKELY (icon_view->priv->layout_idle_id == 0))
     icon_view->priv->layout_idle_id = gdk_threads_add_idle_full (G_PRIORITY_DEFAULT_IDLE, layout_callback, icon_view, layout_destroy);
 }
 
 
 
+/* Returns the index of the first item which ends below @y; in the rows
+ * layout mode the items are sorted by their vertical position.
+ */
+static gint
+exo_icon_view_find_first_item_below (const ExoIconView *icon_view,
+                                     gint               y)
+{
+  ExoIconViewItem *item;
+  gint             lower = 0;
+  gint             upper = EXO_ICON_VIEW_N_ITEMS (icon_view);
+  gint             middle;
+
+  while (lower < upper)
+    {
+      middle = lower + (upper - lower) / 2;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, middle);
+      if (item->area.y + item->area.height < y)
+        lower = middle + 1;
+      else
+        upper = middle;
+    }
+
+  return lower;
+}
+
+
+
 static void
 exo_icon_view_set_cursor_item (ExoIconView     *icon_view,
                                ExoIconViewItem *item,
@@ -4295,17 +4725,28 @@ exo_icon_view_get_item_at_coords (const ExoIconView    *icon_view,
   ExoIconViewCellInfo      *info;
   ExoIconViewItem          *item;
   GdkRectangle              box;
-  const GList              *items;
   const GList              *lp;
+  gint                      n = 0;
+
+  /* skip the rows above the position */
+  if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
+    n = exo_icon_view_find_first_item_below (icon_view, y - priv->column_spacing / 2);
 
-  for (items = priv->items; items != NULL; items = items->next)
+  for (; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = items->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
+      if (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS
+          && y < item->area.y - priv->column_spacing / 2)
+        break;
       if (x >= item->area.x - priv->row_spacing / 2 && x <= item->area.x + item->area.width + priv->row_spacing / 2 &&
           y >= item->area.y - priv->column_spacing / 2 && y <= item->area.y + item->area.height + priv->column_spacing / 2)
         {
           if (only_in_cell || cell_at_pos)
             {
+              if (EXO_ICON_VIEW_FIXED_LAYOUT (icon_view)
+                  && exo_icon_view_ensure_item_cells ((ExoIconView *) icon_view, item))
+                exo_icon_view_queue_layout ((ExoIconView *) icon_view);
+
               exo_icon_view_set_cell_data (icon_view, item);
               for (lp = priv->cell_list; lp != NULL; lp = lp->next)
                 {
@@ -4384,23 +4825,24 @@ exo_icon_view_unselect_item (ExoIconView      *icon_view,
 }
 
 
+#ifdef DEBUG_ICON_VIEW
 static void
 verify_items (ExoIconView *icon_view)
 {
-  GList *items;
-  int i = 0;
+  gint i;
 
-  for (items = icon_view->priv->items; items; items = items->next)
+  for (i = 0; i < EXO_ICON_VIEW_N_ITEMS (icon_view); i++)
     {
-      ExoIconViewItem *item = items->data;
+      ExoIconViewItem *item = EXO_ICON_VIEW_NTH_ITEM (icon_view, i);
 
       if (item->index != i)
         g_error ("List item does not match its index: "
                  "item index %d and list index %d\n", item->index, i);
-
-      i++;
     }
 }
+#else
+#define verify_items(icon_view) G_STMT_START{ (void) 0; }G_STMT_END
+#endif
 
 
 static void
@@ -4411,7 +4853,7 @@ exo_icon_view_row_changed (GtkTreeModel *model,
 {
   ExoIconViewItem *item;
 
-  item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+  item = EXO_ICON_VIEW_NTH_ITEM (icon_view, gtk_tree_path_get_indices(path)[0]);
 
   /* stop editing this item */
   if (G_UNLIKELY (item == icon_view->priv->edited_item))
@@ -4425,7 +4867,7 @@ exo_icon_view_row_changed (GtkTreeModel *model,
    * indicates that the item needs to be layouted).
    */
   item->area.width = -1;
-  exo_icon_view_queue_layout (icon_view);
+  exo_icon_view_queue_layout_from (icon_view, item->index);
   verify_items (icon_view);
 }
 
@@ -4438,8 +4880,9 @@ exo_icon_view_row_inserted (GtkTreeModel *model,
                             ExoIconView  *icon_view)
 {
   ExoIconViewItem *item;
-  GList           *list;
+  GPtrArray       *items = icon_view->priv->items;
   gint             idx;
+  gint             n;
 
   idx = gtk_tree_path_get_indices (path)[0];
 
@@ -4448,19 +4891,18 @@ exo_icon_view_row_inserted (GtkTreeModel *model,
   item->iter = *iter;
   item->area.width = -1;
   item->index = idx;
-  icon_view->priv->items = g_list_insert (icon_view->priv->items, item, idx);
 
-  list = g_list_nth (icon_view->priv->items, idx + 1);
-  for (; list; list = list->next)
-    {
-      item = list->data;
+  /* make room for it in the items array */
+  g_ptr_array_add (items, NULL);
+  memmove (items->pdata + idx + 1, items->pdata + idx, (items->len - idx - 1) * sizeof (gpointer));
+  g_ptr_array_index (items, idx) = item;
 
-      item->index++;
-    }
+  for (n = idx + 1; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+    EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->index++;
   verify_items (icon_view);
 
-  /* recalculate the layout */
-  exo_icon_view_queue_layout (icon_view);
+  /* recalculate the layout, starting with the new item */
+  exo_icon_view_queue_layout_from (icon_view, idx);
 }
 
 
@@ -4471,24 +4913,33 @@ exo_icon_view_row_deleted (GtkTreeModel *model,
                            ExoIconView  *icon_view)
 {
   ExoIconViewItem *item;
+  ExoIconViewItem *neighbour;
   gboolean         changed = FALSE;
-  GList           *list, *next;
+  gint             idx;
+  gint             n;
 
   /* determine the position and the item for the path */
-  list = g_list_nth (icon_view->priv->items, gtk_tree_path_get_indices (path)[0]);
-  next = list->next;
-  item = list->data;
+  idx = gtk_tree_path_get_indices (path)[0];
+  item = EXO_ICON_VIEW_NTH_ITEM (icon_view, idx);
 
   if (G_UNLIKELY (item == icon_view->priv->edited_item))
     exo_icon_view_stop_editing (icon_view, TRUE);
 
-  /* use the next item (if any) as anchor, else use prev, otherwise reset anchor */
+  /* the next item (if any), else the previous one, otherwise none */
+  if (idx + 1 < EXO_ICON_VIEW_N_ITEMS (icon_view))
+    neighbour = EXO_ICON_VIEW_NTH_ITEM (icon_view, idx + 1);
+  else if (idx > 0)
+    neighbour = EXO_ICON_VIEW_NTH_ITEM (icon_view, idx - 1);
+  else
+    neighbour = NULL;
+
+  /* use the neighbour as anchor */
   if (G_UNLIKELY (item == icon_view->priv->anchor_item))
-    icon_view->priv->anchor_item = (list->next != NULL) ? list->next->data : ((list->prev != NULL) ? list->prev->data : NULL);
+    icon_view->priv->anchor_item = neighbour;
 
-  /* use the next item (if any) as cursor, else use prev, otherwise reset cursor */
+  /* use the neighbour as cursor */
   if (G_UNLIKELY (item == icon_view->priv->cursor_item))
-    icon_view->priv->cursor_item = (list->next != NULL) ? list->next->data : ((list->prev != NULL) ? list->prev->data : NULL);
+    icon_view->priv->cursor_item = neighbour;
 
   if (G_UNLIKELY (item == icon_view->priv->prelit_item))
     {
@@ -4511,23 +4962,19 @@ exo_icon_view_row_deleted (GtkTreeModel *model,
   /* release the item resources */
   g_free (item->box);
 
-  /* drop the item from the list */
-  icon_view->priv->items = g_list_delete_link (icon_view->priv->items, list);
+  /* drop the item from the array */
+  g_ptr_array_remove_index (icon_view->priv->items, idx);
 
   /* release the item */
   g_slice_free (ExoIconViewItem, item);
 
   /* update indices */
-  for (; next; next = next->next)
-    {
-      item = next->data;
-
-      item->index--;
-    }
+  for (n = idx; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+    EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->index--;
   verify_items (icon_view);
 
-  /* recalculate the layout */
-  exo_icon_view_queue_layout (icon_view);
+  /* recalculate the layout, the items before the removed one stay */
+  exo_icon_view_queue_layout_from (icon_view, idx);
 
   /* if we removed a previous selected item, we need
    * to tell others that we have a new selection.
@@ -4545,11 +4992,9 @@ exo_icon_view_rows_reordered (GtkTreeModel *model,
                               gint         *new_order,
                               ExoIconView  *icon_view)
 {
-  GList **list_array;
-  GList  *list;
-  gint   *order;
-  gint     length;
-  gint     i;
+  gpointer *items;
+  gint      length;
+  gint      i;
 
   /* cancel any editing attempt */
   exo_icon_view_stop_editing (icon_view, TRUE);
@@ -4559,30 +5004,15 @@ exo_icon_view_rows_reordered (GtkTreeModel *model,
   if (G_UNLIKELY (length == 0))
     return;
 
-  list_array = g_newa (GList *, length);
-  order = g_newa (gint, length);
-
+  /* new_order[i] is the old position of the item which is at i now */
+  items = g_new (gpointer, length);
+  memcpy (items, icon_view->priv->items->pdata, length * sizeof (gpointer));
   for (i = 0; i < length; i++)
-    order[new_order[i]] = i;
-
-  for (i = 0, list = icon_view->priv->items; list != NULL; list = list->next, i++)
-    list_array[order[i]] = list;
-
-  /* hook up the first item */
-  icon_view->priv->items = list_array[0];
-  list_array[0]->prev = NULL;
-  ((ExoIconViewItem*)list_array[0]->data)->index = 0;
-
-  /* hook up the remaining items */
-  for (i = 1; i < length; ++i)
     {
-      ((ExoIconViewItem*)list_array[i]->data)->index = i;
-      list_array[i - 1]->next = list_array[i];
-      list_array[i]->prev = list_array[i - 1];
+      g_ptr_array_index (icon_view->priv->items, i) = items[new_order[i]];
+      EXO_ICON_VIEW_NTH_ITEM (icon_view, i)->index = i;
     }
-
-  /* hook up the last item */
-  list_array[length - 1]->next = NULL;
+  g_free (items);
 
   exo_icon_view_queue_layout (icon_view);
   verify_items (icon_view);
@@ -4761,37 +5191,38 @@ find_item_page_up_down (ExoIconView     *icon_view,
                         ExoIconViewItem *current,
                         gint             count)
 {
-  GList *item = g_list_find (icon_view->priv->items, current);
-  GList *next;
-  gint   col = current->col;
-  gint   y = current->area.y + count * gtk_adjustment_get_page_size(icon_view->priv->vadjustment);
+  gint n_items = EXO_ICON_VIEW_N_ITEMS (icon_view);
+  gint item = current->index;
+  gint next;
+  gint col = current->col;
+  gint y = current->area.y + count * gtk_adjustment_get_page_size(icon_view->priv->vadjustment);
 
   if (count > 0)
     {
-      for (; item != NULL; item = item->next)
+      for (; item < n_items; item++)
         {
-          for (next = item->next; next; next = next->next)
-            if (EXO_ICON_VIEW_ITEM (next->data)->col == col)
+          for (next = item + 1; next < n_items; next++)
+            if (EXO_ICON_VIEW_NTH_ITEM (icon_view, next)->col == col)
               break;
 
-          if (next == NULL || EXO_ICON_VIEW_ITEM (next->data)->area.y > y)
+          if (next >= n_items || EXO_ICON_VIEW_NTH_ITEM (icon_view, next)->area.y > y)
             break;
         }
     }
   else
     {
-      for (; item != NULL; item = item->prev)
+      for (; item >= 0; item--)
         {
-          for (next = item->prev; next; next = next->prev)
-            if (EXO_ICON_VIEW_ITEM (next->data)->col == col)
+          for (next = item - 1; next >= 0; next--)
+            if (EXO_ICON_VIEW_NTH_ITEM (icon_view, next)->col == col)
               break;
 
-          if (next == NULL || EXO_ICON_VIEW_ITEM (next->data)->area.y < y)
+          if (next < 0 || EXO_ICON_VIEW_NTH_ITEM (icon_view, next)->area.y < y)
             break;
         }
     }
 
-  return (item != NULL) ? item->data : NULL;
+  return (item >= 0 && item < n_items) ? EXO_ICON_VIEW_NTH_ITEM (icon_view, item) : NULL;
 }
 
 
@@ -4801,29 +5232,25 @@ exo_icon_view_select_all_between (ExoIconView     *icon_view,
                                   ExoIconViewItem *anchor,
                                   ExoIconViewItem *cursor)
 {
-  GList *items;
-  ExoIconViewItem *item, *last;
+  ExoIconViewItem *item, *first, *last;
   gboolean dirty = FALSE;
+  gint n;
 
-  for (items = icon_view->priv->items; items; items = items->next)
+  /* select from the one which comes first to the other one */
+  if (anchor == NULL || (cursor != NULL && cursor->index < anchor->index))
     {
-      item = items->data;
-
-      if (item == anchor)
-        {
-          last = cursor;
-          break;
-        }
-      else if (item == cursor)
-        {
-          last = anchor;
-          break;
-        }
+      first = cursor;
+      last = anchor;
+    }
+  else
+    {
+      first = anchor;
+      last = cursor;
     }
 
-  for (; items; items = items->next)
+  for (n = (first != NULL) ? first->index : EXO_ICON_VIEW_N_ITEMS (icon_view); n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = items->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       if (!item->selected)
       {
@@ -4849,21 +5276,21 @@ exo_icon_view_move_cursor_up_down (ExoIconView *icon_view,
 {
   ExoIconViewItem *item;
   gboolean         dirty = FALSE;
-  GList           *list;
   gint             cell = -1;
   gint             step;
+  gint             n;
 
   if (!gtk_widget_has_focus (GTK_WIDGET (icon_view)))
     return;
 
   if (!icon_view->priv->cursor_item)
     {
-      if (count > 0)
-        list = icon_view->priv->items;
+      if (EXO_ICON_VIEW_N_ITEMS (icon_view) == 0)
+        item = NULL;
+      else if (count > 0)
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, 0);
       else
-        list = g_list_last (icon_view->priv->items);
-
-      item = list ? list->data : NULL;
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, EXO_ICON_VIEW_N_ITEMS (icon_view) - 1);
     }
   else
     {
@@ -4878,34 +5305,34 @@ exo_icon_view_move_cursor_up_down (ExoIconView *icon_view,
           if (count == 0)
             break;
 
-          /* determine the list position for the item */
-          list = g_list_find (icon_view->priv->items, item);
+          /* determine the array position for the item */
+          n = item->index;
 
           if (G_LIKELY (icon_view->priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
             {
               /* determine the item in the next/prev row */
               if (step > 0)
                 {
-                  for (list = list->next; list != NULL; list = list->next)
-                    if (EXO_ICON_VIEW_ITEM (list->data)->row == item->row + step
-                        && EXO_ICON_VIEW_ITEM (list->data)->col == item->col)
+                  for (n = n + 1; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+                    if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->row == item->row + step
+                        && EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->col == item->col)
                       break;
                  }
               else
                 {
-                  for (list = list->prev; list != NULL; list = list->prev)
-                    if (EXO_ICON_VIEW_ITEM (list->data)->row == item->row + step
-                        && EXO_ICON_VIEW_ITEM (list->data)->col == item->col)
+                  for (n = n - 1; n >= 0; n--)
+                    if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->row == item->row + step
+                        && EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->col == item->col)
                       break;
                 }
             }
           else
             {
-              list = (step > 0) ? list->next : list->prev;
+              n += step;
             }
 
           /* check if we found a matching item */
-          item = (list != NULL) ? list->data : NULL;
+          item = (n >= 0 && n < EXO_ICON_VIEW_N_ITEMS (icon_view)) ? EXO_ICON_VIEW_NTH_ITEM (icon_view, n) : NULL;
 
           count = count - step;
         }
@@ -4954,14 +5381,12 @@ exo_icon_view_move_cursor_page_up_down (ExoIconView *icon_view,
 
   if (!icon_view->priv->cursor_item)
     {
-      GList *list;
-
-      if (count > 0)
-        list = icon_view->priv->items;
+      if (EXO_ICON_VIEW_N_ITEMS (icon_view) == 0)
+        item = NULL;
+      else if (count > 0)
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, 0);
       else
-        list = g_list_last (icon_view->priv->items);
-
-      item = list ? list->data : NULL;
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, EXO_ICON_VIEW_N_ITEMS (icon_view) - 1);
     }
   else
     item = find_item_page_up_down (icon_view,
@@ -5005,9 +5430,9 @@ exo_icon_view_move_cursor_left_right (ExoIconView *icon_view,
 {
   ExoIconViewItem *item;
   gboolean         dirty = FALSE;
-  GList           *list;
   gint             cell = -1;
   gint             step;
+  gint             n;
 
   if (!gtk_widget_has_focus (GTK_WIDGET (icon_view)))
     return;
@@ -5017,12 +5442,12 @@ exo_icon_view_move_cursor_left_right (ExoIconView *icon_view,
 
   if (!icon_view->priv->cursor_item)
     {
-      if (count > 0)
-        list = icon_view->priv->items;
+      if (EXO_ICON_VIEW_N_ITEMS (icon_view) == 0)
+        item = NULL;
+      else if (count > 0)
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, 0);
       else
-        list = g_list_last (icon_view->priv->items);
-
-      item = list ? list->data : NULL;
+        item = EXO_ICON_VIEW_NTH_ITEM (icon_view, EXO_ICON_VIEW_N_ITEMS (icon_view) - 1);
     }
   else
     {
@@ -5037,38 +5462,38 @@ exo_icon_view_move_cursor_left_right (ExoIconView *icon_view,
           if (count == 0)
             break;
 
-          /* lookup the item in the list */
-          list = g_list_find (icon_view->priv->items, item);
+          /* lookup the item in the array */
+          n = item->index;
 
           if (G_LIKELY (icon_view->priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
             {
-              /* determine the next/prev list item depending on step,
+              /* determine the next/prev item depending on step,
                * support wrapping around on the edges, as requested
                * in http://bugzilla.xfce.org/show_bug.cgi?id=1623.
                */
-              list = (step > 0) ? list->next : list->prev;
+              n += step;
             }
           else
             {
               /* determine the item in the next/prev row */
               if (step > 0)
                 {
-                  for (list = list->next; list != NULL; list = list->next)
-                    if (EXO_ICON_VIEW_ITEM (list->data)->col == item->col + step
-                        && EXO_ICON_VIEW_ITEM (list->data)->row == item->row)
+                  for (n = n + 1; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
+                    if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->col == item->col + step
+                        && EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->row == item->row)
                       break;
                  }
               else
                 {
-                  for (list = list->prev; list != NULL; list = list->prev)
-                    if (EXO_ICON_VIEW_ITEM (list->data)->col == item->col + step
-                        && EXO_ICON_VIEW_ITEM (list->data)->row == item->row)
+                  for (n = n - 1; n >= 0; n--)
+                    if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->col == item->col + step
+                        && EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->row == item->row)
                       break;
                 }
             }
 
-          /* determine the item for the list position (if any) */
-          item = (list != NULL) ? list->data : NULL;
+          /* determine the item for the array position (if any) */
+          item = (n >= 0 && n < EXO_ICON_VIEW_N_ITEMS (icon_view)) ? EXO_ICON_VIEW_NTH_ITEM (icon_view, n) : NULL;
 
           count = count - step;
         }
@@ -5111,13 +5536,16 @@ exo_icon_view_move_cursor_start_end (ExoIconView *icon_view,
 {
   ExoIconViewItem *item;
   gboolean         dirty = FALSE;
-  GList           *lp;
 
   if (!gtk_widget_has_focus (GTK_WIDGET (icon_view)))
     return;
 
-  lp = (count < 0) ? icon_view->priv->items : g_list_last (icon_view->priv->items);
-  item = lp ? EXO_ICON_VIEW_ITEM (lp->data) : NULL;
+  if (EXO_ICON_VIEW_N_ITEMS (icon_view) == 0)
+    item = NULL;
+  else if (count < 0)
+    item = EXO_ICON_VIEW_NTH_ITEM (icon_view, 0);
+  else
+    item = EXO_ICON_VIEW_NTH_ITEM (icon_view, EXO_ICON_VIEW_N_ITEMS (icon_view) - 1);
 
   if (item == icon_view->priv->cursor_item)
     gtk_widget_error_bell (GTK_WIDGET (icon_view));
@@ -5634,10 +6062,9 @@ exo_icon_view_get_visible_range (const ExoIconView *icon_view,
 {
   const ExoIconViewPrivate *priv = icon_view->priv;
   const ExoIconViewItem    *item;
-  const GList              *lp;
   gint                      start_index = -1;
   gint                      end_index = -1;
-  gint                      i;
+  gint                      i = 0;
 
   g_return_val_if_fail (EXO_IS_ICON_VIEW (icon_view), FALSE);
 
@@ -5647,9 +6074,16 @@ exo_icon_view_get_visible_range (const ExoIconView *icon_view,
   if (start_path == NULL && end_path == NULL)
     return FALSE;
 
-  for (i = 0, lp = priv->items; lp != NULL; ++i, lp = lp->next)
+  /* the rows above the visible area can be skipped */
+  if (G_LIKELY (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS))
+    i = exo_icon_view_find_first_item_below (icon_view, (gint) gtk_adjustment_get_value(priv->vadjustment));
+
+  for (; i < EXO_ICON_VIEW_N_ITEMS (icon_view); ++i)
     {
-      item = (const ExoIconViewItem *) lp->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, i);
+      if (priv->layout_mode == EXO_ICON_VIEW_LAYOUT_ROWS &&
+          item->area.y > (gint) (gtk_adjustment_get_value(priv->vadjustment) + gtk_adjustment_get_page_size(priv->vadjustment)))
+        break;
       if ((item->area.x + item->area.width >= (gint) gtk_adjustment_get_value(priv->hadjustment)) &&
           (item->area.y + item->area.height >= (gint) gtk_adjustment_get_value(priv->vadjustment)) &&
           (item->area.x <= (gint) (gtk_adjustment_get_value(priv->hadjustment) + gtk_adjustment_get_page_size(priv->hadjustment))) &&
@@ -5686,12 +6120,12 @@ exo_icon_view_selected_foreach (ExoIconView           *icon_view,
                                 gpointer               data)
 {
   GtkTreePath *path;
-  GList       *lp;
+  gint         n;
 
   path = gtk_tree_path_new_first ();
-  for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      if (EXO_ICON_VIEW_ITEM (lp->data)->selected)
+      if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->selected)
         (*func) (icon_view, path, data);
       gtk_tree_path_next (path);
     }
@@ -5832,8 +6266,6 @@ exo_icon_view_set_model (ExoIconView  *icon_view,
 {
   ExoIconViewItem *item;
   GtkTreeIter      iter;
-  GList           *items = NULL;
-  GList           *lp;
   gint             n;
 
   g_return_if_fail (EXO_IS_ICON_VIEW (icon_view));
@@ -5874,13 +6306,13 @@ exo_icon_view_set_model (ExoIconView  *icon_view,
       g_object_unref (G_OBJECT (icon_view->priv->model));
 
       /* drop all items belonging to the previous model */
-      for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+      for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
         {
-          g_free (EXO_ICON_VIEW_ITEM (lp->data)->box);
-          g_slice_free (ExoIconViewItem, lp->data);
+          item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
+          g_free (item->box);
+          g_slice_free (ExoIconViewItem, item);
         }
-      g_list_free (icon_view->priv->items);
-      icon_view->priv->items = NULL;
+      g_ptr_array_set_size (icon_view->priv->items, 0);
 
       /* reset statistics */
       icon_view->priv->search_column = -1;
@@ -5941,7 +6373,7 @@ exo_icon_view_set_model (ExoIconView  *icon_view,
               }
         }
 
-      /* build up the initial items list */
+      /* build up the initial items array */
       if (gtk_tree_model_get_iter_first (model, &iter))
         {
           n = 0;
@@ -5951,11 +6383,10 @@ exo_icon_view_set_model (ExoIconView  *icon_view,
               item->iter = iter;
               item->area.width = -1;
               item->index = n++;
-              items = g_list_prepend (items, item);
+              g_ptr_array_add (icon_view->priv->items, item);
             }
           while (gtk_tree_model_iter_next (model, &iter));
         }
-      icon_view->priv->items = g_list_reverse (items);
 
       /* layout the new items */
       exo_icon_view_queue_layout (icon_view);
@@ -6099,7 +6530,7 @@ exo_icon_view_select_path (ExoIconView *icon_view,
   g_return_if_fail (icon_view->priv->model != NULL);
   g_return_if_fail (gtk_tree_path_get_depth (path) > 0);
 
-  item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+  item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices(path)[0]);
   if (G_LIKELY (item != NULL))
     exo_icon_view_select_item (icon_view, item);
 }
@@ -6123,7 +6554,7 @@ exo_icon_view_unselect_path (ExoIconView *icon_view,
   g_return_if_fail (icon_view->priv->model != NULL);
   g_return_if_fail (gtk_tree_path_get_depth (path) > 0);
 
-  item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+  item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices(path)[0]);
   if (G_LIKELY (item != NULL))
     exo_icon_view_unselect_item (icon_view, item);
 }
@@ -6151,15 +6582,14 @@ GList*
 exo_icon_view_get_selected_items (const ExoIconView *icon_view)
 {
   GList *selected = NULL;
-  GList *lp;
   gint   i;
 
   g_return_val_if_fail (EXO_IS_ICON_VIEW (icon_view), NULL);
 
-  for (i = 0, lp = icon_view->priv->items; lp != NULL; ++i, lp = lp->next)
+  for (i = EXO_ICON_VIEW_N_ITEMS (icon_view); --i >= 0; )
     {
-      if (EXO_ICON_VIEW_ITEM (lp->data)->selected)
-        selected = g_list_append (selected, gtk_tree_path_new_from_indices (i, -1));
+      if (EXO_ICON_VIEW_NTH_ITEM (icon_view, i)->selected)
+        selected = g_list_prepend (selected, gtk_tree_path_new_from_indices (i, -1));
     }
 
   return selected;
@@ -6169,14 +6599,14 @@ exo_icon_view_get_selected_items (const ExoIconView *icon_view)
 
 gint exo_icon_view_count_selected_items (const ExoIconView *icon_view)
 {
-  GList *lp;
+  gint   n;
   gint   i = 0;
 
   g_return_val_if_fail (EXO_IS_ICON_VIEW (icon_view), 0);
 
-  for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      if (EXO_ICON_VIEW_ITEM (lp->data)->selected)
+      if (EXO_ICON_VIEW_NTH_ITEM (icon_view, n)->selected)
         i++;
     }
 
@@ -6195,17 +6625,17 @@ gint exo_icon_view_count_selected_items (const ExoIconView *icon_view)
 void
 exo_icon_view_select_all (ExoIconView *icon_view)
 {
-  GList *items;
   gboolean dirty = FALSE;
+  gint n;
 
   g_return_if_fail (EXO_IS_ICON_VIEW (icon_view));
 
   if (icon_view->priv->selection_mode != GTK_SELECTION_MULTIPLE)
     return;
 
-  for (items = icon_view->priv->items; items; items = items->next)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      ExoIconViewItem *item = items->data;
+      ExoIconViewItem *item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       if (!item->selected)
         {
@@ -6261,7 +6691,7 @@ exo_icon_view_path_is_selected (const ExoIconView *icon_view,
   g_return_val_if_fail (icon_view->priv->model != NULL, FALSE);
   g_return_val_if_fail (gtk_tree_path_get_depth (path) > 0, FALSE);
 
-  item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+  item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices(path)[0]);
 
   return (item != NULL && item->selected);
 }
@@ -6363,7 +6793,7 @@ exo_icon_view_set_cursor (ExoIconView     *icon_view,
 
   exo_icon_view_stop_editing (icon_view, TRUE);
 
-  item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+  item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices(path)[0]);
   if (G_UNLIKELY (item == NULL))
     return;
 
@@ -6447,7 +6877,7 @@ exo_icon_view_scroll_to_path (ExoIconView *icon_view,
     }
   else
     {
-      item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices(path)[0]);
+      item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices(path)[0]);
       if (G_UNLIKELY (item == NULL))
         return;
 
@@ -6642,6 +7072,54 @@ exo_icon_view_set_item_width (ExoIconView *icon_view,
 
 
 
+/**
+ * exo_icon_view_get_fixed_item_size:
+ * @icon_view: a #ExoIconView
+ *
+ * Returns the value of the ::fixed-item-size property.
+ *
+ * Return value: %TRUE if all items are laid out with the same size
+ */
+gboolean
+exo_icon_view_get_fixed_item_size (const ExoIconView *icon_view)
+{
+  g_return_val_if_fail (EXO_IS_ICON_VIEW (icon_view), FALSE);
+  return icon_view->priv->fixed_item_size;
+}
+
+
+
+/**
+ * exo_icon_view_set_fixed_item_size:
+ * @icon_view       : a #ExoIconView
+ * @fixed_item_size : whether all items have the same size
+ *
+ * Sets the ::fixed-item-size property. If it is %TRUE, items are
+ * laid out as a grid of cells of the size of the largest item seen
+ * so far, and only the items which are shown get measured. This is
+ * much faster for big models but every item gets the same space.
+ * It has effect only for %EXO_ICON_VIEW_LAYOUT_ROWS layout mode.
+ */
+void
+exo_icon_view_set_fixed_item_size (ExoIconView *icon_view,
+                                   gboolean     fixed_item_size)
+{
+  g_return_if_fail (EXO_IS_ICON_VIEW (icon_view));
+
+  fixed_item_size = !!fixed_item_size;
+  if (icon_view->priv->fixed_item_size != fixed_item_size)
+    {
+      icon_view->priv->fixed_item_size = fixed_item_size;
+
+      exo_icon_view_stop_editing (icon_view, TRUE);
+      exo_icon_view_invalidate_sizes (icon_view);
+
+      g_object_notify (G_OBJECT (icon_view), "fixed-item-size");
+    }
+}
+
+
+
 /**
  * exo_icon_view_get_spacing:
  * @icon_view: a #ExoIconView
@@ -7784,7 +8262,7 @@ exo_icon_view_set_drag_dest_item (ExoIconView            *icon_view,
       if (G_LIKELY (previous_path != NULL))
         {
           /* schedule a redraw for the previous path */
-          item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices (previous_path)[0]);
+          item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices (previous_path)[0]);
           if (G_LIKELY (item != NULL))
             exo_icon_view_queue_draw_item (icon_view, item);
           gtk_tree_path_free (previous_path);
@@ -7814,7 +8292,7 @@ exo_icon_view_set_drag_dest_item (ExoIconView            *icon_view,
       icon_view->priv->dest_item = gtk_tree_row_reference_new_proxy (G_OBJECT (icon_view), icon_view->priv->model, path);
 
       /* schedule a redraw on the new path */
-      item = g_list_nth_data (icon_view->priv->items, gtk_tree_path_get_indices (path)[0]);
+      item = exo_icon_view_nth_item (icon_view, gtk_tree_path_get_indices (path)[0]);
       if (G_LIKELY (item != NULL))
         exo_icon_view_queue_draw_item (icon_view, item);
     }
@@ -7944,9 +8422,9 @@ exo_icon_view_create_drag_icon (ExoIconView *icon_view,
 #endif
   GdkPixbuf   *pixbuf;
   cairo_t     *cr;
-  GList       *lp;
   GtkStyle    *style;
   gint         idx;
+  ExoIconViewItem *item;
 
   g_return_val_if_fail (EXO_IS_ICON_VIEW (icon_view), NULL);
   g_return_val_if_fail (gtk_tree_path_get_depth (path) > 0, NULL);
@@ -7958,64 +8436,61 @@ exo_icon_view_create_drag_icon (ExoIconView *icon_view,
   idx = gtk_tree_path_get_indices (path)[0];
   style = gtk_widget_get_style (widget);
 
-  for (lp = icon_view->priv->items; lp != NULL; lp = lp->next)
+  item = exo_icon_view_nth_item (icon_view, idx);
+  if (G_LIKELY (item != NULL))
     {
-      ExoIconViewItem *item = lp->data;
-      if (G_UNLIKELY (idx == item->index))
-        {
 #if GTK_CHECK_VERSION(3, 0, 0)
-          s = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
-                                          item->area.width + 2,
-                                          item->area.height + 2);
+      s = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+                                      item->area.width + 2,
+                                      item->area.height + 2);
 
-          cr = cairo_create (s);
+      cr = cairo_create (s);
 #else
-          drawable = gdk_pixmap_new (icon_view->priv->bin_window,
-                                     item->area.width + 2,
-                                     item->area.height + 2,
-                                     -1);
+      drawable = gdk_pixmap_new (icon_view->priv->bin_window,
+                                 item->area.width + 2,
+                                 item->area.height + 2,
+                                 -1);
 
-          cr = gdk_cairo_create (drawable);
+      cr = gdk_cairo_create (drawable);
 #endif
-          gdk_cairo_set_source_color (cr, &style->base[gtk_widget_get_state (widget)]);
-          cairo_rectangle (cr, 0, 0, item->area.width + 2, item->area.height + 2);
-          cairo_fill (cr);
+      gdk_cairo_set_source_color (cr, &style->base[gtk_widget_get_state (widget)]);
+      cairo_rectangle (cr, 0, 0, item->area.width + 2, item->area.height + 2);
+      cairo_fill (cr);
 
-          area.x = 0;
-          area.y = 0;
-          area.width = item->area.width;
-          area.height = item->area.height;
+      area.x = 0;
+      area.y = 0;
+      area.width = item->area.width;
+      area.height = item->area.height;
 
 #if GTK_CHECK_VERSION(3, 0, 0)
-          exo_icon_view_paint_item (icon_view, item, &area, cr, 1, 1, FALSE);
+      exo_icon_view_paint_item (icon_view, item, &area, cr, 1, 1, FALSE);
 #else
-          /* NOTE: this is inefficient but Gtk+2 uses GtkWindow for render */
-          exo_icon_view_paint_item (icon_view, item, &area, drawable, 1, 1, FALSE);
+      /* NOTE: this is inefficient but Gtk+2 uses GtkWindow for render */
+      exo_icon_view_paint_item (icon_view, item, &area, drawable, 1, 1, FALSE);
 #endif
 
-          gdk_cairo_set_source_color (cr, &style->black);
-          cairo_rectangle (cr, 1, 1, item->area.width + 1, item->area.height + 1);
-          cairo_stroke (cr);
+      gdk_cairo_set_source_color (cr, &style->black);
+      cairo_rectangle (cr, 1, 1, item->area.width + 1, item->area.height + 1);
+      cairo_stroke (cr);
 
-          cairo_destroy (cr);
+      cairo_destroy (cr);
 
 #if GTK_CHECK_VERSION(3, 0, 0)
-          pixbuf = gdk_pixbuf_get_from_surface (s, 0, 0,
-                                                item->area.width + 2,
-                                                item->area.height + 2);
-          cairo_surface_destroy (s);
+      pixbuf = gdk_pixbuf_get_from_surface (s, 0, 0,
+                                            item->area.width + 2,
+                                            item->area.height + 2);
+      cairo_surface_destroy (s);
 
-          return pixbuf;
+      return pixbuf;
 #else
-          pixbuf = gdk_pixbuf_get_from_drawable (NULL, drawable,
-                                                 gdk_drawable_get_colormap (drawable),
-                                                 0, 0, 0, 0,
-                                                 item->area.width + 2,
-                                                 item->area.height + 2);
-          g_object_unref (drawable);
-          return pixbuf;
+      pixbuf = gdk_pixbuf_get_from_drawable (NULL, drawable,
+                                             gdk_drawable_get_colormap (drawable),
+                                             0, 0, 0, 0,
+                                             item->area.width + 2,
+                                             item->area.height + 2);
+      g_object_unref (drawable);
+      return pixbuf;
 #endif
-        }
     }
 
   return NULL;
@@ -10262,7 +10737,7 @@ exo_icon_view_accessible_get_n_children (AtkObject *accessible)
 
   icon_view = EXO_ICON_VIEW (widget);
 
-  return g_list_length (icon_view->priv->items);
+  return EXO_ICON_VIEW_N_ITEMS (icon_view);
 }
 
 static AtkObject *
@@ -10292,7 +10767,7 @@ exo_icon_view_accessible_ref_child (AtkObject *accessible,
 {
   ExoIconView *icon_view;
   GtkWidget *widget;
-  GList *icons;
+  ExoIconViewItem *item;
   AtkObject *obj;
   ExoIconViewItemAccessible *a11y_item;
 
@@ -10301,12 +10776,10 @@ exo_icon_view_accessible_ref_child (AtkObject *accessible,
     return NULL;
 
   icon_view = EXO_ICON_VIEW (widget);
-  icons = g_list_nth (icon_view->priv->items, index);
+  item = exo_icon_view_nth_item (icon_view, index);
   obj = NULL;
-  if (icons)
+  if (item)
     {
-      ExoIconViewItem *item = icons->data;
-
       g_return_val_if_fail (item->index == index, NULL);
       obj = exo_icon_view_accessible_find_child (accessible, index);
       if (!obj)
@@ -10639,7 +11112,7 @@ exo_icon_view_accessible_model_rows_reordered (GtkTreeModel *tree_model,
       info = items->data;
       item = EXO_ICON_VIEW_ITEM_ACCESSIBLE (info->item);
       info->index = order[info->index];
-      item->item = g_list_nth_data (icon_view->priv->items, info->index);
+      item->item = exo_icon_view_nth_item (icon_view, info->index);
       items = items->next;
     }
   g_free (order);
@@ -10918,7 +11391,7 @@ exo_icon_view_accessible_add_selection (AtkSelection *selection,
 
   icon_view = EXO_ICON_VIEW (widget);
 
-  item = g_list_nth_data (icon_view->priv->items, i);
+  item = exo_icon_view_nth_item (icon_view, i);
 
   if (!item)
     return FALSE;
@@ -10948,7 +11421,7 @@ static AtkObject*
 exo_icon_view_accessible_ref_selection (AtkSelection *selection,
                                         gint          i)
 {
-  GList *l;
+  gint n;
   GtkWidget *widget;
   ExoIconView *icon_view;
   ExoIconViewItem *item;
@@ -10959,10 +11432,9 @@ exo_icon_view_accessible_ref_selection (AtkSelection *selection,
 
   icon_view = EXO_ICON_VIEW (widget);
 
-  l = icon_view->priv->items;
-  while (l)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = l->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
       if (item->selected)
         {
           if (i == 0)
@@ -10970,7 +11442,6 @@ exo_icon_view_accessible_ref_selection (AtkSelection *selection,
           else
             i--;
         }
-      l = l->next;
     }
 
   return NULL;
@@ -10982,7 +11453,7 @@ exo_icon_view_accessible_get_selection_count (AtkSelection *selection)
   GtkWidget *widget;
   ExoIconView *icon_view;
   ExoIconViewItem *item;
-  GList *l;
+  gint n;
   gint count;
 
   widget = gtk_accessible_get_widget (GTK_ACCESSIBLE (selection));
@@ -10991,16 +11462,13 @@ exo_icon_view_accessible_get_selection_count (AtkSelection *selection)
 
   icon_view = EXO_ICON_VIEW (widget);
 
-  l = icon_view->priv->items;
   count = 0;
-  while (l)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = l->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
 
       if (item->selected)
 	count++;
-
-      l = l->next;
     }
 
   return count;
@@ -11020,7 +11488,7 @@ exo_icon_view_accessible_is_child_selected (AtkSelection *selection,
 
   icon_view = EXO_ICON_VIEW (widget);
 
-  item = g_list_nth_data (icon_view->priv->items, i);
+  item = exo_icon_view_nth_item (icon_view, i);
   if (!item)
     return FALSE;
 
@@ -11034,7 +11502,7 @@ exo_icon_view_accessible_remove_selection (AtkSelection *selection,
   GtkWidget *widget;
   ExoIconView *icon_view;
   ExoIconViewItem *item;
-  GList *l;
+  gint n;
   gint count;
 
   widget = gtk_accessible_get_widget (GTK_ACCESSIBLE (selection));
@@ -11042,11 +11510,10 @@ exo_icon_view_accessible_remove_selection (AtkSelection *selection,
     return FALSE;
 
   icon_view = EXO_ICON_VIEW (widget);
-  l = icon_view->priv->items;
   count = 0;
-  while (l)
+  for (n = 0; n < EXO_ICON_VIEW_N_ITEMS (icon_view); n++)
     {
-      item = l->data;
+      item = EXO_ICON_VIEW_NTH_ITEM (icon_view, n);
       if (item->selected)
         {
           if (count == i)
@@ -11056,7 +11523,6 @@ exo_icon_view_accessible_remove_selection (AtkSelection *selection,
             }
           count++;
         }
-      l = l->next;
     }
 
   return FALSE;
@@ -198,6 +198,10 @@ gint                  exo_icon_view_get_item_width            (const ExoIconView
 void                  exo_icon_view_set_item_width            (ExoIconView              *icon_view,
                                                                gint                      item_width);
 
+gboolean              exo_icon_view_get_fixed_item_size       (const ExoIconView        *icon_view);
+void                  exo_icon_view_set_fixed_item_size       (ExoIconView              *icon_view,
+                                                               gboolean                  fixed_item_size);
+
 gint                  exo_icon_view_get_spacing               (const ExoIconView        *icon_view);
 void                  exo_icon_view_set_spacing               (ExoIconView              *icon_view,
                                                                gint                      spacing);
@@ -42,8 +42,15 @@
 
 #include <glib/gi18n-lib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
 
 typedef struct _FmDirTreeItem FmDirTreeItem;
+typedef struct _FmDirTreeSubdirCheck FmDirTreeSubdirCheck;
 struct _FmDirTreeItem
 {
     FmDirTreeModel* model; /* FIXME: storing model pointer in every item is a waste */
@@ -52,9 +59,13 @@ struct _FmDirTreeItem
     GdkPixbuf* icon;
     gboolean expanded;
     gboolean loaded;
-    GList* parent; /* parent node */
-    GList* children; /* child items */
+    FmDirTreeItem* parent; /* parent node */
+    GSequenceIter* seq_it; /* position in parent->children, NULL if not visible */
+    GSequence* children; /* child items sorted by collate key, NULL if empty */
+    GHashTable* names; /* basename -> item, for children with file info */
     GList* hidden_children;
+    FmDirTreeSubdirCheck* subdir_check; /* pending check, if any */
+    gboolean unprobed; /* should be checked for sub folders when shown */
 };
 
 static GType column_types[N_FM_DIR_TREE_MODEL_COLS];
@@ -71,8 +82,8 @@ static void fm_dir_tree_model_dispose            (GObject *object);
 static void fm_dir_tree_model_tree_model_init(GtkTreeModelIface *iface);
 static GtkTreePath *fm_dir_tree_model_get_path ( GtkTreeModel *tree_model, GtkTreeIter *iter );
 
-static inline void item_to_tree_iter(FmDirTreeModel* model, GList* item_l, GtkTreeIter* it);
-static inline GtkTreePath* item_to_tree_path(FmDirTreeModel* model, GList* item_l);
+static inline void item_to_tree_iter(FmDirTreeModel* model, FmDirTreeItem* item, GtkTreeIter* it);
+static inline GtkTreePath* item_to_tree_path(FmDirTreeModel* model, FmDirTreeItem* item);
 
 G_DEFINE_TYPE_WITH_CODE( FmDirTreeModel, fm_dir_tree_model, G_TYPE_OBJECT,
                         G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, fm_dir_tree_model_tree_model_init)
@@ -80,48 +91,53 @@ G_DEFINE_TYPE_WITH_CODE( FmDirTreeModel, fm_dir_tree_model, G_TYPE_OBJECT,
                         G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_DRAG_DEST, fm_dir_tree_model_drag_dest_init) */
                         )
 
-/* a varient of g_list_foreach which does the same thing, but pass GList* element
- * itself as the first parameter to func(), not the element data. */
-static inline void _g_list_foreach_l(GList* list, GFunc func, gpointer user_data)
+static void item_queue_subdir_check(FmDirTreeModel* model, FmDirTreeItem* item);
+static inline void item_cancel_subdir_check(FmDirTreeItem* item);
+static inline void item_mark_unprobed(FmDirTreeItem* item);
+
+/* returns first child item or NULL if there are no children */
+static inline FmDirTreeItem* item_first_child(FmDirTreeItem* item)
 {
-    while (list)
-    {
-        GList *next = list->next;
-        (*func)(list, user_data);
-        list = next;
-    }
+    if(!item->children)
+        return NULL;
+    return (FmDirTreeItem*)g_sequence_get(g_sequence_get_begin_iter(item->children));
 }
 
-/*
-FIXME: this is convenience to have expanders actualized but it may be expensive
-static void item_queue_subdir_check(FmDirTreeModel* model, GList* item_l);
-*/
+/* returns index of the item among its visible siblings or -1 on error */
+static inline gint item_get_index(FmDirTreeModel* model, FmDirTreeItem* item)
+{
+    if(G_LIKELY(item->seq_it))
+        return g_sequence_iter_get_position(item->seq_it);
+    if(item->parent == NULL) /* root item */
+        return g_list_index(model->roots, item);
+    return -1; /* bug? the item is not a child of its parent? */
+}
 
-static void item_reload_icon(FmDirTreeModel* model, GList* item_l, GtkTreePath* tp)
+static void item_reload_icon(FmDirTreeModel* model, FmDirTreeItem* item, GtkTreePath* tp)
 {
     GtkTreeIter it;
     GList* l;
-    FmDirTreeItem *item, *child;
+    GSequenceIter* seq_it;
+    FmDirTreeItem *child;
 
-    g_return_if_fail(item_l && tp);
-    item = item_l->data;
-    g_return_if_fail(item);
+    g_return_if_fail(item && tp);
 
     if(item->icon)
     {
         g_object_unref(item->icon);
         item->icon = NULL;
-        item_to_tree_iter(model, item_l, &it);
+        item_to_tree_iter(model, item, &it);
         gtk_tree_model_row_changed(GTK_TREE_MODEL(model), tp, &it);
     }
 
     if(item->children)
     {
         gtk_tree_path_append_index(tp, 0);
-        for(l = item->children; l; l=l->next)
+        seq_it = g_sequence_get_begin_iter(item->children);
+        for(; !g_sequence_iter_is_end(seq_it); seq_it = g_sequence_iter_next(seq_it))
         {
-            child = (FmDirTreeItem*)l->data;
-            item_reload_icon(model, l, tp);
+            child = (FmDirTreeItem*)g_sequence_get(seq_it);
+            item_reload_icon(model, child, tp);
             gtk_tree_path_next(tp);
         }
         gtk_tree_path_up(tp);
@@ -137,7 +153,6 @@ static void item_reload_icon(FmDirTreeModel* model, GList* item_l, GtkTreePath*
         }
     }
 }
-
 static void fm_dir_tree_model_class_init(FmDirTreeModelClass *klass)
 {
     GObjectClass *g_object_class;
@@ -171,62 +186,66 @@ static void fm_dir_tree_model_class_init(FmDirTreeModelClass *klass)
 }
 
 
-static inline FmDirTreeItem* fm_dir_tree_item_new(FmDirTreeModel* model, GList* parent_l)
+static inline FmDirTreeItem* fm_dir_tree_item_new(FmDirTreeModel* model, FmDirTreeItem* parent)
 {
     FmDirTreeItem* item = g_slice_new0(FmDirTreeItem);
     item->model = model;
-    item->parent = parent_l;
+    item->parent = parent;
     return item;
 }
 
-static inline void item_free_folder(FmFolder* item, gpointer item_l);
+static inline void item_free_folder(FmFolder* folder, FmDirTreeItem* item);
 
-static void fm_dir_tree_item_free_l(GList* item_l);
+static void fm_dir_tree_item_free(FmDirTreeItem* item);
 
-/* Note: item_l below may be already freed so unusable as GList */
-static inline void fm_dir_tree_item_free(FmDirTreeItem* item, gpointer item_l)
+/* frees all child items, visible and hidden ones */
+static void item_free_children(FmDirTreeItem* item)
 {
-    if(item->folder)
-        item_free_folder(item->folder, item_l);
-    if(item->fi)
-        fm_file_info_unref(item->fi);
-    if(item->icon)
-        g_object_unref(item->icon);
+    if(item->names)
+    {
+        g_hash_table_destroy(item->names);
+        item->names = NULL;
+    }
     if(item->children)
     {
-        _g_list_foreach_l(item->children, (GFunc)fm_dir_tree_item_free_l, NULL);
-        g_list_free(item->children);
+        g_sequence_foreach(item->children, (GFunc)fm_dir_tree_item_free, NULL);
+        g_sequence_free(item->children);
+        item->children = NULL;
     }
     if(item->hidden_children)
     {
-        _g_list_foreach_l(item->hidden_children, (GFunc)fm_dir_tree_item_free_l, NULL);
+        g_list_foreach(item->hidden_children, (GFunc)fm_dir_tree_item_free, NULL);
         g_list_free(item->hidden_children);
+        item->hidden_children = NULL;
     }
-    g_slice_free(FmDirTreeItem, item);
 }
 
-/* Free the GList* element along with its associated FmDirTreeItem */
-static void fm_dir_tree_item_free_l(GList* item_l)
+static void fm_dir_tree_item_free(FmDirTreeItem* item)
 {
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
-
-    if(!item) /* is it possible? */
-        return;
-    fm_dir_tree_item_free(item, item_l);
+    if(item->subdir_check)
+        item_cancel_subdir_check(item);
+    if(item->folder)
+        item_free_folder(item->folder, item);
+    if(item->fi)
+        fm_file_info_unref(item->fi);
+    if(item->icon)
+        g_object_unref(item->icon);
+    item_free_children(item);
+    g_slice_free(FmDirTreeItem, item);
 }
 
-static inline void item_to_tree_iter(FmDirTreeModel* model, GList* item_l, GtkTreeIter* it)
+static inline void item_to_tree_iter(FmDirTreeModel* model, FmDirTreeItem* item, GtkTreeIter* it)
 {
     it->stamp = model->stamp;
-    /* We simply store a GList pointer in the iter */
-    it->user_data = item_l;
+    /* We simply store an item pointer in the iter */
+    it->user_data = item;
     it->user_data2 = it->user_data3 = NULL;
 }
 
-static inline GtkTreePath* item_to_tree_path(FmDirTreeModel* model, GList* item_l)
+static inline GtkTreePath* item_to_tree_path(FmDirTreeModel* model, FmDirTreeItem* item)
 {
     GtkTreeIter it;
-    item_to_tree_iter(model, item_l, &it);
+    item_to_tree_iter(model, item, &it);
     return fm_dir_tree_model_get_path((GtkTreeModel*)model, &it);
 }
 
@@ -236,7 +255,7 @@ static void on_theme_changed(GtkIconTheme* theme, FmDirTreeModel* model)
     GtkTreePath* tp = gtk_tree_path_new_first();
     for(l = model->roots; l; l=l->next)
     {
-        item_reload_icon(model, l, tp);
+        item_reload_icon(model, l->data, tp);
         gtk_tree_path_next(tp);
     }
     gtk_tree_path_free(tp);
@@ -256,13 +275,11 @@ static void fm_dir_tree_model_dispose(GObject *object)
 
     if(model->roots)
     {
-        _g_list_foreach_l(model->roots, (GFunc)fm_dir_tree_item_free_l, NULL);
+        g_list_foreach(model->roots, (GFunc)fm_dir_tree_item_free, NULL);
         g_list_free(model->roots);
         model->roots = NULL;
     }
 
-    /* TODO: g_object_unref(model->subdir_cancellable); */
-
     G_OBJECT_CLASS(fm_dir_tree_model_parent_class)->dispose(object);
 }
 
@@ -272,11 +289,6 @@ static void fm_dir_tree_model_init(FmDirTreeModel *model)
                      G_CALLBACK(on_theme_changed), model);
     model->icon_size = 16;
     model->stamp = g_random_int();
-    /* TODO:
-    g_queue_init(&model->subdir_checks);
-    model->subdir_checks_mutex = g_mutex_new();
-    model->subdir_cancellable = g_cancellable_new();
-    */
 }
 
 static GtkTreeModelFlags fm_dir_tree_model_get_flags (GtkTreeModel *tree_model)
@@ -295,13 +307,15 @@ static GType fm_dir_tree_model_get_column_type(GtkTreeModel *tree_model, gint in
     return column_types[index];
 }
 
+
 static gboolean fm_dir_tree_model_get_iter(GtkTreeModel *tree_model,
                                     GtkTreeIter *iter,
                                     GtkTreePath *path )
 {
     FmDirTreeModel *model;
     gint *indices, i, depth;
-    GList *children, *child = NULL;
+    FmDirTreeItem *item;
+    GSequenceIter *seq_it;
 
     g_assert(FM_IS_DIR_TREE_MODEL(tree_model));
     g_assert(path!=NULL);
@@ -312,29 +326,32 @@ static gboolean fm_dir_tree_model_get_iter(GtkTreeModel *tree_model,
 
     indices = gtk_tree_path_get_indices(path);
     depth   = gtk_tree_path_get_depth(path);
+    if( G_UNLIKELY(depth == 0) )
+        return FALSE;
 
-    children = model->roots;
-    for( i = 0; i < depth; ++i )
+    item = g_list_nth_data(model->roots, indices[0]);
+    if( !item )
+        return FALSE;
+    for( i = 1; i < depth; ++i )
     {
-        FmDirTreeItem* item;
-        child = g_list_nth(children, indices[i]);
-        if( !child )
+        if( !item->children || indices[i] < 0 )
+            return FALSE;
+        seq_it = g_sequence_get_iter_at_pos(item->children, indices[i]);
+        if( g_sequence_iter_is_end(seq_it) )
             return FALSE;
-        item = (FmDirTreeItem*)child->data;
-        children = item->children;
+        item = (FmDirTreeItem*)g_sequence_get(seq_it);
     }
-    item_to_tree_iter(model, child, iter);
+    item_to_tree_iter(model, item, iter);
     return TRUE;
 }
 
 static GtkTreePath *fm_dir_tree_model_get_path(GtkTreeModel *tree_model,
                                                GtkTreeIter *iter )
 {
-    GList* item_l;
-    GList* children;
     FmDirTreeItem* item;
     GtkTreePath* path;
-    int i;
+    gint *indices;
+    int i, depth;
     FmDirTreeModel* model;
 
     g_return_val_if_fail (FM_IS_DIR_TREE_MODEL(tree_model), NULL);
@@ -343,39 +360,22 @@ static GtkTreePath *fm_dir_tree_model_get_path(GtkTreeModel *tree_model,
     g_return_val_if_fail (iter != NULL, NULL);
     g_return_val_if_fail (iter->user_data != NULL, NULL);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
-
-    if(item->parent == NULL) /* root item */
-    {
-        i = g_list_position(model->roots, item_l);
-        path = gtk_tree_path_new_first();
-        gtk_tree_path_get_indices(path)[0] = i;
-    }
-    else
+    /* collect indices bottom-up, each level is O(log n) */
+    depth = 0;
+    for(item = (FmDirTreeItem*)iter->user_data; item; item = item->parent)
+        ++depth;
+    indices = g_newa(gint, depth);
+    i = depth;
+    for(item = (FmDirTreeItem*)iter->user_data; item; item = item->parent)
     {
-        path = gtk_tree_path_new();
-        do
-        {
-            FmDirTreeItem* parent_item = (FmDirTreeItem*)item->parent->data;
-            children = parent_item->children;
-            i = g_list_position(children, item_l);
-            if(G_UNLIKELY(i == -1)) /* bug? the item is not a child of its parent? */
-            {
-                gtk_tree_path_free(path);
-                return NULL;
-            }
-            /* FIXME: gtk_tree_path_prepend_index() is inefficient */
-            gtk_tree_path_prepend_index(path, i);
-            item_l = item->parent; /* go up a level */
-            item = (FmDirTreeItem*)item_l->data;
-        }while(G_UNLIKELY(item->parent)); /* we're not at toplevel yet */
-
-        /* we have reached toplevel */
-        children = model->roots;
-        i = g_list_position(children, item_l);
-        gtk_tree_path_prepend_index(path, i);
+        indices[--i] = item_get_index(model, item);
+        if(G_UNLIKELY(indices[i] == -1))
+            return NULL;
     }
+
+    path = gtk_tree_path_new();
+    for(i = 0; i < depth; ++i)
+        gtk_tree_path_append_index(path, indices[i]);
     return path;
 }
 
@@ -385,7 +385,6 @@ static void fm_dir_tree_model_get_value ( GtkTreeModel *tree_model,
                               GValue *value )
 {
     FmDirTreeModel* model;
-    GList* item_l;
     FmDirTreeItem* item;
     FmIcon* icon;
 
@@ -394,8 +393,7 @@ static void fm_dir_tree_model_get_value ( GtkTreeModel *tree_model,
     g_return_if_fail (iter->stamp == model->stamp);
 
     g_value_init (value, column_types[column] );
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     switch((FmDirTreeModelCol)column)
     {
@@ -415,7 +413,7 @@ static void fm_dir_tree_model_get_value ( GtkTreeModel *tree_model,
         else /* this is a place holder item */
         {
             /* parent is always non NULL. otherwise it's a bug. */
-            FmDirTreeItem* parent = (FmDirTreeItem*)item->parent->data;
+            FmDirTreeItem* parent = item->parent;
             if(parent->folder && fm_folder_is_loaded(parent->folder))
                 g_value_set_string( value, _("<No subfolders>"));
             else
@@ -439,19 +437,30 @@ static gboolean fm_dir_tree_model_iter_next(GtkTreeModel *tree_model,
                                             GtkTreeIter *iter)
 {
     FmDirTreeModel* model;
-    GList* item_l;
+    FmDirTreeItem* item;
     g_return_val_if_fail (FM_IS_DIR_TREE_MODEL (tree_model), FALSE);
     if (iter == NULL || iter->user_data == NULL)
         return FALSE;
 
-    item_l = (GList*)iter->user_data;
+    model = (FmDirTreeModel*)tree_model;
+    item = (FmDirTreeItem*)iter->user_data;
     /* Is this the last child in the parent node? */
-    item_l = item_l->next;
-    if(!item_l)
-        return FALSE;
+    if(G_LIKELY(item->seq_it))
+    {
+        GSequenceIter* next = g_sequence_iter_next(item->seq_it);
+        if(g_sequence_iter_is_end(next))
+            return FALSE;
+        item = (FmDirTreeItem*)g_sequence_get(next);
+    }
+    else /* root item */
+    {
+        GList* item_l = g_list_find(model->roots, item);
+        if(!item_l || !item_l->next)
+            return FALSE;
+        item = (FmDirTreeItem*)item_l->next->data;
+    }
 
-    model = (FmDirTreeModel*)tree_model;
-    item_to_tree_iter(model, item_l, iter);
+    item_to_tree_iter(model, item, iter);
     return TRUE;
 }
 
@@ -460,22 +469,18 @@ static gboolean fm_dir_tree_model_iter_children(GtkTreeModel *tree_model,
                                                 GtkTreeIter *parent)
 {
     FmDirTreeModel* model;
-    GList *first_child;
+    FmDirTreeItem *first_child;
 
     g_return_val_if_fail(parent == NULL || parent->user_data != NULL, FALSE);
     g_return_val_if_fail(FM_IS_DIR_TREE_MODEL(tree_model), FALSE);
     model = (FmDirTreeModel*)tree_model;
 
     if(parent)
-    {
-        GList* parent_l = (GList*)parent->user_data;
-        FmDirTreeItem *parent_item = (FmDirTreeItem*)parent_l->data;
-        first_child = parent_item->children;
-    }
+        first_child = item_first_child((FmDirTreeItem*)parent->user_data);
     else /* toplevel item */
     {
         /* parent == NULL is a special case; we need to return the first top-level row */
-        first_child = model->roots;
+        first_child = model->roots ? (FmDirTreeItem*)model->roots->data : NULL;
     }
     if(!first_child)
         return FALSE;
@@ -488,13 +493,11 @@ static gboolean fm_dir_tree_model_iter_children(GtkTreeModel *tree_model,
 static gboolean fm_dir_tree_model_iter_has_child(GtkTreeModel *tree_model,
                                                  GtkTreeIter *iter)
 {
-    GList* item_l;
     FmDirTreeItem* item;
     g_return_val_if_fail( iter != NULL, FALSE );
     g_return_val_if_fail( iter->stamp == FM_DIR_TREE_MODEL(tree_model)->stamp, FALSE );
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
     return (item->children != NULL);
 }
 
@@ -502,20 +505,15 @@ static gint fm_dir_tree_model_iter_n_children(GtkTreeModel *tree_model,
                                               GtkTreeIter *iter)
 {
     FmDirTreeModel* model;
-    GList* children;
+    FmDirTreeItem* item;
     g_return_val_if_fail(FM_IS_DIR_TREE_MODEL(tree_model), -1);
 
     model = (FmDirTreeModel*)tree_model;
     /* special case: if iter == NULL, return number of top-level rows */
     if(!iter)
-        children = model->roots;
-    else
-    {
-        GList* item_l = (GList*)iter->user_data;
-        FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
-        children = item->children;
-    }
-    return g_list_length(children);
+        return g_list_length(model->roots);
+    item = (FmDirTreeItem*)iter->user_data;
+    return item->children ? g_sequence_get_length(item->children) : 0;
 }
 
 static gboolean fm_dir_tree_model_iter_nth_child(GtkTreeModel *tree_model,
@@ -524,25 +522,28 @@ static gboolean fm_dir_tree_model_iter_nth_child(GtkTreeModel *tree_model,
                                                  gint n)
 {
     FmDirTreeModel *model;
-    GList* children;
-    GList *child_l;
+    FmDirTreeItem *child;
 
     g_return_val_if_fail (FM_IS_DIR_TREE_MODEL (tree_model), FALSE);
     model = (FmDirTreeModel*)tree_model;
 
     if(G_LIKELY(parent))
     {
-        GList* parent_l = (GList*)parent->user_data;
-        FmDirTreeItem* item = (FmDirTreeItem*)parent_l->data;
-        children = item->children;
+        FmDirTreeItem* item = (FmDirTreeItem*)parent->user_data;
+        GSequenceIter* seq_it;
+        if(!item->children || n < 0)
+            return FALSE;
+        seq_it = g_sequence_get_iter_at_pos(item->children, n);
+        if(g_sequence_iter_is_end(seq_it))
+            return FALSE;
+        child = (FmDirTreeItem*)g_sequence_get(seq_it);
     }
     else /* special case: if parent == NULL, set iter to n-th top-level row */
-        children = model->roots;
-    child_l = g_list_nth(children, n);
-    if(!child_l)
+        child = g_list_nth_data(model->roots, n);
+    if(!child)
         return FALSE;
 
-    item_to_tree_iter(model, child_l, iter);
+    item_to_tree_iter(model, child, iter);
     return TRUE;
 }
 
@@ -550,14 +551,12 @@ static gboolean fm_dir_tree_model_iter_parent(GtkTreeModel *tree_model,
                                               GtkTreeIter *iter,
                                               GtkTreeIter *child)
 {
-    GList* child_l;
     FmDirTreeItem* child_item;
     FmDirTreeModel* model;
     g_return_val_if_fail( iter != NULL && child != NULL, FALSE );
 
     model = FM_DIR_TREE_MODEL( tree_model );
-    child_l = (GList*)child->user_data;
-    child_item = (FmDirTreeItem*)child_l->data;
+    child_item = (FmDirTreeItem*)child->user_data;
 
     if(G_LIKELY(child_item->parent))
     {
@@ -603,17 +602,19 @@ FmDirTreeModel *fm_dir_tree_model_new(void)
     return (FmDirTreeModel*)g_object_new(FM_TYPE_DIR_TREE_MODEL, NULL);
 }
 
-static void add_place_holder_child_item(FmDirTreeModel* model, GList* parent_l, GtkTreePath* parent_tp, gboolean emit_signal)
+
+static void add_place_holder_child_item(FmDirTreeModel* model, FmDirTreeItem* parent_item, GtkTreePath* parent_tp, gboolean emit_signal)
 {
-    FmDirTreeItem* parent_item = (FmDirTreeItem*)parent_l->data;
-    FmDirTreeItem* item = fm_dir_tree_item_new(model, parent_l);
-    parent_item->children = g_list_prepend(parent_item->children, item);
+    FmDirTreeItem* item = fm_dir_tree_item_new(model, parent_item);
+    if(!parent_item->children)
+        parent_item->children = g_sequence_new(NULL);
+    item->seq_it = g_sequence_prepend(parent_item->children, item);
 
     if(emit_signal)
     {
         GtkTreeIter it;
         GtkTreePath* ph_tp;
-        item_to_tree_iter(model, parent_item->children, &it);
+        item_to_tree_iter(model, item, &it);
         ph_tp = gtk_tree_path_copy(parent_tp);
         gtk_tree_path_append_index(ph_tp, 0);
         gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), ph_tp, &it);
@@ -621,114 +622,126 @@ static void add_place_holder_child_item(FmDirTreeModel* model, GList* parent_l,
     }
 }
 
+/* place holder items go first, the rest are sorted by collate key */
+static gint item_compare(gconstpointer a, gconstpointer b, gpointer unused)
+{
+    FmDirTreeItem* item_a = (FmDirTreeItem*)a;
+    FmDirTreeItem* item_b = (FmDirTreeItem*)b;
+
+    if(G_UNLIKELY(!item_a->fi))
+        return item_b->fi ? -1 : 0;
+    if(G_UNLIKELY(!item_b->fi))
+        return 1;
+    return strcmp(fm_file_info_get_collate_key(item_a->fi),
+                  fm_file_info_get_collate_key(item_b->fi));
+}
+
 /* Add a new node to parent node to proper position.
  * GtkTreePath tp is the tree path of parent node.
- * Returns GList item where new_item is incapsulated */
-static GList* insert_item(FmDirTreeModel* model, GList* parent_l, GtkTreePath* tp, FmDirTreeItem* new_item)
+ * Returns new_item */
+static FmDirTreeItem* insert_item(FmDirTreeModel* model, FmDirTreeItem* parent_item, GtkTreePath* tp, FmDirTreeItem* new_item)
 {
-    GList* new_item_l;
-    FmDirTreeItem* parent_item = (FmDirTreeItem*)parent_l->data;
-    const char* new_key = fm_file_info_get_collate_key(new_item->fi);
-    GList* item_l, *last_l = NULL;
     GtkTreePath* new_tp;
     GtkTreeIter it;
-    int n = 0;
-    for(item_l = parent_item->children; item_l; item_l=item_l->next, ++n)
-    {
-        FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
-        const char* key;
-        last_l = item_l;
-        if( G_UNLIKELY(!item->fi) )
-            continue;
-        key = fm_file_info_get_collate_key(item->fi);
-        if(strcmp(new_key, key) <= 0)
-            break;
-    }
-
-    parent_item->children = g_list_insert_before(parent_item->children, item_l, new_item);
-    /* get the GList* of the newly inserted item */
-    if(!item_l) /* the new item becomes the last item of the list */
-        new_item_l = last_l ? last_l->next : parent_item->children;
-    else /* the new item is just previous item of its sibling. */
-        new_item_l = item_l->prev;
+    int n;
 
     g_assert( new_item->fi != NULL );
-    g_assert( new_item == new_item_l->data );
-    g_assert( ((FmDirTreeItem*)new_item_l->data)->fi != NULL );
+
+    if(!parent_item->children)
+        parent_item->children = g_sequence_new(NULL);
+    new_item->seq_it = g_sequence_insert_sorted(parent_item->children, new_item,
+                                                item_compare, NULL);
+    n = g_sequence_iter_get_position(new_item->seq_it);
+    if(!parent_item->names)
+        parent_item->names = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(parent_item->names,
+                        (char*)fm_path_get_basename(fm_file_info_get_path(new_item->fi)),
+                        new_item);
 
     /* emit row-inserted signal for the new item */
-    item_to_tree_iter(model, new_item_l, &it);
+    item_to_tree_iter(model, new_item, &it);
     new_tp = gtk_tree_path_copy(tp);
     gtk_tree_path_append_index(new_tp, n);
     gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), new_tp, &it);
 
     /* add a placeholder child item to make the node expandable */
     if(!fm_config->no_child_non_expandable || fm_file_info_is_accessible(new_item->fi))
-        add_place_holder_child_item(model, new_item_l, new_tp, TRUE);
+        add_place_holder_child_item(model, new_item, new_tp, TRUE);
     gtk_tree_path_free(new_tp);
 
-    /* TODO: check if the dir has subdirs and make it expandable if needed. */
-    /* item_queue_subdir_check(model, new_item_l); */
+    /* check if the dir has subdirs once the view shows it */
+    item_mark_unprobed(new_item);
 
-    return new_item_l;
+    return new_item;
 }
 
 /* Add file info to parent node to proper position.
  * GtkTreePath tp is the tree path of parent node. */
-static GList* insert_file_info(FmDirTreeModel* model, GList* parent_l, GtkTreePath* tp, FmFileInfo* fi)
+static FmDirTreeItem* insert_file_info(FmDirTreeModel* model, FmDirTreeItem* parent_item, GtkTreePath* tp, FmFileInfo* fi)
 {
-    GList* item_l;
-    FmDirTreeItem* parent_item = (FmDirTreeItem*)parent_l->data;
-    FmDirTreeItem* item = fm_dir_tree_item_new(model, parent_l);
+    FmDirTreeItem* item = fm_dir_tree_item_new(model, parent_item);
     item->fi = fm_file_info_ref(fi);
 
     if(!model->show_hidden && fm_file_info_is_hidden(fi)) /* hidden folder */
-    {
         parent_item->hidden_children = g_list_prepend(parent_item->hidden_children, item);
-        item_l = parent_item->hidden_children;
-    }
     else
-        item_l = insert_item(model, parent_l, tp, item);
-    return item_l;
+        insert_item(model, parent_item, tp, item);
+    return item;
+}
+
+/* unlinks visible item from its parent, frees children sequence if empty */
+static void item_unlink(FmDirTreeItem* parent_item, FmDirTreeItem* item)
+{
+    g_sequence_remove(item->seq_it);
+    item->seq_it = NULL;
+    if(item->fi && parent_item->names)
+    {
+        const char* name = fm_path_get_basename(fm_file_info_get_path(item->fi));
+        if(g_hash_table_lookup(parent_item->names, name) == item)
+            g_hash_table_remove(parent_item->names, name);
+    }
+    if(g_sequence_get_length(parent_item->children) == 0)
+    {
+        g_sequence_free(parent_item->children);
+        parent_item->children = NULL;
+    }
 }
 
 /* deletes item from lists but not frees data */
-static void remove_item_l(FmDirTreeModel* model, GList* item_l)
+static void remove_item_l(FmDirTreeModel* model, FmDirTreeItem* item)
 {
     GtkTreePath* tp;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
 
     g_return_if_fail(item != NULL);
-    tp = item_to_tree_path(model, item_l);
+    tp = item_to_tree_path(model, item);
 
     if(item->parent)
     {
-        FmDirTreeItem* parent_item = item->parent->data;
+        FmDirTreeItem* parent_item = item->parent;
 
-        parent_item->children = g_list_delete_link(parent_item->children, item_l);
+        item_unlink(parent_item, item);
         /* signal the view that we removed the item. */
         gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), tp);
         /* If the item being removed is the last child item of parent_item,
          * we need to insert a place holder item to keep it expandable. */
         if(parent_item->children == NULL)
         {
-            GList* parent_l = item->parent;
             gtk_tree_path_up(tp);
             if(fm_config->no_child_non_expandable)
             {
                 GtkTreeIter it;
-                item_to_tree_iter(model, parent_l, &it);
+                item_to_tree_iter(model, parent_item, &it);
                 /* signal the view to redraw row removing expander */
                 gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model), tp, &it);
             }
             else
-                add_place_holder_child_item(model, parent_l, tp, TRUE);
+                add_place_holder_child_item(model, parent_item, tp, TRUE);
         }
     }
     else /* root item */
     {
         /* FIXME: this needs more testing. */
-        model->roots = g_list_delete_link(model->roots, item_l);
+        model->roots = g_list_remove(model->roots, item);
         /* signal the view that we removed the item. */
         gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), tp);
     }
@@ -737,46 +750,39 @@ static void remove_item_l(FmDirTreeModel* model, GList* item_l)
 }
 
 /* deletes and frees item with data */
-static void remove_item(FmDirTreeModel* model, GList* item_l)
+static void remove_item(FmDirTreeModel* model, FmDirTreeItem* item)
 {
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
-    remove_item_l(model, item_l);
-    fm_dir_tree_item_free(item, item_l); /* item_l is freed already */
+    remove_item_l(model, item);
+    fm_dir_tree_item_free(item);
 }
 
 /* find child item by filename, and retrive its index if idx is not NULL. */
-static GList* children_by_name(FmDirTreeModel* model, GList* children, const char* name, int* idx)
+static FmDirTreeItem* children_by_name(FmDirTreeItem* parent_item, const char* name, int* idx)
 {
-    GList* l;
-    int i = 0;
-    for(l = children; l; l=l->next, ++i)
-    {
-        FmDirTreeItem* item = (FmDirTreeItem*)l->data;
-        FmPath* path;
-        if(G_LIKELY(item->fi) &&
-           G_LIKELY((path = fm_file_info_get_path(item->fi))) &&
-           G_UNLIKELY(strcmp(fm_path_get_basename(path), name) == 0))
-        {
-            if(idx)
-                *idx = i;
-            return l;
-        }
-    }
-    return NULL;
+    FmDirTreeItem* item;
+
+    if(!parent_item->names)
+        return NULL;
+    item = g_hash_table_lookup(parent_item->names, name);
+    if(item && idx)
+        *idx = g_sequence_iter_get_position(item->seq_it);
+    return item;
 }
 
-static void remove_all_children(FmDirTreeModel* model, GList* item_l, GtkTreePath* tp)
+static void remove_all_children(FmDirTreeModel* model, FmDirTreeItem* item, GtkTreePath* tp)
 {
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
     if(G_UNLIKELY(!item->children))
         return;
+    if(item->names)
+        g_hash_table_remove_all(item->names);
     gtk_tree_path_append_index(tp, 0);
     /* FIXME: How to improve performance?
      * TODO: study the horrible source code of GtkTreeView */
     while(item->children)
     {
-        fm_dir_tree_item_free_l(item->children);
-        item->children = g_list_delete_link(item->children, item->children);
+        FmDirTreeItem* child = item_first_child(item);
+        item_unlink(item, child);
+        fm_dir_tree_item_free(child);
         /* signal the view that we removed the placeholder item. */
         gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), tp);
         /* everytime we remove the first item, its next item became the
@@ -785,13 +791,401 @@ static void remove_all_children(FmDirTreeModel* model, GList* item_l, GtkTreePat
 
     if(item->hidden_children)
     {
-        _g_list_foreach_l(item->hidden_children, (GFunc)fm_dir_tree_item_free_l, NULL);
+        g_list_foreach(item->hidden_children, (GFunc)fm_dir_tree_item_free, NULL);
         g_list_free(item->hidden_children);
         item->hidden_children = NULL;
     }
     gtk_tree_path_up(tp);
 }
 
+/* Checking for sub folders.
+ * When the tree should not show expanders on folders without sub folders,
+ * each row shown by the view is probed in a worker thread, the view tells
+ * which rows are shown with fm_dir_tree_model_check_subdirs(). Rows are
+ * only marked as unprobed when inserted or changed. The folder is read until
+ * the first sub folder is found, without creating FmFolder for it. The
+ * result is cached by device, inode and modification time of the folder. */
+
+#define SUBDIR_CHECK_MAX_THREADS 2
+#define SUBDIR_CACHE_MAX_SIZE 4096
+
+typedef enum
+{
+    SUBDIR_UNKNOWN,
+    SUBDIR_NONE,
+    SUBDIR_HIDDEN, /* only hidden sub folders */
+    SUBDIR_VISIBLE
+} FmDirTreeSubdirState;
+
+struct _FmDirTreeSubdirCheck
+{
+    FmDirTreeItem* item; /* NULL if cancelled, used in main thread only */
+    char* path_str;
+    volatile gint cancelled;
+    FmDirTreeSubdirState state;
+};
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    FmDirTreeSubdirState state;
+} FmDirTreeSubdirCacheEntry;
+
+G_LOCK_DEFINE_STATIC(subdir_checks);
+static GThreadPool* subdir_pool = NULL;
+static GQueue subdir_ready = G_QUEUE_INIT; /* consists of FmDirTreeSubdirCheck */
+static guint subdir_ready_handler = 0;
+static GHashTable* subdir_cache = NULL; /* guarded by subdir_checks lock too */
+
+static guint subdir_cache_hash(gconstpointer key)
+{
+    const FmDirTreeSubdirCacheEntry* entry = key;
+    return (guint)entry->ino ^ ((guint)entry->dev << 16);
+}
+
+static gboolean subdir_cache_equal(gconstpointer a, gconstpointer b)
+{
+    const FmDirTreeSubdirCacheEntry *entry_a = a, *entry_b = b;
+    return entry_a->ino == entry_b->ino && entry_a->dev == entry_b->dev;
+}
+
+/* test if @ent is a directory, following symlinks, with minimal I/O */
+static gboolean subdir_entry_is_dir(const char* dir_path, int dir_fd, struct dirent* ent)
+{
+    struct stat st;
+#ifndef HAVE_AT_FUNCS
+    char* path;
+    gboolean is_dir;
+#endif
+
+#ifdef DT_UNKNOWN
+    switch (ent->d_type)
+    {
+    case DT_DIR:
+        return TRUE;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        break;
+    default:
+        return FALSE;
+    }
+#endif
+#ifdef HAVE_AT_FUNCS
+    return (fstatat(dir_fd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+#else
+    path = g_build_filename(dir_path, ent->d_name, NULL);
+    is_dir = (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+    g_free(path);
+    return is_dir;
+#endif
+}
+
+/* reads the folder until the first not hidden sub folder is found */
+static FmDirTreeSubdirState subdir_check_read(FmDirTreeSubdirCheck* check)
+{
+    FmDirTreeSubdirState state = SUBDIR_UNKNOWN;
+    FmDirTreeSubdirCacheEntry* entry;
+    struct dirent* ent;
+    struct stat st;
+    DIR* dir;
+    int dir_fd = -1;
+
+#ifdef HAVE_AT_FUNCS
+    dir_fd = open(check->path_str, O_RDONLY | O_DIRECTORY);
+    if(dir_fd < 0)
+        return SUBDIR_UNKNOWN;
+    if(fstat(dir_fd, &st) < 0)
+    {
+        close(dir_fd);
+        return SUBDIR_UNKNOWN;
+    }
+#else
+    if(stat(check->path_str, &st) < 0)
+        return SUBDIR_UNKNOWN;
+#endif
+
+    G_LOCK(subdir_checks);
+    if(subdir_cache)
+    {
+        FmDirTreeSubdirCacheEntry key;
+        key.dev = st.st_dev;
+        key.ino = st.st_ino;
+        entry = g_hash_table_lookup(subdir_cache, &key);
+        if(entry && entry->mtime == st.st_mtime)
+            state = entry->state;
+    }
+    G_UNLOCK(subdir_checks);
+    if(state != SUBDIR_UNKNOWN)
+    {
+        if(dir_fd >= 0)
+            close(dir_fd);
+        return state;
+    }
+
+#ifdef HAVE_AT_FUNCS
+    dir = fdopendir(dir_fd);
+    if(!dir)
+    {
+        close(dir_fd);
+        return SUBDIR_UNKNOWN;
+    }
+#else
+    dir = opendir(check->path_str);
+    if(!dir)
+        return SUBDIR_UNKNOWN;
+#endif
+    state = SUBDIR_NONE;
+    while((ent = readdir(dir)) != NULL)
+    {
+        const char* name = ent->d_name;
+        gboolean hidden;
+
+        if(g_atomic_int_get(&check->cancelled))
+        {
+            closedir(dir);
+            return SUBDIR_UNKNOWN;
+        }
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        /* the same as fm_file_info_is_hidden() may tell for the name */
+        hidden = (name[0] == '.' ||
+                  (fm_config->backup_as_hidden && name[strlen(name) - 1] == '~'));
+        if(hidden && state == SUBDIR_HIDDEN)
+            continue;
+        if(!subdir_entry_is_dir(check->path_str, dir_fd, ent))
+            continue;
+        if(!hidden)
+        {
+            state = SUBDIR_VISIBLE;
+            break;
+        }
+        state = SUBDIR_HIDDEN;
+    }
+    closedir(dir);
+
+    /* don't cache folders modified within last seconds since mtime has
+       coarse resolution and folder may be changed again in the same second */
+    if(time(NULL) - st.st_mtime > 2)
+    {
+        G_LOCK(subdir_checks);
+        if(!subdir_cache)
+            subdir_cache = g_hash_table_new_full(subdir_cache_hash, subdir_cache_equal,
+                                                 NULL, g_free);
+        else if(g_hash_table_size(subdir_cache) >= SUBDIR_CACHE_MAX_SIZE)
+            g_hash_table_remove_all(subdir_cache);
+        entry = g_new(FmDirTreeSubdirCacheEntry, 1);
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        entry->mtime = st.st_mtime;
+        entry->state = state;
+        g_hash_table_replace(subdir_cache, entry, entry);
+        G_UNLOCK(subdir_checks);
+    }
+    return state;
+}
+
+static inline void subdir_check_free(FmDirTreeSubdirCheck* check)
+{
+    g_free(check->path_str);
+    g_slice_free(FmDirTreeSubdirCheck, check);
+}
+
+/* applies result of the check to the row, runs in main thread */
+static void item_apply_subdir_check(FmDirTreeItem* item, FmDirTreeSubdirState state)
+{
+    FmDirTreeModel* model = item->model;
+    FmDirTreeItem* place_holder;
+    GtkTreePath* tp;
+    GtkTreeIter it;
+    gboolean has_subdirs;
+
+    /* loaded folders are handled by FmFolder, hidden items aren't in the tree */
+    if(state == SUBDIR_UNKNOWN || item->folder || !fm_config->no_child_non_expandable)
+        return;
+    if(!item->seq_it && item->parent)
+        return;
+    has_subdirs = (state == SUBDIR_VISIBLE || (state == SUBDIR_HIDDEN && model->show_hidden));
+    place_holder = item_first_child(item);
+    if(has_subdirs)
+    {
+        if(place_holder) /* already expandable */
+            return;
+        tp = item_to_tree_path(model, item);
+        add_place_holder_child_item(model, item, tp, TRUE);
+        item_to_tree_iter(model, item, &it);
+        gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model), tp, &it);
+        gtk_tree_path_free(tp);
+    }
+    else if(place_holder && place_holder->fi == NULL &&
+            g_sequence_get_length(item->children) == 1)
+        /* it will emit "row-has-child-toggled" for the item */
+        remove_item(model, place_holder);
+}
+
+static gboolean on_subdir_checks_ready(gpointer unused)
+{
+    GQueue ready;
+    FmDirTreeSubdirCheck* check;
+
+    G_LOCK(subdir_checks);
+    ready = subdir_ready;
+    g_queue_init(&subdir_ready);
+    subdir_ready_handler = 0;
+    G_UNLOCK(subdir_checks);
+
+    while((check = g_queue_pop_head(&ready)) != NULL)
+    {
+        FmDirTreeItem* item = check->item;
+        if(item)
+        {
+            item->subdir_check = NULL;
+            item_apply_subdir_check(item, check->state);
+        }
+        subdir_check_free(check);
+    }
+    return FALSE;
+}
+
+static void subdir_check_thread(gpointer data, gpointer unused)
+{
+    FmDirTreeSubdirCheck* check = data;
+
+    if(!g_atomic_int_get(&check->cancelled))
+        check->state = subdir_check_read(check);
+    G_LOCK(subdir_checks);
+    g_queue_push_tail(&subdir_ready, check);
+    if(subdir_ready_handler == 0)
+        subdir_ready_handler = gdk_threads_add_idle_full(G_PRIORITY_LOW,
+                                                         on_subdir_checks_ready,
+                                                         NULL, NULL);
+    G_UNLOCK(subdir_checks);
+}
+
+/* queues the item for check in background, only local folders are probed */
+static void item_queue_subdir_check(FmDirTreeModel* model, FmDirTreeItem* item)
+{
+    FmDirTreeSubdirCheck* check;
+    FmPath* path;
+
+    if(!fm_config->no_child_non_expandable || !item->fi || item->folder)
+        return;
+    path = fm_file_info_get_path(item->fi);
+    if(!fm_path_is_native(path) || !fm_file_info_is_accessible(item->fi))
+        return;
+    if(item->subdir_check) /* it might be changed since the check is queued */
+        item_cancel_subdir_check(item);
+
+    check = g_slice_new0(FmDirTreeSubdirCheck);
+    check->item = item;
+    check->path_str = fm_path_to_str(path);
+    item->subdir_check = check;
+    G_LOCK(subdir_checks);
+    if(G_UNLIKELY(subdir_pool == NULL))
+        subdir_pool = g_thread_pool_new(subdir_check_thread, NULL,
+                                        SUBDIR_CHECK_MAX_THREADS, FALSE, NULL);
+    G_UNLOCK(subdir_checks);
+    g_thread_pool_push(subdir_pool, check, NULL);
+}
+
+/* the check will be freed by on_subdir_checks_ready() later */
+static inline void item_cancel_subdir_check(FmDirTreeItem* item)
+{
+    item->subdir_check->item = NULL;
+    g_atomic_int_set(&item->subdir_check->cancelled, 1);
+    item->subdir_check = NULL;
+}
+
+/* the row will be checked for sub folders once the view shows it */
+static inline void item_mark_unprobed(FmDirTreeItem* item)
+{
+    if(item->subdir_check) /* it might be changed since the check is queued */
+        item_cancel_subdir_check(item);
+    item->unprobed = TRUE;
+}
+
+/* returns the row shown next to the item in the view or NULL */
+static FmDirTreeItem* item_next_shown(FmDirTreeModel* model, FmDirTreeItem* item)
+{
+    GSequenceIter* seq_it;
+    GList* l;
+
+    if(item->expanded && item->children)
+        return item_first_child(item);
+    while(item->parent)
+    {
+        if(!item->seq_it)
+            return NULL;
+        seq_it = g_sequence_iter_next(item->seq_it);
+        if(!g_sequence_iter_is_end(seq_it))
+            return g_sequence_get(seq_it);
+        item = item->parent;
+    }
+    l = g_list_find(model->roots, item);
+    return (l && l->next) ? l->next->data : NULL;
+}
+
+/**
+ * fm_dir_tree_model_check_subdirs
+ * @model: the model instance
+ * @start: first row shown to the user
+ * @end: last row shown to the user
+ *
+ * Checks in background which folders from @start to @end have sub folders,
+ * if that was not done yet since the row was inserted or changed, so the
+ * rows without sub folders lose their expanders. Does nothing unless the
+ * 'no_child_non_expandable' option is set in config. The view should call
+ * this each time the range of visible rows changes.
+ *
+ * Since: 1.2.0
+ */
+void fm_dir_tree_model_check_subdirs(FmDirTreeModel* model, GtkTreePath* start,
+                                     GtkTreePath* end)
+{
+    FmDirTreeItem *item, *last;
+    GtkTreeIter it;
+
+    g_return_if_fail(FM_IS_DIR_TREE_MODEL(model));
+    g_return_if_fail(start != NULL && end != NULL);
+
+    if(!fm_config->no_child_non_expandable)
+        return;
+    if(!fm_dir_tree_model_get_iter(GTK_TREE_MODEL(model), &it, end))
+        return;
+    last = it.user_data;
+    if(!fm_dir_tree_model_get_iter(GTK_TREE_MODEL(model), &it, start))
+        return;
+    for(item = it.user_data; item; item = item_next_shown(model, item))
+    {
+        if(item->unprobed)
+        {
+            item->unprobed = FALSE;
+            item_queue_subdir_check(model, item);
+        }
+        if(item == last)
+            break;
+    }
+}
+
+void _fm_dir_tree_model_finalize(void)
+{
+    FmDirTreeSubdirCheck* check;
+
+    /* all models should be disposed already so all checks are cancelled */
+    if(subdir_pool)
+        g_thread_pool_free(subdir_pool, FALSE, TRUE);
+    subdir_pool = NULL;
+    if(subdir_ready_handler)
+        g_source_remove(subdir_ready_handler);
+    subdir_ready_handler = 0;
+    while((check = g_queue_pop_head(&subdir_ready)) != NULL)
+        subdir_check_free(check);
+    if(subdir_cache)
+        g_hash_table_destroy(subdir_cache);
+    subdir_cache = NULL;
+}
+
 /**
  * fm_dir_tree_model_add_root
  * @model: the model instance
@@ -807,50 +1201,49 @@ void fm_dir_tree_model_add_root(FmDirTreeModel* model, FmFileInfo* root, GtkTree
 {
     GtkTreeIter it;
     GtkTreePath* tp;
-    GList* item_l;
     FmDirTreeItem* item = fm_dir_tree_item_new(model, NULL);
     item->fi = fm_file_info_ref(root);
     model->roots = g_list_append(model->roots, item);
-    item_l = g_list_last(model->roots); /* FIXME: this is inefficient */
-    add_place_holder_child_item(model, item_l, NULL, FALSE);
+    add_place_holder_child_item(model, item, NULL, FALSE);
 
     /* emit row-inserted signal for the new root item */
-    item_to_tree_iter(model, item_l, &it);
-    tp = item_to_tree_path(model, item_l);
+    item_to_tree_iter(model, item, &it);
+    tp = item_to_tree_path(model, item);
     gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), tp, &it);
+    item_mark_unprobed(item);
 
     if(iter)
         *iter = it;
     gtk_tree_path_free(tp);
 }
 
-static void on_folder_finish_loading(FmFolder* folder, GList* item_l)
+static void on_folder_finish_loading(FmFolder* folder, FmDirTreeItem* item)
 {
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
     FmDirTreeModel* model = item->model;
-    GList* place_holder_l;
-    GtkTreePath* tp = item_to_tree_path(model, item_l);
+    FmDirTreeItem* place_holder;
+    GtkTreePath* tp = item_to_tree_path(model, item);
 
     /* set 'loaded' flag beforehand as callback may check it */
     item->loaded = TRUE;
-    place_holder_l = item->children;
+    place_holder = item_first_child(item);
     /* don't leave expanders if not stated in config */
     /* if we have loaded sub dirs, remove the place holder */
-    if(fm_config->no_child_non_expandable || !place_holder_l || place_holder_l->next)
+    if(fm_config->no_child_non_expandable || !place_holder ||
+       g_sequence_get_length(item->children) > 1)
     {
         /* remove the fake placeholder item showing "Loading..." */
         /* #3614965: crash after removing only child from existing directory:
            after reload first item may be absent or may be not a placeholder,
-           if no_child_non_expandable is unset, place_holder_l cannot be NULL */
-        if (place_holder_l && ((FmDirTreeItem*)place_holder_l->data)->fi == NULL)
-            remove_item(model, place_holder_l);
+           if no_child_non_expandable is unset, place_holder cannot be NULL */
+        if (place_holder && place_holder->fi == NULL)
+            remove_item(model, place_holder);
         /* in case if no_child_non_expandable was unset while reloading, it may
-           be still place_holder_l is NULL but let leave empty folder still */
+           be still place_holder is NULL but let leave empty folder still */
     }
     else /* if we have no sub dirs, leave the place holder and let it show "Empty" */
     {
         GtkTreeIter it;
-        item_to_tree_iter(model, place_holder_l, &it);
+        item_to_tree_iter(model, place_holder, &it);
         /* if the folder is empty, the place holder item
          * shows "<Empty>" instead of "Loading..." */
         gtk_tree_path_append_index(tp, 0);
@@ -862,19 +1255,18 @@ static void on_folder_finish_loading(FmFolder* folder, GList* item_l)
     /* FIXME: should we really cease monitoring non-expandable folder? */
 //    if(!item->children)
 //    {
-//        item_free_folder(item->folder, item_l);
+//        item_free_folder(item->folder, item);
 //        item->folder = NULL;
 //        item->expanded = FALSE;
 //        item->loaded = FALSE;
 //    }
 }
 
-static void on_folder_files_added(FmFolder* folder, GSList* files, GList* item_l)
+static void on_folder_files_added(FmFolder* folder, GSList* files, FmDirTreeItem* item)
 {
     GSList* l;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
     FmDirTreeModel* model = item->model;
-    GtkTreePath* tp = item_to_tree_path(model, item_l);
+    GtkTreePath* tp = item_to_tree_path(model, item);
     for(l = files; l; l = l->next)
     {
         FmFileInfo* fi = FM_FILE_INFO(l->data);
@@ -882,35 +1274,32 @@ static void on_folder_files_added(FmFolder* folder, GSList* files, GList* item_l
         {
             /* Ideally FmFolder should not emit files-added signals for files that
              * already exists. So there is no need to check for duplication here. */
-            insert_file_info(model, item_l, tp, fi);
+            insert_file_info(model, item, tp, fi);
         }
     }
     gtk_tree_path_free(tp);
 }
 
-static void on_folder_files_removed(FmFolder* folder, GSList* files, GList* item_l)
+static void on_folder_files_removed(FmFolder* folder, GSList* files, FmDirTreeItem* item)
 {
     GSList* l;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
     FmDirTreeModel* model = item->model;
 
     for(l = files; l; l = l->next)
     {
         FmFileInfo* fi = FM_FILE_INFO(l->data);
         FmPath* path = fm_file_info_get_path(fi);
-        GList* rm_item_l = children_by_name(model, item->children,
-                                            fm_path_get_basename(path), NULL);
-        if(rm_item_l)
-            remove_item(model, rm_item_l);
+        FmDirTreeItem* rm_item = children_by_name(item, fm_path_get_basename(path), NULL);
+        if(rm_item)
+            remove_item(model, rm_item);
     }
 }
 
-static void on_folder_files_changed(FmFolder* folder, GSList* files, GList* item_l)
+static void on_folder_files_changed(FmFolder* folder, GSList* files, FmDirTreeItem* item)
 {
     GSList* l;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
     FmDirTreeModel* model = item->model;
-    GtkTreePath* tp = item_to_tree_path(model, item_l);
+    GtkTreePath* tp = item_to_tree_path(model, item);
 
     /* g_debug("files changed!!"); */
 
@@ -919,35 +1308,37 @@ static void on_folder_files_changed(FmFolder* folder, GSList* files, GList* item
         FmFileInfo* fi = FM_FILE_INFO(l->data);
         int idx;
         FmPath* path = fm_file_info_get_path(fi);
-        GList* changed_item_l = children_by_name(model, item->children,
-                                                 fm_path_get_basename(path), &idx);
+        const char* name = fm_path_get_basename(path);
+        FmDirTreeItem* changed_item = children_by_name(item, name, &idx);
         /* g_debug("changed file: %s", fi->path->name); */
-        if(changed_item_l)
+        if(changed_item)
         {
-            FmDirTreeItem* changed_item = (FmDirTreeItem*)changed_item_l->data;
+            FmFileInfo* old_fi = changed_item->fi;
             GtkTreeIter it;
-            if(changed_item->fi)
-                fm_file_info_unref(changed_item->fi);
             changed_item->fi = fm_file_info_ref(fi);
+            /* the key should be owned by the new file info now */
+            g_hash_table_replace(item->names, (char*)name, changed_item);
+            if(old_fi)
+                fm_file_info_unref(old_fi);
             /* inform gtk tree view about the change */
-            item_to_tree_iter(model, changed_item_l, &it);
+            item_to_tree_iter(model, changed_item, &it);
             gtk_tree_path_append_index(tp, idx);
             gtk_tree_model_row_changed(GTK_TREE_MODEL(model), tp, &it);
             gtk_tree_path_up(tp);
 
-            /* FIXME and TODO: check if we have sub folder */
-            /* item_queue_subdir_check(model, changed_item_l); */
+            /* the folder might get or lose sub folders */
+            item_mark_unprobed(changed_item);
         }
     }
     gtk_tree_path_free(tp);
 }
 
-static inline void item_free_folder(FmFolder* folder, gpointer item_l)
+static inline void item_free_folder(FmFolder* folder, FmDirTreeItem* item)
 {
-    g_signal_handlers_disconnect_by_func(folder, on_folder_finish_loading, item_l);
-    g_signal_handlers_disconnect_by_func(folder, on_folder_files_added, item_l);
-    g_signal_handlers_disconnect_by_func(folder, on_folder_files_removed, item_l);
-    g_signal_handlers_disconnect_by_func(folder, on_folder_files_changed, item_l);
+    g_signal_handlers_disconnect_by_func(folder, on_folder_finish_loading, item);
+    g_signal_handlers_disconnect_by_func(folder, on_folder_files_added, item);
+    g_signal_handlers_disconnect_by_func(folder, on_folder_files_removed, item);
+    g_signal_handlers_disconnect_by_func(folder, on_folder_files_changed, item);
     g_object_unref(folder);
 }
 
@@ -973,8 +1364,7 @@ static inline void item_free_folder(FmFolder* folder, gpointer item_l)
  */
 void fm_dir_tree_model_load_row(FmDirTreeModel* model, GtkTreeIter* it, GtkTreePath* tp)
 {
-    GList* item_l = (GList*)it->user_data;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
+    FmDirTreeItem* item = (FmDirTreeItem*)it->user_data;
     g_return_if_fail(item != NULL);
     if(!item->expanded)
     {
@@ -984,20 +1374,18 @@ void fm_dir_tree_model_load_row(FmDirTreeModel* model, GtkTreeIter* it, GtkTreeP
 
         /* g_debug("fm_dir_tree_model_load_row()"); */
         /* associate the data with loaded handler */
-        g_signal_connect(folder, "finish-loading", G_CALLBACK(on_folder_finish_loading), item_l);
-        g_signal_connect(folder, "files-added", G_CALLBACK(on_folder_files_added), item_l);
-        g_signal_connect(folder, "files-removed", G_CALLBACK(on_folder_files_removed), item_l);
-        g_signal_connect(folder, "files-changed", G_CALLBACK(on_folder_files_changed), item_l);
+        g_signal_connect(folder, "finish-loading", G_CALLBACK(on_folder_finish_loading), item);
+        g_signal_connect(folder, "files-added", G_CALLBACK(on_folder_files_added), item);
+        g_signal_connect(folder, "files-removed", G_CALLBACK(on_folder_files_removed), item);
+        g_signal_connect(folder, "files-changed", G_CALLBACK(on_folder_files_changed), item);
 
         if(!item->children)
-            add_place_holder_child_item(model, item_l, tp, TRUE);
+            add_place_holder_child_item(model, item, tp, TRUE);
         /* set 'expanded' flag beforehand as callback may check it */
         item->expanded = TRUE;
         /* if the folder is already loaded, call "loaded" handler ourselves */
         if(fm_folder_is_loaded(folder)) /* already loaded */
         {
-            FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
-            FmDirTreeModel* model = item->model;
             GList* file_l;
             FmFileInfoList* files = fm_folder_get_files(folder);
             for(file_l = fm_file_info_list_peek_head_link(files); file_l; file_l = file_l->next)
@@ -1008,11 +1396,11 @@ void fm_dir_tree_model_load_row(FmDirTreeModel* model, GtkTreeIter* it, GtkTreeP
                     /* FIXME: later we can try to support adding
                      *        files to the tree, too so this model
                      *        can be even more useful. */
-                    insert_file_info(model, item_l, tp, fi);
+                    insert_file_info(model, item, tp, fi);
                     /* g_debug("insert: %s", fi->path->name); */
                 }
             }
-            on_folder_finish_loading(folder, item_l);
+            on_folder_finish_loading(folder, item);
         }
     }
 }
@@ -1033,24 +1421,23 @@ void fm_dir_tree_model_load_row(FmDirTreeModel* model, GtkTreeIter* it, GtkTreeP
  */
 void fm_dir_tree_model_unload_row(FmDirTreeModel* model, GtkTreeIter* it, GtkTreePath* tp)
 {
-    GList* item_l = (GList*)it->user_data;
-    FmDirTreeItem* item = (FmDirTreeItem*)item_l->data;
+    FmDirTreeItem* item = (FmDirTreeItem*)it->user_data;
     g_return_if_fail(item != NULL);
     if(item->expanded) /* do some cleanup */
     {
-        GList* had_children = item->children;
+        gboolean had_children = (item->children != NULL);
         /* remove all children, and replace them with a dummy child
          * item to keep expander in the tree view around. */
-        remove_all_children(model, item_l, tp);
+        remove_all_children(model, item, tp);
 
         /* now, GtkTreeView think that we have no child since all
          * child items are removed. So we add a place holder child
          * item to keep the expander around. */
         /* don't leave expanders if not stated in config */
         if(had_children)
-            add_place_holder_child_item(model, item_l, tp, TRUE);
+            add_place_holder_child_item(model, item, tp, TRUE);
         /* deactivate folder since it will be reactivated on expand */
-        item_free_folder(item->folder, item_l);
+        item_free_folder(item->folder, item);
         item->folder = NULL;
         item->expanded = FALSE;
         item->loaded = FALSE;
@@ -1076,7 +1463,7 @@ void fm_dir_tree_model_set_icon_size(FmDirTreeModel* model, guint icon_size)
         GList* l;
         for(l = model->roots; l; l=l->next)
         {
-            item_reload_icon(model, l, tp);
+            item_reload_icon(model, l->data, tp);
             gtk_tree_path_next(tp);
         }
         gtk_tree_path_free(tp);
@@ -1114,14 +1501,12 @@ guint fm_dir_tree_model_get_icon_size(FmDirTreeModel* model)
  */
 GdkPixbuf* fm_dir_tree_row_get_icon(FmDirTreeModel* model, GtkTreeIter* iter)
 {
-    GList* item_l;
     FmDirTreeItem *item;
     FmIcon* icon;
 
     g_return_val_if_fail (iter->stamp == model->stamp, NULL);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     if(item->icon)
         return item->icon;
@@ -1144,13 +1529,11 @@ GdkPixbuf* fm_dir_tree_row_get_icon(FmDirTreeModel* model, GtkTreeIter* iter)
  */
 FmFileInfo* fm_dir_tree_row_get_file_info(FmDirTreeModel* model, GtkTreeIter* iter)
 {
-    GList* item_l;
     FmDirTreeItem *item;
 
     g_return_val_if_fail (iter->stamp == model->stamp, NULL);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     return item->fi;
 }
@@ -1169,13 +1552,11 @@ FmFileInfo* fm_dir_tree_row_get_file_info(FmDirTreeModel* model, GtkTreeIter* it
  */
 FmPath* fm_dir_tree_row_get_file_path(FmDirTreeModel* model, GtkTreeIter* iter)
 {
-    GList* item_l;
     FmDirTreeItem *item;
 
     g_return_val_if_fail (iter->stamp == model->stamp, NULL);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     return item->fi ? fm_file_info_get_path(item->fi) : NULL;
 }
@@ -1194,19 +1575,17 @@ FmPath* fm_dir_tree_row_get_file_path(FmDirTreeModel* model, GtkTreeIter* iter)
  */
 const char* fm_dir_tree_row_get_disp_name(FmDirTreeModel* model, GtkTreeIter* iter)
 {
-    GList* item_l;
     FmDirTreeItem *item, *parent;
 
     g_return_val_if_fail (iter->stamp == model->stamp, NULL);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     if(item->fi)
         return fm_file_info_get_disp_name(item->fi);
     /* else this is a place holder item */
     /* parent is always non NULL. otherwise it's a bug. */
-    parent = (FmDirTreeItem*)item->parent->data;
+    parent = item->parent;
     if(parent->folder && fm_folder_is_loaded(parent->folder))
         return _("<No subfolders>");
     return _("Loading...");
@@ -1227,69 +1606,64 @@ const char* fm_dir_tree_row_get_disp_name(FmDirTreeModel* model, GtkTreeIter* it
  */
 gboolean fm_dir_tree_row_is_loaded(FmDirTreeModel* model, GtkTreeIter* iter)
 {
-    GList* item_l;
     FmDirTreeItem *item;
 
     g_return_val_if_fail (iter->stamp == model->stamp, FALSE);
 
-    item_l = (GList*)iter->user_data;
-    item = (FmDirTreeItem*)item_l->data;
+    item = (FmDirTreeItem*)iter->user_data;
 
     return item->loaded;
 }
 
-static void item_hide_hidden_children(FmDirTreeModel *model, GList *item_l)
+static void item_hide_hidden_children(FmDirTreeModel *model, FmDirTreeItem *item)
 {
-    FmDirTreeItem *item = (FmDirTreeItem*)item_l->data;
     FmDirTreeItem *child;
-    GList *child_l, *next;
+    GSequenceIter *seq_it, *next;
 
-    if (item) for (child_l = item->children; child_l; child_l = next)
+    if (!item || !item->children)
+        return;
+    for (seq_it = g_sequence_get_begin_iter(item->children);
+         !g_sequence_iter_is_end(seq_it); seq_it = next)
     {
-        next = child_l->next;
-        child = child_l->data;
+        next = g_sequence_iter_next(seq_it);
+        child = g_sequence_get(seq_it);
         if (G_UNLIKELY(child->fi == NULL)) /* placeholder */
             continue;
         if (fm_file_info_is_hidden(child->fi))
         {
+            /* if this is the last child then the sequence may be freed
+               or a placeholder may be added on removal, stop there */
+            gboolean last = g_sequence_iter_is_end(next);
             /* remove from visibility in model */
-            remove_item_l(model, child_l);
+            remove_item_l(model, child);
             /* do cleanup on item data */
             if (child->folder)
-                item_free_folder(child->folder, child_l);
+                item_free_folder(child->folder, child);
             child->folder = NULL;
             child->expanded = FALSE;
             child->loaded = FALSE;
-            if(child->children)
-            {
-                _g_list_foreach_l(child->children, (GFunc)fm_dir_tree_item_free_l, NULL);
-                g_list_free(child->children);
-                child->children = NULL;
-            }
-            if(child->hidden_children)
-            {
-                _g_list_foreach_l(child->hidden_children, (GFunc)fm_dir_tree_item_free_l, NULL);
-                g_list_free(child->hidden_children);
-                child->hidden_children = NULL;
-            }
+            item_free_children(child);
             /* item is clean so can be added to hidden children */
             item->hidden_children = g_list_prepend(item->hidden_children, child);
+            if (last)
+                break;
         }
         else
-            item_hide_hidden_children(model, child_l); /* do recursion */
+            item_hide_hidden_children(model, child); /* do recursion */
     }
 }
 
-static void item_show_hidden_children(FmDirTreeModel *model, GList *item_l)
+static void item_show_hidden_children(FmDirTreeModel *model, FmDirTreeItem *item)
 {
-    FmDirTreeItem *item = (FmDirTreeItem*)item_l->data;
     FmDirTreeItem *child;
     GtkTreePath *tp;
-    GList *child_l;
+    GSequenceIter *seq_it;
 
-    tp = item_to_tree_path(model, item_l);
-    for (child_l = item->children; child_l; child_l = child_l->next)
-        item_show_hidden_children(model, child_l); /* do recursion */
+    tp = item_to_tree_path(model, item);
+    if (item->children)
+        for (seq_it = g_sequence_get_begin_iter(item->children);
+             !g_sequence_iter_is_end(seq_it); seq_it = g_sequence_iter_next(seq_it))
+            item_show_hidden_children(model, g_sequence_get(seq_it)); /* do recursion */
     while (item->hidden_children)
     {
         /* isolate child */
@@ -1297,11 +1671,27 @@ static void item_show_hidden_children(FmDirTreeModel *model, GList *item_l)
         item->hidden_children = g_list_delete_link(item->hidden_children,
                                                    item->hidden_children);
         /* insert it into visible list */
-        insert_item(model, item_l, tp, child);
+        insert_item(model, item, tp, child);
     }
     gtk_tree_path_free(tp);
 }
 
+/* folders with only hidden sub folders may become (non-)expandable */
+static void item_requeue_subdir_checks(FmDirTreeModel *model, FmDirTreeItem *item)
+{
+    GSequenceIter *seq_it;
+
+    if (!item->folder)
+    {
+        item_mark_unprobed(item);
+        return;
+    }
+    if (item->children)
+        for (seq_it = g_sequence_get_begin_iter(item->children);
+             !g_sequence_iter_is_end(seq_it); seq_it = g_sequence_iter_next(seq_it))
+            item_requeue_subdir_checks(model, g_sequence_get(seq_it)); /* do recursion */
+}
+
 void fm_dir_tree_model_set_show_hidden(FmDirTreeModel* model, gboolean show_hidden)
 {
     GList *l;
@@ -1311,12 +1701,14 @@ void fm_dir_tree_model_set_show_hidden(FmDirTreeModel* model, gboolean show_hidd
         /* filter the model to hide hidden folders */
         if(model->show_hidden)
             for (l = model->roots; l; l = l->next)
-                item_hide_hidden_children(model, l);
+                item_hide_hidden_children(model, l->data);
         /* filter the model to show hidden folders */
         else
             for (l = model->roots; l; l = l->next)
-                item_show_hidden_children(model, l);
+                item_show_hidden_children(model, l->data);
         model->show_hidden = show_hidden;
+        for (l = model->roots; l; l = l->next)
+            item_requeue_subdir_checks(model, l->data);
     }
 }
 
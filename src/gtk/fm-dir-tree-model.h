@@ -112,8 +112,13 @@ const char* fm_dir_tree_row_get_disp_name(FmDirTreeModel* model, GtkTreeIter* it
 void fm_dir_tree_model_set_show_hidden(FmDirTreeModel* model, gboolean show_hidden);
 gboolean fm_dir_tree_model_get_show_hidden(FmDirTreeModel* model);
 
+void fm_dir_tree_model_check_subdirs(FmDirTreeModel* model, GtkTreePath* start,
+                                     GtkTreePath* end);
+
 /* void fm_dir_tree_model_reload(FmDirTreeModel* model); */
 
+void _fm_dir_tree_model_finalize(void);
+
 G_END_DECLS
 
 #endif /* __FM_DIR_TREE_MODEL_H__ */
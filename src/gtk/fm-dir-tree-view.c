@@ -39,6 +39,7 @@
 
 #include "fm-dir-tree-view.h"
 #include "fm-dir-tree-model.h"
+#include "fm-config.h"
 #include "fm-cell-renderer-pixbuf.h"
 #include "fm-file-menu.h"
 #include "fm-gtk-marshal.h"
@@ -161,6 +162,52 @@ static void on_row_expanded(GtkTreeView *tree_view, GtkTreeIter *iter, GtkTreePa
 }
 */
 
+static gboolean on_check_subdirs_timeout(gpointer user_data)
+{
+    FmDirTreeView* view = (FmDirTreeView*)user_data;
+    GtkTreeModel* model;
+    GtkTreePath *start, *end;
+
+    /* check if view is destroyed already */
+    if(g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    view->check_subdirs_timeout = 0;
+    model = gtk_tree_view_get_model(GTK_TREE_VIEW(view));
+    if(!model || !FM_IS_DIR_TREE_MODEL(model))
+        return FALSE;
+    if(gtk_tree_view_get_visible_range(GTK_TREE_VIEW(view), &start, &end))
+    {
+        fm_dir_tree_model_check_subdirs(FM_DIR_TREE_MODEL(model), start, end);
+        gtk_tree_path_free(start);
+        gtk_tree_path_free(end);
+    }
+    return FALSE;
+}
+
+/* rows become visible on scrolling, expanding, or inserting, and each time
+   the view is redrawn, so check rows shown when redrawing is settled */
+static void queue_check_subdirs(FmDirTreeView* view)
+{
+    if(!view->check_subdirs_timeout && fm_config->no_child_non_expandable)
+        view->check_subdirs_timeout = gdk_threads_add_timeout_full(G_PRIORITY_DEFAULT_IDLE, 100,
+                                                                   on_check_subdirs_timeout,
+                                                                   view, NULL);
+}
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+static gboolean fm_dir_tree_view_draw(GtkWidget *widget, cairo_t *cr)
+{
+    queue_check_subdirs(FM_DIR_TREE_VIEW(widget));
+    return GTK_WIDGET_CLASS(fm_dir_tree_view_parent_class)->draw(widget, cr);
+}
+#else
+static gboolean fm_dir_tree_view_expose_event(GtkWidget *widget, GdkEventExpose *event)
+{
+    queue_check_subdirs(FM_DIR_TREE_VIEW(widget));
+    return GTK_WIDGET_CLASS(fm_dir_tree_view_parent_class)->expose_event(widget, event);
+}
+#endif
+
 static void on_row_collapsed(GtkTreeView *tree_view, GtkTreeIter *iter, GtkTreePath *path)
 {
     FmDirTreeModel* model = FM_DIR_TREE_MODEL(gtk_tree_view_get_model(tree_view));
@@ -356,6 +403,11 @@ static void fm_dir_tree_view_class_init(FmDirTreeViewClass *klass)
     widget_class->button_press_event = on_button_press_event;
     widget_class->drag_motion = on_drag_motion;
     widget_class->drag_data_received = on_drag_data_received;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    widget_class->draw = fm_dir_tree_view_draw;
+#else
+    widget_class->expose_event = fm_dir_tree_view_expose_event;
+#endif
 
     tree_view_class->test_expand_row = on_test_expand_row;
     tree_view_class->row_collapsed = on_row_collapsed;
@@ -500,6 +552,11 @@ static void fm_dir_tree_view_dispose(GObject *object)
         g_object_unref(view->dd);
         view->dd = NULL;
     }
+    if(view->check_subdirs_timeout)
+    {
+        g_source_remove(view->check_subdirs_timeout);
+        view->check_subdirs_timeout = 0;
+    }
 
     G_OBJECT_CLASS(fm_dir_tree_view_parent_class)->dispose(object);
 }
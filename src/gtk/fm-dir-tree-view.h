@@ -53,7 +53,7 @@ struct _FmDirTreeView
 
     /* <private> */
     FmDndDest* FM_SEAL(dd);
-    gpointer _reserved1;
+    guint FM_SEAL(check_subdirs_timeout);
 
     /* used for chdir */
     GSList* FM_SEAL(paths_to_expand);
@@ -1402,7 +1402,7 @@ GtkDialog* fm_file_properties_widget_new(FmFileInfoList* files, gboolean topleve
     if(data->single_type)
         data->mime_type = fm_mime_type_ref(fm_file_info_get_mime_type(data->fi));
     paths = fm_path_list_new_from_file_info_list(files);
-    data->dc_job = fm_deep_count_job_new(paths, FM_DC_JOB_DEFAULT);
+    data->dc_job = fm_deep_count_job_new(paths, FM_DC_JOB_USE_CACHE);
     fm_path_list_unref(paths);
     data->ext = NULL; /* no extension by default */
     data->extdata = NULL;
@@ -1097,40 +1097,324 @@ _sort_by_name:
     return FM_SORT_IS_ASCENDING(model->sort_mode) ? ret : -ret;
 }
 
+/* Sorting whole model: keys for every item are computed once into an array,
+   then the array is sorted with stable merge sort, in several threads if
+   there are many items, and the sequence is rearranged in resulting order.
+   Order is the same as fm_folder_model_compare() gives. */
+
+/* don't spawn threads for less items than this */
+#define SORT_PARALLEL_MIN 20000
+#define SORT_MAX_THREADS 8
+
+typedef enum
+{
+    SORT_BY_NAME,
+    SORT_BY_NUMBER, /* by number, then by name */
+    SORT_BY_STRING, /* by string key, then by name */
+    SORT_BY_DIRNAME,
+    SORT_BY_FUNC, /* by column compare function, then by name */
+    SORT_NONE
+} FmFolderSortKind;
+
+typedef struct
+{
+    FmFolderItem* item;
+    GSequenceIter* iter;
+    gint old_pos;
+    guint rank; /* folders first and extra items positions */
+    gint64 number;
+    const char* str;
+    const char* name;
+} FmFolderSortKey;
+
+typedef struct
+{
+    FmFolderSortKind kind;
+    gboolean ascending;
+    gboolean case_sensitive;
+    gint (*compare)(FmFileInfo*, FmFileInfo*);
+    FmFolderSortKey** keys;
+    FmFolderSortKey** tmp;
+    guint start, end; /* chunk for thread */
+    GStringChunk* names; /* copies of name keys made by thread */
+} FmFolderSortCtx;
+
+static inline gint _sort_key_compare(const FmFolderSortCtx* ctx,
+                                     const FmFolderSortKey* k1,
+                                     const FmFolderSortKey* k2)
+{
+    gint ret;
+
+    if(k1->rank != k2->rank)
+        return k1->rank < k2->rank ? -1 : 1;
+    switch(ctx->kind)
+    {
+    case SORT_NONE:
+        return 0;
+    case SORT_BY_NUMBER:
+        if(k1->number != k2->number)
+            ret = k1->number < k2->number ? -1 : 1;
+        else
+            ret = g_strcmp0(k1->name, k2->name);
+        break;
+    case SORT_BY_STRING:
+        ret = g_strcmp0(k1->str, k2->str);
+        if(ret == 0)
+            ret = g_strcmp0(k1->name, k2->name);
+        break;
+    case SORT_BY_DIRNAME:
+        ret = fm_path_compare(fm_path_get_parent(fm_file_info_get_path(k1->item->inf)),
+                              fm_path_get_parent(fm_file_info_get_path(k2->item->inf)));
+        break;
+    case SORT_BY_FUNC:
+        ret = ctx->compare(k1->item->inf, k2->item->inf);
+        if(ret == 0)
+            ret = g_strcmp0(k1->name, k2->name);
+        break;
+    case SORT_BY_NAME:
+    default:
+        ret = g_strcmp0(k1->name, k2->name);
+    }
+    return ctx->ascending ? ret : -ret;
+}
+
+/* merges sorted keys[start:mid] and keys[mid:end] using tmp */
+static void _sort_merge(const FmFolderSortCtx* ctx, FmFolderSortKey** keys,
+                        FmFolderSortKey** tmp, guint start, guint mid, guint end)
+{
+    guint i = start, j = mid, k = start;
+
+    /* already in order, common case for resort after small change */
+    if(_sort_key_compare(ctx, keys[mid - 1], keys[mid]) <= 0)
+        return;
+    while(i < mid && j < end)
+    {
+        /* take from left one on equal keys to keep sort stable */
+        if(_sort_key_compare(ctx, keys[j], keys[i]) < 0)
+            tmp[k++] = keys[j++];
+        else
+            tmp[k++] = keys[i++];
+    }
+    while(i < mid)
+        tmp[k++] = keys[i++];
+    /* the rest of right part is in place already */
+    memcpy(&keys[start], &tmp[start], (j - start) * sizeof(*keys));
+}
+
+static void _sort_range(const FmFolderSortCtx* ctx, FmFolderSortKey** keys,
+                        FmFolderSortKey** tmp, guint start, guint end)
+{
+    guint mid;
+
+    if(end - start <= 12) /* insertion sort for short runs */
+    {
+        guint i, j;
+        for(i = start + 1; i < end; i++)
+        {
+            FmFolderSortKey* key = keys[i];
+            for(j = i; j > start && _sort_key_compare(ctx, key, keys[j - 1]) < 0; j--)
+                keys[j] = keys[j - 1];
+            keys[j] = key;
+        }
+        return;
+    }
+    mid = start + (end - start) / 2;
+    _sort_range(ctx, keys, tmp, start, mid);
+    _sort_range(ctx, keys, tmp, mid, end);
+    _sort_merge(ctx, keys, tmp, start, mid, end);
+}
+
+/* creates name keys for chunk and sorts it, may be run in a thread */
+static gpointer _sort_chunk(gpointer user_data)
+{
+    FmFolderSortCtx* ctx = user_data;
+    const char* name;
+    guint i;
+
+    if(ctx->kind != SORT_NONE && ctx->kind != SORT_BY_DIRNAME)
+    {
+        /* display name returned may be valid only until next call so
+           keys are copied, that also keeps them close in memory */
+        ctx->names = g_string_chunk_new(16 * 1024);
+        for(i = ctx->start; i < ctx->end; i++)
+        {
+            FmFolderSortKey* key = ctx->keys[i];
+            if(ctx->case_sensitive)
+                /* unfortunately g_uft8_collate_key() ignores case in some locales */
+                name = fm_file_info_get_disp_name(key->item->inf);
+            else
+                name = fm_file_info_get_collate_key(key->item->inf);
+            key->name = name ? g_string_chunk_insert(ctx->names, name) : NULL;
+        }
+    }
+    _sort_range(ctx, ctx->keys, ctx->tmp, ctx->start, ctx->end);
+    return NULL;
+}
+
+/* sorts ctx->keys, returns name keys storage to free after use */
+static GSList* _sort_keys(FmFolderSortCtx* ctx, guint n)
+{
+    FmFolderSortCtx chunks[SORT_MAX_THREADS];
+    GThread* threads[SORT_MAX_THREADS];
+    GSList* names = NULL;
+    guint n_chunks = 1, i, step;
+
+    /* column compare functions come from modules and may be not
+       thread-safe, sort with them in this thread */
+    if(n >= SORT_PARALLEL_MIN && ctx->kind != SORT_BY_FUNC)
+    {
+#if GLIB_CHECK_VERSION(2, 36, 0)
+        n_chunks = MIN(g_get_num_processors(), SORT_MAX_THREADS);
+#else
+        n_chunks = 4;
+#endif
+    }
+    for(i = 0; i < n_chunks; i++)
+    {
+        chunks[i] = *ctx;
+        chunks[i].start = (guint64)n * i / n_chunks;
+        chunks[i].end = (guint64)n * (i + 1) / n_chunks;
+        chunks[i].names = NULL;
+        threads[i] = NULL;
+        if(i == 0)
+            continue; /* the first chunk is done in this thread */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        threads[i] = g_thread_try_new("sort", _sort_chunk, &chunks[i], NULL);
+#else
+        threads[i] = g_thread_create(_sort_chunk, &chunks[i], TRUE, NULL);
+#endif
+    }
+    _sort_chunk(&chunks[0]);
+    for(i = 1; i < n_chunks; i++)
+    {
+        if(threads[i])
+            g_thread_join(threads[i]);
+        else /* failed to create thread */
+            _sort_chunk(&chunks[i]);
+    }
+    /* merge sorted chunks pairwise */
+    for(step = 1; step < n_chunks; step *= 2)
+        for(i = 0; i + step < n_chunks; i += 2 * step)
+            _sort_merge(ctx, ctx->keys, ctx->tmp, chunks[i].start,
+                        chunks[i + step].start,
+                        chunks[MIN(i + 2 * step, n_chunks) - 1].end);
+    for(i = 0; i < n_chunks; i++)
+        if(chunks[i].names)
+            names = g_slist_prepend(names, chunks[i].names);
+    return names;
+}
+
 static void fm_folder_model_do_sort(FmFolderModel* model)
 {
-    GHashTable* old_order;
+    FmFolderSortCtx ctx;
+    FmFolderSortKey* keys;
+    GHashTable* desc_keys = NULL;
+    GSList* names;
     gint *new_order;
-    GSequenceIter *items_it;
+    GSequenceIter *items_it, *end_it;
     GtkTreePath *path;
+    gboolean folder_first;
+    guint n, i;
 
     /* if there is only one item */
-    if( model->items == NULL || g_sequence_get_length(model->items) <= 1 )
+    if( model->items == NULL || (n = g_sequence_get_length(model->items)) <= 1 )
         return;
 
-    old_order = g_hash_table_new(g_direct_hash, g_direct_equal);
-    /* save old order */
+    ctx.ascending = FM_SORT_IS_ASCENDING(model->sort_mode);
+    ctx.case_sensitive = (model->sort_mode & FM_SORT_CASE_SENSITIVE) != 0;
+    ctx.compare = NULL;
+    if(model->sort_col >= FM_FOLDER_MODEL_N_COLS &&
+       model->sort_col < column_infos_n &&
+       column_infos[model->sort_col]->compare)
+    {
+        ctx.kind = SORT_BY_FUNC;
+        ctx.compare = column_infos[model->sort_col]->compare;
+    }
+    else switch(model->sort_col)
+    {
+    case FM_FOLDER_MODEL_COL_SIZE:
+    case FM_FOLDER_MODEL_COL_MTIME:
+        ctx.kind = SORT_BY_NUMBER;
+        break;
+    case FM_FOLDER_MODEL_COL_DESC:
+        ctx.kind = SORT_BY_STRING;
+        /* there are few distinct descriptions, collate each only once */
+        desc_keys = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+        break;
+    case FM_FOLDER_MODEL_COL_UNSORTED:
+        ctx.kind = SORT_NONE;
+        break;
+    case FM_FOLDER_MODEL_COL_DIRNAME:
+        ctx.kind = SORT_BY_DIRNAME;
+        break;
+    default:
+        ctx.kind = SORT_BY_NAME;
+    }
+    folder_first = !(model->sort_mode & FM_SORT_NO_FOLDER_FIRST);
+
+    /* collect keys in old order */
+    keys = g_new(FmFolderSortKey, n);
+    ctx.keys = g_new(FmFolderSortKey*, n);
+    ctx.tmp = g_new(FmFolderSortKey*, n);
     items_it = g_sequence_get_begin_iter(model->items);
-    while( !g_sequence_iter_is_end(items_it) )
+    for(i = 0; i < n; i++, items_it = g_sequence_iter_next(items_it))
     {
-        int i = g_sequence_iter_get_position(items_it);
-        g_hash_table_insert( old_order, items_it, GINT_TO_POINTER(i) );
-        items_it = g_sequence_iter_next(items_it);
+        FmFolderSortKey* key = &keys[i];
+        FmFolderItem* item = g_sequence_get(items_it);
+        FmFileInfo* fi = item->inf;
+
+        key->item = item;
+        key->iter = items_it;
+        key->old_pos = i;
+        key->rank = 1;
+        if(G_UNLIKELY(item->is_extra))
+        {
+            if(item->pos == FM_FOLDER_MODEL_ITEMPOS_PRE)
+                key->rank = 0;
+            else if(item->pos == FM_FOLDER_MODEL_ITEMPOS_POST)
+                key->rank = 2;
+        }
+        if(folder_first && !fm_file_info_is_dir(fi))
+            key->rank += 3;
+        key->str = key->name = NULL;
+        if(ctx.kind == SORT_BY_NUMBER)
+            key->number = (model->sort_col == FM_FOLDER_MODEL_COL_SIZE) ?
+                                fm_file_info_get_size(fi) :
+                                (gint64)fm_file_info_get_mtime(fi);
+        else if(ctx.kind == SORT_BY_STRING)
+        {
+            const char* desc = fm_file_info_get_desc(fi);
+            if(desc)
+            {
+                char* desc_key = g_hash_table_lookup(desc_keys, desc);
+                if(!desc_key)
+                {
+                    desc_key = g_utf8_collate_key(desc, -1);
+                    g_hash_table_insert(desc_keys, (gpointer)desc, desc_key);
+                }
+                key->str = desc_key;
+            }
+        }
+        ctx.keys[i] = key;
     }
 
-    /* sort the list */
-    g_sequence_sort(model->items, fm_folder_model_compare, model);
+    names = _sort_keys(&ctx, n);
 
-    /* save new order */
-    new_order = g_new( int, g_sequence_get_length(model->items) );
-    items_it = g_sequence_get_begin_iter(model->items);
-    while( !g_sequence_iter_is_end(items_it) )
+    /* rearrange the sequence and save new order */
+    new_order = g_new(int, n);
+    end_it = g_sequence_get_end_iter(model->items);
+    for(i = 0; i < n; i++)
     {
-        int i = g_sequence_iter_get_position(items_it);
-        new_order[i] = GPOINTER_TO_INT(g_hash_table_lookup(old_order, items_it));
-        items_it = g_sequence_iter_next(items_it);
+        new_order[i] = ctx.keys[i]->old_pos;
+        g_sequence_move(ctx.keys[i]->iter, end_it);
     }
-    g_hash_table_destroy(old_order);
+    g_free(ctx.tmp);
+    g_free(ctx.keys);
+    g_free(keys);
+    g_slist_free_full(names, (GDestroyNotify)g_string_chunk_free);
+    if(desc_keys)
+        g_hash_table_destroy(desc_keys);
+
     path = gtk_tree_path_new();
     gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model),
                                   path, NULL, new_order);
@@ -1597,6 +1881,64 @@ void fm_folder_model_set_icon_size(FmFolderModel* model, guint icon_size)
     reload_icons(model, RELOAD_BOTH);
 }
 
+/**
+ * fm_folder_model_raise_thumbnails
+ * @model: the folder model instance
+ * @start: first row shown to the user
+ * @end: last row shown to the user
+ *
+ * Moves requests for thumbnails of rows from @start to @end ahead of all
+ * other requests so thumbnails which the user sees are loaded first. The
+ * view should call this each time the range of visible rows changes.
+ *
+ * Since: 1.2.0
+ */
+void fm_folder_model_raise_thumbnails(FmFolderModel* model, GtkTreePath* start,
+                                      GtkTreePath* end)
+{
+    GHashTable* visible;
+    FmThumbnailRequest** reqs;
+    GSequenceIter* seq_it;
+    GList* l;
+    gint first, n, i;
+
+    g_return_if_fail(FM_IS_FOLDER_MODEL(model));
+    g_return_if_fail(start != NULL && end != NULL);
+
+    if(model->thumbnail_requests == NULL)
+        return;
+    first = gtk_tree_path_get_indices(start)[0];
+    n = gtk_tree_path_get_indices(end)[0] - first + 1;
+    if(first < 0 || n <= 0)
+        return;
+    visible = g_hash_table_new(g_direct_hash, NULL);
+    seq_it = g_sequence_get_iter_at_pos(model->items, first);
+    for(i = 0; i < n && !g_sequence_iter_is_end(seq_it); i++)
+    {
+        FmFolderItem* item = (FmFolderItem*)g_sequence_get(seq_it);
+        if(item->thumbnail_loading)
+            g_hash_table_insert(visible, item->inf, GINT_TO_POINTER(i + 1));
+        seq_it = g_sequence_iter_next(seq_it);
+    }
+    if(g_hash_table_size(visible) > 0)
+    {
+        reqs = g_new0(FmThumbnailRequest*, n);
+        for(l = model->thumbnail_requests; l; l = l->next)
+        {
+            FmFileInfo* fi = fm_thumbnail_request_get_file_info(l->data);
+            i = GPOINTER_TO_INT(g_hash_table_lookup(visible, fi));
+            if(i > 0)
+                reqs[i - 1] = l->data;
+        }
+        /* the request raised last is served first, so go from the bottom */
+        for(i = n - 1; i >= 0; i--)
+            if(reqs[i])
+                fm_thumbnail_loader_raise_priority(reqs[i]);
+        g_free(reqs);
+    }
+    g_hash_table_destroy(visible);
+}
+
 /**
  * fm_folder_model_get_icon_size
  * @model: the folder model instance
@@ -417,6 +417,8 @@ static gboolean on_update_dlg(gpointer user_data)
 {
     FmProgressDisplay* data = (FmProgressDisplay*)user_data;
     gdouble elapsed;
+    goffset finished, total, rate;
+    gboolean estimated;
 
     if (g_source_is_destroyed(g_main_current_source()) || data->dlg == NULL)
         return FALSE;
@@ -431,14 +433,30 @@ static gboolean on_update_dlg(gpointer user_data)
         data->old_cur_file = data->cur_file;
         data->cur_file = NULL;
     }
-    g_string_printf(data->str, "%d %%", data->percent);
+    estimated = fm_file_ops_job_is_total_estimated(data->job);
+    if(estimated)
+        /* the total size is still being counted */
+        g_string_printf(data->str, _("%d %% (estimated)"), data->percent);
+    else
+        g_string_printf(data->str, "%d %%", data->percent);
     gtk_progress_bar_set_fraction(data->progress, (gdouble)data->percent/100);
     gtk_progress_bar_set_text(data->progress, data->str->str);
 
     elapsed = g_timer_elapsed(data->timer, NULL);
-    if(elapsed >= 0.5 && data->percent > 0)
+    fm_file_ops_job_get_progress(data->job, &finished, &total, NULL, &rate);
+    if(estimated)
     {
-        gdouble remaining = elapsed * (100 - data->percent) / data->percent;
+        if(data->remaining_time)
+            gtk_label_set_text(data->remaining_time, "--:--:--");
+    }
+    else if(elapsed >= 0.5 && data->percent > 0)
+    {
+        gdouble remaining;
+        /* the current rate follows changes of speed better than average */
+        if(rate > 0 && total > finished)
+            remaining = (gdouble)(total - finished) / rate;
+        else
+            remaining = elapsed * (100 - data->percent) / data->percent;
         if(data->remaining_time)
         {
             char time_str[32];
@@ -76,6 +76,9 @@ struct _FmStandardView
     guint sel_changed_idle;
     gboolean sel_changed_pending;
 
+    /* to load thumbnails of visible items first */
+    guint raise_thumbnails_idle;
+
     FmFileInfoList* cached_selected_files;
     FmPathList* cached_selected_file_paths;
 
@@ -195,11 +198,55 @@ static void on_tree_view_row_activated(GtkTreeView* tv, GtkTreePath* path, GtkTr
     fm_folder_view_item_clicked(FM_FOLDER_VIEW(fv), path, FM_FV_ACTIVATED);
 }
 
+static gboolean on_raise_thumbnails_idle(gpointer user_data)
+{
+    FmStandardView* fv = (FmStandardView*)user_data;
+    GtkTreePath *start = NULL, *end = NULL;
+    gboolean visible;
+
+    /* check if fv is destroyed already */
+    if(g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    fv->raise_thumbnails_idle = 0;
+    if(!fv->model || !fv->view)
+        return FALSE;
+    if(fv->mode == FM_FV_LIST_VIEW)
+        visible = gtk_tree_view_get_visible_range(GTK_TREE_VIEW(fv->view), &start, &end);
+    else
+        visible = exo_icon_view_get_visible_range(EXO_ICON_VIEW(fv->view), &start, &end);
+    if(visible)
+    {
+        fm_folder_model_raise_thumbnails(fv->model, start, end);
+        gtk_tree_path_free(start);
+        gtk_tree_path_free(end);
+    }
+    return FALSE;
+}
+
+/* rows shown are drawn before the timeout fires so requests for their
+   thumbnails are already made and can be raised */
+static void queue_raise_thumbnails(FmStandardView* fv)
+{
+    if(!fv->raise_thumbnails_idle && fm_config->show_thumbnail)
+        fv->raise_thumbnails_idle = gdk_threads_add_timeout_full(G_PRIORITY_DEFAULT_IDLE, 100,
+                                                                 on_raise_thumbnails_idle,
+                                                                 fv, NULL);
+}
+
+static void on_adjustment_changed(GtkAdjustment* adj, FmStandardView* fv)
+{
+    queue_raise_thumbnails(fv);
+}
+
 static void fm_standard_view_init(FmStandardView *self)
 {
     gtk_scrolled_window_set_hadjustment((GtkScrolledWindow*)self, NULL);
     gtk_scrolled_window_set_vadjustment((GtkScrolledWindow*)self, NULL);
     gtk_scrolled_window_set_policy((GtkScrolledWindow*)self, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    g_signal_connect(gtk_scrolled_window_get_hadjustment((GtkScrolledWindow*)self),
+                     "value-changed", G_CALLBACK(on_adjustment_changed), self);
+    g_signal_connect(gtk_scrolled_window_get_vadjustment((GtkScrolledWindow*)self),
+                     "value-changed", G_CALLBACK(on_adjustment_changed), self);
 
     /* config change notifications */
     g_signal_connect(fm_config, "changed::single_click", G_CALLBACK(on_single_click_changed), self);
@@ -291,6 +338,7 @@ static void on_row_inserted(GtkTreeModel *tree_model, GtkTreePath *path,
 {
     if(fv->mode == FM_FV_LIST_VIEW)
         _reset_columns_widths(GTK_TREE_VIEW(fv->view));
+    queue_raise_thumbnails(fv);
 }
 
 static void unset_model(FmStandardView* fv)
@@ -311,6 +359,7 @@ static void unset_view(FmStandardView* fv);
 static void fm_standard_view_dispose(GObject *object)
 {
     FmStandardView *self;
+    GtkAdjustment *adj;
     g_return_if_fail(object != NULL);
     g_return_if_fail(FM_IS_STANDARD_VIEW(object));
     self = (FmStandardView*)object;
@@ -366,6 +415,18 @@ static void fm_standard_view_dispose(GObject *object)
         self->sel_changed_idle = 0;
     }
 
+    adj = gtk_scrolled_window_get_hadjustment((GtkScrolledWindow*)self);
+    if(adj)
+        g_signal_handlers_disconnect_by_func(adj, on_adjustment_changed, self);
+    adj = gtk_scrolled_window_get_vadjustment((GtkScrolledWindow*)self);
+    if(adj)
+        g_signal_handlers_disconnect_by_func(adj, on_adjustment_changed, self);
+    if(self->raise_thumbnails_idle)
+    {
+        g_source_remove(self->raise_thumbnails_idle);
+        self->raise_thumbnails_idle = 0;
+    }
+
     if(self->icon_size_changed_handler)
     {
         g_signal_handler_disconnect(fm_config, self->icon_size_changed_handler);
@@ -444,6 +505,8 @@ static void on_show_full_names_changed(FmConfig* cfg, FmStandardView* fv)
     else /* thumbnail view */
         font_height *= 5;
     g_object_set((GObject*)fv->renderer_text, "max-height", font_height, NULL);
+    /* with names cut to few lines all the items have the same size */
+    exo_icon_view_set_fixed_item_size(EXO_ICON_VIEW(fv->view), !fm_config->show_full_names);
     /* we cannot use gtk_widget_queue_resize() since ExoIconView does not
        recalculate sizes on that, therefore we do a little trick here:
        we reset all attributes we set before enforcing it to relayout */
@@ -630,6 +693,9 @@ static inline void create_icon_view(FmStandardView* fv, GList* sels)
                          NULL );
             exo_icon_view_set_column_spacing( (ExoIconView*)fv->view, 8 );
         }
+        /* with names cut to few lines all the items have the same size,
+           so the view doesn't need to measure every file to place them */
+        exo_icon_view_set_fixed_item_size((ExoIconView*)fv->view, !fm_config->show_full_names);
     }
     gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(fv->view), render, TRUE);
     gtk_cell_layout_add_attribute(GTK_CELL_LAYOUT(fv->view), render,
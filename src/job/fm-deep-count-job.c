@@ -31,18 +31,60 @@
  * size of all given files and directories, and size on disk for them.
  * If flags for the job include FM_DC_JOB_PREPARE_MOVE then also count of
  * files to move between volumes will be counted as well.
+ *
+ * Size on disk of a file which has several hard links is counted once.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "fm-deep-count-job.h"
+#include "fm-job-private.h"
 #include <glib/gstdio.h>
 #include <errno.h>
 
+#ifdef HAVE_AT_FUNCS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#endif
+
+typedef struct
+{
+    /* total_size is read by FmFileOpsJob while counting, it is updated
+       under this lock so it isn't seen torn on 32-bit systems */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex total_lock;
+#else
+    GMutex* total_lock;
+#endif
+} FmDeepCountJobPrivate;
+
+#define FM_DEEP_COUNT_JOB_GET_PRIVATE(job) \
+    (G_TYPE_INSTANCE_GET_PRIVATE((job), FM_DEEP_COUNT_JOB_TYPE, FmDeepCountJobPrivate))
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#  define DC_TOTAL_LOCK(priv) (&(priv)->total_lock)
+#else
+#  define DC_TOTAL_LOCK(priv) ((priv)->total_lock)
+#endif
+
 static void fm_deep_count_job_dispose              (GObject *object);
+static void fm_deep_count_job_finalize             (GObject *object);
 G_DEFINE_TYPE(FmDeepCountJob, fm_deep_count_job, FM_TYPE_JOB);
 
 static gboolean fm_deep_count_job_run(FmJob* job);
 
+#ifdef HAVE_AT_FUNCS
+static void deep_count_native(FmDeepCountJob* job, const char* path);
+#else
 static gboolean deep_count_posix(FmDeepCountJob* job, const char* path);
+#endif
 static gboolean deep_count_gio(FmDeepCountJob* job, GFileInfo* inf, GFile* gf);
 
 static const char query_str[] =
@@ -53,16 +95,39 @@ static const char query_str[] =
                 G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE","
                 G_FILE_ATTRIBUTE_ID_FILESYSTEM;
 
+static inline void dc_add_total_size(FmDeepCountJob* job, goffset size)
+{
+    FmDeepCountJobPrivate* priv = FM_DEEP_COUNT_JOB_GET_PRIVATE(job);
+
+    g_mutex_lock(DC_TOTAL_LOCK(priv));
+    job->total_size += size;
+    g_mutex_unlock(DC_TOTAL_LOCK(priv));
+}
+
+/* returns total size counted so far, can be called from any thread */
+goffset _fm_deep_count_job_get_total_size(FmDeepCountJob* job)
+{
+    FmDeepCountJobPrivate* priv = FM_DEEP_COUNT_JOB_GET_PRIVATE(job);
+    goffset total_size;
+
+    g_mutex_lock(DC_TOTAL_LOCK(priv));
+    total_size = job->total_size;
+    g_mutex_unlock(DC_TOTAL_LOCK(priv));
+    return total_size;
+}
+
 static void fm_deep_count_job_class_init(FmDeepCountJobClass *klass)
 {
     GObjectClass *g_object_class;
     FmJobClass* job_class;
     g_object_class = G_OBJECT_CLASS(klass);
     g_object_class->dispose = fm_deep_count_job_dispose;
-    /* use finalize from parent class */
+    g_object_class->finalize = fm_deep_count_job_finalize;
 
     job_class = FM_JOB_CLASS(klass);
     job_class->run = fm_deep_count_job_run;
+
+    g_type_class_add_private(klass, sizeof(FmDeepCountJobPrivate));
 }
 
 
@@ -83,10 +148,28 @@ static void fm_deep_count_job_dispose(GObject *object)
     G_OBJECT_CLASS(fm_deep_count_job_parent_class)->dispose(object);
 }
 
+static void fm_deep_count_job_finalize(GObject *object)
+{
+    FmDeepCountJobPrivate *priv = FM_DEEP_COUNT_JOB_GET_PRIVATE(object);
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&priv->total_lock);
+#else
+    g_mutex_free(priv->total_lock);
+#endif
+    G_OBJECT_CLASS(fm_deep_count_job_parent_class)->finalize(object);
+}
+
 
 static void fm_deep_count_job_init(FmDeepCountJob *self)
 {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&FM_DEEP_COUNT_JOB_GET_PRIVATE(self)->total_lock);
+#else
+    FM_DEEP_COUNT_JOB_GET_PRIVATE(self)->total_lock = g_mutex_new();
+#endif
     fm_job_init_cancellable(FM_JOB(self));
+    fm_job_set_priority(FM_JOB(self), FM_JOB_PRIORITY_COUNT);
 }
 
 /**
@@ -105,6 +188,7 @@ FmDeepCountJob *fm_deep_count_job_new(FmPathList* paths, FmDeepCountJobFlags fla
     FmDeepCountJob* job = (FmDeepCountJob*)g_object_new(FM_DEEP_COUNT_JOB_TYPE, NULL);
     job->paths = fm_path_list_ref(paths);
     job->flags = flags;
+    _fm_job_set_io_path(FM_JOB(job), fm_path_list_peek_head(paths));
     return job;
 }
 
@@ -120,7 +204,11 @@ static gboolean fm_deep_count_job_run(FmJob* job)
         if(fm_path_is_native(path)) /* if it's a native file, use posix APIs */
         {
             char *path_str = fm_path_to_str(path);
+#ifdef HAVE_AT_FUNCS
+            deep_count_native( dc, path_str );
+#else
             deep_count_posix( dc, path_str );
+#endif
             g_free(path_str);
         }
         else
@@ -133,6 +221,512 @@ static gboolean fm_deep_count_job_run(FmJob* job)
     return TRUE;
 }
 
+#ifdef HAVE_AT_FUNCS
+/* Local folders are walked without building a path for each file: every
+ * entry is tested with fstatat() relative to its folder descriptor. The
+ * folder given to the job is handed to a thread pool, and subfolders met
+ * at any depth are handed further while some thread is idle, the rest is
+ * walked depth first by the same thread. Errors are
+ * emitted from the threads of the pool while the job thread waits, so if
+ * the job runs in the thread which owns the main context then the tree
+ * is walked by the job thread alone. */
+
+#define DEEP_COUNT_THREADS          4    /* threads walking subfolders */
+#define DEEP_COUNT_FLUSH_FILES      64   /* files counted between updates of the job */
+#define DEEP_COUNT_CACHE_MIN_FILES  256  /* smaller subtrees are not cached */
+#define DEEP_COUNT_CACHE_MAX        4096 /* cache is emptied when it grows bigger */
+#define DEEP_COUNT_CACHE_TTL        30   /* seconds while cached totals are used */
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+} DCInode;
+
+typedef struct
+{
+    goffset size;
+    goffset ondisk;
+    guint count;
+    guint shared; /* links left out of ondisk since met by the walk before */
+} DCTotals;
+
+typedef struct _DCTask DCTask;
+
+typedef struct
+{
+    FmDeepCountJob* job;
+    GThreadPool* pool;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock;
+    GCond cond;
+    GMutex error_lock;
+#else
+    GMutex* lock;
+    GCond* cond;
+    GMutex* error_lock;
+#endif
+    int stat_flags;
+    gboolean use_cache;
+    gboolean sequential; /* no pool, the job runs in main thread */
+    volatile gint n_running; /* tasks queued or being walked */
+    /* these are protected by lock */
+    guint n_tasks; /* tasks not finished yet */
+    GHashTable* inodes; /* files with several links counted already */
+} DCWalk;
+
+/* a folder handed to the pool, its totals are complete once the folder
+ * itself is walked and all the tasks it handed further are done */
+struct _DCTask
+{
+    DCTask* parent;
+    int fd;
+    DCInode inode;
+    time_t mtime;
+    time_t ctime;
+    volatile gint pending; /* own walk + unfinished sub tasks */
+    /* these are protected by lock of walk */
+    DCTotals totals;
+    gboolean complete;
+};
+
+/* totals of big folders counted recently; they are valid while neither
+ * mtime nor ctime of the folder changed, that doesn't catch files changed
+ * deeper in the tree therefore entries expire after DEEP_COUNT_CACHE_TTL */
+typedef struct
+{
+    DCInode inode;
+    time_t mtime;
+    time_t ctime;
+    time_t stamp;
+    gboolean follow_links;
+    DCTotals totals;
+} DCCacheEntry;
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#  define DC_LOCK(walk) (&(walk)->lock)
+#  define DC_COND(walk) (&(walk)->cond)
+#  define DC_ERROR_LOCK(walk) (&(walk)->error_lock)
+#else
+#  define DC_LOCK(walk) ((walk)->lock)
+#  define DC_COND(walk) ((walk)->cond)
+#  define DC_ERROR_LOCK(walk) ((walk)->error_lock)
+#endif
+
+G_LOCK_DEFINE_STATIC(dc_cache);
+static GHashTable* dc_cache = NULL;
+
+static void deep_count_worker(gpointer data, gpointer user_data);
+
+static guint dc_inode_hash(gconstpointer key)
+{
+    const DCInode* inode = key;
+    guint64 ino = (guint64)inode->ino;
+    return (guint)ino ^ (guint)(ino >> 32) ^ ((guint)inode->dev * 31);
+}
+
+static gboolean dc_inode_equal(gconstpointer a, gconstpointer b)
+{
+    const DCInode* ia = a;
+    const DCInode* ib = b;
+    return ia->ino == ib->ino && ia->dev == ib->dev;
+}
+
+static void dc_inode_free(gpointer data)
+{
+    g_slice_free(DCInode, data);
+}
+
+static void dc_cache_entry_free(gpointer data)
+{
+    g_slice_free(DCCacheEntry, data);
+}
+
+static inline void dc_totals_add(DCTotals* totals, const DCTotals* add)
+{
+    totals->size += add->size;
+    totals->ondisk += add->ondisk;
+    totals->count += add->count;
+    totals->shared += add->shared;
+}
+
+static gboolean dc_cache_lookup(DCWalk* walk, const struct stat* st, DCTotals* totals)
+{
+    DCCacheEntry* entry = NULL;
+    DCInode inode;
+
+    inode.dev = st->st_dev;
+    inode.ino = st->st_ino;
+    G_LOCK(dc_cache);
+    if(dc_cache)
+        entry = g_hash_table_lookup(dc_cache, &inode);
+    if(entry && (entry->mtime != st->st_mtime || entry->ctime != st->st_ctime
+                 || entry->follow_links != (walk->stat_flags == 0)
+                 || time(NULL) - entry->stamp >= DEEP_COUNT_CACHE_TTL))
+    {
+        g_hash_table_remove(dc_cache, &inode);
+        entry = NULL;
+    }
+    if(entry)
+        *totals = entry->totals;
+    G_UNLOCK(dc_cache);
+    return (entry != NULL);
+}
+
+static void dc_cache_store(DCWalk* walk, const DCInode* inode, time_t mtime,
+                           time_t ctime, const DCTotals* totals)
+{
+    DCCacheEntry* entry;
+
+    /* ondisk of the subtree depends on what the walk met outside of it */
+    if(totals->count < DEEP_COUNT_CACHE_MIN_FILES || totals->shared > 0)
+        return;
+    entry = g_slice_new(DCCacheEntry);
+    entry->inode = *inode;
+    entry->mtime = mtime;
+    entry->ctime = ctime;
+    entry->stamp = time(NULL);
+    entry->follow_links = (walk->stat_flags == 0);
+    entry->totals = *totals;
+    G_LOCK(dc_cache);
+    if(G_UNLIKELY(dc_cache == NULL))
+        dc_cache = g_hash_table_new_full(dc_inode_hash, dc_inode_equal,
+                                         NULL, dc_cache_entry_free);
+    else if(g_hash_table_size(dc_cache) >= DEEP_COUNT_CACHE_MAX)
+        g_hash_table_remove_all(dc_cache);
+    g_hash_table_replace(dc_cache, &entry->inode, entry);
+    G_UNLOCK(dc_cache);
+}
+
+/* returns TRUE if the file wasn't met by the walk before */
+static gboolean dc_inode_first(DCWalk* walk, const struct stat* st)
+{
+    DCInode inode;
+    gboolean first;
+
+    inode.dev = st->st_dev;
+    inode.ino = st->st_ino;
+    g_mutex_lock(DC_LOCK(walk));
+    if(G_UNLIKELY(walk->inodes == NULL))
+        walk->inodes = g_hash_table_new_full(dc_inode_hash, dc_inode_equal,
+                                             dc_inode_free, NULL);
+    first = !g_hash_table_lookup_extended(walk->inodes, &inode, NULL, NULL);
+    if(first)
+    {
+        DCInode* key = g_slice_new(DCInode);
+        *key = inode;
+        g_hash_table_insert(walk->inodes, key, key);
+    }
+    g_mutex_unlock(DC_LOCK(walk));
+    return first;
+}
+
+/* errors from different threads are shown one by one; returns TRUE to retry */
+static gboolean dc_error(DCWalk* walk, int e)
+{
+    FmJob* job = FM_JOB(walk->job);
+    FmJobErrorAction act = FM_JOB_CONTINUE;
+
+    g_mutex_lock(DC_ERROR_LOCK(walk));
+    if(!fm_job_is_cancelled(job))
+    {
+        GError* err = g_error_new(G_IO_ERROR, g_io_error_from_errno(e), "%s", g_strerror(e));
+        act = fm_job_emit_error(job, err, FM_JOB_ERROR_MILD);
+        g_error_free(err);
+    }
+    g_mutex_unlock(DC_ERROR_LOCK(walk));
+    return (act == FM_JOB_RETRY);
+}
+
+/* adds totals found by the walk to the job so they are seen while counting */
+static void dc_flush(DCWalk* walk, DCTotals* found)
+{
+    if(found->count == 0)
+        return;
+    g_mutex_lock(DC_LOCK(walk));
+    walk->job->count += found->count;
+    dc_add_total_size(walk->job, found->size);
+    walk->job->total_ondisk_size += found->ondisk;
+    g_mutex_unlock(DC_LOCK(walk));
+    memset(found, 0, sizeof(DCTotals));
+}
+
+/* adds the file to the totals, returns TRUE if it's a folder to descend into */
+static gboolean dc_count_stat(DCWalk* walk, const struct stat* st, DCTotals* found)
+{
+    FmDeepCountJob* job = walk->job;
+
+    ++found->count;
+    found->size += (goffset)st->st_size;
+    /* several links of the same file take the disk space once */
+    if(S_ISDIR(st->st_mode) || st->st_nlink <= 1 || dc_inode_first(walk, st))
+        found->ondisk += (st->st_blocks * 512);
+    else
+        ++found->shared;
+
+    /* NOTE: if job->dest_dev is 0, that means our destination
+     * folder is not on native UNIX filesystem. Hence it's not
+     * on the same device. Our st.st_dev will always be non-zero
+     * since our file is on a native UNIX filesystem. */
+
+    /* only descends into files on the same filesystem */
+    if( job->flags & FM_DC_JOB_SAME_FS )
+    {
+        if( st->st_dev != job->dest_dev )
+            return FALSE;
+    }
+    /* only descends into files on the different filesystem */
+    else if( job->flags & FM_DC_JOB_PREPARE_MOVE )
+    {
+        if( st->st_dev == job->dest_dev )
+            return FALSE;
+    }
+    if(!S_ISDIR(st->st_mode))
+        return FALSE;
+    /* following symlinks may lead into a loop */
+    if(walk->stat_flags == 0 && !dc_inode_first(walk, st))
+        return FALSE;
+    return TRUE;
+}
+
+static void dc_queue(DCWalk* walk, DCTask* parent, int fd, const struct stat* st)
+{
+    DCTask* task = g_slice_new0(DCTask);
+
+    task->parent = parent;
+    task->fd = fd;
+    task->inode.dev = st->st_dev;
+    task->inode.ino = st->st_ino;
+    task->mtime = st->st_mtime;
+    task->ctime = st->st_ctime;
+    task->pending = 1;
+    task->complete = TRUE;
+    if(parent)
+        g_atomic_int_inc(&parent->pending);
+    g_atomic_int_inc(&walk->n_running);
+    g_mutex_lock(DC_LOCK(walk));
+    walk->n_tasks++;
+    g_mutex_unlock(DC_LOCK(walk));
+    if(walk->sequential)
+        deep_count_worker(task, walk);
+    else
+    {
+        if(G_UNLIKELY(walk->pool == NULL))
+            walk->pool = g_thread_pool_new(deep_count_worker, walk, DEEP_COUNT_THREADS,
+                                           FALSE, NULL);
+        g_thread_pool_push(walk->pool, task, NULL);
+    }
+}
+
+/* drops one pending count of @task; the last one adds totals of the task
+ * to the task which handed it over and does the same for that task */
+static void dc_task_done(DCWalk* walk, DCTask* task)
+{
+    while(task && g_atomic_int_dec_and_test(&task->pending))
+    {
+        DCTask* parent = task->parent;
+
+        if(task->complete && walk->use_cache)
+            dc_cache_store(walk, &task->inode, task->mtime, task->ctime, &task->totals);
+        g_mutex_lock(DC_LOCK(walk));
+        if(parent)
+        {
+            dc_totals_add(&parent->totals, &task->totals);
+            if(!task->complete)
+                parent->complete = FALSE;
+        }
+        walk->n_tasks--;
+        g_cond_broadcast(DC_COND(walk));
+        g_mutex_unlock(DC_LOCK(walk));
+        g_slice_free(DCTask, task);
+        task = parent;
+    }
+}
+
+/* counts contents of the folder open as @fd and takes ownership of it;
+ * @task is the task the folder belongs to, subfolders may be handed to
+ * other threads as its sub tasks; totals of contents are added to @totals
+ * except those handed over, then @queued is set; returns FALSE if anything
+ * was not counted */
+static gboolean dc_count_dir(DCWalk* walk, DCTask* task, int fd, DCTotals* totals,
+                             gboolean* queued)
+{
+    FmDeepCountJob* job = walk->job;
+    FmJob* fmjob = FM_JOB(job);
+    DCTotals found = { 0, 0, 0, 0 };
+    gboolean complete = TRUE;
+    struct dirent* ent;
+    DIR* dir;
+
+    dir = fdopendir(fd);
+    if(dir == NULL)
+    {
+        close(fd);
+        return FALSE;
+    }
+    while(!fm_job_is_cancelled(fmjob) && (ent = readdir(dir)) != NULL)
+    {
+        const char* name = ent->d_name;
+        DCTotals sub = { 0, 0, 0, 0 };
+        struct stat st;
+        int ret, sub_fd;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        while((ret = fstatat(dirfd(dir), name, &st, walk->stat_flags)) < 0)
+        {
+            if(!dc_error(walk, errno))
+                break;
+        }
+        if(ret < 0)
+        {
+            complete = FALSE;
+            continue;
+        }
+        if(dc_count_stat(walk, &st, &sub))
+        {
+            DCTotals contents = { 0, 0, 0, 0 };
+
+            if(walk->use_cache && dc_cache_lookup(walk, &st, &contents))
+                dc_totals_add(&sub, &contents);
+            else if((sub_fd = openat(dirfd(dir), name,
+                                     O_RDONLY | O_DIRECTORY | O_NOCTTY |
+                                     (walk->stat_flags ? O_NOFOLLOW : 0))) < 0)
+                complete = FALSE;
+            else if(!walk->sequential &&
+                    g_atomic_int_get(&walk->n_running) < DEEP_COUNT_THREADS)
+            {
+                dc_queue(walk, task, sub_fd, &st); /* contents are added by the task */
+                *queued = TRUE;
+            }
+            else
+            {
+                gboolean sub_queued = FALSE;
+
+                if(!dc_count_dir(walk, task, sub_fd, &contents, &sub_queued))
+                    complete = FALSE;
+                /* don't cache it if part of contents is counted by other tasks */
+                else if(!sub_queued && walk->use_cache)
+                {
+                    DCInode inode;
+                    inode.dev = st.st_dev;
+                    inode.ino = st.st_ino;
+                    dc_cache_store(walk, &inode, st.st_mtime, st.st_ctime, &contents);
+                }
+                if(sub_queued)
+                    *queued = TRUE;
+                /* the job got contents already from the walk above */
+                dc_totals_add(totals, &contents);
+            }
+        }
+        dc_totals_add(totals, &sub);
+        dc_totals_add(&found, &sub);
+        /* for moving across different devices, an additional 'delete'
+         * for source file is needed. so let's +1 for the delete.*/
+        if(job->flags & FM_DC_JOB_PREPARE_MOVE)
+        {
+            ++totals->size;
+            ++totals->ondisk;
+            ++totals->count;
+            ++found.size;
+            ++found.ondisk;
+            ++found.count;
+        }
+        if(found.count >= DEEP_COUNT_FLUSH_FILES)
+            dc_flush(walk, &found);
+    }
+    dc_flush(walk, &found);
+    closedir(dir);
+    return complete && !fm_job_is_cancelled(fmjob);
+}
+
+static void deep_count_worker(gpointer data, gpointer user_data)
+{
+    DCTask* task = (DCTask*)data;
+    DCWalk* walk = (DCWalk*)user_data;
+    DCTotals totals = { 0, 0, 0, 0 };
+    gboolean complete, queued = FALSE;
+
+    if(fm_job_is_cancelled(FM_JOB(walk->job)))
+    {
+        close(task->fd);
+        complete = FALSE;
+    }
+    else
+        complete = dc_count_dir(walk, task, task->fd, &totals, &queued);
+    g_mutex_lock(DC_LOCK(walk));
+    dc_totals_add(&task->totals, &totals);
+    if(!complete)
+        task->complete = FALSE;
+    g_mutex_unlock(DC_LOCK(walk));
+    g_atomic_int_add(&walk->n_running, -1);
+    dc_task_done(walk, task);
+}
+
+static void deep_count_native(FmDeepCountJob* job, const char* path)
+{
+    FmJob* fmjob = FM_JOB(job);
+    DCWalk walk;
+    DCTotals found = { 0, 0, 0, 0 };
+    struct stat st;
+    int ret, fd;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.job = job;
+    walk.stat_flags = (job->flags & FM_DC_JOB_FOLLOW_LINKS) ? 0 : AT_SYMLINK_NOFOLLOW;
+    walk.use_cache = (job->flags & FM_DC_JOB_USE_CACHE)
+                     && !(job->flags & (FM_DC_JOB_SAME_FS | FM_DC_JOB_PREPARE_MOVE));
+    walk.sequential = g_main_context_is_owner(g_main_context_default());
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&walk.lock);
+    g_cond_init(&walk.cond);
+    g_mutex_init(&walk.error_lock);
+#else
+    walk.lock = g_mutex_new();
+    walk.cond = g_cond_new();
+    walk.error_lock = g_mutex_new();
+#endif
+
+_retry_stat:
+    if( G_UNLIKELY(job->flags & FM_DC_JOB_FOLLOW_LINKS) )
+        ret = stat(path, &st);
+    else
+        ret = lstat(path, &st);
+    if(ret < 0)
+    {
+        if(dc_error(&walk, errno))
+            goto _retry_stat;
+        goto _out;
+    }
+    if(dc_count_stat(&walk, &st, &found) && !fm_job_is_cancelled(fmjob)
+       && !(walk.use_cache && dc_cache_lookup(&walk, &st, &found))
+       && (fd = open(path, O_RDONLY | O_DIRECTORY | O_NOCTTY)) >= 0)
+    {
+        dc_flush(&walk, &found);
+        dc_queue(&walk, NULL, fd, &st);
+        /* wait for the pool to walk the whole tree */
+        g_mutex_lock(DC_LOCK(&walk));
+        while(walk.n_tasks > 0)
+            g_cond_wait(DC_COND(&walk), DC_LOCK(&walk));
+        g_mutex_unlock(DC_LOCK(&walk));
+        if(walk.pool)
+            g_thread_pool_free(walk.pool, FALSE, TRUE);
+    }
+    dc_flush(&walk, &found);
+_out:
+    if(walk.inodes)
+        g_hash_table_destroy(walk.inodes);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&walk.lock);
+    g_cond_clear(&walk.cond);
+    g_mutex_clear(&walk.error_lock);
+#else
+    g_mutex_free(walk.lock);
+    g_cond_free(walk.cond);
+    g_mutex_free(walk.error_lock);
+#endif
+}
+#else /* !HAVE_AT_FUNCS */
 static gboolean deep_count_posix(FmDeepCountJob* job, const char *path)
 {
     FmJob* fmjob = FM_JOB(job);
@@ -148,7 +742,7 @@ _retry_stat:
     if( ret == 0 )
     {
         ++job->count;
-        job->total_size += (goffset)st.st_size;
+        dc_add_total_size(job, (goffset)st.st_size);
         job->total_ondisk_size += (st.st_blocks * 512);
 
         /* NOTE: if job->dest_dev is 0, that means our destination
@@ -200,7 +794,7 @@ _retry_stat:
                          * for source file is needed. so let's +1 for the delete.*/
                         if(job->flags & FM_DC_JOB_PREPARE_MOVE)
                         {
-                            ++job->total_size;
+                            dc_add_total_size(job, 1);
                             ++job->total_ondisk_size;
                             ++job->count;
                         }
@@ -213,6 +807,18 @@ _retry_stat:
     }
     return TRUE;
 }
+#endif /* HAVE_AT_FUNCS */
+
+void _fm_deep_count_job_finalize(void)
+{
+#ifdef HAVE_AT_FUNCS
+    G_LOCK(dc_cache);
+    if(dc_cache)
+        g_hash_table_destroy(dc_cache);
+    dc_cache = NULL;
+    G_UNLOCK(dc_cache);
+#endif
+}
 
 static gboolean deep_count_gio(FmDeepCountJob* job, GFileInfo* inf, GFile* gf)
 {
@@ -250,7 +856,7 @@ _retry_query_info:
     descend = TRUE;
 
     ++job->count;
-    job->total_size += g_file_info_get_size(inf);
+    dc_add_total_size(job, g_file_info_get_size(inf));
     job->total_ondisk_size += g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
 
     /* prepare for moving across different devices */
@@ -260,7 +866,7 @@ _retry_query_info:
         if( g_strcmp0(fs_id, job->dest_fs_id) != 0 )
         {
             /* files on different device requires an additional 'delete' for the source file. */
-            ++job->total_size; /* this is for the additional delete */
+            dc_add_total_size(job, 1); /* this is for the additional delete */
             ++job->total_ondisk_size;
             ++job->count;
         }
@@ -50,13 +50,16 @@ typedef struct _FmDeepCountJobClass        FmDeepCountJobClass;
  * @FM_DC_JOB_SAME_FS: only do deep count for files on the same devices. what's the use case of this?
  * @FM_DC_JOB_PREPARE_MOVE: special handling for moving files. only do deep count for files on different devices
  * @FM_DC_JOB_PREPARE_DELETE: special handling for deleting files
+ * @FM_DC_JOB_USE_CACHE: reuse totals of big local folders counted recently
+ *  (since 1.2.0); these may miss changes in files modified in place
  */
 typedef enum {
     FM_DC_JOB_DEFAULT = 0,
     FM_DC_JOB_FOLLOW_LINKS = 1<<0,
     FM_DC_JOB_SAME_FS = 1<<1,
     FM_DC_JOB_PREPARE_MOVE = 1<<2,
-    FM_DC_JOB_PREPARE_DELETE = 1 <<3
+    FM_DC_JOB_PREPARE_DELETE = 1 <<3,
+    FM_DC_JOB_USE_CACHE = 1 << 4
 } FmDeepCountJobFlags;
 
 /**
@@ -100,6 +103,8 @@ FmDeepCountJob* fm_deep_count_job_new(FmPathList* paths, FmDeepCountJobFlags fla
  */
 void fm_deep_count_job_set_dest(FmDeepCountJob* dc, dev_t dev, const char* fs_id);
 
+void _fm_deep_count_job_finalize(void);
+
 G_END_DECLS
 
 #endif /* __FM_DEEP_COUNT_JOB_H__ */
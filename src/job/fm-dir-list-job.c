@@ -40,8 +40,17 @@
 #include <gio/gio.h>
 #include <string.h>
 #include <glib/gstdio.h>
+#ifdef HAVE_AT_FUNCS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
 #include "fm-mime-type.h"
 #include "fm-file-info-job.h"
+#include "fm-file-info-private.h"
 #include "glib-compat.h"
 
 #include "fm-file-info.h"
@@ -51,15 +60,43 @@ enum {
     N_SIGNALS
 };
 
+typedef struct
+{
+    FmFileInfoArena* arena; /* collate keys of found files */
+    guint n_files_to_add;
+    guint batch_size;
+    guint batch_latency;
+    gboolean batch_urgent;
+} FmDirListJobPrivate;
+
+#define FM_DIR_LIST_JOB_GET_PRIVATE(job) \
+    (G_TYPE_INSTANCE_GET_PRIVATE((job), FM_TYPE_DIR_LIST_JOB, FmDirListJobPrivate))
+
 static void fm_dir_list_job_dispose              (GObject *object);
 G_DEFINE_TYPE(FmDirListJob, fm_dir_list_job, FM_TYPE_JOB);
 
 static int signals[N_SIGNALS];
 
+/* files found by the worker are handed over to the main thread in batches:
+   the batch is flushed either after batch_latency ms or as soon as there
+   are batch_size files in it, whichever comes first */
+#define DEFAULT_BATCH_SIZE      1000
+#define DEFAULT_BATCH_LATENCY   1000 /* ms */
+
+/* after this many entries the listing is considered big and stat() and
+   content type tests are fanned out to a few threads so I/O round trips
+   overlap, which matters a lot on network file systems */
+#define PIPELINE_THRESHOLD      128
+#define PIPELINE_MAX_WORKERS    4
+
+/* protects files_to_add, delay_add_files_handler, and private n_files_to_add
+   and batch_urgent of every job */
+G_LOCK_DEFINE_STATIC(files_to_add);
+
 static gboolean fm_dir_list_job_run(FmJob *job);
 static void fm_dir_list_job_finished(FmJob* job);
 
-static gboolean emit_found_files(gpointer user_data);
+static void flush_found_files(FmDirListJob *job);
 
 static void fm_dir_list_job_class_init(FmDirListJobClass *klass)
 {
@@ -93,13 +130,20 @@ static void fm_dir_list_job_class_init(FmDirListJobClass *klass)
                      g_cclosure_marshal_VOID__POINTER,
                      G_TYPE_NONE, 1, G_TYPE_POINTER);
 
+    g_type_class_add_private(klass, sizeof(FmDirListJobPrivate));
 }
 
 
 static void fm_dir_list_job_init(FmDirListJob *job)
 {
+    FmDirListJobPrivate *priv = FM_DIR_LIST_JOB_GET_PRIVATE(job);
+
     job->files = fm_file_info_list_new();
+    priv->arena = _fm_file_info_arena_new();
+    priv->batch_size = DEFAULT_BATCH_SIZE;
+    priv->batch_latency = DEFAULT_BATCH_LATENCY;
     fm_job_init_cancellable(FM_JOB(job));
+    fm_job_set_priority(FM_JOB(job), FM_JOB_PRIORITY_INTERACTIVE);
 }
 
 /**
@@ -166,11 +210,13 @@ FmDirListJob* fm_dir_list_job_new_for_gfile(GFile* gf)
 static void fm_dir_list_job_dispose(GObject *object)
 {
     FmDirListJob *job;
+    FmDirListJobPrivate *priv;
 
     g_return_if_fail(object != NULL);
     g_return_if_fail(FM_IS_DIR_LIST_JOB(object));
 
     job = (FmDirListJob*)object;
+    priv = FM_DIR_LIST_JOB_GET_PRIVATE(job);
 
     if(job->dir_path)
     {
@@ -190,45 +236,131 @@ static void fm_dir_list_job_dispose(GObject *object)
         job->files = NULL;
     }
 
+    if(priv->arena)
+    {
+        _fm_file_info_arena_unref(priv->arena);
+        priv->arena = NULL;
+    }
+
+    G_LOCK(files_to_add);
     if(job->delay_add_files_handler)
     {
         g_source_remove(job->delay_add_files_handler);
         job->delay_add_files_handler = 0;
-        g_slist_free_full(job->files_to_add, (GDestroyNotify)fm_file_info_unref);
-        job->files_to_add = NULL;
     }
+    g_slist_free_full(job->files_to_add, (GDestroyNotify)fm_file_info_unref);
+    job->files_to_add = NULL;
+    priv->n_files_to_add = 0;
+    G_UNLOCK(files_to_add);
 
     if (G_OBJECT_CLASS(fm_dir_list_job_parent_class)->dispose)
         (* G_OBJECT_CLASS(fm_dir_list_job_parent_class)->dispose)(object);
 }
 
-static inline FmFileInfo *_new_info_for_native_file(FmDirListJob* job, FmPath* path, const char* path_str, GError** err)
+static inline FmFileInfo *_new_info_for_native_file(FmDirListJob* job, FmPath* path,
+                                                    int dir_fd, const char* path_str,
+                                                    GError** err)
 {
     FmFileInfo *fi;
 
     if (fm_job_is_cancelled(FM_JOB(job)))
         return NULL;
-    if (!(job->flags & FM_DIR_LIST_JOB_DETAILED))
-        return fm_file_info_new_from_native_file(path, path_str, err);
     fi = fm_file_info_new();
     fm_file_info_set_path(fi, path);
-    if (fm_file_info_set_from_native_file(fi, path_str, err))
+    if (_fm_file_info_set_from_native_file_at(fi, dir_fd, path_str, err,
+                                              !(job->flags & FM_DIR_LIST_JOB_DETAILED)))
         return fi;
     fm_file_info_unref(fi);
     return NULL;
 }
 
+#ifdef HAVE_AT_FUNCS
+/* test if @ent is a directory, following symlinks, with minimal I/O */
+static gboolean _dir_entry_is_dir(int dir_fd, struct dirent *ent)
+{
+    struct stat st;
+
+#ifdef DT_UNKNOWN
+    /* most file systems fill d_type so we don't need stat() for them */
+    switch (ent->d_type)
+    {
+    case DT_DIR:
+        return TRUE;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        break;
+    default:
+        return FALSE;
+    }
+#endif
+    return (fstatat(dir_fd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+}
+#endif
+
+typedef struct
+{
+    FmDirListJob* job;
+    int dir_fd;
+} FmDirListPipeline;
+
+typedef struct
+{
+    FmPath* path;
+    char* path_str;
+} FmDirListPipelineItem;
+
+/* worker for big listings, runs in a thread from the pool */
+static void _pipeline_worker(gpointer data, gpointer user_data)
+{
+    FmDirListPipelineItem* item = data;
+    FmDirListPipeline* pipeline = user_data;
+    FmDirListJob* job = pipeline->job;
+    FmFileInfo* fi;
+    GError* err = NULL;
+
+    while(!(fi = _new_info_for_native_file(job, item->path, pipeline->dir_fd,
+                                           item->path_str, &err)))
+    {
+        FmJobErrorAction act;
+
+        if(!err) /* the job is cancelled */
+            break;
+        act = fm_job_emit_error(FM_JOB(job), err, FM_JOB_ERROR_MILD);
+        g_error_free(err);
+        err = NULL;
+        if(act != FM_JOB_RETRY)
+            break;
+    }
+    if(fi)
+    {
+        fm_dir_list_job_add_found_file(job, fi);
+        fm_file_info_unref(fi);
+    }
+    fm_path_unref(item->path);
+    g_free(item->path_str);
+    g_slice_free(FmDirListPipelineItem, item);
+}
+
 static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
 {
     FmJob* fmjob = FM_JOB(job);
     FmFileInfo* fi;
     GError *err = NULL;
     char* path_str;
+    FmDirListPipeline pipeline;
+    GThreadPool* pool = NULL;
+    guint n_found = 0;
+#ifdef HAVE_AT_FUNCS
+    DIR* dir;
+    int dir_fd;
+#else
     GDir* dir;
+    int dir_fd = -1;
+#endif
 
     path_str = fm_path_to_str(job->dir_path);
 
-    fi = _new_info_for_native_file(job, job->dir_path, path_str, NULL);
+    fi = _new_info_for_native_file(job, job->dir_path, -1, path_str, NULL);
     if(fi)
     {
         if(! fm_file_info_is_dir(fi))
@@ -255,10 +387,21 @@ static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
         return FALSE;
     }
 
+#ifdef HAVE_AT_FUNCS
+    /* read the directory via its descriptor and do all the tests for the
+     * files relative to it so kernel does not resolve full path each time */
+    dir_fd = open(path_str, O_RDONLY | O_DIRECTORY);
+    dir = (dir_fd >= 0) ? fdopendir(dir_fd) : NULL;
+    if( dir )
+    {
+        struct dirent* ent;
+        const char* name;
+#else
     dir = g_dir_open(path_str, 0, &err);
     if( dir )
     {
         const char* name;
+#endif
         GString* fpath = g_string_sized_new(4096);
         int dir_len = strlen(path_str);
         g_string_append_len(fpath, path_str, dir_len);
@@ -267,24 +410,55 @@ static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
             g_string_append_c(fpath, '/');
             ++dir_len;
         }
+#ifdef HAVE_AT_FUNCS
+        while( ! fm_job_is_cancelled(fmjob) && (ent = readdir(dir)) )
+#else
         while( ! fm_job_is_cancelled(fmjob) && (name = g_dir_read_name(dir)) )
+#endif
         {
             FmPath* new_path;
+#ifdef HAVE_AT_FUNCS
+            name = ent->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+#endif
             g_string_truncate(fpath, dir_len);
             g_string_append(fpath, name);
 
             if(job->flags & FM_DIR_LIST_JOB_DIR_ONLY) /* if we only want directories */
             {
+#ifdef HAVE_AT_FUNCS
+                if(!_dir_entry_is_dir(dir_fd, ent))
+                    continue;
+#else
                 struct stat st;
                 /* FIXME: this results in an additional stat() call, which is inefficient */
                 if(stat(fpath->str, &st) == -1 || !S_ISDIR(st.st_mode))
                     continue;
+#endif
             }
 
             new_path = fm_path_new_child(job->dir_path, name);
 
+            /* the directory is big, continue in parallel */
+            if(G_UNLIKELY(++n_found == PIPELINE_THRESHOLD))
+            {
+                pipeline.job = job;
+                pipeline.dir_fd = dir_fd;
+                pool = g_thread_pool_new(_pipeline_worker, &pipeline,
+                                         PIPELINE_MAX_WORKERS, FALSE, NULL);
+            }
+            if(pool)
+            {
+                FmDirListPipelineItem* item = g_slice_new(FmDirListPipelineItem);
+                item->path = new_path; /* steal the reference */
+                item->path_str = g_strndup(fpath->str, fpath->len);
+                g_thread_pool_push(pool, item, NULL);
+                continue;
+            }
+
         _retry:
-            fi = _new_info_for_native_file(job, new_path, fpath->str, &err);
+            fi = _new_info_for_native_file(job, new_path, dir_fd, fpath->str, &err);
             if(fi)
             {
                 fm_dir_list_job_add_found_file(job, fi);
@@ -301,10 +475,28 @@ static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
             fm_path_unref(new_path);
         }
         g_string_free(fpath, TRUE);
+        /* wait for workers since they use dir_fd */
+        if(pool)
+            g_thread_pool_free(pool, FALSE, TRUE);
+#ifdef HAVE_AT_FUNCS
+        closedir(dir); /* closes dir_fd as well */
+#else
         g_dir_close(dir);
+#endif
     }
     else
     {
+#ifdef HAVE_AT_FUNCS
+        int errsv = errno;
+        char *dname = g_filename_display_name(path_str);
+
+        if (dir_fd >= 0)
+            close(dir_fd);
+        err = g_error_new(G_IO_ERROR, g_io_error_from_errno(errsv),
+                          _("Error opening directory '%s': %s"),
+                          dname, g_strerror(errsv));
+        g_free(dname);
+#endif
         fm_job_emit_error(fmjob, err, FM_JOB_ERROR_CRITICAL);
         g_error_free(err);
     }
@@ -458,11 +650,16 @@ static void fm_dir_list_job_finished(FmJob* job)
 
     if(dirlist_job->emit_files_found)
     {
-        if(dirlist_job->delay_add_files_handler)
-        {
-            g_source_remove(dirlist_job->delay_add_files_handler);
-            emit_found_files(dirlist_job);
-        }
+        guint handler;
+
+        /* the worker is done so flush the rest right now */
+        G_LOCK(files_to_add);
+        handler = dirlist_job->delay_add_files_handler;
+        dirlist_job->delay_add_files_handler = 0;
+        G_UNLOCK(files_to_add);
+        if(handler)
+            g_source_remove(handler);
+        flush_found_files(dirlist_job);
     }
     if(job_class->finished)
         job_class->finished(job);
@@ -538,34 +735,48 @@ FmFileInfoList* fm_dir_dist_job_get_files(FmDirListJob* job)
 }
 #endif /* FM_DISABLE_DEPRECATED */
 
+/* this function is called from the main thread */
+static void flush_found_files(FmDirListJob *job)
+{
+    FmDirListJobPrivate *priv = FM_DIR_LIST_JOB_GET_PRIVATE(job);
+    GSList *files;
+
+    G_LOCK(files_to_add);
+    files = job->files_to_add;
+    job->files_to_add = NULL;
+    priv->n_files_to_add = 0;
+    priv->batch_urgent = FALSE;
+    G_UNLOCK(files_to_add);
+    /* g_print("flush_found_files: %d\n", g_slist_length(files)); */
+    if(files)
+    {
+        g_signal_emit(job, signals[FILES_FOUND], 0, files);
+        g_slist_free_full(files, (GDestroyNotify)fm_file_info_unref);
+    }
+}
+
 static gboolean emit_found_files(gpointer user_data)
 {
     /* this callback is called from the main thread */
     FmDirListJob* job = FM_DIR_LIST_JOB(user_data);
-    /* g_print("emit_found_files: %d\n", g_slist_length(job->files_to_add)); */
+    GSource *source = g_main_current_source();
 
-    if(g_source_is_destroyed(g_main_current_source()))
+    if(g_source_is_destroyed(source))
         return FALSE;
-    g_signal_emit(job, signals[FILES_FOUND], 0, job->files_to_add);
-    g_slist_free_full(job->files_to_add, (GDestroyNotify)fm_file_info_unref);
-    job->files_to_add = NULL;
+    G_LOCK(files_to_add);
+    /* the delayed flush may be superseded by an urgent one, or the job
+       may be already finished, in both cases the batch isn't ours */
+    if(job->delay_add_files_handler != g_source_get_id(source))
+    {
+        G_UNLOCK(files_to_add);
+        return FALSE;
+    }
     job->delay_add_files_handler = 0;
+    G_UNLOCK(files_to_add);
+    flush_found_files(job);
     return FALSE;
 }
 
-static gpointer queue_add_file(FmJob* fmjob, gpointer user_data)
-{
-    FmDirListJob* job = FM_DIR_LIST_JOB(fmjob);
-    FmFileInfo* file = FM_FILE_INFO(user_data);
-    /* this callback is called from the main thread */
-    /* g_print("queue_add_file: %s\n", fm_file_info_get_disp_name(file)); */
-    job->files_to_add = g_slist_prepend(job->files_to_add, fm_file_info_ref(file));
-    if(job->delay_add_files_handler == 0)
-        job->delay_add_files_handler = g_timeout_add_seconds_full(G_PRIORITY_LOW,
-                        1, emit_found_files, g_object_ref(job), g_object_unref);
-    return NULL;
-}
-
 /**
  * fm_dir_list_job_add_found_file
  * @job: the job that collected listing
@@ -586,9 +797,35 @@ static gpointer queue_add_file(FmJob* fmjob, gpointer user_data)
  */
 void fm_dir_list_job_add_found_file(FmDirListJob* job, FmFileInfo* file)
 {
+    FmDirListJobPrivate* priv = FM_DIR_LIST_JOB_GET_PRIVATE(job);
+
+    /* the file will be sorted by name most likely, make the key now while
+       we are not in the main thread */
+    if(G_LIKELY(priv->arena))
+        _fm_file_info_make_collate_key(file, priv->arena);
+    /* big listings are done by few threads at once so lock is required */
+    G_LOCK(files_to_add);
     fm_file_info_list_push_tail(job->files, file);
     if(G_UNLIKELY(job->emit_files_found))
-        fm_job_call_main_thread(FM_JOB(job), queue_add_file, file);
+    {
+        /* never wait for the main thread here, just queue the file and
+           let the main loop pick up the whole batch later */
+        job->files_to_add = g_slist_prepend(job->files_to_add, fm_file_info_ref(file));
+        priv->n_files_to_add++;
+        if(priv->n_files_to_add >= priv->batch_size && !priv->batch_urgent)
+        {
+            /* batch is full: replace the pending timeout with an idle
+               handler, emit_found_files() will ignore the timeout */
+            priv->batch_urgent = TRUE;
+            job->delay_add_files_handler = g_idle_add_full(G_PRIORITY_LOW,
+                        emit_found_files, g_object_ref(job), g_object_unref);
+        }
+        else if(job->delay_add_files_handler == 0)
+            job->delay_add_files_handler = g_timeout_add_full(G_PRIORITY_LOW,
+                        priv->batch_latency, emit_found_files,
+                        g_object_ref(job), g_object_unref);
+    }
+    G_UNLOCK(files_to_add);
 }
 
 #if 0
@@ -642,3 +879,31 @@ void fm_dir_list_job_set_incremental(FmDirListJob* job, gboolean set)
 {
     job->emit_files_found = set;
 }
+
+/**
+ * fm_dir_list_job_set_incremental_batch
+ * @job: the job descriptor
+ * @batch_size: max number of files to collect before emitting the signal
+ * @latency: max delay before emitting the signal, in milliseconds
+ *
+ * Sets how found files are grouped for the #FmDirListJob::files-found
+ * signal emission when it is turned on by fm_dir_list_job_set_incremental().
+ * The signal is emitted either after @latency milliseconds since the
+ * first file of a batch was found or when @batch_size files were found,
+ * whichever comes first. The worker thread never waits for the signal
+ * handlers to complete. Value 0 for either parameter means to use the
+ * default (1000 files and 1000 ms).
+ * This should only be called before the @job is launched.
+ *
+ * Since: 1.2.0
+ */
+void fm_dir_list_job_set_incremental_batch(FmDirListJob *job, guint batch_size,
+                                           guint latency)
+{
+    FmDirListJobPrivate *priv;
+
+    g_return_if_fail(FM_IS_DIR_LIST_JOB(job));
+    priv = FM_DIR_LIST_JOB_GET_PRIVATE(job);
+    priv->batch_size = batch_size ? batch_size : DEFAULT_BATCH_SIZE;
+    priv->batch_latency = latency ? latency : DEFAULT_BATCH_LATENCY;
+}
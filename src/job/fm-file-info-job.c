@@ -37,6 +37,7 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "fm-file-info.h"
 
@@ -151,13 +152,18 @@ FmFileInfoJob* fm_file_info_job_new(FmPathList* files_to_query, FmFileInfoJobFla
 
 static void _check_native_display_names(FmPath *path)
 {
+    char path_buf[PATH_MAX];
     char *path_str, *disp_name;
 
     if (path == NULL || _fm_path_get_display_name(path) != NULL)
         return; /* all done */
-    path_str = fm_path_to_str(path);
+    if (fm_path_to_str_buf(path, path_buf, sizeof(path_buf)) < sizeof(path_buf))
+        path_str = path_buf;
+    else
+        path_str = fm_path_to_str(path);
     disp_name = g_filename_display_basename(path_str);
-    g_free(path_str);
+    if (path_str != path_buf)
+        g_free(path_str);
     _fm_path_set_display_name(path, disp_name);
     g_free(disp_name);
     _check_native_display_names(fm_path_get_parent(path)); /* recursion */
@@ -212,7 +218,12 @@ static gboolean fm_file_info_job_run(FmJob* fmjob)
 
         if(fm_path_is_native(path))
         {
-            char* path_str = fm_path_to_str(path);
+            char path_buf[PATH_MAX];
+            char* path_str = path_buf;
+
+            /* avoid allocation for each file */
+            if(fm_path_to_str_buf(path, path_buf, sizeof(path_buf)) >= sizeof(path_buf))
+                path_str = fm_path_to_str(path);
             if(!_fm_file_info_job_get_info_for_native_file(fmjob, fi, path_str, &err))
             {
                 FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MILD);
@@ -220,7 +231,8 @@ static gboolean fm_file_info_job_run(FmJob* fmjob)
                 err = NULL;
                 if(act == FM_JOB_RETRY)
                 {
-                    g_free(path_str);
+                    if(path_str != path_buf)
+                        g_free(path_str);
                     continue; /* retry */
                 }
 
@@ -228,7 +240,8 @@ static gboolean fm_file_info_job_run(FmJob* fmjob)
             }
             else if(G_UNLIKELY(job->flags & FM_FILE_INFO_JOB_EMIT_FOR_EACH_FILE))
                 fm_job_call_main_thread(fmjob, _emit_current_file, fi);
-            g_free(path_str);
+            if(path_str != path_buf)
+                g_free(path_str);
             /* recursively set display names for path parents */
             _check_native_display_names(fm_path_get_parent(path));
         }
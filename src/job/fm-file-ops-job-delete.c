@@ -30,10 +30,429 @@
 #include "fm-file.h"
 #include <glib/gi18n-lib.h>
 
+#ifdef HAVE_AT_FUNCS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
 static const char query[] =  G_FILE_ATTRIBUTE_STANDARD_TYPE","
                                G_FILE_ATTRIBUTE_STANDARD_NAME","
                                G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME;
 
+#ifdef HAVE_AT_FUNCS
+/* Local files are deleted without GIO: each folder is read through its
+ * descriptor and its entries are removed with unlinkat() relative to it,
+ * so kernel does not resolve full path for each file. Subfolders found
+ * in a folder handed to the pool are handed to the pool as well while
+ * some thread is idle, the rest of the tree is removed depth first.
+ * Errors are emitted from the threads of the pool while the job thread
+ * waits, so if the job runs in the thread which owns the main context
+ * then the tree is removed by the job thread alone. */
+
+#define DELETE_THREADS          4   /* threads removing subtrees in parallel */
+#define DELETE_PROGRESS_FILES   64  /* files removed between progress updates */
+
+typedef struct _FmDeleteTree FmDeleteTree;
+typedef struct _FmDeleteTask FmDeleteTask;
+
+struct _FmDeleteTree
+{
+    FmFileOpsJob* job;
+    GThreadPool* pool;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock;
+    GCond cond;
+    GMutex error_lock;
+#else
+    GMutex* lock;
+    GCond* cond;
+    GMutex* error_lock;
+#endif
+    volatile gint n_running; /* tasks queued or being scanned */
+    gboolean sequential; /* no pool, the job runs in main thread */
+    /* these are protected by lock */
+    guint n_tasks; /* tasks which folder isn't removed yet */
+    gboolean root_removed;
+};
+
+/* a folder handed to the pool, it is removed once the folder itself is
+ * scanned and all the tasks it handed further are done */
+struct _FmDeleteTask
+{
+    FmDeleteTask* parent;
+    char* path_str;
+    FmPath* path;
+    volatile gint pending; /* own scan + unfinished sub tasks */
+    volatile gint incomplete; /* something inside was skipped */
+};
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#  define DELETE_LOCK(tree) (&(tree)->lock)
+#  define DELETE_COND(tree) (&(tree)->cond)
+#  define DELETE_ERROR_LOCK(tree) (&(tree)->error_lock)
+#else
+#  define DELETE_LOCK(tree) ((tree)->lock)
+#  define DELETE_COND(tree) ((tree)->cond)
+#  define DELETE_ERROR_LOCK(tree) ((tree)->error_lock)
+#endif
+
+enum
+{
+    DELETE_LEFT, /* skipped or failed */
+    DELETE_DONE,
+    DELETE_QUEUED
+};
+
+static void _delete_tree_worker(gpointer data, gpointer user_data);
+
+/* asks user what to do about the failed operation on @path_str, requests
+ * from different threads are asked one by one; returns TRUE to retry */
+static gboolean _delete_tree_error(FmDeleteTree* tree, int e, const char* path_str)
+{
+    FmJob* job = FM_JOB(tree->job);
+    FmJobErrorAction act = FM_JOB_CONTINUE;
+    GError* err;
+    char* disp;
+
+    g_mutex_lock(DELETE_ERROR_LOCK(tree));
+    if(!fm_job_is_cancelled(job))
+    {
+        disp = g_filename_display_name(path_str);
+        err = g_error_new(G_IO_ERROR, g_io_error_from_errno(e),
+                          _("Cannot delete '%s': %s"), disp, g_strerror(e));
+        g_free(disp);
+        act = fm_job_emit_error(job, err, FM_JOB_ERROR_MODERATE);
+        g_error_free(err);
+    }
+    g_mutex_unlock(DELETE_ERROR_LOCK(tree));
+    return (act == FM_JOB_RETRY);
+}
+
+static gboolean _delete_tree_unlink(FmDeleteTree* tree, int dir_fd, const char* name,
+                                    int flags, const char* path_str)
+{
+    while(unlinkat(dir_fd, name, flags) < 0)
+    {
+        int e = errno;
+        if(e == ENOENT) /* somebody else removed it already */
+            break;
+        if(fm_job_is_cancelled(FM_JOB(tree->job)) || !_delete_tree_error(tree, e, path_str))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static void _delete_tree_progress(FmDeleteTree* tree, guint n_files)
+{
+    if(n_files == 0)
+        return;
+    g_mutex_lock(DELETE_LOCK(tree));
+    tree->job->finished += n_files;
+    fm_file_ops_job_emit_percent(tree->job);
+    g_mutex_unlock(DELETE_LOCK(tree));
+}
+
+static void _delete_tree_notify(FmPath* path)
+{
+    FmFolder* folder = fm_folder_find_by_path(fm_path_get_parent(path));
+    if(folder)
+    {
+        _fm_folder_event_file_deleted(folder, path);
+        g_object_unref(folder);
+    }
+}
+
+static void _delete_tree_queue(FmDeleteTree* tree, FmDeleteTask* parent,
+                               const char* path_str, FmPath* path)
+{
+    FmDeleteTask* task = g_slice_new(FmDeleteTask);
+
+    task->parent = parent;
+    task->path_str = g_strdup(path_str);
+    task->path = path; /* steal the reference */
+    task->pending = 1;
+    task->incomplete = 0;
+    if(parent)
+        g_atomic_int_inc(&parent->pending);
+    g_atomic_int_inc(&tree->n_running);
+    g_mutex_lock(DELETE_LOCK(tree));
+    tree->n_tasks++;
+    g_mutex_unlock(DELETE_LOCK(tree));
+    if(tree->sequential)
+        _delete_tree_worker(task, tree);
+    else
+    {
+        if(G_UNLIKELY(tree->pool == NULL))
+            tree->pool = g_thread_pool_new(_delete_tree_worker, tree, DELETE_THREADS,
+                                           FALSE, NULL);
+        g_thread_pool_push(tree->pool, task, NULL);
+    }
+}
+
+/* drops one pending count of @task; the last one removes the folder and
+ * does the same for the task which handed it over */
+static void _delete_task_done(FmDeleteTree* tree, FmDeleteTask* task)
+{
+    while(task && g_atomic_int_dec_and_test(&task->pending))
+    {
+        FmDeleteTask* parent = task->parent;
+        gboolean removed = FALSE;
+
+        if(!g_atomic_int_get(&task->incomplete) && !fm_job_is_cancelled(FM_JOB(tree->job))
+           && _delete_tree_unlink(tree, AT_FDCWD, task->path_str, AT_REMOVEDIR, task->path_str))
+        {
+            _delete_tree_progress(tree, 1);
+            _delete_tree_notify(task->path);
+            removed = TRUE;
+        }
+        else if(parent)
+            g_atomic_int_set(&parent->incomplete, 1);
+
+        g_free(task->path_str);
+        fm_path_unref(task->path);
+        g_slice_free(FmDeleteTask, task);
+
+        g_mutex_lock(DELETE_LOCK(tree));
+        if(parent == NULL)
+            tree->root_removed = removed;
+        tree->n_tasks--;
+        g_cond_broadcast(DELETE_COND(tree));
+        g_mutex_unlock(DELETE_LOCK(tree));
+        task = parent;
+    }
+}
+
+static int _delete_tree_subdir(FmDeleteTree* tree, FmDeleteTask* task, int dir_fd,
+                               const char* name, FmPath* dir_path, GString* path_str);
+
+/* removes everything inside of the folder @dir_path open as @fd, takes
+ * ownership of @fd; @task is set only for the folder of the task so its
+ * subfolders may be handed to other threads; @path_str contains the path
+ * of the folder on entry and on return; returns FALSE if anything is left */
+static gboolean _delete_dir_contents(FmDeleteTree* tree, FmDeleteTask* task, int fd,
+                                     FmPath* dir_path, GString* path_str)
+{
+    FmJob* job = FM_JOB(tree->job);
+    FmFolder* folder;
+    DIR* dir;
+    struct dirent* ent;
+    gsize len = path_str->len;
+    guint n_removed = 0;
+    gboolean complete = TRUE;
+
+    while((dir = fdopendir(fd)) == NULL)
+    {
+        if(fm_job_is_cancelled(job) || !_delete_tree_error(tree, errno, path_str->str))
+        {
+            close(fd);
+            return FALSE;
+        }
+    }
+    folder = fm_folder_find_by_path(dir_path);
+    while(!fm_job_is_cancelled(job) && (ent = readdir(dir)) != NULL)
+    {
+        const char* name = ent->d_name;
+        gboolean is_dir;
+        int res;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        g_string_append_c(path_str, G_DIR_SEPARATOR);
+        g_string_append(path_str, name);
+#ifdef _DIRENT_HAVE_D_TYPE
+        if(ent->d_type != DT_UNKNOWN)
+            is_dir = (ent->d_type == DT_DIR);
+        else
+#endif
+        {
+            struct stat st;
+            is_dir = (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                      && S_ISDIR(st.st_mode));
+        }
+        if(is_dir)
+            res = _delete_tree_subdir(tree, task, dirfd(dir), name, dir_path, path_str);
+        else if(_delete_tree_unlink(tree, dirfd(dir), name, 0, path_str->str))
+            res = DELETE_DONE;
+        else
+            res = DELETE_LEFT;
+        g_string_truncate(path_str, len);
+
+        if(res == DELETE_DONE)
+        {
+            if(folder)
+            {
+                FmPath* path = fm_path_new_child(dir_path, name);
+                _fm_folder_event_file_deleted(folder, path);
+                fm_path_unref(path);
+            }
+            if(++n_removed == DELETE_PROGRESS_FILES)
+            {
+                _delete_tree_progress(tree, n_removed);
+                n_removed = 0;
+            }
+        }
+        else if(res == DELETE_LEFT)
+            complete = FALSE;
+    }
+    _delete_tree_progress(tree, n_removed);
+    closedir(dir);
+    if(folder)
+        g_object_unref(folder);
+    return complete && !fm_job_is_cancelled(job);
+}
+
+/* removes the subfolder @name of the folder open as @dir_fd, or hands it
+ * over if @task is set and some thread of the pool is idle; @path_str
+ * contains the path of the subfolder */
+static int _delete_tree_subdir(FmDeleteTree* tree, FmDeleteTask* task, int dir_fd,
+                               const char* name, FmPath* dir_path, GString* path_str)
+{
+    FmPath* path = fm_path_new_child(dir_path, name);
+    char* disp;
+    int fd;
+    int res = DELETE_LEFT;
+
+    if(task && !tree->sequential && g_atomic_int_get(&tree->n_running) < DELETE_THREADS)
+    {
+        _delete_tree_queue(tree, task, path_str->str, path);
+        return DELETE_QUEUED;
+    }
+
+    while((fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0)
+    {
+        int e = errno;
+        if(e == ENOENT)
+        {
+            res = DELETE_DONE;
+            goto _out;
+        }
+        if(fm_job_is_cancelled(FM_JOB(tree->job)) || !_delete_tree_error(tree, e, path_str->str))
+            goto _out;
+    }
+    disp = g_filename_display_name(name);
+    fm_file_ops_job_emit_cur_file(tree->job, disp);
+    g_free(disp);
+    if(_delete_dir_contents(tree, NULL, fd, path, path_str)
+       && _delete_tree_unlink(tree, dir_fd, name, AT_REMOVEDIR, path_str->str))
+        res = DELETE_DONE;
+_out:
+    fm_path_unref(path);
+    return res;
+}
+
+static void _delete_tree_worker(gpointer data, gpointer user_data)
+{
+    FmDeleteTask* task = (FmDeleteTask*)data;
+    FmDeleteTree* tree = (FmDeleteTree*)user_data;
+    GString* path_str;
+    char* disp;
+    int fd;
+
+    path_str = g_string_new(task->path_str);
+    while(!fm_job_is_cancelled(FM_JOB(tree->job)))
+    {
+        fd = open(task->path_str, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if(fd >= 0)
+        {
+            disp = fm_path_display_basename(task->path);
+            fm_file_ops_job_emit_cur_file(tree->job, disp);
+            g_free(disp);
+            if(!_delete_dir_contents(tree, task, fd, task->path, path_str))
+                g_atomic_int_set(&task->incomplete, 1);
+            break;
+        }
+        if(errno == ENOENT) /* somebody else removed it already */
+            break;
+        if(!_delete_tree_error(tree, errno, task->path_str))
+        {
+            g_atomic_int_set(&task->incomplete, 1);
+            break;
+        }
+    }
+    g_string_free(path_str, TRUE);
+    g_atomic_int_add(&tree->n_running, -1);
+    _delete_task_done(tree, task);
+}
+
+static FmDeleteTree* _delete_tree_new(FmFileOpsJob* job)
+{
+    FmDeleteTree* tree = g_slice_new0(FmDeleteTree);
+
+    tree->job = job;
+    tree->sequential = g_main_context_is_owner(g_main_context_default());
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&tree->lock);
+    g_cond_init(&tree->cond);
+    g_mutex_init(&tree->error_lock);
+#else
+    tree->lock = g_mutex_new();
+    tree->cond = g_cond_new();
+    tree->error_lock = g_mutex_new();
+#endif
+    return tree;
+}
+
+static void _delete_tree_free(FmDeleteTree* tree)
+{
+    if(tree->pool)
+        g_thread_pool_free(tree->pool, FALSE, TRUE);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&tree->lock);
+    g_cond_clear(&tree->cond);
+    g_mutex_clear(&tree->error_lock);
+#else
+    g_mutex_free(tree->lock);
+    g_cond_free(tree->cond);
+    g_mutex_free(tree->error_lock);
+#endif
+    g_slice_free(FmDeleteTree, tree);
+}
+
+/* deletes the local file or folder @path, returns TRUE if it was removed */
+static gboolean _fm_file_ops_job_delete_native(FmDeleteTree* tree, FmPath* path)
+{
+    FmJob* job = FM_JOB(tree->job);
+    char* path_str = fm_path_to_str(path);
+    char* disp;
+    struct stat st;
+    gboolean ok = FALSE;
+
+    disp = fm_path_display_basename(path);
+    fm_file_ops_job_emit_cur_file(tree->job, disp);
+    g_free(disp);
+
+    while(lstat(path_str, &st) < 0)
+    {
+        if(errno == ENOENT || fm_job_is_cancelled(job) || !_delete_tree_error(tree, errno, path_str))
+            goto _out;
+    }
+    if(S_ISDIR(st.st_mode))
+    {
+        tree->root_removed = FALSE;
+        _delete_tree_queue(tree, NULL, path_str, fm_path_ref(path));
+        /* wait for the pool to remove the whole tree */
+        g_mutex_lock(DELETE_LOCK(tree));
+        while(tree->n_tasks > 0)
+            g_cond_wait(DELETE_COND(tree), DELETE_LOCK(tree));
+        ok = tree->root_removed;
+        g_mutex_unlock(DELETE_LOCK(tree));
+    }
+    else if(_delete_tree_unlink(tree, AT_FDCWD, path_str, 0, path_str))
+    {
+        _delete_tree_progress(tree, 1);
+        _delete_tree_notify(path);
+        ok = TRUE;
+    }
+_out:
+    g_free(path_str);
+    return ok;
+}
+#endif /* HAVE_AT_FUNCS */
+
 
 gboolean _fm_file_ops_job_delete_file(FmJob* job, GFile* gf, GFileInfo* inf, FmFolder *folder)
 {
@@ -214,6 +633,9 @@ gboolean _fm_file_ops_job_delete_run(FmFileOpsJob* job)
     FmJob* fmjob = FM_JOB(job);
     FmPath *path, *parent = NULL;
     FmFolder *parent_folder = NULL;
+#ifdef HAVE_AT_FUNCS
+    FmDeleteTree *tree = NULL;
+#endif
 
     /* let the deep count job share the same cancellable */
     fm_job_set_cancellable(FM_JOB(dc), fm_job_get_cancellable(fmjob));
@@ -255,11 +677,24 @@ gboolean _fm_file_ops_job_delete_run(FmFileOpsJob* job)
                 g_object_unref(pf);
         }
         parent = fm_path_get_parent(path);
+#ifdef HAVE_AT_FUNCS
+        if(fm_path_is_native(path))
+        {
+            if(tree == NULL)
+                tree = _delete_tree_new(job);
+            ret = _fm_file_ops_job_delete_native(tree, path);
+            continue;
+        }
+#endif
         src = fm_path_to_gfile(path);
 
         ret = _fm_file_ops_job_delete_file(fmjob, src, NULL, parent_folder);
         g_object_unref(src);
     }
+#ifdef HAVE_AT_FUNCS
+    if(tree)
+        _delete_tree_free(tree);
+#endif
     if (parent_folder)
     {
         fm_folder_unblock_updates(parent_folder);
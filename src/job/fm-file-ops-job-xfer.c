@@ -23,13 +23,31 @@
 #include <config.h>
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for copy_file_range() and O_NOFOLLOW */
+#endif
+
 #include "fm-file-ops-job-xfer.h"
 #include "fm-file-ops-job-delete.h"
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FLISTXATTR)
+#include <sys/xattr.h>
+#endif
 #include "fm-utils.h"
+#include "fm-config.h"
 #include <glib/gi18n-lib.h>
 
 static const char query[]=
@@ -77,6 +95,723 @@ static gboolean _fm_file_ops_job_check_paths(FmFileOpsJob* job, GFile* src, GFil
     return (err == NULL);
 }
 
+/* kernel side copying is done by chunks this big so the job can be
+   cancelled and progress is updated not more often than once per chunk */
+#define NATIVE_COPY_CHUNK   (8 * 1024 * 1024)
+/* buffer size for the last resort read()/write() loop */
+#define NATIVE_COPY_BUFFER  (1024 * 1024)
+
+typedef enum
+{
+    NATIVE_COPY_OK,
+    NATIVE_COPY_FAILED,
+    NATIVE_COPY_UNSUPPORTED /* caller should use g_file_copy() instead */
+} NativeCopyResult;
+
+/* errors meaning that method cannot be used on this pair of files */
+static inline gboolean _native_copy_not_supported(int e)
+{
+    return (e == ENOSYS || e == EXDEV || e == EINVAL || e == EOPNOTSUPP ||
+            e == ENOTSUP || e == ENOTTY || e == EBADF || e == EPERM);
+}
+
+static void _native_copy_set_error(GError** err, int e, GFile* file)
+{
+    char* name = g_file_get_parse_name(file);
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(e),
+                _("Error copying file '%s': %s"), name, g_strerror(e));
+    g_free(name);
+}
+
+/* copies timestamps, permissions, owner and extended attributes same way
+   as G_FILE_COPY_ALL_METADATA does, errors are ignored */
+static void _native_copy_attributes(int src_fd, int dest_fd, const struct stat* st)
+{
+#ifdef HAVE_FUTIMENS
+    struct timespec times[2];
+#endif
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FLISTXATTR)
+    ssize_t len = flistxattr(src_fd, NULL, 0);
+
+    if(len > 0)
+    {
+        char *names = g_malloc(len), *name;
+        len = flistxattr(src_fd, names, len);
+        for(name = names; len > 0 && name < names + len; name += strlen(name) + 1)
+        {
+            ssize_t vlen;
+            char* value;
+            /* only user namespace may be copied safely */
+            if(strncmp(name, "user.", 5) != 0)
+                continue;
+            vlen = fgetxattr(src_fd, name, NULL, 0);
+            if(vlen < 0)
+                continue;
+            value = g_malloc(vlen + 1);
+            vlen = fgetxattr(src_fd, name, value, vlen);
+            if(vlen >= 0)
+                fsetxattr(dest_fd, name, value, vlen, 0);
+            g_free(value);
+        }
+        g_free(names);
+    }
+#endif
+    if(fchown(dest_fd, st->st_uid, st->st_gid) < 0) /* will fail if not root */
+    {
+        if(fchown(dest_fd, -1, st->st_gid) < 0)
+            g_debug("cannot preserve group of the copied file");
+    }
+    fchmod(dest_fd, st->st_mode & 07777);
+#ifdef HAVE_FUTIMENS
+    times[0] = st->st_atim;
+    times[1] = st->st_mtim;
+    futimens(dest_fd, times);
+#else
+    {
+        struct timeval tv[2];
+        tv[0].tv_sec = st->st_atime;
+        tv[0].tv_usec = 0;
+        tv[1].tv_sec = st->st_mtime;
+        tv[1].tv_usec = 0;
+        futimes(dest_fd, tv);
+    }
+#endif
+}
+
+/* moves data from src_fd to dest_fd starting at current positions using
+   the fastest method available: reflink, copy_file_range(), sendfile(),
+   and at last read()/write() with big buffer. Returns 0 or errno. */
+static int _native_copy_data(FmFileOpsJob* job, int src_fd, int dest_fd,
+                             goffset size, GFileProgressCallback cb,
+                             gpointer cb_data)
+{
+    FmJob* fmjob = FM_JOB(job);
+    goffset done = 0, reported = 0;
+    gboolean use_range = TRUE, use_sendfile = TRUE;
+    char* buf = NULL;
+    int e = 0;
+
+#ifdef FICLONE
+    /* share extents on btrfs, xfs, etc. - no data is copied at all */
+    if(size > 0 && ioctl(dest_fd, FICLONE, src_fd) == 0)
+    {
+        cb(size, size, cb_data);
+        return 0;
+    }
+#endif
+    while(done < size)
+    {
+        ssize_t n = -1;
+        size_t chunk = (size_t)MIN(size - done, NATIVE_COPY_CHUNK);
+        gboolean from_read = FALSE;
+
+        if(fm_job_is_cancelled(fmjob))
+        {
+            e = ECANCELED;
+            break;
+        }
+#ifdef HAVE_COPY_FILE_RANGE
+        if(use_range)
+        {
+            n = copy_file_range(src_fd, NULL, dest_fd, NULL, chunk, 0);
+            /* some file systems return 0 for ranges they can't copy */
+            if(n == 0 || (n < 0 && _native_copy_not_supported(errno)))
+                use_range = FALSE;
+            else if(n < 0 && errno != EINTR)
+            {
+                e = errno;
+                break;
+            }
+        }
+        else
+#endif
+#ifdef HAVE_SENDFILE
+        if(use_sendfile)
+        {
+            n = sendfile(dest_fd, src_fd, NULL, chunk);
+            if(n == 0 || (n < 0 && _native_copy_not_supported(errno)))
+                use_sendfile = FALSE;
+            else if(n < 0 && errno != EINTR)
+            {
+                e = errno;
+                break;
+            }
+        }
+        else
+#endif
+        {
+            ssize_t written = 0;
+            if(!buf)
+                buf = g_malloc(NATIVE_COPY_BUFFER);
+            n = read(src_fd, buf, MIN(chunk, NATIVE_COPY_BUFFER));
+            from_read = TRUE;
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                e = errno;
+                break;
+            }
+            while(written < n)
+            {
+                ssize_t w = write(dest_fd, buf + written, n - written);
+                if(w < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    e = errno;
+                    break;
+                }
+                written += w;
+            }
+            if(e)
+                break;
+        }
+        /* only read() tells the end of file reliably, others returning 0
+           before size is reached fall back to the next method above */
+        if(n == 0 && from_read) /* file was truncated while we copied it */
+            break;
+        if(n > 0)
+        {
+            done += n;
+            if(done - reported >= NATIVE_COPY_CHUNK || done >= size)
+            {
+                cb(done, size, cb_data);
+                reported = done;
+            }
+        }
+    }
+    /* silence warnings if the methods aren't compiled in */
+    (void)use_range;
+    (void)use_sendfile;
+    g_free(buf);
+    return e;
+}
+
+/* copies a regular local file bypassing GIO streams, the data never goes
+   through userspace buffers unless kernel cannot do it for us */
+static NativeCopyResult _fm_file_ops_job_copy_native(FmFileOpsJob* job, GFile* src,
+                                                     GFile* dest, gboolean overwrite,
+                                                     GFileProgressCallback cb,
+                                                     gpointer cb_data, GError** err)
+{
+    char *src_path, *dest_path, *tmp_path = NULL;
+    struct stat st, dest_st;
+    int src_fd, dest_fd, e;
+    NativeCopyResult ret = NATIVE_COPY_UNSUPPORTED;
+
+    src_path = g_file_get_path(src);
+    dest_path = g_file_get_path(dest);
+    if(!src_path || !dest_path)
+        goto _out;
+    src_fd = open(src_path, O_RDONLY | O_NOFOLLOW);
+    if(src_fd < 0)
+        goto _out; /* let GIO report the error */
+    if(fstat(src_fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(src_fd);
+        goto _out;
+    }
+    if(lstat(dest_path, &dest_st) == 0)
+    {
+        if(!overwrite)
+        {
+            close(src_fd);
+            g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                                _("Target file already exists"));
+            ret = NATIVE_COPY_FAILED;
+            goto _out;
+        }
+        /* leave directories to GIO so it can report the error properly */
+        if(S_ISDIR(dest_st.st_mode) ||
+           (st.st_dev == dest_st.st_dev && st.st_ino == dest_st.st_ino))
+        {
+            close(src_fd);
+            goto _out;
+        }
+        /* GIO replaces the target instead of writing into it, so do we;
+           the data go into a temporary file which replaces the target
+           only when complete, so the target is intact if copying fails */
+        tmp_path = g_strdup_printf("%s.XXXXXX", dest_path);
+    }
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    /* ensure we have rw permission to the file while copying it */
+    if(tmp_path)
+        dest_fd = g_mkstemp_full(tmp_path, O_WRONLY, S_IRUSR | S_IWUSR);
+    else
+        dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if(dest_fd < 0)
+    {
+        e = errno;
+        close(src_fd);
+        _native_copy_set_error(err, e, dest);
+        ret = NATIVE_COPY_FAILED;
+        goto _out;
+    }
+    e = _native_copy_data(job, src_fd, dest_fd, st.st_size, cb, cb_data);
+    if(e == 0)
+        _native_copy_attributes(src_fd, dest_fd, &st);
+    if(close(dest_fd) < 0 && e == 0)
+        e = errno;
+    close(src_fd);
+    if(e == 0 && tmp_path && rename(tmp_path, dest_path) < 0)
+        e = errno;
+    if(e == 0)
+        ret = NATIVE_COPY_OK;
+    else
+    {
+        /* don't leave partial content behind */
+        unlink(tmp_path ? tmp_path : dest_path);
+        if(e == ECANCELED)
+            g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                _("Operation was cancelled"));
+        else
+            _native_copy_set_error(err, e, dest);
+        ret = NATIVE_COPY_FAILED;
+    }
+_out:
+    g_free(src_path);
+    g_free(dest_path);
+    g_free(tmp_path);
+    return ret;
+}
+
+/* copies single regular file or symlink, using native copy if possible */
+static gboolean _fm_file_ops_job_copy_regular(FmFileOpsJob* job, GFile* src,
+                                              GFileType type, GFile* dest,
+                                              GFileCopyFlags flags, GError** err)
+{
+    if(type == G_FILE_TYPE_REGULAR && g_file_is_native(src) && g_file_is_native(dest))
+    {
+        switch(_fm_file_ops_job_copy_native(job, src, dest,
+                                            (flags & G_FILE_COPY_OVERWRITE) != 0,
+                                            progress_cb, job, err))
+        {
+        case NATIVE_COPY_OK:
+            return TRUE;
+        case NATIVE_COPY_FAILED:
+            return FALSE;
+        case NATIVE_COPY_UNSUPPORTED:
+            break;
+        }
+    }
+    return g_file_copy(src, dest, flags, fm_job_get_cancellable(FM_JOB(job)),
+                       progress_cb, job, err);
+}
+
+/* Parallel copy of local files.
+ *
+ * The job thread walks the tree, creates folders and resolves conflicts
+ * with fm_file_ops_job_ask_rename() the same way as before, but regular
+ * files are handed over to a thread pool of their source file system.
+ * No more than n_threads batches are written to the same destination
+ * device at once either, whichever pool they came from: the job thread
+ * holds a batch back until its device is free so workers never wait.
+ * Small files are grouped into batches so each of them doesn't cost a
+ * pool task. Finished files are reaped by the job thread in the order
+ * they were submitted so errors are reported in the same order as with
+ * sequential copy. */
+
+#define XFER_SMALL_FILE         (64 * 1024) /* smaller files are batched */
+#define XFER_BATCH_FILES        32
+#define XFER_BATCH_BYTES        (1024 * 1024)
+#define XFER_MAX_QUEUED         1024 /* finished files waiting for reaping */
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#define XFER_LOCK(pl) (&(pl)->lock)
+#define XFER_COND(pl) (&(pl)->cond)
+#else
+#define XFER_LOCK(pl) ((pl)->lock)
+#define XFER_COND(pl) ((pl)->cond)
+#endif
+
+typedef struct _FmXferPipeline FmXferPipeline;
+
+typedef struct
+{
+    FmXferPipeline* pl;
+    GFile* src;
+    GFile* dest;
+    char* dest_path; /* key in pl->pending_dests */
+    dev_t dest_dev;
+    goffset size;
+    goffset done; /* bytes copied so far */
+    FmFolder* dest_folder;
+    GError* error;
+    gboolean finished;
+} FmXferItem;
+
+typedef struct
+{
+    dev_t dev;
+    gint n_writing; /* batches being written to the device */
+} FmXferDevice;
+
+struct _FmXferPipeline
+{
+    FmFileOpsJob* job;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock;
+    GCond cond;
+#else
+    GMutex* lock;
+    GCond* cond;
+#endif
+    gint n_threads;
+    GHashTable* pools; /* interned file system id -> GThreadPool */
+    GQueue items; /* FmXferItem in order of submission, not reaped yet */
+    GHashTable* pending_dests; /* dest_path -> FmXferItem */
+    GSList* batch; /* files to push into pool for batch_fs_id */
+    const char* batch_fs_id;
+    dev_t batch_dest_dev;
+    guint batch_n;
+    goffset batch_size;
+    /* these are protected by lock */
+    guint n_running; /* submitted but not finished files */
+    goffset in_progress; /* sum of done for files not reaped yet */
+    GSList* devices; /* FmXferDevice for each destination device */
+    /* these are accessed by the job thread only */
+    goffset reported; /* part of in_progress added to job->finished */
+    gboolean failed;
+    char* last_dest_dir; /* cache for _xfer_dest_dev() */
+    dev_t last_dest_dev;
+};
+
+static GQuark xfer_pipeline_quark(void)
+{
+    static GQuark q = 0;
+    if(G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("fm-xfer-pipeline");
+    return q;
+}
+
+static void _xfer_progress_cb(goffset cur, goffset total, gpointer data)
+{
+    FmXferItem* item = (FmXferItem*)data;
+    FmXferPipeline* pl = item->pl;
+
+    g_mutex_lock(XFER_LOCK(pl));
+    pl->in_progress += cur - item->done;
+    item->done = cur;
+    g_cond_broadcast(XFER_COND(pl));
+    g_mutex_unlock(XFER_LOCK(pl));
+}
+
+/* Should be called with pl->lock held. */
+static FmXferDevice* _xfer_device_find(FmXferPipeline* pl, dev_t dev)
+{
+    FmXferDevice* device;
+    GSList* l;
+
+    for(l = pl->devices; l; l = l->next)
+        if(((FmXferDevice*)l->data)->dev == dev)
+            return (FmXferDevice*)l->data;
+    device = g_slice_new0(FmXferDevice);
+    device->dev = dev;
+    pl->devices = g_slist_prepend(pl->devices, device);
+    return device;
+}
+
+/* in worker thread: copy files of one batch */
+static void _xfer_worker(gpointer data, gpointer user_data)
+{
+    FmXferPipeline* pl = (FmXferPipeline*)user_data;
+    FmJob* fmjob = FM_JOB(pl->job);
+    GSList *batch = (GSList*)data, *l;
+
+    for(l = batch; l; l = l->next)
+    {
+        FmXferItem* item = (FmXferItem*)l->data;
+        GError* err = NULL;
+
+        if(fm_job_is_cancelled(fmjob))
+            g_set_error_literal(&err, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                _("Operation was cancelled"));
+        else if(_fm_file_ops_job_copy_native(pl->job, item->src, item->dest, FALSE,
+                                             _xfer_progress_cb, item, &err)
+                == NATIVE_COPY_UNSUPPORTED)
+            g_file_copy(item->src, item->dest,
+                        G_FILE_COPY_ALL_METADATA|G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                        fm_job_get_cancellable(fmjob), _xfer_progress_cb, item, &err);
+        g_mutex_lock(XFER_LOCK(pl));
+        item->error = err;
+        item->finished = TRUE;
+        pl->n_running--;
+        if(!l->next) /* all files in batch go to the same device */
+            _xfer_device_find(pl, item->dest_dev)->n_writing--;
+        g_cond_broadcast(XFER_COND(pl));
+        g_mutex_unlock(XFER_LOCK(pl));
+    }
+    g_slist_free(batch);
+}
+
+/* in job thread: push the batch into the pool of its source file system
+   once its destination device can take one more writer, so the pool
+   threads never wait for each other. Should be called with pl->lock held. */
+static void _xfer_flush_batch(FmXferPipeline* pl)
+{
+    FmXferDevice* device;
+    GThreadPool* pool;
+
+    if(!pl->batch)
+        return;
+    device = _xfer_device_find(pl, pl->batch_dest_dev);
+    while(device->n_writing >= pl->n_threads)
+        g_cond_wait(XFER_COND(pl), XFER_LOCK(pl));
+    device->n_writing++;
+    pool = g_hash_table_lookup(pl->pools, pl->batch_fs_id);
+    if(!pool)
+    {
+        pool = g_thread_pool_new(_xfer_worker, pl, pl->n_threads, FALSE, NULL);
+        g_hash_table_insert(pl->pools, (gpointer)pl->batch_fs_id, pool);
+    }
+    g_thread_pool_push(pool, g_slist_reverse(pl->batch), NULL);
+    pl->batch = NULL;
+    pl->batch_n = 0;
+    pl->batch_size = 0;
+}
+
+/* in job thread: report result of finished file */
+static void _xfer_item_done(FmXferPipeline* pl, FmXferItem* item)
+{
+    FmFileOpsJob* job = pl->job;
+    FmJob* fmjob = FM_JOB(job);
+    GError* err = item->error;
+    gboolean ok = TRUE;
+
+    while(err)
+    {
+        FmJobErrorAction act = FM_JOB_CONTINUE;
+        /* the destination didn't exist when the file was submitted so
+           anything there now is a partial copy, unless that's the error */
+        gboolean partial = !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_EXISTS);
+
+        if(!fm_job_is_cancelled(fmjob))
+            act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MODERATE);
+        g_clear_error(&err);
+        if(act != FM_JOB_RETRY)
+        {
+            ok = FALSE;
+            break;
+        }
+        /* the retry doesn't overwrite so it would fail on partial copy */
+        if(partial)
+            g_file_delete(item->dest, fm_job_get_cancellable(fmjob), NULL);
+        _fm_file_ops_job_copy_regular(job, item->src, G_FILE_TYPE_REGULAR, item->dest,
+                                      G_FILE_COPY_ALL_METADATA|G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                                      &err);
+        /* the retry shows progress of its own, it's accounted below */
+        job->current_file_finished = 0;
+    }
+    /* done part of the file was added to job->finished already */
+    if(item->size > item->done)
+        job->finished += item->size - item->done;
+
+    if(!ok)
+        pl->failed = TRUE;
+    else if(item->dest_folder)
+    {
+        FmPath* fm_dest = fm_path_new_for_gfile(item->dest);
+        if(!_fm_folder_event_file_added(item->dest_folder, fm_dest))
+            fm_path_unref(fm_dest);
+    }
+    g_hash_table_remove(pl->pending_dests, item->dest_path);
+    g_object_unref(item->src);
+    g_object_unref(item->dest);
+    if(item->dest_folder)
+        g_object_unref(item->dest_folder);
+    g_free(item->dest_path);
+    g_slice_free(FmXferItem, item);
+}
+
+/* in job thread: adds data copied by workers since the last call to
+   job->finished. The job thread may copy some file itself meanwhile and
+   account it in job->current_file_finished, so the pipeline doesn't use
+   that. Should be called with pl->lock held. */
+static void _xfer_sync_progress(FmXferPipeline* pl)
+{
+    pl->job->finished += pl->in_progress - pl->reported;
+    pl->reported = pl->in_progress;
+}
+
+/* in job thread: reap finished files and wait until no more than
+   max_running files are being copied */
+static void _xfer_reap(FmXferPipeline* pl, guint max_running)
+{
+    FmFileOpsJob* job = pl->job;
+    FmXferItem* item;
+
+    g_mutex_lock(XFER_LOCK(pl));
+    for(;;)
+    {
+        item = g_queue_peek_head(&pl->items);
+        if(item && item->finished)
+        {
+            g_queue_pop_head(&pl->items);
+            _xfer_sync_progress(pl);
+            pl->in_progress -= item->done;
+            pl->reported -= item->done;
+            g_mutex_unlock(XFER_LOCK(pl));
+            _xfer_item_done(pl, item);
+            g_mutex_lock(XFER_LOCK(pl));
+            continue;
+        }
+        if(max_running == 0 ? item == NULL
+                            : (pl->n_running <= max_running &&
+                               g_queue_get_length(&pl->items) < XFER_MAX_QUEUED))
+            break;
+        /* files in batch will never finish if the batch isn't pushed */
+        _xfer_flush_batch(pl);
+        g_cond_wait(XFER_COND(pl), XFER_LOCK(pl));
+        /* show progress of files being copied */
+        _xfer_sync_progress(pl);
+        g_mutex_unlock(XFER_LOCK(pl));
+        fm_file_ops_job_emit_percent(job);
+        g_mutex_lock(XFER_LOCK(pl));
+    }
+    _xfer_sync_progress(pl);
+    g_mutex_unlock(XFER_LOCK(pl));
+    fm_file_ops_job_emit_percent(job);
+}
+
+/* in job thread: find device where dest_path will be created. The tree
+   is walked folder by folder so the last folder is remembered. */
+static gboolean _xfer_dest_dev(FmXferPipeline* pl, const char* dest_path, dev_t* dev)
+{
+    char* dir = g_path_get_dirname(dest_path);
+    struct stat st;
+
+    if(g_strcmp0(dir, pl->last_dest_dir) != 0)
+    {
+        if(stat(dir, &st) < 0)
+        {
+            g_free(dir);
+            return FALSE;
+        }
+        g_free(pl->last_dest_dir);
+        pl->last_dest_dir = dir;
+        pl->last_dest_dev = st.st_dev;
+    }
+    else
+        g_free(dir);
+    *dev = pl->last_dest_dev;
+    return TRUE;
+}
+
+/* in job thread: queue a regular file for copying in a worker thread.
+   Returns FALSE if the file should be copied by the caller instead, for
+   example, if destination already exists so the user should be asked. */
+static gboolean _xfer_submit(FmFileOpsJob* job, GFile* src, GFile* dest,
+                             goffset size, const char* fs_id, FmFolder* dest_folder)
+{
+    FmXferPipeline* pl = g_object_get_qdata(G_OBJECT(job), xfer_pipeline_quark());
+    FmXferItem* item;
+    struct stat st;
+    char* dest_path;
+    dev_t dest_dev;
+
+    if(!pl || !g_file_is_native(src) || !g_file_is_native(dest))
+        return FALSE;
+    dest_path = g_file_get_path(dest);
+    if(!dest_path)
+        return FALSE;
+    if(g_hash_table_lookup(pl->pending_dests, dest_path))
+    {
+        /* let the file be completed before we ask the user about it */
+        _xfer_reap(pl, 0);
+        g_free(dest_path);
+        return FALSE;
+    }
+    if(lstat(dest_path, &st) == 0 || !_xfer_dest_dev(pl, dest_path, &dest_dev))
+    {
+        g_free(dest_path);
+        return FALSE;
+    }
+
+    item = g_slice_new0(FmXferItem);
+    item->pl = pl;
+    item->src = g_object_ref(src);
+    item->dest = g_object_ref(dest);
+    item->dest_path = dest_path;
+    item->dest_dev = dest_dev;
+    item->size = size;
+    if(dest_folder)
+        item->dest_folder = g_object_ref(dest_folder);
+    g_hash_table_insert(pl->pending_dests, dest_path, item);
+    g_queue_push_tail(&pl->items, item);
+    g_mutex_lock(XFER_LOCK(pl));
+    pl->n_running++;
+    if(pl->batch && (pl->batch_fs_id != fs_id || pl->batch_dest_dev != dest_dev))
+        _xfer_flush_batch(pl);
+    pl->batch_fs_id = fs_id;
+    pl->batch_dest_dev = dest_dev;
+    pl->batch = g_slist_prepend(pl->batch, item);
+    pl->batch_n++;
+    pl->batch_size += size;
+    if(size >= XFER_SMALL_FILE || pl->batch_n >= XFER_BATCH_FILES ||
+       pl->batch_size >= XFER_BATCH_BYTES)
+        _xfer_flush_batch(pl);
+    g_mutex_unlock(XFER_LOCK(pl));
+
+    /* let each thread have at most two batches to work on */
+    _xfer_reap(pl, pl->n_threads * XFER_BATCH_FILES * 2);
+    return TRUE;
+}
+
+static FmXferPipeline* _xfer_pipeline_new(FmFileOpsJob* job, gint n_threads)
+{
+    FmXferPipeline* pl = g_slice_new0(FmXferPipeline);
+
+    pl->job = job;
+    pl->n_threads = n_threads;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&pl->lock);
+    g_cond_init(&pl->cond);
+#else
+    pl->lock = g_mutex_new();
+    pl->cond = g_cond_new();
+#endif
+    pl->pools = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pl->pending_dests = g_hash_table_new(g_str_hash, g_str_equal);
+    g_queue_init(&pl->items);
+    g_object_set_qdata(G_OBJECT(job), xfer_pipeline_quark(), pl);
+    return pl;
+}
+
+/* waits for all files and frees pipeline, returns FALSE if some file failed */
+static gboolean _xfer_pipeline_free(FmXferPipeline* pl)
+{
+    GHashTableIter it;
+    gpointer pool;
+    gboolean ret;
+
+    _xfer_reap(pl, 0);
+    g_hash_table_iter_init(&it, pl->pools);
+    while(g_hash_table_iter_next(&it, NULL, &pool))
+        g_thread_pool_free(pool, FALSE, TRUE);
+    g_hash_table_destroy(pl->pools);
+    g_hash_table_destroy(pl->pending_dests);
+    while(pl->devices)
+    {
+        g_slice_free(FmXferDevice, pl->devices->data);
+        pl->devices = g_slist_delete_link(pl->devices, pl->devices);
+    }
+    g_free(pl->last_dest_dir);
+    g_object_set_qdata(G_OBJECT(pl->job), xfer_pipeline_quark(), NULL);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&pl->lock);
+    g_cond_clear(&pl->cond);
+#else
+    g_mutex_free(pl->lock);
+    g_cond_free(pl->cond);
+#endif
+    ret = !pl->failed;
+    g_slice_free(FmXferPipeline, pl);
+    return ret;
+}
+
 static gboolean _fm_file_ops_job_copy_file(FmFileOpsJob* job, GFile* src,
                                            GFileInfo* inf, GFile* dest,
                                            FmFolder *src_folder, /* if move */
@@ -92,6 +827,7 @@ static gboolean _fm_file_ops_job_copy_file(FmFileOpsJob* job, GFile* src,
     FmJob* fmjob = FM_JOB(job);
     FmPath *fm_dest;
     guint32 mode;
+    const char* fs_id;
     gboolean skip_dir_content = FALSE;
 
     /* FIXME: g_file_get_child() failed? generate error! */
@@ -132,6 +868,7 @@ _retry_query_src_info:
 
     size = g_file_info_get_size(inf);
     mode = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_UNIX_MODE);
+    fs_id = g_intern_string(g_file_info_get_attribute_string(inf, G_FILE_ATTRIBUTE_ID_FILESYSTEM));
 
     g_object_unref(inf);
     inf = NULL;
@@ -386,9 +1123,16 @@ _retry_enum_children:
 
     default:
         flags = G_FILE_COPY_ALL_METADATA|G_FILE_COPY_NOFOLLOW_SYMLINKS;
+        /* source should be deleted after it's copied so copy it here */
+        if(type == G_FILE_TYPE_REGULAR && !delete_src &&
+           _xfer_submit(job, src, dest, size, fs_id, dest_folder))
+        {
+            /* progress and folder will be updated when it's finished */
+            ret = TRUE;
+            break;
+        }
 _retry_copy:
-        if( !g_file_copy(src, dest, flags, fm_job_get_cancellable(fmjob),
-                         progress_cb, fmjob, &err) )
+        if( !_fm_file_ops_job_copy_regular(job, src, type, dest, flags, &err) )
         {
             flags &= ~G_FILE_COPY_OVERWRITE;
 
@@ -676,20 +1420,14 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
     GList* l;
     FmJob* fmjob = FM_JOB(job);
     /* prepare the job, count total work needed with FmDeepCountJob */
-    FmDeepCountJob* dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_DEFAULT);
+    FmDeepCountJob* dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_USE_CACHE);
+    FmXferPipeline* pl = NULL;
     FmFolder *df;
 
-    /* let the deep count job share the same cancellable object. */
-    fm_job_set_cancellable(FM_JOB(dc), fm_job_get_cancellable(fmjob));
-    fm_job_run_sync(FM_JOB(dc));
-    job->total = dc->total_size;
+    /* count it while copying, the progress is estimated until it's done */
+    fm_file_ops_job_count_total(job, dc);
     if(fm_job_is_cancelled(fmjob))
-    {
-        g_object_unref(dc);
         return FALSE;
-    }
-    g_object_unref(dc);
-    g_debug("total size to copy: %llu", (long long unsigned int)job->total);
 
     dest_dir = fm_path_to_gfile(job->dest);
     /* suspend updates for destination */
@@ -699,6 +1437,10 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
 
     fm_file_ops_job_emit_prepared(job);
 
+    /* copy local files in parallel, nothing to gain for remote ones */
+    if(fm_config->copy_threads > 1 && g_file_is_native(dest_dir))
+        pl = _xfer_pipeline_new(job, fm_config->copy_threads);
+
     for(l = fm_path_list_peek_head_link(job->srcs); !fm_job_is_cancelled(fmjob) && l; l=l->next)
     {
         FmPath* path = FM_PATH(l->data);
@@ -723,6 +1465,9 @@ gboolean _fm_file_ops_job_copy_run(FmFileOpsJob* job)
         g_object_unref(src);
         g_object_unref(dest);
     }
+    /* wait for files still being copied */
+    if(pl && !_xfer_pipeline_free(pl))
+        ret = FALSE;
 
     /* g_debug("finished: %llu, total: %llu", job->finished, job->total); */
     fm_file_ops_job_emit_percent(job);
@@ -782,18 +1527,14 @@ _retry_query_dest_info:
     /* prepare the job, count total work needed with FmDeepCountJob */
     dc = fm_deep_count_job_new(job->srcs, FM_DC_JOB_PREPARE_MOVE);
     fm_deep_count_job_set_dest(dc, dest_dev, job->dest_fs_id);
-    fm_job_run_sync(FM_JOB(dc));
-    job->total = dc->total_size;
-
-    if( fm_job_is_cancelled(FM_JOB(dc)) )
+    /* count it while moving, the progress is estimated until it's done */
+    fm_file_ops_job_count_total(job, dc);
+    if(fm_job_is_cancelled(fmjob))
     {
         g_object_unref(dest_dir);
-        g_object_unref(dc);
         return FALSE;
     }
-    g_object_unref(dc);
-    g_debug("total size to move: %llu, dest_fs: %s",
-            (long long unsigned int)job->total, job->dest_fs_id);
+    g_debug("moving to dest_fs: %s", job->dest_fs_id);
 
     fm_file_ops_job_emit_prepared(job);
     /* suspend updates for destination */
@@ -43,6 +43,7 @@
 #include "fm-file-ops-job-change-attr.h"
 #include "fm-marshal.h"
 #include "fm-file-info-job.h"
+#include "fm-job-private.h"
 #include "glib-compat.h"
 
 enum
@@ -56,6 +57,45 @@ enum
 
 static guint signals[N_SIGNALS];
 
+/* Progress of the job is published by the job thread(s) into this
+ * snapshot and sampled by the main loop every PROGRESS_INTERVAL ms,
+ * then the #FmFileOpsJob::cur-file and #FmFileOpsJob::percent signals
+ * are emitted from there. That way the job never waits for the UI to
+ * show the progress. */
+#define PROGRESS_INTERVAL   100 /* ms, 10 updates per second */
+
+struct _FmFileOpsJobProgress
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock;
+#else
+    GMutex* lock;
+#endif
+    /* these are protected by lock */
+    GString* cur_file;
+    gboolean cur_file_changed;
+    guint percent;
+    goffset finished;
+    goffset total;
+    guint n_files;
+    gboolean estimated; /* counter hasn't finished yet */
+    /* these are set by the job thread while the job runs */
+    guint timeout_handler;
+    FmDeepCountJob* counter;
+    GThread* count_thread;
+    /* these are accessed in main thread only */
+    guint percent_shown;
+    goffset rate;
+    goffset rate_finished;
+    GTimer* rate_timer;
+};
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#  define PROGRESS_LOCK(p) (&(p)->lock)
+#else
+#  define PROGRESS_LOCK(p) ((p)->lock)
+#endif
+
 static void fm_file_ops_job_finalize              (GObject *object);
 
 static gboolean fm_file_ops_job_run(FmJob* fm_job);
@@ -64,6 +104,15 @@ static gboolean fm_file_ops_job_run(FmJob* fm_job);
 /* funcs for io jobs */
 static gboolean _fm_file_ops_job_link_run(FmFileOpsJob* job);
 
+/* funcs for progress reporting */
+static void _progress_start(FmFileOpsJob* job);
+static void _progress_stop(FmFileOpsJob* job);
+static void _count_stop(FmFileOpsJob* job);
+static gboolean on_job_interaction(GSignalInvocationHint* ihint,
+                                   guint n_param_values,
+                                   const GValue* param_values,
+                                   gpointer data);
+
 
 G_DEFINE_TYPE(FmFileOpsJob, fm_file_ops_job, FM_TYPE_JOB);
 
@@ -202,21 +251,50 @@ static void fm_file_ops_job_class_init(FmFileOpsJobClass *klass)
                       fm_marshal_INT__POINTER_POINTER_POINTER,
                       G_TYPE_INT, 3, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER );
 
+    /* the user should see which file an error or a question is about */
+    g_signal_add_emission_hook(g_signal_lookup("error", FM_TYPE_JOB), 0,
+                               on_job_interaction, NULL, NULL);
+    g_signal_add_emission_hook(g_signal_lookup("ask", FM_TYPE_JOB), 0,
+                               on_job_interaction, NULL, NULL);
 }
 
 
 static void fm_file_ops_job_finalize(GObject *object)
 {
+    FmFileOpsJobProgress* progress;
+
     g_return_if_fail(object != NULL);
     g_return_if_fail(FM_IS_FILE_OPS_JOB(object));
 
+    progress = ((FmFileOpsJob*)object)->progress;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&progress->lock);
+#else
+    g_mutex_free(progress->lock);
+#endif
+    g_string_free(progress->cur_file, TRUE);
+    g_timer_destroy(progress->rate_timer);
+    g_slice_free(FmFileOpsJobProgress, progress);
+
     G_OBJECT_CLASS(fm_file_ops_job_parent_class)->finalize(object);
 }
 
 
 static void fm_file_ops_job_init(FmFileOpsJob *self)
 {
+    FmFileOpsJobProgress* progress = g_slice_new0(FmFileOpsJobProgress);
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&progress->lock);
+#else
+    progress->lock = g_mutex_new();
+#endif
+    progress->cur_file = g_string_sized_new(128);
+    progress->rate_timer = g_timer_new();
+    self->progress = progress;
+
     fm_job_init_cancellable(FM_JOB(self));
+    fm_job_set_priority(FM_JOB(self), FM_JOB_PRIORITY_BULK);
 
     /* for chown */
     self->uid = -1;
@@ -240,6 +318,8 @@ FmFileOpsJob *fm_file_ops_job_new(FmFileOpType type, FmPathList* files)
     FmFileOpsJob* job = (FmFileOpsJob*)g_object_new(FM_FILE_OPS_JOB_TYPE, NULL);
     job->srcs = fm_path_list_ref(files);
     job->type = type;
+    /* let the scheduler know which device the job will stress */
+    _fm_job_set_io_path(FM_JOB(job), fm_path_list_peek_head(files));
     return job;
 }
 
@@ -247,25 +327,37 @@ FmFileOpsJob *fm_file_ops_job_new(FmFileOpType type, FmPathList* files)
 static gboolean fm_file_ops_job_run(FmJob* fm_job)
 {
     FmFileOpsJob* job = FM_FILE_OPS_JOB(fm_job);
+    gboolean ret = FALSE;
+
+    _progress_start(job);
     switch(job->type)
     {
     case FM_FILE_OP_COPY:
-        return _fm_file_ops_job_copy_run(job);
+        ret = _fm_file_ops_job_copy_run(job);
+        break;
     case FM_FILE_OP_MOVE:
-        return _fm_file_ops_job_move_run(job);
+        ret = _fm_file_ops_job_move_run(job);
+        break;
     case FM_FILE_OP_TRASH:
-        return _fm_file_ops_job_trash_run(job);
+        ret = _fm_file_ops_job_trash_run(job);
+        break;
     case FM_FILE_OP_UNTRASH:
-        return _fm_file_ops_job_untrash_run(job);
+        ret = _fm_file_ops_job_untrash_run(job);
+        break;
     case FM_FILE_OP_DELETE:
-        return _fm_file_ops_job_delete_run(job);
+        ret = _fm_file_ops_job_delete_run(job);
+        break;
     case FM_FILE_OP_LINK:
-        return _fm_file_ops_job_link_run(job);
+        ret = _fm_file_ops_job_link_run(job);
+        break;
     case FM_FILE_OP_CHANGE_ATTR:
-        return _fm_file_ops_job_change_attr_run(job);
+        ret = _fm_file_ops_job_change_attr_run(job);
+        break;
     case FM_FILE_OP_NONE: ;
     }
-    return FALSE;
+    _count_stop(job);
+    _progress_stop(job);
+    return ret;
 }
 
 
@@ -284,6 +376,8 @@ static gboolean fm_file_ops_job_run(FmJob* fm_job)
 void fm_file_ops_job_set_dest(FmFileOpsJob* job, FmPath* dest)
 {
     job->dest = fm_path_ref(dest);
+    /* for copy and move the destination is what is written */
+    _fm_job_set_io_path(FM_JOB(job), dest);
 }
 
 /**
@@ -365,18 +459,109 @@ void fm_file_ops_job_set_recursive(FmFileOpsJob* job, gboolean recursive)
     job->recursive = recursive;
 }
 
-static gpointer emit_cur_file(FmJob* job, gpointer cur_file)
+/* in main thread: emit signals for progress published since last time */
+static void _progress_flush(FmFileOpsJob* job)
+{
+    FmFileOpsJobProgress* progress = job->progress;
+    char* cur_file = NULL;
+    guint percent;
+    goffset finished;
+    gdouble elapsed;
+
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    if(progress->cur_file_changed)
+    {
+        cur_file = g_strndup(progress->cur_file->str, progress->cur_file->len);
+        progress->cur_file_changed = FALSE;
+    }
+    percent = progress->percent;
+    finished = progress->finished;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+
+    /* average the rate over last few samples */
+    elapsed = g_timer_elapsed(progress->rate_timer, NULL);
+    if(elapsed * 2000 >= PROGRESS_INTERVAL)
+    {
+        goffset rate = (goffset)((finished - progress->rate_finished) / elapsed);
+        if(progress->rate > 0)
+            progress->rate = (3 * progress->rate + rate) / 4;
+        else
+            progress->rate = rate;
+        progress->rate_finished = finished;
+        g_timer_start(progress->rate_timer);
+    }
+
+    if(cur_file)
+    {
+        g_signal_emit(job, signals[CUR_FILE], 0, cur_file);
+        g_free(cur_file);
+    }
+    if(percent != progress->percent_shown) /* estimated one may go down */
+    {
+        progress->percent_shown = percent;
+        g_signal_emit(job, signals[PERCENT], 0, percent);
+    }
+}
+
+static gboolean on_progress_timeout(gpointer user_data)
+{
+    if(g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    _progress_flush(FM_FILE_OPS_JOB(user_data));
+    return TRUE;
+}
+
+static gpointer flush_progress(FmJob* job, gpointer unused)
 {
-    g_signal_emit(job, signals[CUR_FILE], 0, (const char*)cur_file);
+    _progress_flush(FM_FILE_OPS_JOB(job));
     return NULL;
 }
 
+/* in job thread: start sampling the progress in main loop */
+static void _progress_start(FmFileOpsJob* job)
+{
+    FmFileOpsJobProgress* progress = job->progress;
+
+    g_timer_start(progress->rate_timer);
+    progress->timeout_handler = g_timeout_add_full(G_PRIORITY_DEFAULT,
+                                                   PROGRESS_INTERVAL,
+                                                   on_progress_timeout,
+                                                   g_object_ref(job),
+                                                   g_object_unref);
+}
+
+/* in job thread: stop sampling and deliver the final state */
+static void _progress_stop(FmFileOpsJob* job)
+{
+    g_source_remove(job->progress->timeout_handler);
+    job->progress->timeout_handler = 0;
+    fm_job_call_main_thread(FM_JOB(job), flush_progress, NULL);
+}
+
+/* the file which an error or a question is about should be shown first */
+static gboolean on_job_interaction(GSignalInvocationHint* ihint,
+                                   guint n_param_values,
+                                   const GValue* param_values,
+                                   gpointer data)
+{
+    gpointer job = g_value_get_object(&param_values[0]);
+
+    if(FM_IS_FILE_OPS_JOB(job) && FM_FILE_OPS_JOB(job)->progress->timeout_handler)
+        _progress_flush(job);
+    return TRUE;
+}
+
 /**
  * fm_file_ops_job_emit_cur_file
  * @job: the job to emit signal
  * @cur_file: the data to emit
  *
- * Emits the #FmFileOpsJob::cur-file signal in main thread.
+ * Publishes @cur_file as currently processed file. The
+ * #FmFileOpsJob::cur-file signal will be emitted in main thread with
+ * the latest file published, at most 10 times per second.
+ *
+ * This function may be called from any thread and never waits for
+ * the main thread.
  *
  * This API is private to #FmFileOpsJob and should not be used outside
  * of libfm implementation.
@@ -385,20 +570,25 @@ static gpointer emit_cur_file(FmJob* job, gpointer cur_file)
  */
 void fm_file_ops_job_emit_cur_file(FmFileOpsJob* job, const char* cur_file)
 {
-    fm_job_call_main_thread(FM_JOB(job), emit_cur_file, (gpointer)cur_file);
-}
+    FmFileOpsJobProgress* progress = job->progress;
 
-static gpointer emit_percent(FmJob* job, gpointer percent)
-{
-    g_signal_emit(job, signals[PERCENT], 0, GPOINTER_TO_UINT(percent));
-    return NULL;
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    g_string_assign(progress->cur_file, cur_file ? cur_file : "");
+    progress->cur_file_changed = TRUE;
+    progress->n_files++;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
 }
 
 /**
  * fm_file_ops_job_emit_percent
  * @job: the job to emit signal
  *
- * Emits the #FmFileOpsJob::percent signal in main thread.
+ * Publishes the current state of @job->finished, @job->current_file_finished
+ * and @job->total. The #FmFileOpsJob::percent signal will be emitted in main
+ * thread once the ratio grows, at most 10 times per second.
+ *
+ * This function may be called from any thread and never waits for
+ * the main thread.
  *
  * This API is private to #FmFileOpsJob and should not be used outside
  * of libfm implementation.
@@ -407,22 +597,188 @@ static gpointer emit_percent(FmJob* job, gpointer percent)
  */
 void fm_file_ops_job_emit_percent(FmFileOpsJob* job)
 {
+    FmFileOpsJobProgress* progress = job->progress;
+    goffset finished = job->finished + job->current_file_finished;
+    goffset total;
     guint percent;
-    if(job->total > 0)
+
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    if(G_UNLIKELY(progress->estimated))
     {
-        gdouble dpercent = (gdouble)(job->finished + job->current_file_finished) / job->total;
-        percent = (guint)(dpercent * 100);
-        if(percent > 100)
+        /* the counter is still running, its total only grows */
+        total = MAX(_fm_deep_count_job_get_total_size(progress->counter), finished);
+        if(total > 0)
+            percent = MIN((guint)((gdouble)finished * 100 / total), 99);
+        else
+            percent = 0;
+        progress->percent = percent;
+        job->percent = percent;
+    }
+    else
+    {
+        total = job->total;
+        if(total > 0)
+        {
+            gdouble dpercent = (gdouble)finished / total;
+            percent = (guint)(dpercent * 100);
+            if(percent > 100)
+                percent = 100;
+        }
+        else
             percent = 100;
+        if( percent > progress->percent )
+        {
+            progress->percent = percent;
+            job->percent = percent;
+        }
     }
+    progress->finished = finished;
+    progress->total = total;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+}
+
+/**
+ * fm_file_ops_job_get_progress
+ * @job: a job to inspect
+ * @finished: (out) (allow-none): location to store amount of work done
+ * @total: (out) (allow-none): location to store total amount of work
+ * @n_files: (out) (allow-none): location to store number of files started
+ * @rate: (out) (allow-none): location to store amount of work done per second
+ *
+ * Retrieves the last progress published by @job. The amount of work is
+ * measured in bytes for copy and move operations and in files for other
+ * operations. The @rate is averaged over last few seconds and is updated
+ * together with the #FmFileOpsJob::percent signal.
+ *
+ * This API should be called from main thread only.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_ops_job_get_progress(FmFileOpsJob* job, goffset* finished, goffset* total,
+                                  guint* n_files, goffset* rate)
+{
+    FmFileOpsJobProgress* progress;
+
+    g_return_if_fail(FM_IS_FILE_OPS_JOB(job));
+
+    progress = job->progress;
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    if(finished)
+        *finished = progress->finished;
+    if(total)
+        *total = progress->total;
+    if(n_files)
+        *n_files = progress->n_files;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+    if(rate)
+        *rate = progress->rate;
+}
+
+static gpointer count_total_thread(gpointer user_data)
+{
+    FmFileOpsJob* job = FM_FILE_OPS_JOB(user_data);
+    FmFileOpsJobProgress* progress = job->progress;
+    FmDeepCountJob* dc = progress->counter;
+
+    fm_job_run_sync(FM_JOB(dc));
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    if(fm_job_is_cancelled(FM_JOB(dc))) /* the job ended before the counter */
+        job->total = MAX(dc->total_size, job->finished + job->current_file_finished);
     else
-        percent = 100;
+        job->total = dc->total_size;
+    progress->estimated = FALSE;
+    /* the estimated percent may be bigger than the real one */
+    progress->percent = 0;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+    fm_file_ops_job_emit_percent(job);
+    return NULL;
+}
 
-    if( percent > job->percent )
+/**
+ * fm_file_ops_job_count_total
+ * @job: the job to count total for
+ * @dc: (transfer full): the job to count total size
+ *
+ * Starts @dc to count @job->total while @job already does the work.
+ * Until @dc finishes the total size grows with the size counted so far
+ * and fm_file_ops_job_is_total_estimated() returns %TRUE. The @dc is
+ * cancelled if @job ends first.
+ *
+ * If this function is called in main thread then @dc is ran before
+ * return, since errors of @dc might need the main loop. It shares the
+ * cancellable of @job then so cancelling @job stops the counting.
+ *
+ * This API is private to #FmFileOpsJob and should not be used outside
+ * of libfm implementation.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_ops_job_count_total(FmFileOpsJob* job, FmDeepCountJob* dc)
+{
+    FmFileOpsJobProgress* progress = job->progress;
+
+    g_return_if_fail(progress->counter == NULL);
+
+    if(g_main_context_is_owner(g_main_context_default()))
     {
-        fm_job_call_main_thread(FM_JOB(job), emit_percent, GUINT_TO_POINTER(percent));
-        job->percent = percent;
+        /* not shared with the counter thread since cancelling the counter
+           there when the job ends would cancel the job as well */
+        fm_job_set_cancellable(FM_JOB(dc), fm_job_get_cancellable(FM_JOB(job)));
+        fm_job_run_sync(FM_JOB(dc));
+        job->total = dc->total_size;
+        g_object_unref(dc);
+        return;
     }
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    progress->counter = dc;
+    progress->estimated = TRUE;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    progress->count_thread = g_thread_new("fm-count-total", count_total_thread, job);
+#else
+    progress->count_thread = g_thread_create(count_total_thread, job, TRUE, NULL);
+#endif
+}
+
+/* in job thread: cancel the counter if it's still running */
+static void _count_stop(FmFileOpsJob* job)
+{
+    FmFileOpsJobProgress* progress = job->progress;
+    FmDeepCountJob* dc = progress->counter;
+
+    if(dc == NULL)
+        return;
+    fm_job_cancel(FM_JOB(dc));
+    g_thread_join(progress->count_thread);
+    progress->count_thread = NULL;
+    g_mutex_lock(PROGRESS_LOCK(progress));
+    progress->counter = NULL;
+    g_mutex_unlock(PROGRESS_LOCK(progress));
+    g_object_unref(dc);
+}
+
+/**
+ * fm_file_ops_job_is_total_estimated
+ * @job: a job to inspect
+ *
+ * Checks if total amount of work for @job is still being counted while
+ * @job runs. In that case the total retrieved with
+ * fm_file_ops_job_get_progress() and the percent are estimated.
+ *
+ * Returns: %TRUE if the total isn't known yet.
+ *
+ * Since: 1.2.0
+ */
+gboolean fm_file_ops_job_is_total_estimated(FmFileOpsJob* job)
+{
+    gboolean estimated;
+
+    g_return_val_if_fail(FM_IS_FILE_OPS_JOB(job), FALSE);
+
+    g_mutex_lock(PROGRESS_LOCK(job->progress));
+    estimated = job->progress->estimated;
+    g_mutex_unlock(PROGRESS_LOCK(job->progress));
+    return estimated;
 }
 
 static gpointer emit_prepared(FmJob* job, gpointer user_data)
@@ -458,6 +814,7 @@ struct AskRename
 static gpointer emit_ask_rename(FmJob* job, gpointer input_data)
 {
 #define data ((struct AskRename*)input_data)
+    _progress_flush(FM_FILE_OPS_JOB(job));
     g_signal_emit(job, signals[ASK_RENAME], 0, data->src_fi, data->dest_fi, &data->new_name, &data->ret);
 #undef data
     return NULL;
@@ -527,7 +884,9 @@ FmFileOpOption fm_file_ops_job_ask_rename(FmFileOpsJob* job, GFile* src, GFileIn
     data.src_fi = src_fi;
     data.dest_fi = dest_fi;
     data.new_name = NULL;
+    _fm_job_wait_for_user(FM_JOB(job));
     fm_job_call_main_thread(FM_JOB(job), emit_ask_rename, (gpointer)&data);
+    _fm_job_user_answered(FM_JOB(job));
 
     if(data.ret == FM_FILE_OP_RENAME)
     {
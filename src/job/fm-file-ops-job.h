@@ -42,6 +42,7 @@ G_BEGIN_DECLS
 
 typedef struct _FmFileOpsJob            FmFileOpsJob;
 typedef struct _FmFileOpsJobClass        FmFileOpsJobClass;
+typedef struct _FmFileOpsJobProgress     FmFileOpsJobProgress;
 
 /**
  * FmFileOpType:
@@ -130,7 +131,7 @@ struct _FmFileOpsJob
     FmFileOpOption supported_options;
 
     /*< private >*/
-    gpointer _reserved1;
+    FmFileOpsJobProgress* progress;
     gpointer _reserved2;
 };
 
@@ -171,6 +172,10 @@ void fm_file_ops_job_set_target(FmFileOpsJob *job, const char *url);
 void fm_file_ops_job_emit_prepared(FmFileOpsJob* job);
 void fm_file_ops_job_emit_cur_file(FmFileOpsJob* job, const char* cur_file);
 void fm_file_ops_job_emit_percent(FmFileOpsJob* job);
+void fm_file_ops_job_get_progress(FmFileOpsJob* job, goffset* finished, goffset* total,
+                                  guint* n_files, goffset* rate);
+void fm_file_ops_job_count_total(FmFileOpsJob* job, FmDeepCountJob* dc);
+gboolean fm_file_ops_job_is_total_estimated(FmFileOpsJob* job);
 FmFileOpOption fm_file_ops_job_ask_rename(FmFileOpsJob* job, GFile* src, GFileInfo* src_inf, GFile* dest, GFile** new_dest);
 FmFileOpOption fm_file_ops_job_get_options(FmFileOpsJob* job);
 
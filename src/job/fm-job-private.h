@@ -0,0 +1,45 @@
+/*
+ *      fm-job-private.h
+ *
+ *      Copyright 2009 PCMan <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* internals of FmJob shared with job implementations in libfm,
+   this header is not installed */
+
+#ifndef __FM_JOB_PRIVATE_H__
+#define __FM_JOB_PRIVATE_H__
+
+#include "fm-job.h"
+#include "fm-path.h"
+#include "fm-deep-count-job.h"
+
+G_BEGIN_DECLS
+
+/* for job implementations waiting for the user in some other way */
+void _fm_job_wait_for_user(FmJob *job);
+void _fm_job_user_answered(FmJob *job);
+
+void _fm_job_set_io_path(FmJob *job, FmPath *path);
+
+/* for reading the total while FmDeepCountJob is still counting */
+goffset _fm_deep_count_job_get_total_size(FmDeepCountJob *job);
+
+G_END_DECLS
+
+#endif /* __FM_JOB_PRIVATE_H__ */
@@ -26,10 +26,15 @@
 
 #define FM_DISABLE_SEAL
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include "fm-job.h"
+#include "fm-job-private.h"
 #include "fm-marshal.h"
 #include "glib-compat.h"
 #include "fm-utils.h"
+#include "fm-config.h"
 
 /**
  * SECTION:fm-job
@@ -48,6 +53,13 @@
  * will be emitted before emitting #FmJob::finished signal. You can also run
  * the job in blocking fashion instead of running it asynchronously by
  * calling fm_job_run_sync().
+ *
+ * Jobs started with fm_job_run_async() are not started immediately but
+ * queued and ran by limited number of worker threads (see the
+ * max_job_threads option in #FmConfig) in order of their #FmJobPriority. Priority
+ * of a job that is not started yet may be changed by fm_job_set_priority().
+ * A job which waits for the user to answer an error or a question gives
+ * its slot to other jobs until the answer is received.
  */
 
 enum {
@@ -86,6 +98,28 @@ G_LOCK_DEFINE_STATIC(idle_handler);
 static GThreadPool* thread_pool = NULL;
 static guint n_jobs = 0;
 
+/* the scheduler: jobs are queued by priority and pushed into the thread
+   pool only when there is a free slot for them */
+G_LOCK_DEFINE_STATIC(scheduler);
+static GQueue pending[FM_JOB_N_PRIORITIES]; /* zeroed GQueue is empty */
+static guint n_running = 0;
+static guint n_running_background = 0;
+static GSList *running_io = NULL; /* running background jobs with device */
+
+/* scheduling data of a job, protected by the scheduler lock; it is kept
+   out of FmJob to not change size of the structure for derived classes */
+typedef struct
+{
+    FmJobPriority priority;
+    gboolean background;
+    guint64 io_device;
+    FmPath *io_path; /* to find io_device once the job is started */
+    gboolean scheduled; /* the job holds a slot */
+    guint waiting; /* nested waits for the user */
+} FmJobSchedule;
+
+#define JOB_SCHED(job) ((FmJobSchedule*)((FmJob*)(job))->_reserved1)
+
 static guint signals[N_SIGNALS];
 
 static void fm_job_emit_finished(FmJob* job)
@@ -230,6 +264,8 @@ static void fm_job_init(FmJob *self)
     if( G_UNLIKELY(!thread_pool) )
         thread_pool = g_thread_pool_new((GFunc)job_thread, NULL, -1, FALSE, NULL);
     ++n_jobs;
+    self->_reserved1 = g_slice_new0(FmJobSchedule);
+    JOB_SCHED(self)->priority = FM_JOB_PRIORITY_INFO;
 }
 
 /**
@@ -252,6 +288,10 @@ static void fm_job_finalize(GObject *object)
     g_return_if_fail(object != NULL);
     g_return_if_fail(FM_IS_JOB(object));
 
+    if (JOB_SCHED(object)->io_path)
+        fm_path_unref(JOB_SCHED(object)->io_path);
+    g_slice_free(FmJobSchedule, JOB_SCHED(object));
+
     if (G_OBJECT_CLASS(fm_job_parent_class)->finalize)
         (* G_OBJECT_CLASS(fm_job_parent_class)->finalize)(object);
 
@@ -263,9 +303,131 @@ static void fm_job_finalize(GObject *object)
     }
 }
 
+static guint _get_max_threads(void)
+{
+    if (fm_config && fm_config->max_job_threads > 0)
+        return fm_config->max_job_threads;
+    return FM_CONFIG_DEFAULT_MAX_JOB_THREADS;
+}
+
+static inline gboolean _is_background(FmJobPriority priority)
+{
+    return (priority >= FM_JOB_PRIORITY_COUNT);
+}
+
+/* a deep count isn't delayed by a long copy on the same device, only
+   jobs of the same class wait for each other */
+static gboolean _device_is_busy(guint64 device, FmJobPriority priority)
+{
+    GSList *l;
+
+    for (l = running_io; l; l = l->next)
+    {
+        FmJobSchedule *sched = JOB_SCHED(l->data);
+        if (sched->io_device == device && sched->priority == priority)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void _schedule_jobs(void);
+
+/* these should be called with scheduler lock held */
+static void _release_slot(FmJob *job)
+{
+    n_running--;
+    if (JOB_SCHED(job)->background)
+    {
+        n_running_background--;
+        running_io = g_slist_remove(running_io, job);
+    }
+}
+
+static void _take_slot(FmJob *job)
+{
+    FmJobSchedule *sched = JOB_SCHED(job);
+
+    n_running++;
+    if (sched->background)
+    {
+        n_running_background++;
+        if (sched->io_device != 0)
+            running_io = g_slist_prepend(running_io, job);
+    }
+}
+
+/* a job waiting for the user lets other jobs run meanwhile; once the
+   answer is received the job continues even if all slots are busy */
+void _fm_job_wait_for_user(FmJob *job)
+{
+    FmJobSchedule *sched = JOB_SCHED(job);
+
+    G_LOCK(scheduler);
+    if (sched->scheduled && sched->waiting++ == 0)
+    {
+        _release_slot(job);
+        _schedule_jobs();
+    }
+    G_UNLOCK(scheduler);
+}
+
+void _fm_job_user_answered(FmJob *job)
+{
+    FmJobSchedule *sched = JOB_SCHED(job);
+
+    G_LOCK(scheduler);
+    if (sched->scheduled && --sched->waiting == 0)
+        _take_slot(job);
+    G_UNLOCK(scheduler);
+}
+
+/* starts as many pending jobs as there are free slots, should be called
+   with scheduler lock held */
+static void _schedule_jobs(void)
+{
+    guint max_threads = _get_max_threads();
+    /* leave at least one thread for interactive jobs */
+    guint max_background = (max_threads > 1) ? max_threads - 1 : 1;
+    FmJobPriority priority;
+    GList *l, *next;
+    FmJob *job;
+    FmJobSchedule *sched;
+
+    for (priority = 0; priority < FM_JOB_N_PRIORITIES; priority++)
+    {
+        for (l = pending[priority].head; l; l = next)
+        {
+            if (n_running >= max_threads)
+                return;
+            next = l->next;
+            job = l->data;
+            sched = JOB_SCHED(job);
+            if (_is_background(priority))
+            {
+                if (n_running_background >= max_background)
+                    return;
+                /* don't let I/O heavy jobs fight for the same device */
+                if (sched->io_device != 0 && _device_is_busy(sched->io_device, priority))
+                    continue;
+                n_running_background++;
+                if (sched->io_device != 0)
+                    running_io = g_slist_prepend(running_io, job);
+            }
+            sched->background = _is_background(priority);
+            sched->scheduled = TRUE;
+            g_queue_delete_link(&pending[priority], l);
+            n_running++;
+            g_thread_pool_push(thread_pool, job, NULL);
+        }
+    }
+}
+
 static gboolean fm_job_real_run_async(FmJob* job)
 {
-    g_thread_pool_push(thread_pool, job, NULL);
+    G_LOCK(scheduler);
+    g_queue_push_tail(&pending[JOB_SCHED(job)->priority], job);
+    _schedule_jobs();
+    G_UNLOCK(scheduler);
     return TRUE;
 }
 
@@ -359,12 +521,68 @@ gboolean fm_job_run_sync_with_mainloop(FmJob* job)
     return ret;
 }
 
+/* finds the device of the path set by _fm_job_set_io_path(); it is done
+   in working thread since stat() may hang on a slow or dead file system.
+   Returns FALSE if another job of the same class works on the device, the
+   job gives its slot away and is queued again in front of others then */
+static gboolean _job_take_device(FmJob *job)
+{
+    FmJobSchedule *sched = JOB_SCHED(job);
+    FmPath *path;
+    char *path_str;
+    struct stat st;
+    guint64 device = 0;
+    gboolean ret = TRUE;
+
+    G_LOCK(scheduler);
+    path = sched->io_path;
+    sched->io_path = NULL;
+    G_UNLOCK(scheduler);
+    if (path == NULL)
+        return TRUE;
+    path_str = fm_path_to_str(path);
+    if (lstat(path_str, &st) == 0)
+        device = st.st_dev;
+    g_free(path_str);
+    fm_path_unref(path);
+
+    G_LOCK(scheduler);
+    sched->io_device = device;
+    if (device != 0 && sched->background)
+    {
+        if (_device_is_busy(device, sched->priority))
+        {
+            _release_slot(job);
+            sched->scheduled = FALSE;
+            g_queue_push_head(&pending[sched->priority], job);
+            _schedule_jobs();
+            ret = FALSE;
+        }
+        else
+            running_io = g_slist_prepend(running_io, job);
+    }
+    G_UNLOCK(scheduler);
+    return ret;
+}
+
 /* this is called from working thread */
 static void job_thread(FmJob* job, gpointer unused)
 {
     FmJobClass* klass = FM_JOB_CLASS(G_OBJECT_GET_CLASS(job));
+    FmJobSchedule *sched = JOB_SCHED(job);
+
+    if (!_job_take_device(job))
+        return; /* it will be started again once the device is free */
     klass->run(job);
 
+    /* release the slot and let the next queued job run */
+    G_LOCK(scheduler);
+    if(sched->waiting == 0)
+        _release_slot(job);
+    sched->scheduled = FALSE;
+    _schedule_jobs();
+    G_UNLOCK(scheduler);
+
     /* let the main thread know that we're done, and free the job
      * in idle handler if neede. */
     fm_job_finish(job);
@@ -514,9 +732,15 @@ gint fm_job_ask(FmJob* job, const char* question, ...)
 gint fm_job_askv(FmJob* job, const char* question, gchar* const *options)
 {
     struct AskData data;
+    gint ret;
+
     data.question = question;
     data.options = options;
-    return GPOINTER_TO_INT(fm_job_call_main_thread(job, ask_in_main_thread, &data));
+
+    _fm_job_wait_for_user(job);
+    ret = GPOINTER_TO_INT(fm_job_call_main_thread(job, ask_in_main_thread, &data));
+    _fm_job_user_answered(job);
+    return ret;
 }
 
 /**
@@ -709,7 +933,9 @@ FmJobErrorAction fm_job_emit_error(FmJob* job, GError* err, FmJobErrorSeverity s
     g_return_val_if_fail(err, FM_JOB_ABORT);
     data.err = err;
     data.severity = severity;
+    _fm_job_wait_for_user(job);
     ret = GPOINTER_TO_UINT(fm_job_call_main_thread(job, error_in_main_thread, &data));
+    _fm_job_user_answered(job);
     if(severity == FM_JOB_ERROR_CRITICAL || ret == FM_JOB_ABORT)
     {
         ret = FM_JOB_ABORT;
@@ -827,3 +1053,94 @@ void fm_job_resume(FmJob *job)
     job->suspended = FALSE;
     g_rec_mutex_unlock(&job->stop); /* ...and drop it */
 }
+
+/**
+ * fm_job_set_priority
+ * @job: a job to apply
+ * @priority: new scheduling class for the @job
+ *
+ * Changes scheduling class of the @job. If the @job is queued by
+ * fm_job_run_async() but not started yet then it will be moved into
+ * the queue of new class so raising the priority makes the @job start
+ * sooner. Changing priority of a running job has no effect on it.
+ *
+ * This API may be called from any thread.
+ *
+ * Since: 1.2.0
+ */
+void fm_job_set_priority(FmJob *job, FmJobPriority priority)
+{
+    GList *l;
+    FmJobPriority old_priority;
+
+    g_return_if_fail(job != NULL && FM_IS_JOB(job));
+    g_return_if_fail(priority < FM_JOB_N_PRIORITIES);
+    G_LOCK(scheduler);
+    old_priority = JOB_SCHED(job)->priority;
+    if (priority != old_priority)
+    {
+        JOB_SCHED(job)->priority = priority;
+        l = g_queue_find(&pending[old_priority], job);
+        if (l)
+        {
+            g_queue_delete_link(&pending[old_priority], l);
+            g_queue_push_tail(&pending[priority], job);
+            _schedule_jobs();
+        }
+    }
+    G_UNLOCK(scheduler);
+}
+
+/**
+ * fm_job_get_priority
+ * @job: the job to inspect
+ *
+ * Retrieves scheduling class of the @job.
+ *
+ * Returns: the priority of the @job.
+ *
+ * Since: 1.2.0
+ */
+FmJobPriority fm_job_get_priority(FmJob *job)
+{
+    g_return_val_if_fail(job != NULL && FM_IS_JOB(job), FM_JOB_PRIORITY_INFO);
+    return JOB_SCHED(job)->priority;
+}
+
+/**
+ * fm_job_set_io_device
+ * @job: a job to apply
+ * @device: device ID (st_dev) the @job works with, or 0 if unknown
+ *
+ * Sets the device which will be mostly used by the @job. Only one job of
+ * class %FM_JOB_PRIORITY_COUNT and one of class %FM_JOB_PRIORITY_BULK
+ * are running on the same device at a time, others are waiting in the
+ * queue.
+ * This should only be called before the @job is launched.
+ *
+ * Since: 1.2.0
+ */
+void fm_job_set_io_device(FmJob *job, guint64 device)
+{
+    g_return_if_fail(job != NULL && FM_IS_JOB(job));
+    G_LOCK(scheduler);
+    JOB_SCHED(job)->io_device = device;
+    G_UNLOCK(scheduler);
+}
+
+/* sets the file the job will mostly work with, for local files it is
+   used to find the device for fm_job_set_io_device() when the job is
+   started; that way the caller (usually main thread) doesn't wait for
+   the file system. Should only be called before the job is launched. */
+void _fm_job_set_io_path(FmJob *job, FmPath *path)
+{
+    FmJobSchedule *sched = JOB_SCHED(job);
+
+    if (!path || !fm_path_is_native(path))
+        return;
+    G_LOCK(scheduler);
+    if (sched->io_path)
+        fm_path_unref(sched->io_path);
+    sched->io_path = fm_path_ref(path);
+    G_UNLOCK(scheduler);
+}
@@ -83,6 +83,28 @@ typedef enum {
     FM_JOB_ABORT
 } FmJobErrorAction;
 
+/**
+ * FmJobPriority
+ * @FM_JOB_PRIORITY_INTERACTIVE: listing of folders shown to the user
+ * @FM_JOB_PRIORITY_INFO: retrieving or refreshing file info
+ * @FM_JOB_PRIORITY_COUNT: recursive counting of files and sizes
+ * @FM_JOB_PRIORITY_BULK: bulk file operations such as copying or deleting
+ *
+ * The scheduling class of the job. Jobs of higher class (lower value) are
+ * started before jobs of lower class. Jobs of classes @FM_JOB_PRIORITY_COUNT
+ * and @FM_JOB_PRIORITY_BULK are considered I/O heavy: they never occupy
+ * all worker threads and only one job of each of them is running at a time
+ * on the same device, see fm_job_set_io_device().
+ */
+typedef enum {
+    FM_JOB_PRIORITY_INTERACTIVE,
+    FM_JOB_PRIORITY_INFO,
+    FM_JOB_PRIORITY_COUNT,
+    FM_JOB_PRIORITY_BULK,
+    /*< private >*/
+    FM_JOB_N_PRIORITIES
+} FmJobPriority;
+
 struct _FmJob
 {
     /*< private >*/
@@ -232,6 +254,10 @@ gint fm_job_ask_valist(FmJob* job, const char* question, va_list options);
 gboolean fm_job_pause(FmJob *job);
 void fm_job_resume(FmJob *job);
 
+void fm_job_set_priority(FmJob *job, FmJobPriority priority);
+FmJobPriority fm_job_get_priority(FmJob *job);
+void fm_job_set_io_device(FmJob *job, guint64 device);
+
 G_END_DECLS
 
 #endif /* __FM-JOB_H__ */
@@ -34,22 +34,52 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #define _GNU_SOURCE /* for FNM_CASEFOLD in fnmatch.h, a GNU extension */
 #include <fnmatch.h>
 
+/* mapped file may be truncated while we read it so SIGBUS should be
+   caught, that needs thread local jump buffer */
+#if defined(HAVE_MMAP) && defined(__GNUC__)
+#define SEARCH_USE_MMAP
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
+#endif
+
 #if __GNUC__ >= 4
 #pragma GCC diagnostic ignored "-Wcomment" /* for comments below */
 #endif
 
 /* ---- Classes structures ---- */
-typedef struct _FmSearchIntIter FmSearchIntIter;
+typedef struct _FmSearchMatcher FmSearchMatcher;
 
-struct _FmSearchIntIter
+/* Boyer-Moore-Horspool substring matcher for content search */
+struct _FmSearchMatcher
 {
-    FmSearchIntIter *parent; /* recursion path */
-    GFile *folder_path; /* path to folder */
-    GFileEnumerator *enu; /* children enumerator */
+    guchar *pattern; /* lower case if fold is set */
+    gsize len;
+    gboolean fold; /* ASCII case insensitive */
+    gsize skip[256];
+};
+
+
+/* folders are scanned by thread pools, one pool for each file system,
+   so slow devices don't take all threads and don't compete for seeks */
+#define SEARCH_THREADS_PER_FS 4
+/* workers pause if the consumer doesn't take results that fast */
+#define SEARCH_MAX_QUEUED 1024
+
+typedef struct _FmSearchResult FmSearchResult;
+
+struct _FmSearchResult
+{
+    GFileInfo *info; /* matched file */
+    GFile *folder_path; /* folder containing it */
 };
 
 #define FM_TYPE_VFS_SEACRH_ENUMERATOR      (fm_vfs_search_enumerator_get_type())
@@ -63,7 +93,6 @@ struct _FmVfsSearchEnumerator
 {
     GFileEnumerator parent;
 
-    FmSearchIntIter* iter;
     char* attributes;
     GFileQueryInfoFlags flags;
     GSList* target_folders; /* GFile */
@@ -71,6 +100,7 @@ struct _FmVfsSearchEnumerator
     GRegex* name_regex;
     char* content_pattern;
     GRegex* content_regex;
+    FmSearchMatcher* content_matcher; /* NULL if line based search is needed */
     char** mime_types;
     guint64 min_mtime;
     guint64 max_mtime;
@@ -80,8 +110,33 @@ struct _FmVfsSearchEnumerator
     gboolean content_case_insensitive : 1;
     gboolean recursive : 1;
     gboolean show_hidden : 1;
+    gboolean started : 1;
+
+    /* parallel directory walker */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    GMutex lock;
+    GCond cond;
+#else
+    GMutex* lock;
+    GCond* cond;
+#endif
+    char* walk_attributes; /* attributes plus file system id */
+    GCancellable* walk_cancellable; /* cancels all workers */
+    /* these are protected by lock */
+    GHashTable* pools; /* interned file system id -> GThreadPool */
+    GQueue results; /* FmSearchResult in order of discovery */
+    guint n_pending; /* folders queued or being scanned */
+    GError* walk_error; /* first error which stopped the search */
 };
 
+#if GLIB_CHECK_VERSION(2, 32, 0)
+#define SEARCH_LOCK(enu) (&(enu)->lock)
+#define SEARCH_COND(enu) (&(enu)->cond)
+#else
+#define SEARCH_LOCK(enu) ((enu)->lock)
+#define SEARCH_COND(enu) ((enu)->cond)
+#endif
+
 struct _FmVfsSearchEnumeratorClass
 {
     GFileEnumeratorClass parent_class;
@@ -102,7 +157,7 @@ struct _FmSearchVFile
     GObject parent_object;
 
     char *path; /* full search path */
-    GFile *current; /* last scanned directory */
+    GFile *current; /* folder of the last found file */
 };
 
 struct _FmSearchVFileClass
@@ -116,42 +171,293 @@ static gboolean fm_search_job_match_file(FmVfsSearchEnumerator * priv,
                                          GFileInfo * info, GFile * parent,
                                          GCancellable *cancellable,
                                          GError **error);
-static void fm_search_job_match_folder(FmVfsSearchEnumerator * priv,
-                                       GFile * folder_path,
-                                       GCancellable *cancellable,
-                                       GError **error);
 static void parse_search_uri(FmVfsSearchEnumerator* priv, const char* uri_str);
 
 
-/* ---- Directory iterator ---- */
-/* caller should g_object_ref(folder_path) if success */
-static inline FmSearchIntIter *_search_iter_new(FmSearchIntIter *parent,
-                                                const char *attributes,
-                                                GFileQueryInfoFlags flags,
-                                                GFile *folder_path,
-                                                GCancellable *cancellable,
-                                                GError **error)
+/* ---- Parallel directory walker ---- */
+static inline void _search_result_free(FmSearchResult *result)
 {
-    GFileEnumerator *enu;
-    FmSearchIntIter *iter;
+    g_object_unref(result->info);
+    g_object_unref(result->folder_path);
+    g_slice_free(FmSearchResult, result);
+}
 
-    enu = g_file_enumerate_children(folder_path, attributes, flags,
-                                    cancellable, error);
-    if(enu == NULL)
-        return NULL;
-    iter = g_slice_new(FmSearchIntIter);
-    iter->parent = parent;
-    iter->folder_path = folder_path;
-    iter->enu = enu;
-    return iter;
+/* should be called with lock held, takes folder_path */
+static void _search_queue_folder(FmVfsSearchEnumerator *enu, GFile *folder_path,
+                                 const char *fs_id);
+
+/* returns TRUE if error should stop the search, called with lock held */
+static gboolean _search_set_error(FmVfsSearchEnumerator *enu, GError *err)
+{
+    if(err->domain == G_IO_ERROR && err->code == G_IO_ERROR_PERMISSION_DENIED)
+    {
+        g_error_free(err); /* ignore this error */
+        return FALSE;
+    }
+    if(enu->walk_error == NULL &&
+       !g_cancellable_is_cancelled(enu->walk_cancellable))
+        enu->walk_error = err;
+    else
+        g_error_free(err);
+    g_cancellable_cancel(enu->walk_cancellable);
+    g_cond_broadcast(SEARCH_COND(enu));
+    return TRUE;
+}
+
+/* in worker thread: scan one folder */
+static void _search_worker(gpointer data, gpointer user_data)
+{
+    GFile *folder_path = (GFile*)data;
+    FmVfsSearchEnumerator *enu = (FmVfsSearchEnumerator*)user_data;
+    GCancellable *cancellable = enu->walk_cancellable;
+    GFileEnumerator *children;
+    GFileInfo *file_info;
+    GError *err = NULL;
+
+    if(g_cancellable_is_cancelled(cancellable))
+        goto _done;
+    children = g_file_enumerate_children(folder_path, enu->walk_attributes,
+                                         enu->flags, cancellable, &err);
+    if(children == NULL)
+    {
+        g_mutex_lock(SEARCH_LOCK(enu));
+        _search_set_error(enu, err);
+        g_mutex_unlock(SEARCH_LOCK(enu));
+        goto _done;
+    }
+    while(!g_cancellable_is_cancelled(cancellable))
+    {
+        gboolean matched, fatal;
+
+        file_info = g_file_enumerator_next_file(children, cancellable, &err);
+        if(file_info == NULL)
+        {
+            if(err == NULL) /* end of file list */
+                break;
+            g_mutex_lock(SEARCH_LOCK(enu));
+            fatal = _search_set_error(enu, err);
+            g_mutex_unlock(SEARCH_LOCK(enu));
+            err = NULL;
+            if(fatal)
+                break;
+            continue;
+        }
+        if(g_file_info_get_name(file_info) == NULL)
+        {
+            g_object_unref(file_info);
+            continue;
+        }
+
+        /* this may read the file for content so it's done without lock */
+        matched = fm_search_job_match_file(enu, file_info, folder_path,
+                                           cancellable, &err);
+        g_mutex_lock(SEARCH_LOCK(enu));
+        if(err != NULL && _search_set_error(enu, err))
+        {
+            g_mutex_unlock(SEARCH_LOCK(enu));
+            g_object_unref(file_info);
+            break;
+        }
+        err = NULL;
+
+        /* recurse upon each directory */
+        if(enu->recursive &&
+           g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY &&
+           (enu->show_hidden || !g_file_info_get_is_hidden(file_info)))
+        {
+            const char *name = g_file_info_get_name(file_info);
+            const char *fs_id = g_file_info_get_attribute_string(file_info,
+                                                G_FILE_ATTRIBUTE_ID_FILESYSTEM);
+            _search_queue_folder(enu, g_file_get_child(folder_path, name), fs_id);
+        }
+
+        if(matched)
+        {
+            FmSearchResult *result;
+
+            /* g_debug("found matched: %s", g_file_info_get_name(file_info)); */
+            while(g_queue_get_length(&enu->results) >= SEARCH_MAX_QUEUED &&
+                  !g_cancellable_is_cancelled(cancellable))
+                g_cond_wait(SEARCH_COND(enu), SEARCH_LOCK(enu));
+            result = g_slice_new(FmSearchResult);
+            result->info = file_info;
+            result->folder_path = g_object_ref(folder_path);
+            g_queue_push_tail(&enu->results, result);
+            g_cond_broadcast(SEARCH_COND(enu));
+        }
+        else
+            g_object_unref(file_info);
+        g_mutex_unlock(SEARCH_LOCK(enu));
+    }
+    g_file_enumerator_close(children, NULL, NULL);
+    g_object_unref(children);
+
+_done:
+    g_mutex_lock(SEARCH_LOCK(enu));
+    enu->n_pending--;
+    g_cond_broadcast(SEARCH_COND(enu));
+    g_mutex_unlock(SEARCH_LOCK(enu));
+    g_object_unref(folder_path);
 }
 
-static inline void _search_iter_free(FmSearchIntIter *iter, GCancellable *cancellable)
+static void _search_queue_folder(FmVfsSearchEnumerator *enu, GFile *folder_path,
+                                 const char *fs_id)
 {
-    g_file_enumerator_close(iter->enu, cancellable, NULL);
-    g_object_unref(iter->enu);
-    g_object_unref(iter->folder_path);
-    g_slice_free(FmSearchIntIter, iter);
+    GThreadPool *pool;
+
+    /* pools are freed on close so nothing can be queued after it */
+    if(enu->pools == NULL || g_cancellable_is_cancelled(enu->walk_cancellable))
+    {
+        g_object_unref(folder_path);
+        return;
+    }
+    fs_id = g_intern_string(fs_id ? fs_id : "");
+    pool = g_hash_table_lookup(enu->pools, fs_id);
+    if(pool == NULL)
+    {
+        pool = g_thread_pool_new(_search_worker, enu, SEARCH_THREADS_PER_FS,
+                                 FALSE, NULL);
+        g_hash_table_insert(enu->pools, (gpointer)fs_id, pool);
+    }
+    enu->n_pending++;
+    g_thread_pool_push(pool, folder_path, NULL);
+}
+
+static void _search_walker_start(FmVfsSearchEnumerator *enu)
+{
+    GSList *l;
+
+    enu->started = TRUE;
+    if(enu->walk_attributes == NULL)
+        enu->walk_attributes = g_strconcat(enu->attributes, ",",
+                                           G_FILE_ATTRIBUTE_ID_FILESYSTEM, NULL);
+    enu->pools = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for(l = enu->target_folders; l; l = l->next)
+    {
+        GFile *folder_path = G_FILE(l->data);
+        GFileInfo *inf = g_file_query_info(folder_path, G_FILE_ATTRIBUTE_ID_FILESYSTEM,
+                                           0, NULL, NULL);
+        const char *fs_id = NULL;
+
+        if(inf)
+            fs_id = g_file_info_get_attribute_string(inf, G_FILE_ATTRIBUTE_ID_FILESYSTEM);
+        g_mutex_lock(SEARCH_LOCK(enu));
+        /* data is moved into queue now */
+        _search_queue_folder(enu, folder_path, fs_id);
+        g_mutex_unlock(SEARCH_LOCK(enu));
+        if(inf)
+            g_object_unref(inf);
+    }
+    g_slist_free(enu->target_folders);
+    enu->target_folders = NULL;
+}
+
+static void _search_pool_free(gpointer key, gpointer pool, gpointer unused)
+{
+    /* finish queued tasks, they are cancelled and will quit immediately */
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+/* cancels all workers and waits for them */
+static void _search_walker_stop(FmVfsSearchEnumerator *enu)
+{
+    GHashTable *pools;
+    FmSearchResult *result;
+
+    g_cancellable_cancel(enu->walk_cancellable);
+    g_mutex_lock(SEARCH_LOCK(enu));
+    pools = enu->pools;
+    enu->pools = NULL;
+    /* wake up workers waiting for free space in results */
+    g_cond_broadcast(SEARCH_COND(enu));
+    g_mutex_unlock(SEARCH_LOCK(enu));
+    if(pools)
+    {
+        g_hash_table_foreach(pools, _search_pool_free, NULL);
+        g_hash_table_destroy(pools);
+    }
+    while((result = g_queue_pop_head(&enu->results)))
+        _search_result_free(result);
+}
+
+static void _search_cancelled(GCancellable *cancellable, FmVfsSearchEnumerator *enu)
+{
+    g_cancellable_cancel(enu->walk_cancellable);
+    g_mutex_lock(SEARCH_LOCK(enu));
+    g_cond_broadcast(SEARCH_COND(enu));
+    g_mutex_unlock(SEARCH_LOCK(enu));
+}
+
+
+/* ---- Content matcher ---- */
+#define ASCII_FOLD(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+/* returns NULL if the pattern cannot be matched bytewise */
+static FmSearchMatcher *_search_matcher_new(const char *pattern, gboolean fold)
+{
+    FmSearchMatcher *m;
+    gsize i, last;
+
+    /* case folding of non-ASCII text needs UTF-8 aware line based search */
+    if(fold)
+        for(i = 0; pattern[i]; i++)
+            if((guchar)pattern[i] >= 0x80)
+                return NULL;
+    m = g_slice_new(FmSearchMatcher);
+    m->len = strlen(pattern);
+    m->pattern = (guchar*)g_strdup(pattern); /* already lower case if fold */
+    m->fold = fold;
+    for(i = 0; i < G_N_ELEMENTS(m->skip); i++)
+        m->skip[i] = m->len;
+    last = m->len ? m->len - 1 : 0;
+    for(i = 0; i < last; i++)
+    {
+        guchar c = m->pattern[i];
+        m->skip[c] = last - i;
+        if(fold && c >= 'a' && c <= 'z') /* text is folded on lookup anyway */
+            m->skip[c - ('a' - 'A')] = last - i;
+    }
+    return m;
+}
+
+static void _search_matcher_free(FmSearchMatcher *m)
+{
+    g_free(m->pattern);
+    g_slice_free(FmSearchMatcher, m);
+}
+
+/* binary safe, unlike strstr() */
+static gboolean _search_matcher_find(const FmSearchMatcher *m, const guchar *buf, gsize len)
+{
+    const guchar *pat = m->pattern;
+    gsize n = m->len, last, pos, i;
+
+    if(n == 0)
+        return TRUE;
+    if(len < n)
+        return FALSE;
+    if(n == 1 && !m->fold)
+        return memchr(buf, pat[0], len) != NULL;
+    last = n - 1;
+    for(pos = 0; pos <= len - n; pos += m->skip[buf[pos + last]])
+    {
+        guchar c = buf[pos + last];
+        if(m->fold)
+            c = ASCII_FOLD(c);
+        if(c != pat[last])
+            continue;
+        if(m->fold)
+        {
+            for(i = 0; i < last; i++)
+                if(ASCII_FOLD(buf[pos + i]) != pat[i])
+                    break;
+        }
+        else
+            i = (memcmp(buf + pos, pat, last) == 0) ? last : 0;
+        if(i == last)
+            return TRUE;
+    }
+    return FALSE;
 }
 
 
@@ -163,13 +469,8 @@ G_DEFINE_TYPE(FmVfsSearchEnumerator, fm_vfs_search_enumerator, G_TYPE_FILE_ENUME
 static void _fm_vfs_search_enumerator_dispose(GObject *object)
 {
     FmVfsSearchEnumerator *priv = FM_VFS_SEACRH_ENUMERATOR(object);
-    FmSearchIntIter *iter;
 
-    while((iter = priv->iter))
-    {
-        priv->iter = iter->parent;
-        _search_iter_free(iter, NULL);
-    }
+    _search_walker_stop(priv);
 
     if(priv->attributes)
     {
@@ -177,6 +478,18 @@ static void _fm_vfs_search_enumerator_dispose(GObject *object)
         priv->attributes = NULL;
     }
 
+    if(priv->walk_attributes)
+    {
+        g_free(priv->walk_attributes);
+        priv->walk_attributes = NULL;
+    }
+
+    if(priv->walk_error)
+    {
+        g_error_free(priv->walk_error);
+        priv->walk_error = NULL;
+    }
+
     if(priv->target_folders)
     {
         g_slist_foreach(priv->target_folders, (GFunc)g_object_unref, NULL);
@@ -208,6 +521,12 @@ static void _fm_vfs_search_enumerator_dispose(GObject *object)
         priv->content_regex = NULL;
     }
 
+    if(priv->content_matcher)
+    {
+        _search_matcher_free(priv->content_matcher);
+        priv->content_matcher = NULL;
+    }
+
     if(priv->mime_types)
     {
         g_strfreev(priv->mime_types);
@@ -222,87 +541,58 @@ static GFileInfo *_fm_vfs_search_enumerator_next_file(GFileEnumerator *enumerato
                                                       GError **error)
 {
     FmVfsSearchEnumerator *enu = FM_VFS_SEACRH_ENUMERATOR(enumerator);
-    FmSearchIntIter *iter;
-    GFileInfo * file_info;
-    GError *err = NULL;
+    FmSearchResult *result;
+    GFileInfo *file_info = NULL;
     FmSearchVFile *container;
+    gulong handler = 0;
 
     /* g_debug("_fm_vfs_search_enumerator_next_file"); */
-    while(!g_cancellable_set_error_if_cancelled(cancellable, error))
-    {
-        iter = enu->iter;
-        if(iter == NULL) /* ended with folder */
-        {
-            if(enu->target_folders == NULL)
-                break;
-            iter = _search_iter_new(NULL, enu->attributes, enu->flags,
-                                    enu->target_folders->data,
-                                    cancellable, error);
-            if(iter == NULL)
-                break;
-            /* data is moved into iter now so free link itself */
-            enu->target_folders = g_slist_delete_link(enu->target_folders,
-                                                      enu->target_folders);
-            container = FM_SEARCH_VFILE(g_file_enumerator_get_container(enumerator));
-            if(container->current)
-                g_object_unref(container->current);
-            container->current = g_object_ref(iter->folder_path);
-            enu->iter = iter;
-        }
+    if(g_cancellable_set_error_if_cancelled(cancellable, error))
+        return NULL;
+    if(!enu->started)
+        _search_walker_start(enu);
+    if(cancellable)
+        handler = g_cancellable_connect(cancellable, G_CALLBACK(_search_cancelled),
+                                        enu, NULL);
 
-        file_info = g_file_enumerator_next_file(iter->enu, cancellable, &err);
-        if(file_info && g_file_info_get_name(file_info))
+    g_mutex_lock(SEARCH_LOCK(enu));
+    for(;;)
+    {
+        result = g_queue_pop_head(&enu->results);
+        if(result) /* results found before an error are still returned */
         {
-            /* check if directory itself matches criteria */
-            if(fm_search_job_match_file(enu, file_info, iter->folder_path,
-                                        cancellable, &err))
-            {
-                g_debug("found matched: %s", g_file_info_get_name(file_info));
-                return file_info;
-            }
-
-            /* recurse upon each directory */
-            if(err == NULL && enu->recursive &&
-               g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY)
-            {
-                if(enu->show_hidden || !g_file_info_get_is_hidden(file_info))
-                {
-                    const char * name = g_file_info_get_name(file_info);
-                    GFile * file = g_file_get_child(iter->folder_path, name);
-                    /* go into directory and iterate it now */
-                    fm_search_job_match_folder(enu, file, cancellable, &err);
-                    g_object_unref(file);
-                }
-            }
-
-            g_object_unref(file_info);
-            if(err == NULL)
-                continue;
+            /* wake up workers waiting for free space */
+            g_cond_broadcast(SEARCH_COND(enu));
+            break;
         }
-
-        if(err != NULL) /* file_info == NULL */
+        if(enu->walk_error)
         {
-            if(err->domain == G_IO_ERROR && err->code == G_IO_ERROR_PERMISSION_DENIED)
-            {
-                g_error_free(err); /* ignore this error */
-                err = NULL;
-                continue;
-            }
-            g_propagate_error(error, err);
+            g_propagate_error(error, enu->walk_error);
+            enu->walk_error = NULL;
             break;
         }
-        /* else end of file list - go up */
-        enu->iter = iter->parent;
+        if(g_cancellable_set_error_if_cancelled(cancellable, error))
+            break;
+        if(enu->n_pending == 0) /* all folders are scanned */
+            break;
+        g_cond_wait(SEARCH_COND(enu), SEARCH_LOCK(enu));
+    }
+    g_mutex_unlock(SEARCH_LOCK(enu));
+
+    if(handler)
+        g_cancellable_disconnect(cancellable, handler);
+
+    if(result)
+    {
+        /* the file is resolved relative to its folder by the container */
         container = FM_SEARCH_VFILE(g_file_enumerator_get_container(enumerator));
         if(container->current)
             g_object_unref(container->current);
-        if(enu->iter)
-            container->current = g_object_ref(enu->iter->folder_path);
-        else
-            container->current = NULL;
-        _search_iter_free(iter, cancellable);
+        container->current = g_object_ref(result->folder_path);
+        file_info = g_object_ref(result->info);
+        _search_result_free(result);
     }
-    return NULL;
+    return file_info;
 }
 
 static gboolean _fm_vfs_search_enumerator_close(GFileEnumerator *enumerator,
@@ -310,22 +600,34 @@ static gboolean _fm_vfs_search_enumerator_close(GFileEnumerator *enumerator,
                                               GError **error)
 {
     FmVfsSearchEnumerator *enu = FM_VFS_SEACRH_ENUMERATOR(enumerator);
-    FmSearchIntIter *iter;
 
-    while((iter = enu->iter))
-    {
-        enu->iter = iter->parent;
-        _search_iter_free(iter, cancellable);
-    }
+    _search_walker_stop(enu);
     return TRUE;
 }
 
+static void _fm_vfs_search_enumerator_finalize(GObject *object)
+{
+    FmVfsSearchEnumerator *enu = FM_VFS_SEACRH_ENUMERATOR(object);
+
+    g_object_unref(enu->walk_cancellable);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_clear(&enu->lock);
+    g_cond_clear(&enu->cond);
+#else
+    g_mutex_free(enu->lock);
+    g_cond_free(enu->cond);
+#endif
+
+    G_OBJECT_CLASS(fm_vfs_search_enumerator_parent_class)->finalize(object);
+}
+
 static void fm_vfs_search_enumerator_class_init(FmVfsSearchEnumeratorClass *klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
   GFileEnumeratorClass *enumerator_class = G_FILE_ENUMERATOR_CLASS(klass);
 
   gobject_class->dispose = _fm_vfs_search_enumerator_dispose;
+  gobject_class->finalize = _fm_vfs_search_enumerator_finalize;
 
   enumerator_class->next_file = _fm_vfs_search_enumerator_next_file;
   enumerator_class->close_fn = _fm_vfs_search_enumerator_close;
@@ -334,7 +636,15 @@ static void fm_vfs_search_enumerator_class_init(FmVfsSearchEnumeratorClass *klas
 
 static void fm_vfs_search_enumerator_init(FmVfsSearchEnumerator *enumerator)
 {
-    /* nothing */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_init(&enumerator->lock);
+    g_cond_init(&enumerator->cond);
+#else
+    enumerator->lock = g_mutex_new();
+    enumerator->cond = g_cond_new();
+#endif
+    g_queue_init(&enumerator->results);
+    enumerator->walk_cancellable = g_cancellable_new();
 }
 
 static GFileEnumerator *_fm_vfs_search_enumerator_new(GFile *file,
@@ -585,31 +895,14 @@ static void parse_search_uri(FmVfsSearchEnumerator* priv, const char* uri_str)
                     priv->content_pattern = down;
                 }
             }
+
+            if(priv->content_pattern)
+                priv->content_matcher = _search_matcher_new(priv->content_pattern,
+                                                priv->content_case_insensitive);
         }
     }
 }
 
-static void fm_search_job_match_folder(FmVfsSearchEnumerator * priv,
-                                       GFile * folder_path,
-                                       GCancellable *cancellable,
-                                       GError **error)
-{
-    FmSearchIntIter *iter;
-    FmSearchVFile *container;
-
-    /* FIXME: make error if NULL */
-    iter = _search_iter_new(priv->iter, priv->attributes, priv->flags, folder_path,
-                            cancellable, error);
-    if(iter == NULL) /* error */
-        return;
-    g_object_ref(folder_path); /* it's copied into iter */
-    priv->iter = iter;
-    container = FM_SEARCH_VFILE(g_file_enumerator_get_container(G_FILE_ENUMERATOR(priv)));
-    if(container->current)
-        g_object_unref(container->current);
-    container->current = g_object_ref(folder_path);
-}
-
 static gboolean fm_search_job_match_filename(FmVfsSearchEnumerator* priv, GFileInfo* info)
 {
     gboolean ret;
@@ -689,56 +982,151 @@ static gboolean fm_search_job_match_content_line_based(FmVfsSearchEnumerator* pr
     return ret;
 }
 
+#define SEARCH_READ_BUF_SIZE (256 * 1024)
+
 static gboolean fm_search_job_match_content_exact(FmVfsSearchEnumerator* priv,
                                                   GFileInfo* info,
                                                   GInputStream* stream,
                                                   GCancellable* cancellable,
                                                   GError** error)
 {
+    const FmSearchMatcher* m = priv->content_matcher;
     gboolean ret = FALSE;
-    char *buf, *pbuf;
+    guchar *buf;
     gssize size;
-
     /* Ensure that the allocated buffer is longer than the string being
-     * searched for. Otherwise it's not possible for the buffer to 
+     * searched for. Otherwise it's not possible for the buffer to
      * contain a string fully matching the pattern. */
-    int pattern_len = strlen(priv->content_pattern);
-    int buf_size = pattern_len > 4095 ? pattern_len : 4095;
-    int bytes_to_read;
+    gsize buf_size = MAX(m->len * 2, SEARCH_READ_BUF_SIZE);
+    gsize filled = 0;
 
-    buf = g_new(char, buf_size + 1); /* +1 for terminating null char. */
-    bytes_to_read = buf_size;
-    pbuf = buf;
+    buf = g_malloc(buf_size);
     for(;;)
     {
-        char* found;
-        size = g_input_stream_read(stream, pbuf, bytes_to_read, cancellable, error);
-        if(size <=0) /* EOF or error */
+        size = g_input_stream_read(stream, buf + filled, buf_size - filled,
+                                   cancellable, error);
+        if(size <= 0) /* EOF or error */
             break;
-        pbuf[size] = '\0'; /* make the string null terminated */
-
-        found = strstr(buf, priv->content_pattern);
-        if(found) /* the string is found in the buffer */
+        filled += size;
+        if(_search_matcher_find(m, buf, filled))
         {
             ret = TRUE;
             break;
         }
-        else if(size == bytes_to_read) /* if size < bytes_to_read, we're at EOF and there are no further data. */
+        /* Preserve the last <pattern_len-1> bytes and move them to
+         * the beginning of the buffer.
+         * Append further data after this chunk of data at next read. */
+        if(filled >= m->len)
         {
-            /* Preserve the last <pattern_len-1> bytes and move them to 
-             * the beginning of the buffer.
-             * Append further data after this chunk of data at next read. */
-            int preserve_len = pattern_len - 1;
-            char* buf_end = buf + buf_size;
-            memmove(buf, buf_end - preserve_len, preserve_len);
-            pbuf = buf + preserve_len;
-            bytes_to_read = buf_size - preserve_len;
+            gsize preserve_len = m->len - 1;
+            memmove(buf, buf + filled - preserve_len, preserve_len);
+            filled = preserve_len;
         }
     }
     g_free(buf);
     return ret;
 }
 
+#ifdef SEARCH_USE_MMAP
+#define SEARCH_MMAP_MIN_SIZE (256 * 1024) /* smaller files are read faster */
+#define SEARCH_MMAP_WINDOW (32 * 1024 * 1024) /* don't exhaust address space */
+
+G_LOCK_DEFINE_STATIC(sigbus_handler);
+static __thread sigjmp_buf *sigbus_jmp = NULL;
+static struct sigaction old_sigbus_action;
+static volatile gint sigbus_handler_installed = 0;
+
+static void _search_on_sigbus(int sig, siginfo_t *si, void *ctx)
+{
+    sigjmp_buf *jmp = sigbus_jmp;
+
+    if(jmp) /* fault in a mapped file which is being searched */
+        siglongjmp(*jmp, 1);
+    /* not ours, restore previous handler, it gets the fault again on return */
+    sigaction(SIGBUS, &old_sigbus_action, NULL);
+    sigbus_handler_installed = 0;
+}
+
+static gboolean _search_install_sigbus_handler(void)
+{
+    G_LOCK(sigbus_handler);
+    if(!sigbus_handler_installed)
+    {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = _search_on_sigbus;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if(sigaction(SIGBUS, &sa, &old_sigbus_action) == 0)
+            sigbus_handler_installed = 1;
+    }
+    G_UNLOCK(sigbus_handler);
+    return sigbus_handler_installed;
+}
+
+/* Searches local file mapped into memory by windows. If the file is truncated
+ * while it's being searched then SIGBUS is caught and the rest of the file is
+ * considered absent. Returns -1 if the file should be read instead. */
+static int _search_match_content_mmap(FmVfsSearchEnumerator* priv, const char* path,
+                                      GCancellable* cancellable)
+{
+    const FmSearchMatcher* m = priv->content_matcher;
+    volatile int ret = 0;
+    sigjmp_buf jmp;
+    struct stat st;
+    goffset pos = 0, page_size = sysconf(_SC_PAGESIZE);
+    int fd;
+
+    if(m->len > SEARCH_MMAP_WINDOW / 2 || page_size <= 0)
+        return -1;
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < SEARCH_MMAP_MIN_SIZE ||
+       !_search_install_sigbus_handler())
+    {
+        close(fd);
+        return -1;
+    }
+    while(ret == 0 && !g_cancellable_is_cancelled(cancellable))
+    {
+        goffset start = pos - pos % page_size;
+        gsize map_len = MIN(st.st_size - start, SEARCH_MMAP_WINDOW);
+        guchar* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, start);
+
+        if(map == MAP_FAILED)
+        {
+            ret = -1;
+            break;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(map, map_len, MADV_SEQUENTIAL);
+#endif
+        if(sigsetjmp(jmp, 1) == 0)
+        {
+            sigbus_jmp = &jmp;
+            if(_search_matcher_find(m, map + (pos - start), map_len - (pos - start)))
+                ret = 1;
+            sigbus_jmp = NULL;
+        }
+        else /* the file was truncated while we read it */
+        {
+            sigbus_jmp = NULL;
+            munmap(map, map_len);
+            break;
+        }
+        munmap(map, map_len);
+        if(start + (goffset)map_len >= st.st_size) /* end of file */
+            break;
+        /* next window overlaps this one by pattern length - 1 */
+        pos = start + map_len - (m->len - 1);
+    }
+    close(fd);
+    return ret;
+}
+#endif /* SEARCH_USE_MMAP */
+
 static gboolean fm_search_job_match_content(FmVfsSearchEnumerator* priv,
                                             GFileInfo* info, GFile* parent,
                                             GCancellable* cancellable,
@@ -751,18 +1139,36 @@ static gboolean fm_search_job_match_content(FmVfsSearchEnumerator* priv,
         if(g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR && g_file_info_get_size(info) > 0)
         {
             GFile* file = g_file_get_child(parent, g_file_info_get_name(info));
-            /* NOTE: I disabled mmap-based search since this could cause
-             * unexpected crashes sometimes if the mapped files are
-             * removed or changed during the search. */
-            GFileInputStream * stream = g_file_read(file, cancellable, error);
+            GFileInputStream * stream;
+            /* bytewise search for the pattern unless regexp is used with
+             * case insensitive search or the pattern isn't ASCII then */
+            gboolean bytewise = priv->content_matcher &&
+                    !(priv->content_case_insensitive && priv->content_regex);
+
+#ifdef SEARCH_USE_MMAP
+            /* big local files are mapped into memory, crashes on files
+             * which are truncated during the search are guarded against */
+            if(bytewise && g_file_is_native(file))
+            {
+                char* path = g_file_get_path(file);
+                int res = path ? _search_match_content_mmap(priv, path, cancellable) : -1;
+                g_free(path);
+                if(res >= 0)
+                {
+                    g_object_unref(file);
+                    return res > 0;
+                }
+            }
+#endif
+            stream = g_file_read(file, cancellable, error);
             g_object_unref(file);
 
             if(stream)
             {
-                if(priv->content_pattern && !priv->content_case_insensitive)
+                if(bytewise)
                 {
-                    /* stream based search optimized for case sensitive
-                     * exact match. */
+                    /* stream based search optimized for exact match,
+                     * ASCII case insensitive match is done the same way. */
                     ret = fm_search_job_match_content_exact(priv, info,
                                                         G_INPUT_STREAM(stream),
                                                         cancellable, error);
@@ -0,0 +1,152 @@
+/*
+ *      bench-fm-folder-events.c
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Replays a synthetic storm of file monitor events (as an untar into a
+ * watched folder would produce) into FmFolder and measures how long the
+ * folder takes to queue them.
+ *
+ * Usage: bench-fm-folder-events [n_events [n_existing_files]]
+ */
+
+#include <fm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void on_finish_loading(FmFolder* folder, GMainLoop* loop)
+{
+    g_main_loop_quit(loop);
+}
+
+static double storm(GFileMonitor* mon, GFile** files, guint n,
+                    GFileMonitorEvent evt, const char* what)
+{
+    GTimer* timer = g_timer_new();
+    double elapsed;
+    guint i;
+
+    for(i = 0; i < n; i++)
+        g_signal_emit_by_name(mon, "changed", files[i], NULL, evt);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    printf("%-28s %8u events %10.3f s\n", what, n, elapsed);
+    return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    guint n_events = 100000, n_existing = 10000, i;
+    char* dir;
+    GFile *dir_gf, **new_files, **old_files;
+    FmFolder* folder;
+    GFileMonitor* mon;
+    double total = 0;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();
+#endif
+    fm_init(NULL);
+
+    if(argc > 1)
+        n_events = atoi(argv[1]);
+    if(argc > 2)
+        n_existing = atoi(argv[2]);
+    /* respect $TMPDIR, /tmp may be small or not writable */
+    dir = g_build_filename(g_get_tmp_dir(), "fm-folder-bench-XXXXXX", NULL);
+    if(!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    dir_gf = g_file_new_for_path(dir);
+
+    /* files that are in the folder when it's loaded */
+    old_files = g_new(GFile*, n_existing);
+    for(i = 0; i < n_existing; i++)
+    {
+        char name[32];
+        char* path;
+        FILE* f;
+
+        g_snprintf(name, sizeof(name), "old-%u", i);
+        old_files[i] = g_file_get_child(dir_gf, name);
+        path = g_file_get_path(old_files[i]);
+        f = fopen(path, "w");
+        if(f)
+            fclose(f);
+        g_free(path);
+    }
+    /* files that "appear" while the folder is watched, never created */
+    new_files = g_new(GFile*, n_events);
+    for(i = 0; i < n_events; i++)
+    {
+        char name[32];
+        g_snprintf(name, sizeof(name), "new-%u", i);
+        new_files[i] = g_file_get_child(dir_gf, name);
+    }
+
+    folder = fm_folder_from_path_name(dir);
+    if(!fm_folder_is_loaded(folder))
+    {
+        GMainLoop* loop = g_main_loop_new(NULL, FALSE);
+        g_signal_connect(folder, "finish-loading", G_CALLBACK(on_finish_loading), loop);
+        g_main_loop_run(loop);
+        g_signal_handlers_disconnect_by_func(folder, on_finish_loading, loop);
+        g_main_loop_unref(loop);
+    }
+    printf("folder loaded with %u files\n",
+           fm_file_info_list_get_length(fm_folder_get_files(folder)));
+
+    mon = fm_monitor_lookup_monitor(dir_gf);
+    if(!mon)
+    {
+        fprintf(stderr, "folder has no monitor\n");
+        return 1;
+    }
+    /* measure only queueing, don't run any update jobs */
+    fm_folder_block_updates(folder);
+
+    total += storm(mon, new_files, n_events, G_FILE_MONITOR_EVENT_CREATED, "created (new)");
+    total += storm(mon, new_files, n_events, G_FILE_MONITOR_EVENT_CREATED, "created (duplicate)");
+    total += storm(mon, old_files, n_existing, G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT, "changed (existing)");
+    total += storm(mon, old_files, n_existing, G_FILE_MONITOR_EVENT_CREATED, "created (existing)");
+    total += storm(mon, new_files, n_events, G_FILE_MONITOR_EVENT_DELETED, "deleted (queued)");
+    total += storm(mon, old_files, n_existing, G_FILE_MONITOR_EVENT_DELETED, "deleted (existing)");
+    printf("%-28s %8s        %10.3f s\n", "total", "", total);
+
+    g_object_unref(mon);
+    g_object_unref(folder);
+
+    for(i = 0; i < n_events; i++)
+        g_object_unref(new_files[i]);
+    g_free(new_files);
+    for(i = 0; i < n_existing; i++)
+    {
+        g_file_delete(old_files[i], NULL, NULL);
+        g_object_unref(old_files[i]);
+    }
+    g_free(old_files);
+    g_file_delete(dir_gf, NULL, NULL);
+    g_object_unref(dir_gf);
+    g_free(dir);
+
+    fm_finalize();
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ *      bench-fm-path.c
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Measures throughput of fm_path_new_child() and fm_path_unref() called
+ * from several threads at once, as parallel directory listing jobs do.
+ * Each thread creates a batch of children, then drops them, either each
+ * thread under its own parent directory or all of them under the same one.
+ *
+ * Usage: bench-fm-path [n_threads [n_children [n_rounds]]]
+ */
+
+#include <fm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    FmPath* parent;
+    guint id;
+    guint n_children;
+    guint n_rounds;
+} Worker;
+
+static gpointer worker_func(gpointer user_data)
+{
+    Worker* w = user_data;
+    FmPath** children = g_new(FmPath*, w->n_children);
+    guint i, round;
+
+    for(round = 0; round < w->n_rounds; round++)
+    {
+        for(i = 0; i < w->n_children; i++)
+        {
+            char name[64];
+            /* odd rounds look up names created by the previous round */
+            g_snprintf(name, sizeof(name), "file-%u-%u", w->id, i);
+            children[i] = fm_path_new_child(w->parent, name);
+        }
+        /* keep paths alive on even rounds so next round reuses them */
+        if(round & 1)
+        {
+            for(i = 0; i < w->n_children; i++)
+                fm_path_unref(children[i]);
+            for(i = 0; i < w->n_children; i++)
+                fm_path_unref(children[i]);
+        }
+    }
+    if(w->n_rounds & 1)
+        for(i = 0; i < w->n_children; i++)
+            fm_path_unref(children[i]);
+    g_free(children);
+    return NULL;
+}
+
+static void run(const char* what, guint n_threads, guint n_children,
+                guint n_rounds, gboolean shared)
+{
+    Worker* workers = g_new0(Worker, n_threads);
+    GThread** threads = g_new(GThread*, n_threads);
+    FmPath* base = fm_path_new_for_path("/tmp/fm-path-bench");
+    GTimer* timer;
+    double elapsed;
+    guint i;
+
+    for(i = 0; i < n_threads; i++)
+    {
+        char name[32];
+        g_snprintf(name, sizeof(name), "dir-%u", shared ? 0 : i);
+        workers[i].parent = fm_path_new_child(base, name);
+        workers[i].id = i;
+        workers[i].n_children = n_children;
+        workers[i].n_rounds = n_rounds;
+    }
+    timer = g_timer_new();
+    for(i = 0; i < n_threads; i++)
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        threads[i] = g_thread_new("bench", worker_func, &workers[i]);
+#else
+        threads[i] = g_thread_create(worker_func, &workers[i], TRUE, NULL);
+#endif
+    for(i = 0; i < n_threads; i++)
+        g_thread_join(threads[i]);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    printf("%-18s %3u threads %10.3f s %12.0f ops/s\n", what, n_threads, elapsed,
+           (double)n_threads * n_children * n_rounds / elapsed);
+
+    for(i = 0; i < n_threads; i++)
+        fm_path_unref(workers[i].parent);
+    fm_path_unref(base);
+    g_free(threads);
+    g_free(workers);
+}
+
+int main(int argc, char** argv)
+{
+    guint n_threads = 8, n_children = 10000, n_rounds = 20, n;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();
+#endif
+    fm_init(NULL);
+
+    if(argc > 1)
+        n_threads = atoi(argv[1]);
+    if(argc > 2)
+        n_children = atoi(argv[2]);
+    if(argc > 3)
+        n_rounds = atoi(argv[3]);
+    if(n_threads == 0 || n_children == 0 || n_rounds == 0)
+    {
+        fprintf(stderr, "usage: %s [n_threads [n_children [n_rounds]]]\n", argv[0]);
+        return 1;
+    }
+
+    for(n = 1; n <= n_threads; n *= 2)
+    {
+        run("distinct parents", n, n_children, n_rounds, FALSE);
+        run("shared parent", n, n_children, n_rounds, TRUE);
+    }
+
+    fm_finalize();
+    return 0;
+}
@@ -20,6 +20,7 @@
  */
 
 #include <fm.h>
+#include <string.h>
 
 //ignore for test disabled asserts
 #ifdef G_DISABLE_ASSERT
@@ -442,6 +443,58 @@ static void test_predefined_paths()
 */
 }
 
+static void test_path_interning()
+{
+    FmPath *parent, *path, *path2, *path3;
+
+    parent = fm_path_new_for_path("/tmp/interning");
+    path = fm_path_new_child(parent, "abc");
+    path2 = fm_path_new_child_len(parent, "abcdef", 3);
+    g_assert(path == path2);
+    fm_path_unref(path2);
+    path3 = fm_path_new_for_path("/tmp/interning/abc");
+    g_assert(path == path3);
+    fm_path_unref(path3);
+    path2 = fm_path_new_child(parent, "abd");
+    g_assert(path != path2);
+    g_assert(fm_path_get_parent(path2) == parent);
+    fm_path_unref(path2);
+    fm_path_unref(path);
+
+    /* remote names are escaped before lookup */
+    path = fm_path_new_for_uri("sftp://host/dir/a%20b");
+    path2 = fm_path_new_child(fm_path_get_parent(path), "a b");
+    g_assert(path == path2);
+    fm_path_unref(path2);
+    fm_path_unref(path);
+    fm_path_unref(parent);
+}
+
+static void test_path_to_str_buf()
+{
+    FmPath* path;
+    char buf[64];
+    char* str;
+
+    path = fm_path_new_for_path("/test/path/to/file");
+    g_assert_cmpuint(fm_path_to_str_buf(path, NULL, 0), ==, 18);
+    g_assert_cmpuint(fm_path_to_str_buf(path, buf, sizeof(buf)), ==, 18);
+    g_assert_cmpstr(buf, ==, "/test/path/to/file");
+    g_assert_cmpuint(fm_path_to_str_buf(path, buf, 18), ==, 18);
+    g_assert_cmpstr(buf, ==, "");
+    fm_path_unref(path);
+
+    path = fm_path_new_for_uri("sftp://user@host/dir/file");
+    str = fm_path_to_str(path);
+    g_assert_cmpuint(fm_path_to_str_buf(path, buf, sizeof(buf)), ==, strlen(str));
+    g_assert_cmpstr(buf, ==, str);
+    g_free(str);
+    fm_path_unref(path);
+
+    g_assert_cmpuint(fm_path_to_str_buf(fm_path_get_root(), buf, sizeof(buf)), ==, 1);
+    g_assert_cmpstr(buf, ==, "/");
+}
+
 int main (int   argc, char *argv[])
 {
 #if !GLIB_CHECK_VERSION(2, 36, 0)
@@ -454,6 +507,8 @@ int main (int   argc, char *argv[])
     g_test_add_func("/FmPath/path_parsing", test_path_parsing);
     g_test_add_func("/FmPath/uri_parsing", test_uri_parsing);
     g_test_add_func("/FmPath/predefined_paths", test_predefined_paths);
+    g_test_add_func("/FmPath/interning", test_path_interning);
+    g_test_add_func("/FmPath/to_str_buf", test_path_to_str_buf);
 
     return g_test_run();
 }